@@ -0,0 +1,1980 @@
+
+/*
+ * Timing and memory measurements for the midifile library, so that changes
+ * to its internals can be compared against each other on the same input.
+ * Build it twice (see Makefile.unix) to compare the pooled allocator against
+ * plain malloc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <midifile.h>
+
+static void usage(char *program_name)
+{
+	fprintf(stderr, "Usage:  %s generate [ --tracks <n> ] [ --events <n> ] [ --tempo-changes <n> ] [ --sysex <n> ] [ --sysex-length <n> ] [ --seed <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s load [ --iterations <n> ] [ --threads <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s save [ --iterations <n> ] <filename.mid> <output.mid>\n", program_name);
+	fprintf(stderr, "        %s compact [ --iterations <n> ] <filename.mid> ...\n", program_name);
+	fprintf(stderr, "        %s pipeline [ --iterations <n> ] [ --file-order ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s convert [ --conversions <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s insert [ --insertions <n> ] [ --indexed ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s import [ --iterations <n> ] [ --tracks <n> ] [ --events <n> ]\n", program_name);
+	fprintf(stderr, "        %s move [ --batch | --indexed ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s convert-events <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s scan [ --passes <n> ] [ --list-only | --frozen-only ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s stream [ --passes <n> ] [ --per-track ] [ --compare-load ] <filename.mid> ...\n", program_name);
+	fprintf(stderr, "        %s pair-notes [ --notes <n> ]\n", program_name);
+	fprintf(stderr, "        %s ruler [ --labels <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s convert-times [ --ticks <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s timeline [ --tempo-changes <n> ] [ --hours <n> ]\n", program_name);
+	fprintf(stderr, "        %s snapshot [ --edits <n> ] <filename.mid>\n", program_name);
+	fprintf(stderr, "        %s cache [ --iterations <n> ] <filename.mid> <cache>\n", program_name);
+	fprintf(stderr, "        %s journal [ --saves <n> ] [ --events-per-save <n> ] [ --sync-interval <n> ] <filename.mid> <output.mid>\n", program_name);
+	fprintf(stderr, "        %s probe [ --passes <n> ] [ --conductor ] [ --meta ] [ --last-events ] <filename.mid or directory> ...\n", program_name);
+	exit(1);
+}
+
+static double get_seconds(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (tv.tv_usec / 1000000.0);
+}
+
+static long get_maximum_resident_set_size_kb(void)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+static unsigned long random_state = 1;
+
+static unsigned long get_random(void)
+{
+	random_state = (random_state * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+	return random_state >> 8;
+}
+
+static int generate(char *program_name, int argc, char **argv)
+{
+	char *output_filename = NULL;
+	int number_of_tracks = 16;
+	long number_of_events = 1000000;
+	long number_of_tempo_changes = 100;
+	long number_of_sysex_events = 0;
+	int sysex_length = 163;
+	MidiFile_t midi_file;
+	MidiFileTrack_t conductor_track;
+	long events_per_track, i;
+	int track_number;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--tracks") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_tracks = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--events") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_events = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--tempo-changes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_tempo_changes = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--sysex") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_sysex_events = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--sysex-length") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			sysex_length = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--seed") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			random_state = strtoul(argv[i], NULL, 10);
+		}
+		else if (output_filename == NULL)
+		{
+			output_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((output_filename == NULL) || (number_of_tracks < 1) || (sysex_length < 2)) usage(program_name);
+
+	midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
+	conductor_track = MidiFile_createTrack(midi_file);
+	MidiFileTrack_createTimeSignatureEvent(conductor_track, 0, 4, 4);
+	MidiFileTrack_createKeySignatureEvent(conductor_track, 0, 0, 0);
+
+	for (i = 0; i < number_of_tempo_changes; i++)
+	{
+		MidiFileTrack_createTempoEvent(conductor_track, i * 480, 60.0 + (get_random() % 120));
+	}
+
+	if (number_of_sysex_events > 0)
+	{
+		/* like a patch librarian's archive:  one dump after another, each framed by F0 and F7 */
+		MidiFileTrack_t sysex_track = MidiFile_createTrack(midi_file);
+		unsigned char *sysex = (unsigned char *)(malloc(sysex_length));
+		int j;
+
+		MidiFileTrack_createTextEvent(sysex_track, 0, "Patches");
+
+		for (i = 0; i < number_of_sysex_events; i++)
+		{
+			sysex[0] = 0xF0;
+			for (j = 1; j < sysex_length - 1; j++) sysex[j] = (unsigned char)(get_random() % 128);
+			sysex[sysex_length - 1] = 0xF7;
+			MidiFileTrack_createSysexEvent(sysex_track, i * 10, sysex_length, sysex);
+		}
+
+		free(sysex);
+	}
+
+	/* each note contributes a start and an end event; the tracks are filled in step with each other so that building the file stays linear */
+	events_per_track = number_of_events / number_of_tracks / 2;
+
+	for (track_number = 0; track_number < number_of_tracks; track_number++)
+	{
+		MidiFileTrack_t track = MidiFile_createTrack(midi_file);
+		char track_name[32];
+
+		sprintf(track_name, "Track %d", track_number + 1);
+		MidiFileTrack_createTextEvent(track, 0, track_name);
+		MidiFileTrack_createProgramChangeEvent(track, 0, track_number % 16, track_number % 128);
+	}
+
+	for (i = 0; i < events_per_track; i++)
+	{
+		MidiFileTrack_t track;
+		long tick = i * 120;
+
+		for (track = MidiFileTrack_getNextTrack(conductor_track); track != NULL; track = MidiFileTrack_getNextTrack(track))
+		{
+			int channel = MidiFileTrack_getNumber(track) % 16;
+			int note = 36 + (get_random() % 48);
+			long note_tick = tick + (get_random() % 120);
+			MidiFileTrack_createNoteOnEvent(track, note_tick, channel, note, 1 + (get_random() % 127));
+			MidiFileTrack_createNoteOffEvent(track, note_tick + 1 + (get_random() % 960), channel, note, 0);
+		}
+	}
+
+	if (MidiFile_save(midi_file, output_filename) < 0)
+	{
+		fprintf(stderr, "Error:  Cannot write MIDI file \"%s\".\n", output_filename);
+		MidiFile_free(midi_file);
+		return 1;
+	}
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int load(char *program_name, int argc, char **argv)
+{
+	char *input_filename = NULL;
+	int number_of_iterations = 5, number_of_threads = -1;
+	double load_seconds = 0.0, free_seconds = 0.0;
+	long base_resident_set_size_kb, loaded_resident_set_size_kb = 0;
+	long number_of_events = 0;
+	struct stat file_status;
+	int i;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0)
+		{
+			/* zero means one per processor */
+			if (++i == argc) usage(program_name);
+			number_of_threads = atoi(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_iterations < 1)) usage(program_name);
+
+	if (stat(input_filename, &file_status) != 0)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	base_resident_set_size_kb = get_maximum_resident_set_size_kb();
+
+	for (i = 0; i < number_of_iterations; i++)
+	{
+		MidiFile_t midi_file;
+		double start_seconds = get_seconds();
+
+		if ((midi_file = (number_of_threads < 0) ? MidiFile_load(input_filename) : MidiFile_loadInParallel(input_filename, number_of_threads)) == NULL)
+		{
+			fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+			return 1;
+		}
+
+		load_seconds += get_seconds() - start_seconds;
+
+		if (i == 0)
+		{
+			MidiFileEvent_t event;
+			for (event = MidiFile_getFirstEvent(midi_file); event != NULL; event = MidiFileEvent_getNextEventInFile(event)) number_of_events++;
+			loaded_resident_set_size_kb = get_maximum_resident_set_size_kb();
+
+			if (number_of_threads >= 0)
+			{
+				/* the parallel loader has to give exactly what the serial one does */
+				MidiFile_t serial_midi_file = MidiFile_load(input_filename);
+				unsigned char *buffer, *serial_buffer;
+				int file_size, serial_file_size;
+
+				buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+				serial_buffer = MidiFile_saveToGrowableBuffer(serial_midi_file, &serial_file_size);
+				printf("same as serial:    %s\n", ((file_size == serial_file_size) && (memcmp(buffer, serial_buffer, file_size) == 0)) ? "yes" : "NO");
+				free(buffer);
+				free(serial_buffer);
+				MidiFile_free(serial_midi_file);
+			}
+		}
+
+		start_seconds = get_seconds();
+		MidiFile_free(midi_file);
+		free_seconds += get_seconds() - start_seconds;
+	}
+
+	printf("events:            %ld\n", number_of_events);
+	printf("load:              %.3f ms\n", load_seconds * 1000.0 / number_of_iterations);
+	if (load_seconds > 0.0) printf("load throughput:   %.1f MB/s\n", (double)(file_status.st_size) * number_of_iterations / load_seconds / 1000000.0);
+	printf("free:              %.3f ms\n", free_seconds * 1000.0 / number_of_iterations);
+	printf("peak RSS increase: %ld KiB\n", loaded_resident_set_size_kb - base_resident_set_size_kb);
+	if (number_of_events > 0) printf("bytes per event:   %.1f\n", (loaded_resident_set_size_kb - base_resident_set_size_kb) * 1024.0 / number_of_events);
+	return 0;
+}
+
+static int save(char *program_name, int argc, char **argv)
+{
+	char *input_filename = NULL;
+	char *output_filename = NULL;
+	int number_of_iterations = 5;
+	double file_seconds = 0.0, size_seconds = 0.0, buffer_seconds = 0.0, growable_buffer_seconds = 0.0;
+	MidiFile_t midi_file;
+	int file_size = 0, i;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else if (output_filename == NULL)
+		{
+			output_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((output_filename == NULL) || (number_of_iterations < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	for (i = 0; i < number_of_iterations; i++)
+	{
+		unsigned char *buffer;
+		double start_seconds = get_seconds();
+
+		if (MidiFile_save(midi_file, output_filename) < 0)
+		{
+			fprintf(stderr, "Error:  Cannot write MIDI file \"%s\".\n", output_filename);
+			MidiFile_free(midi_file);
+			return 1;
+		}
+
+		file_seconds += get_seconds() - start_seconds;
+
+		/* the old way to save into memory:  measure, then serialize */
+		start_seconds = get_seconds();
+		file_size = MidiFile_getFileSize(midi_file);
+		size_seconds += get_seconds() - start_seconds;
+		buffer = (unsigned char *)(malloc(file_size));
+		MidiFile_saveToBuffer(midi_file, buffer);
+		buffer_seconds += get_seconds() - start_seconds;
+		free(buffer);
+
+		start_seconds = get_seconds();
+		buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+		growable_buffer_seconds += get_seconds() - start_seconds;
+		free(buffer);
+	}
+
+	printf("bytes:             %d\n", file_size);
+	printf("save:              %.3f ms\n", file_seconds * 1000.0 / number_of_iterations);
+	printf("getFileSize:       %.3f ms\n", size_seconds * 1000.0 / number_of_iterations);
+	printf("size + buffer:     %.3f ms\n", buffer_seconds * 1000.0 / number_of_iterations);
+	printf("growable buffer:   %.3f ms\n", growable_buffer_seconds * 1000.0 / number_of_iterations);
+	if (file_seconds > 0.0) printf("save throughput:   %.1f MB/s\n", (double)(file_size) * number_of_iterations / file_seconds / 1000000.0);
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int compact(char *program_name, int argc, char **argv)
+{
+	/* what each step of the save flags buys across a set of files, in size and in save and load time */
+
+	static const int flags[] = { MIDI_FILE_SAVE_DEFAULT, MIDI_FILE_SAVE_RUNNING_STATUS, MIDI_FILE_SAVE_RUNNING_STATUS | MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS, MIDI_FILE_SAVE_COMPACT };
+	static const char *flag_names[] = { "default", "running status", "+ note offs as ons", "compact" };
+	long bytes[4] = { 0, 0, 0, 0 };
+	double save_seconds[4] = { 0.0, 0.0, 0.0, 0.0 }, load_seconds[4] = { 0.0, 0.0, 0.0, 0.0 };
+	int number_of_iterations = 5, number_of_files = 0, i, j, iteration;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else
+		{
+			/* gather the filenames at the front */
+			argv[number_of_files++] = argv[i];
+		}
+	}
+
+	if ((number_of_files == 0) || (number_of_iterations < 1)) usage(program_name);
+
+	for (i = 0; i < number_of_files; i++)
+	{
+		MidiFile_t midi_file;
+
+		if ((midi_file = MidiFile_load(argv[i])) == NULL)
+		{
+			fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", argv[i]);
+			return 1;
+		}
+
+		for (j = 0; j < 4; j++)
+		{
+			MidiFile_setSaveFlags(midi_file, flags[j]);
+
+			for (iteration = 0; iteration < number_of_iterations; iteration++)
+			{
+				unsigned char *buffer;
+				int file_size;
+				double start_seconds = get_seconds();
+
+				buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+				save_seconds[j] += get_seconds() - start_seconds;
+
+				start_seconds = get_seconds();
+				MidiFile_free(MidiFile_loadFromBufferWithLength(buffer, file_size));
+				load_seconds[j] += get_seconds() - start_seconds;
+
+				if (iteration == 0) bytes[j] += file_size;
+				free(buffer);
+			}
+		}
+
+		MidiFile_free(midi_file);
+	}
+
+	printf("files:             %d\n", number_of_files);
+
+	for (j = 0; j < 4; j++)
+	{
+		printf("%-19s%ld bytes (%.3f), save %.3f ms, load %.3f ms\n", flag_names[j], bytes[j], (double)(bytes[j]) / bytes[0], save_seconds[j] * 1000.0 / number_of_iterations, load_seconds[j] * 1000.0 / number_of_iterations);
+	}
+
+	return 0;
+}
+
+static void edit_event_for_pipeline(MidiFileEvent_t event)
+{
+	/* soften every note, and put an expression controller in front of each C */
+
+	if (MidiFileEvent_getType(event) != MIDI_FILE_EVENT_TYPE_NOTE_ON) return;
+	MidiFileNoteOnEvent_setVelocity(event, (MidiFileNoteOnEvent_getVelocity(event) * 3 + 3) / 4);
+	if (MidiFileNoteOnEvent_getNote(event) % 12 == 0) MidiFileTrack_createControlChangeEvent(MidiFileEvent_getTrack(event), MidiFileEvent_getTick(event), MidiFileNoteOnEvent_getChannel(event), 11, 100);
+}
+
+static int pipeline(char *program_name, int argc, char **argv)
+{
+	/* load, edit, and save, the way batch tools do; most only ever walk the tracks, which shouldn't have to pay for the file-wide list */
+
+	char *input_filename = NULL;
+	int number_of_iterations = 5, use_file_order = 0;
+	double load_seconds = 0.0, edit_seconds = 0.0, save_seconds = 0.0;
+	unsigned long hash = 2166136261UL;
+	int file_size = 0, i, j;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--file-order") == 0)
+		{
+			use_file_order = 1;
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_iterations < 1)) usage(program_name);
+
+	for (i = 0; i < number_of_iterations; i++)
+	{
+		MidiFile_t midi_file;
+		MidiFileEvent_t event, next_event;
+		unsigned char *buffer;
+		double start_seconds = get_seconds();
+
+		if ((midi_file = MidiFile_load(input_filename)) == NULL)
+		{
+			fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+			return 1;
+		}
+
+		load_seconds += get_seconds() - start_seconds;
+		start_seconds = get_seconds();
+
+		/* the next event is found first, so that the new controllers aren't visited; a batch keeps adding them cheap */
+		MidiFile_beginBatch(midi_file);
+
+		if (use_file_order)
+		{
+			for (event = MidiFile_getFirstEvent(midi_file); event != NULL; event = next_event)
+			{
+				next_event = MidiFileEvent_getNextEventInFile(event);
+				edit_event_for_pipeline(event);
+			}
+		}
+		else
+		{
+			MidiFileTrack_t track;
+
+			for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+			{
+				for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
+				{
+					next_event = MidiFileEvent_getNextEventInTrack(event);
+					edit_event_for_pipeline(event);
+				}
+			}
+		}
+
+		MidiFile_endBatch(midi_file);
+		edit_seconds += get_seconds() - start_seconds;
+		start_seconds = get_seconds();
+		buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+		save_seconds += get_seconds() - start_seconds;
+
+		if (i == 0)
+		{
+			for (j = 0; j < file_size; j++) hash = ((hash ^ buffer[j]) * 16777619UL) & 0xFFFFFFFFUL;
+		}
+
+		free(buffer);
+		MidiFile_free(midi_file);
+	}
+
+	printf("bytes:             %d (result hash %08lx)\n", file_size, hash);
+	printf("load:              %.3f ms\n", load_seconds * 1000.0 / number_of_iterations);
+	printf("edit:              %.3f ms\n", edit_seconds * 1000.0 / number_of_iterations);
+	printf("save:              %.3f ms\n", save_seconds * 1000.0 / number_of_iterations);
+	printf("total:             %.3f ms\n", (load_seconds + edit_seconds + save_seconds) * 1000.0 / number_of_iterations);
+	return 0;
+}
+
+static int convert(char *program_name, int argc, char **argv)
+{
+	char *input_filename = NULL;
+	long number_of_conversions = 1000000;
+	MidiFile_t midi_file;
+	long last_tick, i, checksum = 0;
+	float last_time, last_beat;
+	double start_seconds;
+	int j;
+
+	for (j = 0; j < argc; j++)
+	{
+		if (strcmp(argv[j], "--conversions") == 0)
+		{
+			if (++j == argc) usage(program_name);
+			number_of_conversions = atol(argv[j]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[j];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_conversions < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	last_tick = MidiFileEvent_getTick(MidiFile_getLastEvent(midi_file)) + 1;
+	last_time = MidiFile_getTimeFromTick(midi_file, last_tick);
+	last_beat = MidiFile_getBeatFromTick(midi_file, last_tick);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_conversions; i++) checksum += (long)(MidiFile_getTimeFromTick(midi_file, get_random() % last_tick));
+	printf("getTimeFromTick:   %.1f ns\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_conversions);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_conversions; i++) checksum += MidiFile_getTickFromTime(midi_file, last_time * (get_random() % 65536) / 65536);
+	printf("getTickFromTime:   %.1f ns\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_conversions);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_conversions; i++) checksum += (long)(MidiFile_getBeatFromTick(midi_file, get_random() % last_tick));
+	printf("getBeatFromTick:   %.1f ns\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_conversions);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_conversions; i++) checksum += MidiFile_getTickFromBeat(midi_file, last_beat * (get_random() % 65536) / 65536);
+	printf("getTickFromBeat:   %.1f ns\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_conversions);
+
+	/* keep the compiler from discarding the loops */
+	if (checksum == 42) printf("\n");
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int insert(char *program_name, int argc, char **argv)
+{
+	char *input_filename = NULL;
+	long number_of_insertions = 10000;
+	int indexed = 0;
+	MidiFile_t midi_file;
+	MidiFileTrack_t track;
+	MidiFileTrack_t *tracks;
+	int number_of_tracks, track_number;
+	long last_tick, i, checksum = 0;
+	double start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--insertions") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_insertions = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--indexed") == 0)
+		{
+			indexed = 1;
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_insertions < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	number_of_tracks = MidiFile_getNumberOfTracks(midi_file);
+	tracks = (MidiFileTrack_t *)(malloc(number_of_tracks * sizeof(MidiFileTrack_t)));
+	for (track = MidiFile_getFirstTrack(midi_file), track_number = 0; track != NULL; track = MidiFileTrack_getNextTrack(track), track_number++) tracks[track_number] = track;
+	last_tick = MidiFileEvent_getTick(MidiFile_getLastEvent(midi_file)) + 1;
+
+	start_seconds = get_seconds();
+	MidiFile_setIndexed(midi_file, indexed);
+	printf("indexing:          %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+
+	/* inserts land at random points, so neither end of the list is a shortcut */
+	start_seconds = get_seconds();
+
+	for (i = 0; i < number_of_insertions; i++)
+	{
+		MidiFileTrack_t track = tracks[get_random() % number_of_tracks];
+		long tick = get_random() % last_tick;
+		MidiFileTrack_createControlChangeEvent(track, tick, 0, 1, (int)(i % 128));
+	}
+
+	printf("insertions:        %ld\n", number_of_insertions);
+	printf("insertion:         %.3f us\n", (get_seconds() - start_seconds) * 1000000.0 / number_of_insertions);
+
+	start_seconds = get_seconds();
+
+	for (i = 0; i < number_of_insertions; i++)
+	{
+		long tick = get_random() % last_tick;
+		if (MidiFile_getFirstEventForTick(midi_file, tick) != NULL) checksum++;
+		if (MidiFileTrack_getLastEventForTick(tracks[get_random() % number_of_tracks], tick) != NULL) checksum++;
+	}
+
+	printf("lookup:            %.3f us\n", (get_seconds() - start_seconds) * 1000000.0 / (2 * number_of_insertions));
+	printf("lookup hits:       %ld\n", checksum);
+
+	free(tracks);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int import(char *program_name, int argc, char **argv)
+{
+	/* the notes that "generate" makes, created one call at a time and then all at once from records */
+
+	int number_of_iterations = 5, number_of_tracks = 16;
+	long number_of_events = 1000000;
+	struct MidiFileEventRecord *records;
+	MidiFile_t one_at_a_time_midi_file = NULL, imported_midi_file = NULL;
+	unsigned char *buffer, *imported_buffer;
+	int file_size, imported_file_size, track_number, iteration;
+	long number_of_records = 0, events_per_track, i;
+	double start_seconds, one_at_a_time_seconds = 0.0, import_seconds = 0.0;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--tracks") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_tracks = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--events") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_events = atol(argv[i]);
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((number_of_iterations < 1) || (number_of_tracks < 1) || (number_of_events < 2)) usage(program_name);
+	events_per_track = number_of_events / number_of_tracks / 2;
+
+	if ((records = (struct MidiFileEventRecord *)(calloc(events_per_track * number_of_tracks * 2 + 1, sizeof (struct MidiFileEventRecord)))) == NULL)
+	{
+		fprintf(stderr, "Error:  Out of memory.\n");
+		return 1;
+	}
+
+	for (i = 0; i < events_per_track; i++)
+	{
+		for (track_number = 0; track_number < number_of_tracks; track_number++)
+		{
+			long note_tick = (i * 120) + (get_random() % 120);
+			int note = 36 + (get_random() % 48);
+
+			records[number_of_records].tick = note_tick;
+			records[number_of_records].type = MIDI_FILE_EVENT_TYPE_NOTE_ON;
+			records[number_of_records].track_number = track_number;
+			records[number_of_records].channel = track_number % 16;
+			records[number_of_records].number = note;
+			records[number_of_records].value = 1 + (get_random() % 127);
+			number_of_records++;
+
+			records[number_of_records].tick = note_tick + 1 + (get_random() % 960);
+			records[number_of_records].type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
+			records[number_of_records].track_number = track_number;
+			records[number_of_records].channel = track_number % 16;
+			records[number_of_records].number = note;
+			records[number_of_records].value = 0;
+			number_of_records++;
+		}
+	}
+
+	for (iteration = 0; iteration < number_of_iterations; iteration++)
+	{
+		/* the last ones are kept to compare */
+		MidiFile_free(one_at_a_time_midi_file);
+		MidiFile_free(imported_midi_file);
+
+		start_seconds = get_seconds();
+		one_at_a_time_midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
+
+		for (i = 0; i < number_of_records; i++)
+		{
+			MidiFileTrack_t track = MidiFile_getTrackByNumber(one_at_a_time_midi_file, records[i].track_number, 1);
+
+			if (records[i].type == MIDI_FILE_EVENT_TYPE_NOTE_ON)
+			{
+				MidiFileTrack_createNoteOnEvent(track, records[i].tick, records[i].channel, records[i].number, records[i].value);
+			}
+			else
+			{
+				MidiFileTrack_createNoteOffEvent(track, records[i].tick, records[i].channel, records[i].number, records[i].value);
+			}
+		}
+
+		one_at_a_time_seconds += get_seconds() - start_seconds;
+
+		start_seconds = get_seconds();
+		imported_midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
+		MidiFile_importEvents(imported_midi_file, records, number_of_records, NULL);
+		import_seconds += get_seconds() - start_seconds;
+	}
+
+	buffer = MidiFile_saveToGrowableBuffer(one_at_a_time_midi_file, &file_size);
+	imported_buffer = MidiFile_saveToGrowableBuffer(imported_midi_file, &imported_file_size);
+
+	printf("events:            %ld\n", number_of_records);
+	printf("one at a time:     %.3f ms (%.1f million events/s)\n", one_at_a_time_seconds * 1000.0 / number_of_iterations, number_of_records * number_of_iterations / one_at_a_time_seconds / 1000000.0);
+	printf("import:            %.3f ms (%.1f million events/s)\n", import_seconds * 1000.0 / number_of_iterations, number_of_records * number_of_iterations / import_seconds / 1000000.0);
+	printf("same result:       %s\n", ((file_size == imported_file_size) && (memcmp(buffer, imported_buffer, file_size) == 0)) ? "yes" : "NO");
+
+	free(buffer);
+	free(imported_buffer);
+	MidiFile_free(one_at_a_time_midi_file);
+	MidiFile_free(imported_midi_file);
+	free(records);
+	return 0;
+}
+
+static int move(char *program_name, int argc, char **argv)
+{
+	/* nudge every event by a few ticks, like quantizing does, and hash the result so that the modes can be checked against each other */
+
+	char *input_filename = NULL;
+	int batch = 0, indexed = 0, file_size;
+	MidiFile_t midi_file;
+	MidiFileEvent_t event;
+	unsigned char *buffer;
+	unsigned long hash = 2166136261UL;
+	long number_of_moves = 0, i;
+	double start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--batch") == 0)
+		{
+			batch = 1;
+		}
+		else if (strcmp(argv[i], "--indexed") == 0)
+		{
+			indexed = 1;
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if (input_filename == NULL) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	MidiFile_setIndexed(midi_file, indexed);
+	start_seconds = get_seconds();
+	if (batch) MidiFile_beginBatch(midi_file);
+
+	for (event = MidiFile_iterateEvents(midi_file); event != NULL; event = MidiFile_iterateEvents(midi_file))
+	{
+		long tick = MidiFileEvent_getTick(event) + (long)(get_random() % 97) - 48;
+		MidiFileEvent_setTick(event, (tick < 0) ? 0 : tick);
+		number_of_moves++;
+	}
+
+	if (batch) MidiFile_endBatch(midi_file);
+	printf("moves:             %ld\n", number_of_moves);
+	printf("move (%s):   %.3f us\n", batch ? "batched" : (indexed ? "indexed" : "plain  "), (get_seconds() - start_seconds) * 1000000.0 / number_of_moves);
+
+	buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+	for (i = 0; i < file_size; i++) hash = ((hash ^ buffer[i]) * 16777619UL) & 0xFFFFFFFFUL;
+	printf("result hash:       %08lx\n", hash);
+
+	free(buffer);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int convert_events(char *program_name, int argc, char **argv)
+{
+	/* run the event type conversions there and back again, and hash each result so that library versions can be checked against each other */
+
+	static const char *step_names[] = { "std -> note", "note -> std", "std -> fine", "std -> rpn", "rpn -> std", "fine -> std", "std -> note" };
+	MidiFile_t midi_file;
+	unsigned char *buffer;
+	double start_seconds, seconds;
+	int step, file_size, i;
+
+	if (argc != 1) usage(program_name);
+
+	if ((midi_file = MidiFile_load(argv[0])) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", argv[0]);
+		return 1;
+	}
+
+	for (step = 0; step < 7; step++)
+	{
+		unsigned long hash = 2166136261UL;
+
+		start_seconds = get_seconds();
+
+		switch (step)
+		{
+			case 0: case 6: MidiFile_convertStandardEventsToNoteEvents(midi_file); break;
+			case 1: MidiFile_convertNoteEventsToStandardEvents(midi_file); break;
+			case 2: MidiFile_convertStandardEventsToFineControlChangeEvents(midi_file); break;
+			case 3: MidiFile_convertStandardEventsToRpnAndNrpnEvents(midi_file); break;
+			case 4: MidiFile_convertRpnAndNrpnEventsToStandardEvents(midi_file); break;
+			case 5: MidiFile_convertFineControlChangeEventsToStandardEvents(midi_file); break;
+		}
+
+		seconds = get_seconds() - start_seconds;
+		buffer = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
+		for (i = 0; i < file_size; i++) hash = ((hash ^ buffer[i]) * 16777619UL) & 0xFFFFFFFFUL;
+		printf("%-12s %10.3f ms   result hash %08lx\n", step_names[step], seconds * 1000.0, hash);
+		free(buffer);
+	}
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int scan(char *program_name, int argc, char **argv)
+{
+	/* run with only one of the two walks under "perf stat -e cache-misses" to compare them */
+
+	char *input_filename = NULL;
+	int number_of_passes = 10;
+	int scan_list = 1, scan_frozen = 1;
+	MidiFile_t midi_file;
+	MidiFileFrozen_t frozen;
+	long number_of_events, i;
+	long velocity_sums[16];
+	double start_seconds;
+	int pass;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--passes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_passes = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--list-only") == 0)
+		{
+			scan_frozen = 0;
+		}
+		else if (strcmp(argv[i], "--frozen-only") == 0)
+		{
+			scan_list = 0;
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_passes < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	start_seconds = get_seconds();
+	frozen = MidiFile_freeze(midi_file);
+	number_of_events = MidiFileFrozen_getNumberOfEvents(frozen);
+	printf("events:            %ld\n", number_of_events);
+	printf("freeze:            %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+
+	/* the same job both ways:  total the note on velocities per channel */
+
+	if (scan_list)
+	{
+		memset(velocity_sums, 0, sizeof (velocity_sums));
+		start_seconds = get_seconds();
+
+		for (pass = 0; pass < number_of_passes; pass++)
+		{
+			MidiFileEvent_t event;
+
+			for (event = MidiFile_getFirstEvent(midi_file); event != NULL; event = MidiFileEvent_getNextEventInFile(event))
+			{
+				if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE_ON) velocity_sums[MidiFileNoteOnEvent_getChannel(event) & 0x0F] += MidiFileNoteOnEvent_getVelocity(event);
+			}
+		}
+
+		printf("list walk:         %.2f ns per event (checksum %ld)\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_passes / number_of_events, velocity_sums[0]);
+	}
+
+	if (scan_frozen)
+	{
+		const signed char *types = MidiFileFrozen_getTypes(frozen);
+		const unsigned char *channels = MidiFileFrozen_getChannels(frozen);
+		const int *values = MidiFileFrozen_getValues(frozen);
+
+		memset(velocity_sums, 0, sizeof (velocity_sums));
+		start_seconds = get_seconds();
+
+		for (pass = 0; pass < number_of_passes; pass++)
+		{
+			for (i = 0; i < number_of_events; i++)
+			{
+				if (types[i] == MIDI_FILE_EVENT_TYPE_NOTE_ON) velocity_sums[channels[i] & 0x0F] += values[i];
+			}
+		}
+
+		printf("frozen scan:       %.2f ns per event (checksum %ld)\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_passes / number_of_events, velocity_sums[0]);
+	}
+
+	MidiFileFrozen_free(frozen);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int stream(char *program_name, int argc, char **argv)
+{
+	/* repeat a list of files as many times as needed to stand in for a large corpus */
+
+	int number_of_passes = 1, per_track = 0, compare_load = 0;
+	int first_filename_index = -1;
+	long velocity_sum = 0, number_of_events = 0;
+	double total_bytes = 0.0, start_seconds, stream_seconds;
+	long base_resident_set_size_kb;
+	int i, pass;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--passes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_passes = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--per-track") == 0)
+		{
+			per_track = 1;
+		}
+		else if (strcmp(argv[i], "--compare-load") == 0)
+		{
+			compare_load = 1;
+		}
+		else
+		{
+			first_filename_index = i;
+			break;
+		}
+	}
+
+	if ((first_filename_index < 0) || (number_of_passes < 1)) usage(program_name);
+
+	for (i = first_filename_index; i < argc; i++)
+	{
+		struct stat file_status;
+
+		if (stat(argv[i], &file_status) != 0)
+		{
+			fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", argv[i]);
+			return 1;
+		}
+
+		total_bytes += (double)(file_status.st_size) * number_of_passes;
+	}
+
+	/* the same job both ways:  total the note on velocities */
+
+	base_resident_set_size_kb = get_maximum_resident_set_size_kb();
+	start_seconds = get_seconds();
+
+	for (pass = 0; pass < number_of_passes; pass++)
+	{
+		for (i = first_filename_index; i < argc; i++)
+		{
+			MidiFileReader_t reader;
+			MidiFileEvent_t event;
+
+			if ((reader = MidiFileReader_open(argv[i])) == NULL)
+			{
+				fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", argv[i]);
+				return 1;
+			}
+
+			if (per_track)
+			{
+				int track_number;
+
+				for (track_number = 0; track_number < MidiFileReader_getNumberOfTracks(reader); track_number++)
+				{
+					while ((event = MidiFileReader_getNextEventInTrack(reader, track_number)) != NULL)
+					{
+						if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE_ON) velocity_sum += MidiFileNoteOnEvent_getVelocity(event);
+						number_of_events++;
+					}
+				}
+			}
+			else
+			{
+				while ((event = MidiFileReader_getNextEvent(reader)) != NULL)
+				{
+					if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE_ON) velocity_sum += MidiFileNoteOnEvent_getVelocity(event);
+					number_of_events++;
+				}
+			}
+
+			MidiFileReader_free(reader);
+		}
+	}
+
+	stream_seconds = get_seconds() - start_seconds;
+	printf("events:            %ld (checksum %ld)\n", number_of_events, velocity_sum);
+	printf("stream (%s): %.1f MB/s, %.1f M events/s\n", per_track ? "tracks" : "merged", total_bytes / stream_seconds / 1000000.0, number_of_events / stream_seconds / 1000000.0);
+	printf("peak RSS increase: %ld KiB\n", get_maximum_resident_set_size_kb() - base_resident_set_size_kb);
+
+	if (compare_load)
+	{
+		double load_seconds;
+
+		velocity_sum = 0;
+		start_seconds = get_seconds();
+
+		for (pass = 0; pass < number_of_passes; pass++)
+		{
+			for (i = first_filename_index; i < argc; i++)
+			{
+				MidiFile_t midi_file;
+				MidiFileEvent_t event;
+
+				if ((midi_file = MidiFile_load(argv[i])) == NULL)
+				{
+					fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", argv[i]);
+					return 1;
+				}
+
+				for (event = MidiFile_getFirstEvent(midi_file); event != NULL; event = MidiFileEvent_getNextEventInFile(event))
+				{
+					if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE_ON) velocity_sum += MidiFileNoteOnEvent_getVelocity(event);
+				}
+
+				MidiFile_free(midi_file);
+			}
+		}
+
+		load_seconds = get_seconds() - start_seconds;
+		printf("load and walk:     %.1f MB/s, %.1f M events/s (checksum %ld)\n", total_bytes / load_seconds / 1000000.0, number_of_events / load_seconds / 1000000.0, velocity_sum);
+		printf("peak RSS increase: %ld KiB\n", get_maximum_resident_set_size_kb() - base_resident_set_size_kb);
+	}
+
+	return 0;
+}
+
+static int pair_notes(char *program_name, int argc, char **argv)
+{
+	long number_of_notes = 1000000;
+	MidiFile_t midi_file;
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	long i, number_of_pairs = 0;
+	double start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--notes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_notes = atol(argv[i]);
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if (number_of_notes < 1) usage(program_name);
+
+	/* the worst case for pairing by scanning:  every note overlaps every other one on the same pitch */
+	midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
+	track = MidiFile_createTrack(midi_file);
+	for (i = 0; i < number_of_notes; i++) MidiFileTrack_createNoteOnEvent(track, i, 0, 60, 100);
+	for (i = 0; i < number_of_notes; i++) MidiFileTrack_createNoteOffEvent(track, number_of_notes + i, 0, 60, 0);
+
+	start_seconds = get_seconds();
+
+	for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+	{
+		if (MidiFileNoteStartEvent_getNoteEndEvent(event) != NULL) number_of_pairs++;
+		if (MidiFileNoteEndEvent_getNoteStartEvent(event) != NULL) number_of_pairs++;
+	}
+
+	printf("notes:             %ld\n", number_of_notes);
+	printf("pairs found:       %ld\n", number_of_pairs);
+	printf("pairing:           %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int ruler(char *program_name, int argc, char **argv)
+{
+	/* label evenly spaced ticks the way a time ruler would on every repaint */
+
+	char *input_filename = NULL;
+	long number_of_labels = 100000;
+	MidiFile_t midi_file;
+	MidiFileEvent_t last_event;
+	long last_tick, i;
+	unsigned long checksum = 0;
+	char label[64];
+	double start_seconds;
+	int j;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--labels") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_labels = atol(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_labels < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	last_tick = ((last_event = MidiFile_getLastEvent(midi_file)) == NULL) ? 0 : MidiFileEvent_getTick(last_event);
+	start_seconds = get_seconds();
+
+	for (i = 0; i < number_of_labels; i++)
+	{
+		long tick = (long)((double)(last_tick) * i / number_of_labels);
+		MidiFile_formatMeasureBeatFromTick(midi_file, tick, label, sizeof (label));
+		for (j = 0; label[j] != '\0'; j++) checksum = checksum * 31 + label[j];
+		MidiFile_formatHourMinuteSecondFromTick(midi_file, tick, label, sizeof (label));
+		for (j = 0; label[j] != '\0'; j++) checksum = checksum * 31 + label[j];
+	}
+
+	printf("labels:            %ld\n", number_of_labels);
+	printf("labelling:         %.2f ns per label (checksum %08lx)\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_labels, checksum & 0xFFFFFFFFUL);
+
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int convert_times(char *program_name, int argc, char **argv)
+{
+	/* sorted ticks spread over the length of the file, converted to seconds and back one at a time and as arrays */
+
+	char *input_filename = NULL;
+	long number_of_ticks = 10000000;
+	MidiFile_t midi_file;
+	MidiFileEvent_t last_event;
+	long last_tick, number_of_differences = 0, i;
+	long *ticks, *ticks_out;
+	float *times, *times_out;
+	double start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--ticks") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_ticks = atol(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_ticks < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	ticks = (long *)(malloc(number_of_ticks * sizeof (long)));
+	ticks_out = (long *)(malloc(number_of_ticks * sizeof (long)));
+	times = (float *)(malloc(number_of_ticks * sizeof (float)));
+	times_out = (float *)(malloc(number_of_ticks * sizeof (float)));
+
+	if ((ticks == NULL) || (ticks_out == NULL) || (times == NULL) || (times_out == NULL))
+	{
+		fprintf(stderr, "Error:  Out of memory.\n");
+		return 1;
+	}
+
+	last_tick = ((last_event = MidiFile_getLastEvent(midi_file)) == NULL) ? 0 : MidiFileEvent_getTick(last_event);
+	for (i = 0; i < number_of_ticks; i++) ticks[i] = (long)((double)(last_tick) * i / number_of_ticks);
+	MidiFile_getTimeFromTick(midi_file, 0); /* build the tempo map outside the timings */
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_ticks; i++) times[i] = MidiFile_getTimeFromTick(midi_file, ticks[i]);
+	printf("ticks to times:    %.2f ns per tick one at a time\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_ticks);
+
+	start_seconds = get_seconds();
+	MidiFile_getTimesFromTicks(midi_file, number_of_ticks, ticks, times_out);
+	printf("ticks to times:    %.2f ns per tick as an array\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_ticks);
+	for (i = 0; i < number_of_ticks; i++) if (memcmp(&(times[i]), &(times_out[i]), sizeof (float)) != 0) number_of_differences++;
+
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_ticks; i++) ticks[i] = MidiFile_getTickFromTime(midi_file, times[i]);
+	printf("times to ticks:    %.2f ns per time one at a time\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_ticks);
+
+	start_seconds = get_seconds();
+	MidiFile_getTicksFromTimes(midi_file, number_of_ticks, times, ticks_out);
+	printf("times to ticks:    %.2f ns per time as an array\n", (get_seconds() - start_seconds) * 1000000000.0 / number_of_ticks);
+	for (i = 0; i < number_of_ticks; i++) if (ticks[i] != ticks_out[i]) number_of_differences++;
+
+	printf("differences:       %ld\n", number_of_differences);
+
+	free(times_out);
+	free(times);
+	free(ticks_out);
+	free(ticks);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int timeline(char *program_name, int argc, char **argv)
+{
+	/*
+	 * Checks the microsecond conversions against times added up here from
+	 * the tempo events, and against themselves:  a player which schedules
+	 * each event by adding the difference from the one before must end up
+	 * where a direct conversion says.  The same is measured for the
+	 * conversions in seconds, for comparison.  Fails if the microsecond
+	 * conversions are out by even one.
+	 */
+
+	long number_of_tempo_changes = 10000, number_of_hours = 4, number_of_steps_per_segment = 16;
+	int resolution = 960;
+	MidiFile_t midi_file;
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	long segment_length, tick, last_tick, previous_tick, number_of_checks = 0, number_of_mismatches = 0, number_of_float_round_trip_failures = 0, i, j;
+	long long elapsed = 0, time_us, previous_time_us = 0, summed_time_us = 0;
+	long microseconds_per_beat = 500000;
+	float previous_time = 0.0, summed_time = 0.0;
+	double worst_float_error = 0.0, start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--tempo-changes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_tempo_changes = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--hours") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_hours = atol(argv[i]);
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((number_of_tempo_changes < 1) || (number_of_hours < 1)) usage(program_name);
+
+	/* tempos between 40 and 240 bpm, at around 2240 ticks a second for 140 bpm; slower ones make the file run somewhat longer */
+	segment_length = (long)((double)(number_of_hours) * 3600 * 2240 / number_of_tempo_changes);
+	if (segment_length < number_of_steps_per_segment) segment_length = number_of_steps_per_segment;
+
+	midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, resolution);
+	track = MidiFile_createTrack(midi_file);
+	for (i = 0; i < number_of_tempo_changes; i++) MidiFileTrack_createTempoEvent(track, i * segment_length, (float)(40.0 + (get_random() % 200000) / 1000.0));
+	last_tick = number_of_tempo_changes * segment_length;
+
+	/* walk the tempo events, converting a few ticks in each segment */
+	for (event = MidiFileTrack_getFirstEvent(track), previous_tick = 0; event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+	{
+		long segment_start_tick = previous_tick;
+		long long segment_start_elapsed = elapsed;
+
+		for (j = 0; j < number_of_steps_per_segment; j++)
+		{
+			tick = segment_start_tick + (j * (MidiFileEvent_getTick(event) - segment_start_tick) / number_of_steps_per_segment);
+			if ((j > 0) && (tick == previous_tick)) continue;
+			elapsed = segment_start_elapsed + ((long long)(tick - segment_start_tick) * microseconds_per_beat);
+			time_us = MidiFile_getTimeUsFromTick(midi_file, tick);
+
+			if ((time_us != (elapsed + (resolution / 2)) / resolution) || (MidiFile_getTickFromTimeUs(midi_file, time_us) != tick)) number_of_mismatches++;
+			summed_time_us += time_us - previous_time_us;
+			previous_time_us = time_us;
+
+			{
+				float time = MidiFile_getTimeFromTick(midi_file, tick);
+				double error = (time * 1000000.0) - (double)(time_us);
+				if (error < 0) error = -error;
+				if (error > worst_float_error) worst_float_error = error;
+				if (MidiFile_getTickFromTime(midi_file, time) != tick) number_of_float_round_trip_failures++;
+				summed_time += time - previous_time;
+				previous_time = time;
+			}
+
+			previous_tick = tick;
+			number_of_checks++;
+		}
+
+		elapsed = segment_start_elapsed + ((long long)(MidiFileEvent_getTick(event) - segment_start_tick) * microseconds_per_beat);
+		previous_tick = MidiFileEvent_getTick(event);
+		microseconds_per_beat = (MidiFileMetaEvent_getData(event)[0] << 16) | (MidiFileMetaEvent_getData(event)[1] << 8) | MidiFileMetaEvent_getData(event)[2];
+	}
+
+	time_us = MidiFile_getTimeUsFromTick(midi_file, last_tick);
+	if (time_us != (elapsed + ((long long)(last_tick - previous_tick) * microseconds_per_beat) + (resolution / 2)) / resolution) number_of_mismatches++;
+	if (summed_time_us != previous_time_us) number_of_mismatches++;
+
+	printf("tempo changes:     %ld\n", number_of_tempo_changes);
+	printf("length:            %.3f s\n", time_us / 1000000.0);
+	printf("ticks checked:     %ld\n", number_of_checks);
+	printf("mismatches:        %ld\n", number_of_mismatches);
+	printf("seconds, worst:    %.1f us off\n", worst_float_error);
+	printf("seconds, summed:   %.1f us off\n", ((double)(summed_time) * 1000000.0) - (double)(previous_time_us));
+	printf("seconds, no trip:  %ld\n", number_of_float_round_trip_failures);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < 1000000; i++) summed_time_us += MidiFile_getTimeUsFromTick(midi_file, get_random() % last_tick);
+	printf("getTimeUsFromTick: %.1f ns\n", (get_seconds() - start_seconds) * 1000.0);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < 1000000; i++) summed_time_us += MidiFile_getTickFromTimeUs(midi_file, (long long)(time_us * ((get_random() % 65536) / 65536.0)));
+	printf("getTickFromTimeUs: %.1f ns\n", (get_seconds() - start_seconds) * 1000.0);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < 1000000; i++) summed_time += MidiFile_getTimeFromTick(midi_file, get_random() % last_tick);
+	printf("getTimeFromTick:   %.1f ns\n", (get_seconds() - start_seconds) * 1000.0);
+
+	start_seconds = get_seconds();
+	for (i = 0; i < 1000000; i++) summed_time_us += MidiFile_getTickFromTime(midi_file, previous_time * ((get_random() % 65536) / 65536.0f));
+	printf("getTickFromTime:   %.1f ns\n", (get_seconds() - start_seconds) * 1000.0);
+
+	/* keep the compiler from discarding the loops */
+	if ((summed_time_us == 42) || (summed_time == 42)) printf("\n");
+
+	MidiFile_free(midi_file);
+	return (number_of_mismatches == 0) ? 0 : 1;
+}
+
+static int snapshot(char *program_name, int argc, char **argv)
+{
+	/* an edit session keeping an undo snapshot after every edit, against keeping a saved copy after every edit */
+
+	char *input_filename = NULL;
+	long number_of_edits = 1000;
+	MidiFile_t midi_file, restored_midi_file;
+	MidiFileTrack_t *tracks;
+	MidiFileSnapshot_t *snapshots;
+	int number_of_tracks, track_number, file_size, restored_file_size;
+	unsigned char *buffer, *copy_buffer, *restored_buffer;
+	long last_tick, total_snapshot_size = 0, i;
+	double start_seconds;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--edits") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_edits = atol(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((input_filename == NULL) || (number_of_edits < 1)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	number_of_tracks = MidiFile_getNumberOfTracks(midi_file);
+	tracks = (MidiFileTrack_t *)(malloc(number_of_tracks * sizeof(MidiFileTrack_t)));
+	for (track_number = 0; track_number < number_of_tracks; track_number++) tracks[track_number] = MidiFile_getTrackByNumber(midi_file, track_number, 0);
+	last_tick = MidiFileEvent_getTick(MidiFile_getLastEvent(midi_file)) + 1;
+	snapshots = (MidiFileSnapshot_t *)(malloc(number_of_edits * sizeof(MidiFileSnapshot_t)));
+	MidiFile_setIndexed(midi_file, 1);
+
+	/* the same edits twice, first alone and then with the snapshots, so that the difference is the cost of the snapshots */
+	start_seconds = get_seconds();
+	for (i = 0; i < number_of_edits; i++) MidiFileTrack_createControlChangeEvent(tracks[get_random() % number_of_tracks], get_random() % last_tick, 0, 1, (int)(i % 128));
+	printf("edits:             %ld\n", number_of_edits);
+	printf("edit alone:        %.3f us\n", (get_seconds() - start_seconds) * 1000000.0 / number_of_edits);
+
+	file_size = MidiFile_getFileSize(midi_file);
+	buffer = (unsigned char *)(malloc(file_size));
+	MidiFile_saveToBuffer(midi_file, buffer);
+	printf("file size:         %d bytes\n", file_size);
+	printf("maximum rss:       %ld KB before\n", get_maximum_resident_set_size_kb());
+
+	start_seconds = get_seconds();
+
+	for (i = 0; i < number_of_edits; i++)
+	{
+		snapshots[i] = MidiFile_snapshot(midi_file);
+		MidiFileTrack_createControlChangeEvent(tracks[get_random() % number_of_tracks], get_random() % last_tick, 0, 1, (int)(i % 128));
+	}
+
+	printf("edit + snapshot:   %.3f us\n", (get_seconds() - start_seconds) * 1000000.0 / number_of_edits);
+	for (i = 0; i < number_of_edits; i++) total_snapshot_size += MidiFileSnapshot_getSize(snapshots[i]);
+	printf("snapshots:         %ld bytes held in all\n", total_snapshot_size);
+	printf("maximum rss:       %ld KB after\n", get_maximum_resident_set_size_kb());
+
+	copy_buffer = (unsigned char *)(malloc(MidiFile_getFileSize(midi_file)));
+	start_seconds = get_seconds();
+	for (i = 0; i < 10; i++) MidiFile_saveToBuffer(midi_file, copy_buffer);
+	printf("full copy:         %.3f us per edit, %ld bytes held in all\n", (get_seconds() - start_seconds) * 1000000.0 / 10, (long)(MidiFile_getFileSize(midi_file)) * number_of_edits);
+
+	/* undo all the way back, and check that it matches the file as it was */
+	start_seconds = get_seconds();
+	restored_midi_file = MidiFileSnapshot_toMidiFile(snapshots[0]);
+	printf("restore:           %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+	restored_file_size = MidiFile_getFileSize(restored_midi_file);
+	restored_buffer = (unsigned char *)(malloc(restored_file_size));
+	MidiFile_saveToBuffer(restored_midi_file, restored_buffer);
+	printf("restored intact:   %s\n", ((restored_file_size == file_size) && (memcmp(buffer, restored_buffer, file_size) == 0)) ? "yes" : "no");
+
+	for (i = 0; i < number_of_edits; i++) MidiFileSnapshot_free(snapshots[i]);
+	free(restored_buffer);
+	free(copy_buffer);
+	free(buffer);
+	free(snapshots);
+	free(tracks);
+	MidiFile_free(restored_midi_file);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int cache(char *program_name, int argc, char **argv)
+{
+	/* freezing a file straight from SMF each time, against mapping in a cache of the frozen view */
+
+	char *input_filename = NULL, *cache_filename = NULL;
+	int number_of_iterations = 5, i;
+	double uncached_seconds = 0.0, cached_seconds = 0.0, start_seconds;
+	MidiFile_t midi_file;
+	MidiFileFrozen_t frozen, cached_frozen;
+	long number_of_events;
+	int is_intact;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_iterations = atoi(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else if (cache_filename == NULL)
+		{
+			cache_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((cache_filename == NULL) || (number_of_iterations < 1)) usage(program_name);
+
+	for (i = 0; i < number_of_iterations; i++)
+	{
+		start_seconds = get_seconds();
+
+		if ((midi_file = MidiFile_load(input_filename)) == NULL)
+		{
+			fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+			return 1;
+		}
+
+		frozen = MidiFile_freeze(midi_file);
+		MidiFile_free(midi_file);
+		uncached_seconds += get_seconds() - start_seconds;
+		MidiFileFrozen_free(frozen);
+	}
+
+	/* the first call builds the cache, whether or not one was there before */
+	remove(cache_filename);
+	start_seconds = get_seconds();
+	MidiFileFrozen_free(MidiFile_loadFrozen(input_filename, cache_filename));
+	printf("build cache:       %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+
+	for (i = 0; i < number_of_iterations; i++)
+	{
+		start_seconds = get_seconds();
+		cached_frozen = MidiFile_loadFrozen(input_filename, cache_filename);
+		cached_seconds += get_seconds() - start_seconds;
+		if (i < number_of_iterations - 1) MidiFileFrozen_free(cached_frozen);
+	}
+
+	/* every array has to match, read all the way through so that the mapped pages are touched too */
+	midi_file = MidiFile_load(input_filename);
+	frozen = MidiFile_freeze(midi_file);
+	number_of_events = MidiFileFrozen_getNumberOfEvents(frozen);
+	start_seconds = get_seconds();
+	is_intact = (MidiFileFrozen_getNumberOfEvents(cached_frozen) == number_of_events) &&
+		(memcmp(MidiFileFrozen_getTicks(cached_frozen), MidiFileFrozen_getTicks(frozen), number_of_events * sizeof (long)) == 0) &&
+		(memcmp(MidiFileFrozen_getTimesUs(cached_frozen), MidiFileFrozen_getTimesUs(frozen), number_of_events * sizeof (long long)) == 0) &&
+		(memcmp(MidiFileFrozen_getTrackNumbers(cached_frozen), MidiFileFrozen_getTrackNumbers(frozen), number_of_events * sizeof (unsigned short)) == 0) &&
+		(memcmp(MidiFileFrozen_getTypes(cached_frozen), MidiFileFrozen_getTypes(frozen), number_of_events) == 0) &&
+		(memcmp(MidiFileFrozen_getChannels(cached_frozen), MidiFileFrozen_getChannels(frozen), number_of_events) == 0) &&
+		(memcmp(MidiFileFrozen_getNumbers(cached_frozen), MidiFileFrozen_getNumbers(frozen), number_of_events * sizeof (short)) == 0) &&
+		(memcmp(MidiFileFrozen_getValues(cached_frozen), MidiFileFrozen_getValues(frozen), number_of_events * sizeof (int)) == 0) &&
+		(memcmp(MidiFileFrozen_getPayloadOffsets(cached_frozen), MidiFileFrozen_getPayloadOffsets(frozen), (number_of_events + 1) * sizeof (long)) == 0) &&
+		(memcmp(MidiFileFrozen_getPayloads(cached_frozen), MidiFileFrozen_getPayloads(frozen), MidiFileFrozen_getPayloadOffsets(frozen)[number_of_events]) == 0);
+
+	printf("events:            %ld\n", number_of_events);
+	printf("load and freeze:   %.3f ms\n", uncached_seconds * 1000.0 / number_of_iterations);
+	printf("load from cache:   %.3f ms\n", cached_seconds * 1000.0 / number_of_iterations);
+	printf("first full read:   %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+	printf("cache intact:      %s\n", is_intact ? "yes" : "no");
+
+	MidiFileFrozen_free(cached_frozen);
+	MidiFileFrozen_free(frozen);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+static int journal(char *program_name, int argc, char **argv)
+{
+	/* a recording session saving every so often, through a journal against saving the whole file each time */
+
+	char *input_filename = NULL, *output_filename = NULL, *journal_filename;
+	long number_of_saves = 1000, number_of_events_per_save = 20, journal_size = 0, i, j;
+	int sync_interval = 1, file_size, recovered_file_size;
+	MidiFile_t midi_file, recovered_midi_file;
+	MidiFileTrack_t track;
+	MidiFileJournal_t midi_file_journal;
+	unsigned char *buffer, *recovered_buffer;
+	long tick;
+	double journal_seconds = 0.0, full_seconds = 0.0, start_seconds;
+	struct stat journal_status;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--saves") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_saves = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--events-per-save") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_events_per_save = atol(argv[i]);
+		}
+		else if (strcmp(argv[i], "--sync-interval") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			sync_interval = atoi(argv[i]);
+		}
+		else if (input_filename == NULL)
+		{
+			input_filename = argv[i];
+		}
+		else if (output_filename == NULL)
+		{
+			output_filename = argv[i];
+		}
+		else
+		{
+			usage(program_name);
+		}
+	}
+
+	if ((output_filename == NULL) || (number_of_saves < 1) || (number_of_events_per_save < 1) || (sync_interval < 0)) usage(program_name);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		return 1;
+	}
+
+	journal_filename = (char *)(malloc(strlen(output_filename) + 9));
+	sprintf(journal_filename, "%s.journal", output_filename);
+
+	if ((midi_file_journal = MidiFileJournal_open(midi_file, journal_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot create \"%s\".\n", journal_filename);
+		return 1;
+	}
+
+	MidiFileJournal_setSyncInterval(midi_file_journal, sync_interval);
+	track = MidiFile_createTrack(midi_file);
+	tick = MidiFileEvent_getTick(MidiFile_getLastEvent(midi_file));
+	if (tick < 0) tick = 0;
+
+	for (i = 0; i < number_of_saves; i++)
+	{
+		for (j = 0; j < number_of_events_per_save; j++)
+		{
+			tick += get_random() % 60;
+			MidiFileTrack_createNoteOnEvent(track, tick, 0, 36 + (int)(get_random() % 48), 1 + (int)(get_random() % 127));
+		}
+
+		start_seconds = get_seconds();
+		MidiFileJournal_save(midi_file_journal);
+		journal_seconds += get_seconds() - start_seconds;
+		if ((stat(journal_filename, &journal_status) == 0) && (journal_status.st_size > journal_size)) journal_size = (long)(journal_status.st_size);
+
+		/* every save for small sessions, or a sample of them, since the full saves are what take the time */
+		if ((number_of_saves <= 100) || (i % (number_of_saves / 100) == 0))
+		{
+			start_seconds = get_seconds();
+			MidiFile_save(midi_file, output_filename);
+			full_seconds += (get_seconds() - start_seconds) * ((number_of_saves <= 100) ? 1 : (number_of_saves / 100));
+		}
+	}
+
+	file_size = MidiFile_getFileSize(midi_file);
+	printf("saves:             %ld of %ld events each\n", number_of_saves, number_of_events_per_save);
+	printf("file size:         %d bytes at the end\n", file_size);
+	printf("journal save:      %.3f us\n", journal_seconds * 1000000.0 / number_of_saves);
+	printf("full save:         %.3f us (without syncing)\n", full_seconds * 1000000.0 / number_of_saves);
+	printf("largest journal:   %ld bytes\n", journal_size);
+
+	/* what a crash just after the last save would get back, then the file it leaves on closing */
+	buffer = (unsigned char *)(malloc(file_size));
+	MidiFile_saveToBuffer(midi_file, buffer);
+	start_seconds = get_seconds();
+	recovered_midi_file = MidiFile_loadFromJournal(journal_filename);
+	printf("recover:           %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+	recovered_file_size = MidiFile_getFileSize(recovered_midi_file);
+	recovered_buffer = (unsigned char *)(malloc(recovered_file_size));
+	MidiFile_saveToBuffer(recovered_midi_file, recovered_buffer);
+	printf("recovered intact:  %s\n", ((recovered_file_size == file_size) && (memcmp(buffer, recovered_buffer, file_size) == 0)) ? "yes" : "no");
+
+	start_seconds = get_seconds();
+	MidiFileJournal_close(midi_file_journal, output_filename);
+	printf("close:             %.3f ms\n", (get_seconds() - start_seconds) * 1000.0);
+
+	free(recovered_buffer);
+	free(buffer);
+	free(journal_filename);
+	MidiFile_free(recovered_midi_file);
+	MidiFile_free(midi_file);
+	return 0;
+}
+
+struct ProbeList
+{
+	char **filenames;
+	int number_of_filenames;
+	int maximum_number_of_filenames;
+};
+
+static void add_probe_filename(struct ProbeList *list, char *filename)
+{
+	if (list->number_of_filenames == list->maximum_number_of_filenames)
+	{
+		list->maximum_number_of_filenames = (list->maximum_number_of_filenames + 1) * 2;
+		list->filenames = (char **)(realloc(list->filenames, list->maximum_number_of_filenames * sizeof (char *)));
+	}
+
+	list->filenames[list->number_of_filenames++] = strdup(filename);
+}
+
+static void add_probe_filenames(struct ProbeList *list, char *path)
+{
+	/* directories are walked recursively, and everything else is taken to be a MIDI file */
+
+	struct stat file_status;
+	DIR *directory;
+	struct dirent *entry;
+
+	if ((stat(path, &file_status) == 0) && S_ISDIR(file_status.st_mode) && ((directory = opendir(path)) != NULL))
+	{
+		while ((entry = readdir(directory)) != NULL)
+		{
+			char *entry_path;
+
+			if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) continue;
+			entry_path = (char *)(malloc(strlen(path) + strlen(entry->d_name) + 2));
+			sprintf(entry_path, "%s/%s", path, entry->d_name);
+			add_probe_filenames(list, entry_path);
+			free(entry_path);
+		}
+
+		closedir(directory);
+	}
+	else
+	{
+		add_probe_filename(list, path);
+	}
+}
+
+static int probe(char *program_name, int argc, char **argv)
+{
+	/* count files per second, which for a large corpus of small files is what matters more than bytes */
+
+	int number_of_passes = 1, flags = MIDI_FILE_PROBE_HEADER_ONLY;
+	struct ProbeList list;
+	long number_of_tracks = 0, tick_sum = 0, number_of_failures = 0;
+	double start_seconds, probe_seconds, load_seconds;
+	int i, pass;
+
+	list.filenames = NULL;
+	list.number_of_filenames = 0;
+	list.maximum_number_of_filenames = 0;
+
+	for (i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--passes") == 0)
+		{
+			if (++i == argc) usage(program_name);
+			number_of_passes = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "--conductor") == 0)
+		{
+			flags |= MIDI_FILE_PROBE_CONDUCTOR_TRACK;
+		}
+		else if (strcmp(argv[i], "--meta") == 0)
+		{
+			flags |= MIDI_FILE_PROBE_META_EVENTS;
+		}
+		else if (strcmp(argv[i], "--last-events") == 0)
+		{
+			flags |= MIDI_FILE_PROBE_LAST_EVENTS;
+		}
+		else
+		{
+			add_probe_filenames(&list, argv[i]);
+		}
+	}
+
+	if ((list.number_of_filenames == 0) || (number_of_passes < 1)) usage(program_name);
+
+	/* the first pass of each also warms the page cache for the ones after */
+
+	start_seconds = get_seconds();
+
+	for (pass = 0; pass < number_of_passes; pass++)
+	{
+		for (i = 0; i < list.number_of_filenames; i++)
+		{
+			MidiFile_t midi_file;
+
+			if ((midi_file = MidiFile_probe(list.filenames[i], flags)) == NULL)
+			{
+				number_of_failures++;
+				continue;
+			}
+
+			number_of_tracks += MidiFile_getNumberOfTracks(midi_file);
+			if (MidiFile_getLastEvent(midi_file) != NULL) tick_sum += MidiFileEvent_getTick(MidiFile_getLastEvent(midi_file));
+			MidiFile_free(midi_file);
+		}
+	}
+
+	probe_seconds = get_seconds() - start_seconds;
+	printf("files:  %d (%ld unreadable), %ld tracks, checksum %ld\n", list.number_of_filenames, number_of_failures / number_of_passes, number_of_tracks / number_of_passes, tick_sum);
+	printf("probe:  %.0f files/s\n", (double)(list.number_of_filenames) * number_of_passes / probe_seconds);
+
+	start_seconds = get_seconds();
+
+	for (pass = 0; pass < number_of_passes; pass++)
+	{
+		for (i = 0; i < list.number_of_filenames; i++)
+		{
+			MidiFile_t midi_file;
+
+			if ((midi_file = MidiFile_load(list.filenames[i])) != NULL) MidiFile_free(midi_file);
+		}
+	}
+
+	load_seconds = get_seconds() - start_seconds;
+	printf("load:   %.0f files/s (probe is %.1fx faster)\n", (double)(list.number_of_filenames) * number_of_passes / load_seconds, load_seconds / probe_seconds);
+
+	for (i = 0; i < list.number_of_filenames; i++) free(list.filenames[i]);
+	free(list.filenames);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) usage(argv[0]);
+
+	if (strcmp(argv[1], "generate") == 0)
+	{
+		return generate(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "load") == 0)
+	{
+		return load(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "save") == 0)
+	{
+		return save(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "compact") == 0)
+	{
+		return compact(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "pipeline") == 0)
+	{
+		return pipeline(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "convert") == 0)
+	{
+		return convert(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "insert") == 0)
+	{
+		return insert(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "import") == 0)
+	{
+		return import(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "move") == 0)
+	{
+		return move(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "convert-events") == 0)
+	{
+		return convert_events(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "scan") == 0)
+	{
+		return scan(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "stream") == 0)
+	{
+		return stream(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "pair-notes") == 0)
+	{
+		return pair_notes(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "ruler") == 0)
+	{
+		return ruler(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "convert-times") == 0)
+	{
+		return convert_times(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "timeline") == 0)
+	{
+		return timeline(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "snapshot") == 0)
+	{
+		return snapshot(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "cache") == 0)
+	{
+		return cache(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "journal") == 0)
+	{
+		return journal(argv[0], argc - 2, argv + 2);
+	}
+	else if (strcmp(argv[1], "probe") == 0)
+	{
+		return probe(argv[0], argc - 2, argv + 2);
+	}
+	else
+	{
+		usage(argv[0]);
+	}
+
+	return 0;
+}
+
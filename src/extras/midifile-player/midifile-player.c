@@ -52,7 +52,7 @@ static void *thread_main(void *arg)
 
 	while (!player->should_shutdown && (player->event != NULL))
 	{
-		long sleep_time = (MidiFile_getTimeFromTick(player->midi_file, MidiFileEvent_getTick(player->event)) * 1000) - (MidiFilePlayer_getCurrentTime() - (player->absolute_start_time - player->relative_start_time));
+		long sleep_time = (long)(MidiFile_getTimeUsFromTick(player->midi_file, MidiFileEvent_getTick(player->event)) / 1000) - (MidiFilePlayer_getCurrentTime() - (player->absolute_start_time - player->relative_start_time));
 
 		if (sleep_time > 0)
 		{
@@ -137,11 +137,11 @@ long MidiFilePlayer_getTick(MidiFilePlayer_t player)
 
 	if (player->is_running)
 	{
-		return MidiFile_getTickFromTime(player->midi_file, (MidiFilePlayer_getCurrentTime() - (player->absolute_start_time - player->relative_start_time)) / 1000.0);
+		return MidiFile_getTickFromTimeUs(player->midi_file, (long long)(MidiFilePlayer_getCurrentTime() - (player->absolute_start_time - player->relative_start_time)) * 1000);
 	}
 	else
 	{
-		return MidiFile_getTickFromTime(player->midi_file, player->relative_start_time / 1000.0);
+		return MidiFile_getTickFromTimeUs(player->midi_file, (long long)(player->relative_start_time) * 1000);
 	}
 }
 
@@ -149,7 +149,7 @@ int MidiFilePlayer_setTick(MidiFilePlayer_t player, long tick)
 {
 	if ((player == NULL) || (player->midi_file == NULL)) return -1;
 	stop_held_notes(player);
-	player->relative_start_time = MidiFile_getTimeFromTick(player->midi_file, tick) * 1000;
+	player->relative_start_time = (long)(MidiFile_getTimeUsFromTick(player->midi_file, tick) / 1000);
 
 	for (player->event = MidiFile_getFirstEvent(player->midi_file); player->event != NULL; player->event = MidiFileEvent_getNextEventInFile(player->event))
 	{
@@ -1,6 +1,10 @@
 #!/usr/bin/env python
 
+import sys
 import distutils.core
 
-distutils.core.setup(name = "CMidiFile", ext_modules = [distutils.core.Extension("CMidiFile", sources = ["CMidiFile.c", "../midifile/midifile.c"], include_dirs = ["../midifile"])])
+# the midifile library uses pthreads everywhere but Windows
+thread_args = [] if sys.platform == "win32" else ["-pthread"]
+
+distutils.core.setup(name = "CMidiFile", ext_modules = [distutils.core.Extension("CMidiFile", sources = ["CMidiFile.c", "../midifile/midifile.c"], include_dirs = ["../midifile"], extra_compile_args = thread_args, extra_link_args = thread_args)])
 
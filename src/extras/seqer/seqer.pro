@@ -8,4 +8,5 @@ SOURCES += all-events-lane.cpp colors.cpp continuous-value-lane.cpp controller-l
 win32:CONFIG(debug, release|debug):CONFIG += console
 win32:RC_ICONS += seqer.ico
 macx:ICON = seqer.icns
+unix:LIBS += -pthread
 
@@ -94,11 +94,13 @@ bool Sequence::saveMidiFile(MidiFile_t midi_file, QString filename)
 
 QByteArray Sequence::saveMidiFileToBuffer(MidiFile_t midi_file)
 {
-	QByteArray buffer;
+	int file_size = 0;
 	Sequence::serializeMidiFile(midi_file);
-	buffer.resize(MidiFile_getFileSize(midi_file));
-	MidiFile_saveToBuffer(midi_file, (unsigned char *)(buffer.data()));
+	unsigned char *data = MidiFile_saveToGrowableBuffer(midi_file, &file_size);
 	Sequence::deserializeMidiFile(midi_file);
+	if (data == NULL) return QByteArray();
+	QByteArray buffer((const char *)(data), file_size);
+	free(data);
 	return buffer;
 }
 
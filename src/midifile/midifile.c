@@ -2,12 +2,188 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <io.h>
+#include <malloc.h>
+#endif
+#if !defined(_WIN32) && !defined(MIDI_FILE_NO_THREADS)
+#define MIDI_FILE_THREADS
+#include <pthread.h>
+#endif
+#if defined(_WIN32) && !defined(MIDI_FILE_NO_THREADS)
+#define MIDI_FILE_WIN32_LOCKS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 #include <midifile.h>
 
 /*
  * Data Types
  */
 
+/*
+ * Events and their small payloads are carved out of large blocks owned by
+ * the MidiFile, so that loading does a handful of allocations and freeing
+ * the file releases whole blocks instead of walking every event.  Compile
+ * with -DMIDI_FILE_NO_POOL to fall back to one malloc per event, which is
+ * handy for benchmarking and for memory checkers.
+ */
+
+#define MIDI_FILE_POOL_MINIMUM_ITEMS_PER_BLOCK 64
+#define MIDI_FILE_POOL_MAXIMUM_ITEMS_PER_BLOCK 16384
+#define MIDI_FILE_SMALL_DATA_LENGTH 16
+
+/*
+ * Events refer to each other and to their tracks by 32-bit references
+ * rather than pointers, which along with packing their fields into bytes
+ * keeps an event to 48 bytes on 64-bit platforms.  A reference is a block
+ * number in a directory shared by every file, and an item within that
+ * block, with zero standing for NULL.  Because the directory is shared,
+ * a reference can be looked up without knowing which file it belongs to.
+ * Blocks of events are allocated aligned to their own size, so
+ * an event can find its block from its address, and from that its own
+ * reference and the file that owns its storage.  Tracks are few enough
+ * that each gets a block number to itself, which it remembers.  Without
+ * the pool, every event gets a block number to itself too, and has to
+ * remember its own reference and owner, so events are bigger.
+ *
+ * Entries in the directory are only ever added or removed under a lock,
+ * and the pages of it are never moved or freed, so looking references up
+ * needs no lock at all.
+ */
+
+typedef unsigned int MidiFileReference_t; /* at least 32 bits */
+
+#ifdef MIDI_FILE_NO_POOL
+#define MIDI_FILE_REFERENCE_ITEM_BITS 0
+#define MIDI_FILE_DIRECTORY_PAGE_BITS 16
+#else
+#define MIDI_FILE_REFERENCE_ITEM_BITS 11
+#define MIDI_FILE_DIRECTORY_PAGE_BITS 10
+#endif
+
+#define MIDI_FILE_DIRECTORY_NUMBER_OF_PAGES (1L << (32 - MIDI_FILE_REFERENCE_ITEM_BITS - MIDI_FILE_DIRECTORY_PAGE_BITS))
+#define MIDI_FILE_EVENT_BLOCK_SIZE 65536 /* no more than (1 << MIDI_FILE_REFERENCE_ITEM_BITS) events must fit */
+
+typedef struct MidiFilePool *MidiFilePool_t;
+
+struct MidiFilePoolBlock
+{
+	struct MidiFilePoolBlock *next_block;
+	long number_of_items;
+	struct MidiFile *midi_file; /* these last two only for blocks of events */
+	MidiFileReference_t number;
+};
+
+struct MidiFilePool
+{
+	size_t item_size;
+	long number_of_items_per_block;
+	struct MidiFilePoolBlock *first_block;
+	unsigned char *next_unused_item;
+	unsigned char *end_of_block;
+	void *first_free_item;
+	struct MidiFile *midi_file; /* for a pool of events, the file to give their blocks as owner; otherwise NULL */
+};
+
+struct MidiFileData
+{
+	struct MidiFileData *previous_data;
+	struct MidiFileData *next_data;
+};
+
+/*
+ * The tempo events of the conductor track are summarized into a table of
+ * segments which is rebuilt lazily after the conductor track changes, so
+ * that converting between ticks and absolute or musical time is a binary
+ * search rather than a walk over the track.  The position at the start of
+ * each segment is accumulated in exactly the same order as a walk would,
+ * so the results are identical.
+ */
+
+struct MidiFileTempoSegment
+{
+	long start_tick;
+	float start_position; /* seconds for PPQ files, beats for SMPTE files */
+	float tempo;
+	long long start_time; /* microseconds times the resolution, exact, for PPQ files */
+	long microseconds_per_beat;
+};
+
+/*
+ * The meter map does for time signatures what the tempo map does for tempo
+ * events, caching where each one falls in beats and measures (including the
+ * measure:beat and measure:beat:tick labels of its position) so that
+ * measure lookups don't have to rescan the conductor track.
+ */
+struct MidiFileMeterSegment
+{
+	long start_tick;
+	float start_beat;
+	float start_measure;
+	long visible_measure;
+	float visible_beat;
+	long visible_whole_beat;
+	float visible_tick;
+	int numerator; /* the time signature from here on */
+	int denominator;
+};
+
+/*
+ * An optional index over the ticks in an event list (the file-wide one, or
+ * a track's), for files which see a lot of random access editing.  It is a
+ * skip list with one node per distinct tick, remembering the first and last
+ * events with that tick, so that finding where an event belongs takes
+ * O(log N) instead of a walk along the list.  The order of events which
+ * share a tick is still kept by the list itself.
+ */
+
+#define MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL 20
+
+typedef struct MidiFileTickIndex *MidiFileTickIndex_t;
+typedef struct MidiFileTickIndexNode *MidiFileTickIndexNode_t;
+
+struct MidiFileTickIndexNode
+{
+	long tick;
+	struct MidiFileEvent *first_event;
+	struct MidiFileEvent *last_event;
+	struct MidiFileTickIndexNode *next_nodes[1]; /* really one per level that this node appears on */
+};
+
+struct MidiFileTickIndex
+{
+	int number_of_levels;
+	unsigned long random_state;
+	struct MidiFileTickIndexNode *first_nodes[MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL];
+};
+
+/*
+ * The little state shared between files is locked even where there are no
+ * threads to load with, so that separate files can be used on separate
+ * threads anywhere.  Each file also has a lock of its own for merging its
+ * file-wide list, so that iterating over one file never waits on another.
+ * Windows gets slim reader/writer locks, which need no tearing down.
+ */
+
+#if defined(MIDI_FILE_THREADS)
+typedef pthread_mutex_t MidiFileMutex_t;
+#define MIDI_FILE_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#elif defined(MIDI_FILE_WIN32_LOCKS)
+typedef SRWLOCK MidiFileMutex_t;
+#define MIDI_FILE_MUTEX_INITIALIZER SRWLOCK_INIT
+#else
+typedef int MidiFileMutex_t;
+#define MIDI_FILE_MUTEX_INITIALIZER 0
+#endif
+
 struct MidiFile
 {
 	int file_format;
@@ -25,12 +201,42 @@ struct MidiFile
 	struct MidiFileHourMinuteSecondFrame *hour_minute_second_frame;
 	struct MidiFileEvent *event_iterator_current;
 	struct MidiFileEvent *event_iterator_next;
+	struct MidiFilePool event_pool;
+	struct MidiFilePool small_data_pool;
+	struct MidiFileData *first_large_data;
+	unsigned char *input_buffer; /* the loaded file, if sysex and meta payloads were left in it */
+	long input_buffer_length;
+	long number_of_lent_events; /* events from this file's storage which are detached or in another file */
+	long number_of_borrowed_events; /* events in this file's tracks from another file's storage */
+	int is_freed; /* MidiFile_free() has been called, and only the storage is left, for the lent events */
+	struct MidiFileTempoSegment *tempo_segments;
+	long number_of_tempo_segments;
+	long maximum_number_of_tempo_segments;
+	int tempo_segments_are_valid;
+	int tempo_segments_are_sorted;
+	struct MidiFileMeterSegment *meter_segments;
+	long number_of_meter_segments;
+	long maximum_number_of_meter_segments;
+	int meter_segments_are_valid;
+	int meter_segments_are_sorted_by_measure;
+	int meter_segments_are_sorted_by_measure_beat;
+	int meter_segments_are_sorted_by_measure_beat_tick;
+	int file_event_list_is_stale; /* the file-wide list hasn't been merged from the tracks yet, and only holds the events added since; see merge_file_event_list() */
+	MidiFileMutex_t file_event_list_mutex; /* held while the file-wide list is merged or sorted for iterating */
+	struct MidiFileTickIndex *tick_index; /* NULL unless the file is indexed */
+	int batch_depth;
+	int batch_is_unsorted; /* the file-wide list has events added at its ends out of order */
+	int batch_was_indexed; /* whether to rebuild the index when the batch ends */
+	struct MidiFileJournal *journal; /* NULL unless one is open */
+	int journal_needs_compaction; /* tracks have been inserted or deleted since the last journal save */
+	int save_flags;
 };
 
 struct MidiFileTrack
 {
 	struct MidiFile *midi_file;
 	int number;
+	MidiFileReference_t reference;
 	long end_tick;
 	struct MidiFileTrack *previous_track;
 	struct MidiFileTrack *next_track;
@@ -38,33 +244,64 @@ struct MidiFileTrack
 	struct MidiFileEvent *last_event;
 	struct MidiFileEvent *event_iterator_current;
 	struct MidiFileEvent *event_iterator_next;
+	int note_partners_are_valid;
+	struct MidiFileTickIndex *tick_index; /* NULL unless the file is indexed */
+	int batch_is_unsorted;
+	struct MidiFileTrackImage *snapshot_image; /* shared with snapshots for as long as the track is unchanged, or NULL */
+	struct MidiFileEvent *last_journaled_event;
+	int journal_is_stale; /* changed other than at the end since the last journal save */
 };
 
+#define MIDI_FILE_PLACEMENT_FIRST_AT_TICK 1
+#define MIDI_FILE_PLACEMENT_LAST_AT_TICK 2
+
 struct MidiFileEvent
 {
-	struct MidiFileTrack *track;
-	struct MidiFileEvent *previous_event_in_track;
-	struct MidiFileEvent *next_event_in_track;
-	struct MidiFileEvent *previous_event_in_file;
-	struct MidiFileEvent *next_event_in_file;
+	/*
+	 * The links and the track are references; see get_event() and
+	 * get_track().  The union is 16 bytes, which note ons and offs only
+	 * fit by keeping their channel, note, and velocity in bytes, as notes
+	 * do to go with them.  The other kinds of event fit with ints.
+	 */
+
 	long tick;
-	MidiFileEventType_t type;
+	MidiFileReference_t previous_event_in_track;
+	MidiFileReference_t next_event_in_track;
+	MidiFileReference_t previous_event_in_file;
+	MidiFileReference_t next_event_in_file;
+	MidiFileReference_t track;
+	signed char type; /* a MidiFileEventType_t */
+	unsigned char should_be_visited;
+	unsigned char is_selected;
+	unsigned char placement_at_tick; /* while the file-wide list is stale, where the event was added among those at its tick, or 0 if it was loaded */
 
 	union
 	{
+		/*
+		 * Note on and note off share a layout, so that the pairing links
+		 * survive a note end switching between the two.  The links are only
+		 * meaningful while the track's note_partners_are_valid is set.
+		 */
+
 		struct
 		{
-			int channel;
-			int note;
-			int velocity;
+			unsigned char channel;
+			unsigned char note;
+			unsigned char velocity;
+			MidiFileReference_t partner;
+			MidiFileReference_t previous_event_with_same_note;
+			MidiFileReference_t next_event_with_same_note;
 		}
 		note_off;
 
 		struct
 		{
-			int channel;
-			int note;
-			int velocity;
+			unsigned char channel;
+			unsigned char note;
+			unsigned char velocity;
+			MidiFileReference_t partner;
+			MidiFileReference_t previous_event_with_same_note;
+			MidiFileReference_t next_event_with_same_note;
 		}
 		note_on;
 
@@ -123,10 +360,10 @@ struct MidiFileEvent
 		struct
 		{
 			long duration_ticks;
-			int channel;
-			int note;
-			int velocity;
-			int end_velocity;
+			unsigned char channel;
+			unsigned char note;
+			unsigned char velocity;
+			unsigned char end_velocity;
 		}
 		note;
 
@@ -156,8 +393,10 @@ struct MidiFileEvent
 	}
 	u;
 
-	int should_be_visited;
-	int is_selected;
+#ifdef MIDI_FILE_NO_POOL
+	MidiFileReference_t reference;
+	struct MidiFile *midi_file; /* owns the storage, even while detached */
+#endif
 };
 
 struct MidiFileMeasureBeat
@@ -192,19 +431,69 @@ struct MidiFileHourMinuteSecondFrame
 	char string[32];
 };
 
+/*
+ * A frozen view holds the events of a file in parallel arrays, one entry
+ * per event in file order, so that read-only scans stream through memory
+ * instead of chasing pointers.  Nothing in it changes after it is built.
+ */
+
+struct MidiFileFrozen
+{
+	long number_of_events;
+	long *ticks;
+	long long *times_us;
+	unsigned short *track_numbers;
+	signed char *types;
+	unsigned char *channels;
+	short *numbers;
+	int *values;
+	long *payload_offsets; /* one more than the number of events, so each payload ends where the next begins */
+	unsigned char *payloads;
+	unsigned char *cache; /* the cache file which the arrays point into, or NULL if they were allocated */
+	long cache_length;
+	int cache_is_mapped;
+};
+
+/*
+ * A frozen view can be cached in a file laid out so that it can be mapped
+ * straight back in:  this header, then each array in turn, in the machine's
+ * own byte order and type sizes, starting on an eight byte boundary.  The
+ * header records those sizes, so that a cache from another kind of machine
+ * is treated like a stale one, and the length and modification time of the
+ * file the cache was made from.
+ */
+
+#define MIDI_FILE_FROZEN_CACHE_SIGNATURE "MFFC"
+#define MIDI_FILE_FROZEN_CACHE_VERSION 1
+#define MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS 9
+
+struct MidiFileFrozenCacheHeader
+{
+	char signature[4];
+	int version;
+	long layout; /* type sizes and byte order */
+	long long source_length;
+	long long source_modification_time;
+	long number_of_events;
+	long payload_length;
+	long array_offsets[MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS]; /* in the order of struct MidiFileFrozen */
+};
+
 typedef struct MidiFileIO *MidiFileIO_t;
 
 typedef enum 
 {
 	MIDI_FILE_IO_TYPE_INVALID = -1,
 	MIDI_FILE_IO_TYPE_FILE,
-	MIDI_FILE_IO_TYPE_BUFFER
+	MIDI_FILE_IO_TYPE_BUFFER,
+	MIDI_FILE_IO_TYPE_GROWABLE_BUFFER
 }
 MidiFileIOType_t;
 
 struct MidiFileIO
 {
 	MidiFileIOType_t type;
+	int failed; /* set once a write could not be completed */
 
 	union
 	{
@@ -217,13 +506,284 @@ struct MidiFileIO
 		struct
 		{
 			long offset;
+			long length; /* negative if unknown, in which case reads are not checked */
 			unsigned char *buffer;
 		}
 		buffer;
+
+		struct
+		{
+			long offset;
+			long maximum_length;
+			unsigned char *buffer;
+		}
+		growable_buffer;
 	}
 	u;
 };
 
+/*
+ * When loading from a buffer of our own, sysex and meta payloads are left
+ * where they are in it, and their events noted so that the payloads can be
+ * copied out after all if they don't make the buffer worth keeping.
+ */
+
+struct MidiFilePayloadsInInput
+{
+	long length;
+	MidiFileEvent_t *events;
+	long number_of_events;
+	long maximum_number_of_events;
+	int is_incomplete; /* set if the events could not all be noted, so the buffer has to be kept */
+};
+
+/*
+ * Decoding state for one MTrk chunk, shared by the loader and the reader.
+ */
+
+struct MidiFileTrackParser
+{
+	long end_offset;
+	long tick;
+	unsigned char running_status;
+	int at_end_of_track;
+	long end_tick; /* -1 unless an end of track event has been read */
+	unsigned char *data_buffer; /* reused for each sysex or meta payload */
+	long maximum_data_length;
+	struct MidiFilePayloadsInInput *payloads_in_input; /* or NULL to copy the payloads into the data buffer */
+};
+
+/*
+ * Encoding state for one MTrk chunk, for the save flags.  Sizing a track
+ * goes through the same motions as saving it, so the two always agree.
+ */
+
+struct MidiFileTrackEncoder
+{
+	int flags;
+	int may_trim_tempo_and_time_signature_events; /* only where they take effect */
+	unsigned char running_status; /* or 0 for none */
+	struct MidiFileEvent *last_tempo_event; /* the last of each kind written */
+	struct MidiFileEvent *last_time_signature_event;
+	struct MidiFileEvent *last_key_signature_event;
+};
+
+/*
+ * To load in parallel, the MTrk chunks are located first and then handed
+ * out one at a time to a pool of threads.  Each thread allocates events
+ * from storage of its own, which is given to the file once every track has
+ * been read.  The file-wide list is left to be merged when it is first
+ * needed, like any other file's.
+ * Compile with -DMIDI_FILE_NO_THREADS to always load on the calling thread.
+ */
+
+struct MidiFileLoadJob
+{
+	struct MidiFileTrack *track;
+	long chunk_start;
+	long chunk_size;
+};
+
+struct MidiFileLoader
+{
+	struct MidiFileIO *io; /* each thread reads through a copy of its own */
+	struct MidiFilePayloadsInInput *payloads_in_input; /* shared by the threads, which note theirs separately and add them at the end */
+	struct MidiFileLoadJob *jobs;
+	int number_of_jobs;
+	int next_job;
+#ifdef MIDI_FILE_THREADS
+	pthread_mutex_t mutex;
+#endif
+};
+
+struct MidiFileLoadThread
+{
+	struct MidiFileLoader *loader;
+	struct MidiFile storage; /* only the pools are used */
+#ifdef MIDI_FILE_THREADS
+	pthread_t thread;
+#endif
+};
+
+/*
+ * A reader decodes events straight out of the file data, keeping only one
+ * pending event per track, so memory use does not grow with the length of
+ * the file.
+ */
+
+struct MidiFileReaderTrack
+{
+	long offset; /* where decoding resumes */
+	struct MidiFileTrackParser parser;
+	struct MidiFileEvent pending_event;
+	int has_pending_event;
+};
+
+struct MidiFileReaderHeapEntry
+{
+	long tick; /* copied from the track's pending event, to keep the heap compact */
+	int track_number;
+};
+
+struct MidiFileReader
+{
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_owned;
+	int buffer_is_mapped;
+	MidiFileIO_t io;
+	int file_format;
+	MidiFileDivisionType_t division_type;
+	int resolution;
+	int number_of_tracks;
+	struct MidiFileReaderTrack *tracks;
+	struct MidiFileReaderHeapEntry *heap; /* tracks with a pending event, ordered by its tick and then by track number */
+	int heap_size;
+	int heap_is_stale; /* set when events have been taken from single tracks */
+	int current_track_number; /* track of the last event returned, or -1 */
+};
+
+/*
+ * A snapshot shares each track's events with the live file until the track
+ * is about to change.  Only then are they copied, once, into an image which
+ * every snapshot still sharing the track refers to.  The image packs each
+ * event into a few bytes:  the tick as a delta, the type with the selection
+ * flag, then the fields of that type and any payload.  Unlike SMF, this
+ * keeps note, fine control change, RPN, and NRPN events intact.  Images
+ * never change after being copied, so snapshots can be read from other
+ * threads; the lock covers the reference counts and the copying, which the
+ * live file or a snapshot may end up doing, whichever gets there first.
+ */
+
+struct MidiFileTrackImage
+{
+	int reference_count; /* one per snapshot, plus one for the track while it still matches */
+	struct MidiFileTrack *track; /* where to copy the events from, until they have been */
+	long end_tick;
+	long number_of_events;
+	unsigned char *data;
+	long data_length;
+};
+
+struct MidiFileSnapshot
+{
+	int file_format;
+	MidiFileDivisionType_t division_type;
+	int resolution;
+	int number_of_tracks;
+	struct MidiFileTrackImage **track_images;
+};
+
+/*
+ * A journal is a log of the saves since its checkpoint, so that each save
+ * only has to write what changed.  After a four byte signature, each
+ * record is a payload framed by its length before and an FNV-1a checksum
+ * after.  The payload holds the header, the number of tracks, and an
+ * update for each track that changed:  its number, whether the events
+ * replace the track's or follow on from them, its end tick, the tick the
+ * events are relative to, and the events packed the same way as for
+ * snapshots.  Tracks which were only added to get just their new events;
+ * the others are rewritten whole.  The checkpoint is a record replacing
+ * every track, and it is only ever the first in a journal, since
+ * compacting writes a new journal and renames it over the old one.  A save
+ * cut short leaves a record which is truncated or fails its checksum, and
+ * recovery stops there.
+ */
+
+#define MIDI_FILE_JOURNAL_SIGNATURE "MFJ1"
+#define MIDI_FILE_JOURNAL_MINIMUM_COMPACTION_LENGTH 65536
+
+struct MidiFileJournal
+{
+	MidiFile_t midi_file;
+	char *filename;
+	FILE *file;
+	long length;
+	long checkpoint_length;
+	int sync_interval; /* in saves, or 0 to only sync when compacting or closing */
+	int number_of_saves_since_sync;
+	int file_format; /* as of the last save */
+	MidiFileDivisionType_t division_type;
+	int resolution;
+	int number_of_tracks;
+	unsigned char *record; /* the one being built */
+	long maximum_record_length;
+};
+
+/*
+ * Bulk imports sort and split up the records by these, rather than by the
+ * records themselves or the events made from them, so that neither has to
+ * be read more than once, and then in the order it is laid out in memory.
+ */
+
+struct MidiFileRecordKey
+{
+	long tick;
+	long record_number;
+};
+
+struct MidiFileImportTrack
+{
+	struct MidiFileTrack *track;
+	struct MidiFileEvent *previous_event; /* where to start looking for the place of the next one */
+	long number_of_records;
+	long first_tick; /* of its records in tick order */
+	long last_tick; /* of its records in the order given */
+	long next_key_number;
+	long end_key_number;
+};
+
+static MidiFileMutex_t track_image_mutex = MIDI_FILE_MUTEX_INITIALIZER;
+static MidiFileMutex_t directory_mutex = MIDI_FILE_MUTEX_INITIALIZER;
+
+static unsigned char **directory_pages[MIDI_FILE_DIRECTORY_NUMBER_OF_PAGES];
+static MidiFileReference_t next_unused_block_number = 1; /* zero is never used, so that a zero reference can mean NULL */
+static MidiFileReference_t *free_block_numbers = NULL;
+static long number_of_free_block_numbers = 0;
+static long maximum_number_of_free_block_numbers = 0;
+
+static void lock_mutex(MidiFileMutex_t *mutex)
+{
+#if defined(MIDI_FILE_THREADS)
+	pthread_mutex_lock(mutex);
+#elif defined(MIDI_FILE_WIN32_LOCKS)
+	AcquireSRWLockExclusive(mutex);
+#else
+	(void)(mutex);
+#endif
+}
+
+static void unlock_mutex(MidiFileMutex_t *mutex)
+{
+#if defined(MIDI_FILE_THREADS)
+	pthread_mutex_unlock(mutex);
+#elif defined(MIDI_FILE_WIN32_LOCKS)
+	ReleaseSRWLockExclusive(mutex);
+#else
+	(void)(mutex);
+#endif
+}
+
+static void init_mutex(MidiFileMutex_t *mutex)
+{
+#if defined(MIDI_FILE_THREADS)
+	pthread_mutex_init(mutex, NULL);
+#elif defined(MIDI_FILE_WIN32_LOCKS)
+	InitializeSRWLock(mutex);
+#else
+	*mutex = 0;
+#endif
+}
+
+static void destroy_mutex(MidiFileMutex_t *mutex)
+{
+#if defined(MIDI_FILE_THREADS)
+	pthread_mutex_destroy(mutex);
+#else
+	(void)(mutex);
+#endif
+}
+
 /*
  * Helpers
  */
@@ -232,6 +792,7 @@ static MidiFileIO_t MidiFileIO_newFromFile(FILE *file)
 {
 	MidiFileIO_t io = (MidiFileIO_t)(malloc(sizeof(struct MidiFileIO)));
 	io->type = MIDI_FILE_IO_TYPE_FILE;
+	io->failed = 0;
 	io->u.file.file = file;
 	return io;
 }
@@ -240,13 +801,68 @@ static MidiFileIO_t MidiFileIO_newFromBuffer(unsigned char *buffer)
 {
 	MidiFileIO_t io = (MidiFileIO_t)(malloc(sizeof(struct MidiFileIO)));
 	io->type = MIDI_FILE_IO_TYPE_BUFFER;
+	io->failed = 0;
 	io->u.buffer.offset = 0;
+	io->u.buffer.length = -1;
 	io->u.buffer.buffer = buffer;
 	return io;
 }
 
+static MidiFileIO_t MidiFileIO_newFromBufferWithLength(unsigned char *buffer, long length)
+{
+	MidiFileIO_t io = MidiFileIO_newFromBuffer(buffer);
+	io->u.buffer.length = length;
+	return io;
+}
+
+static MidiFileIO_t MidiFileIO_newGrowableBuffer(long initial_length)
+{
+	MidiFileIO_t io = (MidiFileIO_t)(malloc(sizeof(struct MidiFileIO)));
+	io->type = MIDI_FILE_IO_TYPE_GROWABLE_BUFFER;
+	io->failed = 0;
+	io->u.growable_buffer.offset = 0;
+	io->u.growable_buffer.maximum_length = (initial_length > 0) ? initial_length : 1024;
+	io->u.growable_buffer.buffer = (unsigned char *)(malloc(io->u.growable_buffer.maximum_length));
+	if (io->u.growable_buffer.buffer == NULL) io->failed = 1;
+	return io;
+}
+
+static int MidiFileIO_reserve(MidiFileIO_t io, long length)
+{
+	/* make room in a growable buffer for length more bytes */
+
+	long maximum_length = io->u.growable_buffer.maximum_length;
+	unsigned char *new_buffer;
+
+	if (io->failed) return -1;
+	if (io->u.growable_buffer.offset + length <= maximum_length) return 0;
+	while (io->u.growable_buffer.offset + length > maximum_length) maximum_length *= 2;
+
+	if ((new_buffer = (unsigned char *)(realloc(io->u.growable_buffer.buffer, maximum_length))) == NULL)
+	{
+		io->failed = 1;
+		return -1;
+	}
+
+	io->u.growable_buffer.buffer = new_buffer;
+	io->u.growable_buffer.maximum_length = maximum_length;
+	return 0;
+}
+
+static unsigned char *MidiFileIO_detachGrowableBuffer(MidiFileIO_t io)
+{
+	/* hand ownership of the written data to the caller */
+
+	unsigned char *buffer = io->u.growable_buffer.buffer;
+	io->u.growable_buffer.buffer = NULL;
+	io->u.growable_buffer.offset = 0;
+	io->u.growable_buffer.maximum_length = 0;
+	return buffer;
+}
+
 static void MidiFileIO_free(MidiFileIO_t io)
 {
+	if (io->type == MIDI_FILE_IO_TYPE_GROWABLE_BUFFER) free(io->u.growable_buffer.buffer);
 	free(io);
 }
 
@@ -260,7 +876,10 @@ static int MidiFileIO_getc(MidiFileIO_t io)
 		}
 		case MIDI_FILE_IO_TYPE_BUFFER:
 		{
-			long offset = io->u.buffer.offset++;
+			long offset;
+
+			if ((io->u.buffer.length >= 0) && (io->u.buffer.offset >= io->u.buffer.length)) return EOF;
+			offset = io->u.buffer.offset++;
 
 			if (io->u.buffer.buffer == NULL)
 			{
@@ -284,7 +903,8 @@ static int MidiFileIO_putc(MidiFileIO_t io, int c)
 	{
 		case MIDI_FILE_IO_TYPE_FILE:
 		{
-			return fputc(c, io->u.file.file);
+			if (fputc(c, io->u.file.file) == EOF) io->failed = 1;
+			return 0;
 		}
 		case MIDI_FILE_IO_TYPE_BUFFER:
 		{
@@ -292,6 +912,12 @@ static int MidiFileIO_putc(MidiFileIO_t io, int c)
 			if (io->u.buffer.buffer != NULL) io->u.buffer.buffer[offset] = (unsigned char)(c);
 			return 0;
 		}
+		case MIDI_FILE_IO_TYPE_GROWABLE_BUFFER:
+		{
+			if (MidiFileIO_reserve(io, 1) < 0) return -1;
+			io->u.growable_buffer.buffer[io->u.growable_buffer.offset++] = (unsigned char)(c);
+			return 0;
+		}
 		default:
 		{
 			return -1;
@@ -309,17 +935,26 @@ static size_t MidiFileIO_read(MidiFileIO_t io, size_t length, unsigned char *buf
 		}
 		case MIDI_FILE_IO_TYPE_BUFFER:
 		{
+			size_t available_length = length;
+
+			if ((io->u.buffer.length >= 0) && ((long)(length) > io->u.buffer.length - io->u.buffer.offset))
+			{
+				/* short read; zero the rest so that callers never see stale data */
+				available_length = io->u.buffer.length - io->u.buffer.offset;
+				memset(buffer + available_length, 0, length - available_length);
+			}
+
 			if (io->u.buffer.buffer == NULL)
 			{
-				memset(buffer, 0, length);
+				memset(buffer, 0, available_length);
 			}
 			else
 			{
-				memcpy(buffer, io->u.buffer.buffer + io->u.buffer.offset, length);
+				memcpy(buffer, io->u.buffer.buffer + io->u.buffer.offset, available_length);
 			}
 
-			io->u.buffer.offset += length;
-			return length;
+			io->u.buffer.offset += available_length;
+			return available_length;
 		}
 		default:
 		{
@@ -334,7 +969,9 @@ static size_t MidiFileIO_write(MidiFileIO_t io, size_t length, unsigned char *bu
 	{
 		case MIDI_FILE_IO_TYPE_FILE:
 		{
-			return fwrite(buffer, 1, length, io->u.file.file);
+			size_t length_written = fwrite(buffer, 1, length, io->u.file.file);
+			if (length_written < length) io->failed = 1;
+			return length_written;
 		}
 		case MIDI_FILE_IO_TYPE_BUFFER:
 		{
@@ -342,6 +979,13 @@ static size_t MidiFileIO_write(MidiFileIO_t io, size_t length, unsigned char *bu
 			io->u.buffer.offset += length;
 			return length;
 		}
+		case MIDI_FILE_IO_TYPE_GROWABLE_BUFFER:
+		{
+			if (MidiFileIO_reserve(io, (long)(length)) < 0) return 0;
+			memcpy(io->u.growable_buffer.buffer + io->u.growable_buffer.offset, buffer, length);
+			io->u.growable_buffer.offset += length;
+			return length;
+		}
 		default:
 		{
 			return 0;
@@ -361,6 +1005,10 @@ static long MidiFileIO_tell(MidiFileIO_t io)
 		{
 			return io->u.buffer.offset;
 		}
+		case MIDI_FILE_IO_TYPE_GROWABLE_BUFFER:
+		{
+			return io->u.growable_buffer.offset;
+		}
 		default:
 		{
 			return -1;
@@ -383,18 +1031,22 @@ static int MidiFileIO_seek(MidiFileIO_t io, long offset, int whence)
 				case SEEK_SET:
 				{
 					io->u.buffer.offset = offset;
-					return 0;
+					break;
 				}
 				case SEEK_CUR:
 				{
 					io->u.buffer.offset += offset;
-					return 0;
+					break;
 				}
 				default:
 				{
 					return -1;
 				}
 			}
+
+			if (io->u.buffer.offset < 0) io->u.buffer.offset = 0;
+			if ((io->u.buffer.length >= 0) && (io->u.buffer.offset > io->u.buffer.length)) io->u.buffer.offset = io->u.buffer.length;
+			return 0;
 		}
 		default:
 		{
@@ -403,6 +1055,31 @@ static int MidiFileIO_seek(MidiFileIO_t io, long offset, int whence)
 	}
 }
 
+static long MidiFileIO_getRemainingLength(MidiFileIO_t io)
+{
+	if ((io->type == MIDI_FILE_IO_TYPE_BUFFER) && (io->u.buffer.length >= 0)) return io->u.buffer.length - io->u.buffer.offset;
+	return LONG_MAX;
+}
+
+static int MidiFileIO_isAtEnd(MidiFileIO_t io)
+{
+	switch (io->type)
+	{
+		case MIDI_FILE_IO_TYPE_FILE:
+		{
+			return feof(io->u.file.file);
+		}
+		case MIDI_FILE_IO_TYPE_BUFFER:
+		{
+			return (MidiFileIO_getRemainingLength(io) <= 0);
+		}
+		default:
+		{
+			return 1;
+		}
+	}
+}
+
 static unsigned short interpret_uint16(unsigned char *buffer)
 {
 	return ((unsigned short)(buffer[0]) << 8) | (unsigned short)(buffer[1]);
@@ -435,13 +1112,18 @@ static unsigned long read_uint32(MidiFileIO_t io)
 	return interpret_uint32(buffer);
 }
 
-static void write_uint32(MidiFileIO_t io, unsigned long value)
+static void encode_uint32(unsigned char *buffer, unsigned long value)
 {
-	unsigned char buffer[4];
 	buffer[0] = (unsigned char)(value >> 24);
 	buffer[1] = (unsigned char)((value >> 16) & 0xFF);
 	buffer[2] = (unsigned char)((value >> 8) & 0xFF);
 	buffer[3] = (unsigned char)(value & 0xFF);
+}
+
+static void write_uint32(MidiFileIO_t io, unsigned long value)
+{
+	unsigned char buffer[4];
+	encode_uint32(buffer, value);
 	MidiFileIO_write(io, 4, buffer);
 }
 
@@ -452,7 +1134,9 @@ static unsigned long read_variable_length_quantity(MidiFileIO_t io)
 
 	do
 	{
-		b = MidiFileIO_getc(io);
+		int c = MidiFileIO_getc(io);
+		if (c == EOF) break;
+		b = (unsigned char)(c);
 		value = (value << 7) | (b & 0x7F);
 	}
 	while ((b & 0x80) == 0x80);
@@ -460,1180 +1144,4907 @@ static unsigned long read_variable_length_quantity(MidiFileIO_t io)
 	return value;
 }
 
-static void write_variable_length_quantity(MidiFileIO_t io, unsigned long value)
+static int get_minimum_message_length(unsigned char status)
 {
-	unsigned char buffer[4];
-	int offset = 3;
+	/* not counting the status byte itself */
 
-	while (1)
+	switch (status & 0xF0)
 	{
-		buffer[offset] = (unsigned char)(value & 0x7F);
-		if (offset < 3) buffer[offset] |= 0x80;
-		value >>= 7;
-		if ((value == 0) || (offset == 0)) break;
-		offset--;
-	}
-
-	MidiFileIO_write(io, 4 - offset, buffer + offset);
-}
+		case 0xC0:
+		case 0xD0:
+		{
+			return 1;
+		}
+		case 0xF0:
+		{
+			return (status == 0xFF) ? 2 : 1;
+		}
+		default:
+		{
+			return 2;
+		}
+	}
+}
 
-static void add_event_before(MidiFileEvent_t new_event, MidiFileEvent_t next_event)
+static int get_variable_length_quantity_size(unsigned long value)
 {
-	/* Add in proper sorted order.  Search forwards to optimize for inserting. */
+	/* like the encoder below, anything beyond 28 bits is truncated */
 
-	MidiFileEvent_t event;
+	int size = 1;
+	while (((value >>= 7) != 0) && (size < 4)) size++;
+	return size;
+}
 
-	for (event = new_event->track->first_event; (event != NULL) && (event->tick < new_event->tick); event = event->next_event_in_track) {}
+static int encode_variable_length_quantity(unsigned char *buffer, unsigned long value)
+{
+	int size = get_variable_length_quantity_size(value);
+	int offset;
 
-	if ((event != NULL) && (next_event != NULL) && (event->track == next_event->track) && (event->tick == next_event->tick))
+	for (offset = size - 1; offset >= 0; offset--)
 	{
-		while (event != next_event) event = event->next_event_in_track;
+		buffer[offset] = (unsigned char)(value & 0x7F);
+		if (offset < size - 1) buffer[offset] |= 0x80;
+		value >>= 7;
 	}
 
-	new_event->next_event_in_track = event;
+	return size;
+}
 
-	if (event == NULL)
-	{
-		new_event->previous_event_in_track = new_event->track->last_event;
-		new_event->track->last_event = new_event;
-	}
-	else
-	{
-		new_event->previous_event_in_track = event->previous_event_in_track;
-		event->previous_event_in_track = new_event;
-	}
+static void write_variable_length_quantity(MidiFileIO_t io, unsigned long value)
+{
+	unsigned char buffer[4];
+	MidiFileIO_write(io, encode_variable_length_quantity(buffer, value), buffer);
+}
 
-	if (new_event->previous_event_in_track == NULL)
-	{
-		new_event->track->first_event = new_event;
-	}
-	else
-	{
-		new_event->previous_event_in_track->next_event_in_track = new_event;
-	}
+static MidiFileReference_t register_block(unsigned char *first_item)
+{
+	/* add a block to the directory, returning its number, or zero if the directory is full */
 
-	for (event = new_event->track->midi_file->first_event; (event != NULL) && (new_event->tick > event->tick); event = event->next_event_in_file) {}
+	MidiFileReference_t block_number = 0;
+	unsigned char ***page;
 
-	new_event->next_event_in_file = event;
+	lock_mutex(&directory_mutex);
 
-	if (event == NULL)
+	if (number_of_free_block_numbers > 0)
 	{
-		new_event->previous_event_in_file = new_event->track->midi_file->last_event;
-		new_event->track->midi_file->last_event = new_event;
+		block_number = free_block_numbers[--number_of_free_block_numbers];
 	}
-	else
+	else if ((next_unused_block_number >> MIDI_FILE_DIRECTORY_PAGE_BITS) < MIDI_FILE_DIRECTORY_NUMBER_OF_PAGES)
 	{
-		new_event->previous_event_in_file = event->previous_event_in_file;
-		event->previous_event_in_file = new_event;
+		page = &(directory_pages[next_unused_block_number >> MIDI_FILE_DIRECTORY_PAGE_BITS]);
+		if (*page == NULL) *page = (unsigned char **)(calloc(1L << MIDI_FILE_DIRECTORY_PAGE_BITS, sizeof (unsigned char *)));
+		if (*page != NULL) block_number = next_unused_block_number++;
 	}
 
-	if (new_event->previous_event_in_file == NULL)
-	{
-		new_event->track->midi_file->first_event = new_event;
-	}
-	else
+	if (block_number != 0) directory_pages[block_number >> MIDI_FILE_DIRECTORY_PAGE_BITS][block_number & ((1L << MIDI_FILE_DIRECTORY_PAGE_BITS) - 1)] = first_item;
+
+	unlock_mutex(&directory_mutex);
+
+	return block_number;
+}
+
+static void unregister_block(MidiFileReference_t block_number)
+{
+	lock_mutex(&directory_mutex);
+
+	if (number_of_free_block_numbers == maximum_number_of_free_block_numbers)
 	{
-		new_event->previous_event_in_file->next_event_in_file = new_event;
+		long new_maximum_number_of_free_block_numbers = (maximum_number_of_free_block_numbers + 1) * 2;
+		MidiFileReference_t *new_free_block_numbers = (MidiFileReference_t *)(realloc(free_block_numbers, new_maximum_number_of_free_block_numbers * sizeof (MidiFileReference_t)));
+
+		if (new_free_block_numbers != NULL)
+		{
+			free_block_numbers = new_free_block_numbers;
+			maximum_number_of_free_block_numbers = new_maximum_number_of_free_block_numbers;
+		}
 	}
 
-	if (new_event->tick > new_event->track->end_tick) new_event->track->end_tick = new_event->tick;
+	/* if there's no room to remember it, the number is merely never reused */
+	directory_pages[block_number >> MIDI_FILE_DIRECTORY_PAGE_BITS][block_number & ((1L << MIDI_FILE_DIRECTORY_PAGE_BITS) - 1)] = NULL;
+	if (number_of_free_block_numbers < maximum_number_of_free_block_numbers) free_block_numbers[number_of_free_block_numbers++] = block_number;
+
+	unlock_mutex(&directory_mutex);
 }
 
-static void add_event_after(MidiFileEvent_t new_event, MidiFileEvent_t previous_event)
+static unsigned char *get_directory_item(MidiFileReference_t reference, size_t item_size)
 {
-	/* Add in proper sorted order.  Search backwards to optimize for appending. */
+	MidiFileReference_t block_number = reference >> MIDI_FILE_REFERENCE_ITEM_BITS;
+	return directory_pages[block_number >> MIDI_FILE_DIRECTORY_PAGE_BITS][block_number & ((1L << MIDI_FILE_DIRECTORY_PAGE_BITS) - 1)] + ((reference & ((1L << MIDI_FILE_REFERENCE_ITEM_BITS) - 1)) * item_size);
+}
 
-	MidiFileEvent_t event;
+static MidiFileEvent_t get_event(MidiFileReference_t reference)
+{
+	if (reference == 0) return NULL;
+	return (MidiFileEvent_t)(get_directory_item(reference, sizeof (struct MidiFileEvent)));
+}
 
-	for (event = new_event->track->last_event; (event != NULL) && (event->tick > new_event->tick); event = event->previous_event_in_track) {}
+static MidiFileTrack_t get_track(MidiFileReference_t reference)
+{
+	if (reference == 0) return NULL;
+	return (MidiFileTrack_t)(get_directory_item(reference, sizeof (struct MidiFileTrack)));
+}
 
-	if ((event != NULL) && (previous_event != NULL) && (event->track == previous_event->track) && (event->tick == previous_event->tick))
-	{
-		while (event != previous_event) event = event->previous_event_in_track;
-	}
+static int register_track(MidiFileTrack_t track)
+{
+	/* tracks take a block number each, so their references are always to the first item */
+	if (track == NULL) return -1;
+	track->reference = register_block((unsigned char *)(track)) << MIDI_FILE_REFERENCE_ITEM_BITS;
+	return (track->reference == 0) ? -1 : 0;
+}
 
-	new_event->previous_event_in_track = event;
+static MidiFileReference_t get_track_reference(MidiFileTrack_t track)
+{
+	if (track == NULL) return 0;
+	return track->reference;
+}
 
-	if (event == NULL)
-	{
-		new_event->next_event_in_track = new_event->track->first_event;
-		new_event->track->first_event = new_event;
-	}
-	else
-	{
-		new_event->next_event_in_track = event->next_event_in_track;
-		event->next_event_in_track = new_event;
-	}
+#ifndef MIDI_FILE_NO_POOL
+
+static struct MidiFilePoolBlock *get_event_block(MidiFileEvent_t event)
+{
+	return (struct MidiFilePoolBlock *)((size_t)(event) & ~((size_t)(MIDI_FILE_EVENT_BLOCK_SIZE) - 1));
+}
+
+static MidiFileReference_t get_event_reference(MidiFileEvent_t event)
+{
+	struct MidiFilePoolBlock *block;
+
+	if (event == NULL) return 0;
+	block = get_event_block(event);
+	return (block->number << MIDI_FILE_REFERENCE_ITEM_BITS) | (MidiFileReference_t)(((unsigned char *)(event) - (unsigned char *)(block + 1)) / sizeof (struct MidiFileEvent));
+}
+
+static MidiFile_t get_event_storage(MidiFileEvent_t event)
+{
+	/* the file which owns the event's storage, even while it's detached */
+	return get_event_block(event)->midi_file;
+}
+
+static void *allocate_event_block(void)
+{
+#ifdef _WIN32
+	return _aligned_malloc(MIDI_FILE_EVENT_BLOCK_SIZE, MIDI_FILE_EVENT_BLOCK_SIZE);
+#else
+	void *block;
+	if (posix_memalign(&block, MIDI_FILE_EVENT_BLOCK_SIZE, MIDI_FILE_EVENT_BLOCK_SIZE) != 0) return NULL;
+	return block;
+#endif
+}
+
+static void free_event_block(void *block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+static void MidiFilePool_empty(MidiFilePool_t pool)
+{
+	pool->number_of_items_per_block = MIDI_FILE_POOL_MINIMUM_ITEMS_PER_BLOCK;
+	pool->first_block = NULL;
+	pool->next_unused_item = NULL;
+	pool->end_of_block = NULL;
+	pool->first_free_item = NULL;
+}
+
+static void MidiFilePool_init(MidiFilePool_t pool, size_t item_size)
+{
+	/* free items store the link to the next free item in their first bytes */
+	if (item_size < sizeof (void *)) item_size = sizeof (void *);
+	pool->item_size = item_size;
+	pool->midi_file = NULL;
+	MidiFilePool_empty(pool);
+}
+
+static void MidiFilePool_initForEvents(MidiFilePool_t pool, MidiFile_t midi_file)
+{
+	MidiFilePool_init(pool, sizeof (struct MidiFileEvent));
+	pool->midi_file = midi_file;
+}
+
+static void *MidiFilePool_allocate(MidiFilePool_t pool)
+{
+	void *item;
 
-	if (new_event->next_event_in_track == NULL)
+	if (pool->first_free_item != NULL)
 	{
-		new_event->track->last_event = new_event;
+		item = pool->first_free_item;
+		pool->first_free_item = *((void **)(item));
+		return item;
 	}
-	else
+
+	if (pool->next_unused_item == pool->end_of_block)
 	{
-		new_event->next_event_in_track->previous_event_in_track = new_event;
+		struct MidiFilePoolBlock *block;
+
+		if (pool->midi_file != NULL)
+		{
+			/* blocks of events are all the same size, aligned to it, and in the directory */
+			if ((block = (struct MidiFilePoolBlock *)(allocate_event_block())) == NULL) return NULL;
+			block->number_of_items = (MIDI_FILE_EVENT_BLOCK_SIZE - sizeof(struct MidiFilePoolBlock)) / pool->item_size;
+			block->midi_file = pool->midi_file;
+
+			if ((block->number = register_block((unsigned char *)(block + 1))) == 0)
+			{
+				free_event_block(block);
+				return NULL;
+			}
+		}
+		else
+		{
+			/* grow geometrically so that big files need only a handful of blocks */
+			if ((block = (struct MidiFilePoolBlock *)(malloc(sizeof(struct MidiFilePoolBlock) + (pool->number_of_items_per_block * pool->item_size)))) == NULL) return NULL;
+			block->number_of_items = pool->number_of_items_per_block;
+		}
+
+		block->next_block = pool->first_block;
+		pool->first_block = block;
+		pool->next_unused_item = (unsigned char *)(block + 1);
+		pool->end_of_block = pool->next_unused_item + (block->number_of_items * pool->item_size);
+		if (pool->number_of_items_per_block < MIDI_FILE_POOL_MAXIMUM_ITEMS_PER_BLOCK) pool->number_of_items_per_block *= 2;
 	}
 
-	for (event = new_event->track->midi_file->last_event; (event != NULL) && (new_event->tick < event->tick); event = event->previous_event_in_file) {}
+	item = pool->next_unused_item;
+	pool->next_unused_item += pool->item_size;
+	return item;
+}
 
-	new_event->previous_event_in_file = event;
+static void MidiFilePool_release(MidiFilePool_t pool, void *item)
+{
+	*((void **)(item)) = pool->first_free_item;
+	pool->first_free_item = item;
+}
 
-	if (event == NULL)
+static void MidiFilePool_free(MidiFilePool_t pool)
+{
+	struct MidiFilePoolBlock *block, *next_block;
+
+	for (block = pool->first_block; block != NULL; block = next_block)
 	{
-		new_event->next_event_in_file = new_event->track->midi_file->first_event;
-		new_event->track->midi_file->first_event = new_event;
+		next_block = block->next_block;
+
+		if (pool->midi_file != NULL)
+		{
+			unregister_block(block->number);
+			free_event_block(block);
+		}
+		else
+		{
+			free(block);
+		}
 	}
-	else
+
+	MidiFilePool_empty(pool);
+}
+
+static void MidiFilePool_adopt(MidiFilePool_t pool, MidiFilePool_t other_pool)
+{
+	/* take over the blocks of another pool with the same item size, leaving it empty */
+
+	struct MidiFilePoolBlock *block;
+	void **free_item;
+
+	if (other_pool->first_block == NULL) return;
+
+	for (block = other_pool->first_block; ; block = block->next_block)
 	{
-		new_event->next_event_in_file = event->next_event_in_file;
-		event->next_event_in_file = new_event;
+		if (pool->midi_file != NULL) block->midi_file = pool->midi_file;
+		if (block->next_block == NULL) break;
 	}
 
-	if (new_event->next_event_in_file == NULL)
+	block->next_block = pool->first_block;
+	pool->first_block = other_pool->first_block;
+
+	/* carry on filling whichever partly used block has more room left */
+	if (other_pool->end_of_block - other_pool->next_unused_item > pool->end_of_block - pool->next_unused_item)
 	{
-		new_event->track->midi_file->last_event = new_event;
+		pool->next_unused_item = other_pool->next_unused_item;
+		pool->end_of_block = other_pool->end_of_block;
 	}
-	else
+
+	if (other_pool->first_free_item != NULL)
 	{
-		new_event->next_event_in_file->previous_event_in_file = new_event;
+		for (free_item = (void **)(other_pool->first_free_item); *free_item != NULL; free_item = (void **)(*free_item)) {}
+		*free_item = pool->first_free_item;
+		pool->first_free_item = other_pool->first_free_item;
 	}
 
-	if (new_event->tick > new_event->track->end_tick) new_event->track->end_tick = new_event->tick;
+	if (other_pool->number_of_items_per_block > pool->number_of_items_per_block) pool->number_of_items_per_block = other_pool->number_of_items_per_block;
+	MidiFilePool_empty(other_pool);
 }
 
-static void add_event(MidiFileEvent_t new_event)
+#else
+
+static MidiFileReference_t get_event_reference(MidiFileEvent_t event)
 {
-	add_event_after(new_event, NULL);
+	if (event == NULL) return 0;
+	return event->reference;
 }
 
-static void remove_event(MidiFileEvent_t event)
+static MidiFile_t get_event_storage(MidiFileEvent_t event)
 {
-	if (event->previous_event_in_track == NULL)
-	{
-		event->track->first_event = event->next_event_in_track;
-	}
-	else
-	{
-		event->previous_event_in_track->next_event_in_track = event->next_event_in_track;
-	}
+	return event->midi_file;
+}
 
-	if (event->next_event_in_track == NULL)
-	{
-		event->track->last_event = event->previous_event_in_track;
-	}
-	else
+#endif
+
+static MidiFileEvent_t allocate_event(MidiFile_t midi_file)
+{
+	MidiFileEvent_t event;
+#ifdef MIDI_FILE_NO_POOL
+	if ((event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)))) == NULL) return NULL;
+
+	if ((event->reference = register_block((unsigned char *)(event))) == 0)
 	{
-		event->next_event_in_track->previous_event_in_track = event->previous_event_in_track;
+		free(event);
+		return NULL;
 	}
 
-	if (event->previous_event_in_file == NULL)
+	event->midi_file = midi_file;
+#else
+	event = (MidiFileEvent_t)(MidiFilePool_allocate(&(midi_file->event_pool)));
+#endif
+	if (event != NULL) event->placement_at_tick = 0;
+	return event;
+}
+
+static void free_event(MidiFileEvent_t event)
+{
+#ifdef MIDI_FILE_NO_POOL
+	unregister_block(event->reference);
+	free(event);
+#else
+	MidiFilePool_release(&(get_event_storage(event)->event_pool), event);
+#endif
+}
+
+static unsigned char *allocate_data(MidiFile_t midi_file, int data_length)
+{
+#ifdef MIDI_FILE_NO_POOL
+	(void)(midi_file);
+	return (unsigned char *)(malloc(data_length));
+#else
+	if (data_length <= MIDI_FILE_SMALL_DATA_LENGTH)
 	{
-		event->track->midi_file->first_event = event->next_event_in_file;
+		return (unsigned char *)(MidiFilePool_allocate(&(midi_file->small_data_pool)));
 	}
 	else
 	{
-		event->previous_event_in_file->next_event_in_file = event->next_event_in_file;
+		/* large payloads are chained together so that MidiFile_free() can release them without visiting every event */
+		struct MidiFileData *data = (struct MidiFileData *)(malloc(sizeof(struct MidiFileData) + data_length));
+		if (data == NULL) return NULL;
+		data->previous_data = NULL;
+		data->next_data = midi_file->first_large_data;
+		if (data->next_data != NULL) data->next_data->previous_data = data;
+		midi_file->first_large_data = data;
+		return (unsigned char *)(data + 1);
 	}
+#endif
+}
+
+static int is_in_input_buffer(MidiFile_t midi_file, unsigned char *data_buffer)
+{
+	/* such payloads belong to the buffer, which is released along with the file */
+	return ((midi_file->input_buffer != NULL) && (data_buffer >= midi_file->input_buffer) && (data_buffer < midi_file->input_buffer + midi_file->input_buffer_length));
+}
 
-	if (event->next_event_in_file == NULL)
+static void free_data(MidiFile_t midi_file, unsigned char *data_buffer, int data_length)
+{
+	if (is_in_input_buffer(midi_file, data_buffer)) return;
+#ifdef MIDI_FILE_NO_POOL
+	(void)(data_length);
+	free(data_buffer);
+#else
+	if (data_length <= MIDI_FILE_SMALL_DATA_LENGTH)
 	{
-		event->track->midi_file->last_event = event->previous_event_in_file;
+		MidiFilePool_release(&(midi_file->small_data_pool), data_buffer);
 	}
 	else
 	{
-		event->next_event_in_file->previous_event_in_file = event->previous_event_in_file;
+		struct MidiFileData *data = (struct MidiFileData *)(data_buffer) - 1;
+
+		if (data->previous_data == NULL)
+		{
+			midi_file->first_large_data = data->next_data;
+		}
+		else
+		{
+			data->previous_data->next_data = data->next_data;
+		}
+
+		if (data->next_data != NULL) data->next_data->previous_data = data->previous_data;
+		free(data);
 	}
+#endif
 }
 
-static MidiFile_t load_midi_file(MidiFileIO_t io)
+static void init_storage(MidiFile_t storage)
 {
-	MidiFile_t midi_file;
-	unsigned char chunk_id[4], division_type_and_resolution[4];
-	long chunk_size, chunk_start;
-	int file_format, number_of_tracks, number_of_tracks_read = 0;
+	/* just enough of a MidiFile for allocate_event() and allocate_data() */
+#ifndef MIDI_FILE_NO_POOL
+	MidiFilePool_initForEvents(&(storage->event_pool), storage);
+	MidiFilePool_init(&(storage->small_data_pool), MIDI_FILE_SMALL_DATA_LENGTH);
+	storage->first_large_data = NULL;
+#else
+	(void)(storage);
+#endif
+}
 
-	MidiFileIO_read(io, 4, chunk_id);
-	chunk_size = read_uint32(io);
-	chunk_start = MidiFileIO_tell(io);
+static void adopt_storage(MidiFile_t midi_file, MidiFile_t storage)
+{
+	/* hand everything allocated from the storage over to the file, so that freeing one of its events or the file itself releases it */
+#ifndef MIDI_FILE_NO_POOL
+	struct MidiFileData *data;
 
-	/* check for the RMID variation on SMF */
+	MidiFilePool_adopt(&(midi_file->event_pool), &(storage->event_pool));
+	MidiFilePool_adopt(&(midi_file->small_data_pool), &(storage->small_data_pool));
 
-	if (memcmp(chunk_id, "RIFF", 4) == 0)
+	if (storage->first_large_data != NULL)
 	{
-		MidiFileIO_read(io, 4, chunk_id); /* technically this one is a type id rather than a chunk id, but we'll reuse the buffer anyway */
+		for (data = storage->first_large_data; data->next_data != NULL; data = data->next_data) {}
+		data->next_data = midi_file->first_large_data;
+		if (midi_file->first_large_data != NULL) midi_file->first_large_data->previous_data = data;
+		midi_file->first_large_data = storage->first_large_data;
+		storage->first_large_data = NULL;
+	}
+#else
+	(void)(midi_file);
+	(void)(storage);
+#endif
+}
 
-		if (memcmp(chunk_id, "RMID", 4) != 0)
-		{
-			return NULL;
-		}
+static void free_storage(MidiFile_t midi_file)
+{
+#ifndef MIDI_FILE_NO_POOL
+	while (midi_file->first_large_data != NULL)
+	{
+		struct MidiFileData *next_data = midi_file->first_large_data->next_data;
+		free(midi_file->first_large_data);
+		midi_file->first_large_data = next_data;
+	}
 
-		MidiFileIO_read(io, 4, chunk_id);
-		chunk_size = read_uint32(io);
+	MidiFilePool_free(&(midi_file->small_data_pool));
+	MidiFilePool_free(&(midi_file->event_pool));
+#endif
+	free(midi_file->input_buffer);
+	destroy_mutex(&(midi_file->file_event_list_mutex));
+	free(midi_file);
+}
 
-		if (memcmp(chunk_id, "data", 4) != 0)
-		{
-			return NULL;
-		}
+static void note_event_moving_between_files(MidiFileEvent_t event, MidiFileTrack_t from_track, MidiFileTrack_t to_track)
+{
+	/*
+	 * An event stays in the storage of the file it was made in wherever it
+	 * goes, so that pointers to it stay good.  Count which events are away
+	 * from their storage, so that freeing a file can keep its storage for
+	 * as long as its events are still in use elsewhere, and give back the
+	 * events it holds from other files.
+	 */
 
-		MidiFileIO_read(io, 4, chunk_id);
-		chunk_size = read_uint32(io);
-		chunk_start = MidiFileIO_tell(io);
+	MidiFile_t storage = get_event_storage(event);
+	MidiFile_t from_file = (from_track == NULL) ? NULL : from_track->midi_file;
+	MidiFile_t to_file = (to_track == NULL) ? NULL : to_track->midi_file;
+
+	if (from_file != storage)
+	{
+		(storage->number_of_lent_events)--;
+		if (from_file != NULL) (from_file->number_of_borrowed_events)--;
 	}
 
-	if (memcmp(chunk_id, "MThd", 4) != 0)
+	if (to_file != storage)
 	{
-		return NULL;
+		(storage->number_of_lent_events)++;
+		if (to_file != NULL) (to_file->number_of_borrowed_events)++;
 	}
+}
 
-	file_format = read_uint16(io);
-	number_of_tracks = read_uint16(io);
-	MidiFileIO_read(io, 2, division_type_and_resolution);
+static void free_event_and_data(MidiFileEvent_t event)
+{
+	/* the event has already been unlinked, or its track is going away with it */
 
-	switch ((signed char)(division_type_and_resolution[0]))
+	MidiFile_t storage = get_event_storage(event);
+
+	switch (event->type)
 	{
-		case -24:
-		{
-			midi_file = MidiFile_new(file_format, MIDI_FILE_DIVISION_TYPE_SMPTE24, division_type_and_resolution[1]);
-			break;
-		}
-		case -25:
-		{
-			midi_file = MidiFile_new(file_format, MIDI_FILE_DIVISION_TYPE_SMPTE25, division_type_and_resolution[1]);
-			break;
-		}
-		case -29:
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
 		{
-			midi_file = MidiFile_new(file_format, MIDI_FILE_DIVISION_TYPE_SMPTE30DROP, division_type_and_resolution[1]);
+			free_data(storage, event->u.sysex.data_buffer, event->u.sysex.data_length);
 			break;
 		}
-		case -30:
+		case MIDI_FILE_EVENT_TYPE_META:
 		{
-			midi_file = MidiFile_new(file_format, MIDI_FILE_DIVISION_TYPE_SMPTE30, division_type_and_resolution[1]);
+			free_data(storage, event->u.meta.data_buffer, event->u.meta.data_length + 1);
 			break;
 		}
 		default:
 		{
-			midi_file = MidiFile_new(file_format, MIDI_FILE_DIVISION_TYPE_PPQ, interpret_uint16(division_type_and_resolution));
 			break;
 		}
 	}
 
-	/* forwards compatibility:  skip over any extra header data */
-	MidiFileIO_seek(io, chunk_start + chunk_size, SEEK_SET);
-
-	while (number_of_tracks_read < number_of_tracks)
+	if (event->track == 0)
 	{
-		MidiFileIO_read(io, 4, chunk_id);
-		chunk_size = read_uint32(io);
-		chunk_start = MidiFileIO_tell(io);
+		(storage->number_of_lent_events)--;
+	}
+	else if (get_track(event->track)->midi_file != storage)
+	{
+		(storage->number_of_lent_events)--;
+		(get_track(event->track)->midi_file->number_of_borrowed_events)--;
+	}
 
-		if (memcmp(chunk_id, "MTrk", 4) == 0)
-		{
-			MidiFileTrack_t track = MidiFile_createTrack(midi_file);
-			long tick, previous_tick = 0;
-			unsigned char status, running_status = 0;
-			int at_end_of_track = 0;
+	free_event(event);
+	if (storage->is_freed && (storage->number_of_lent_events == 0)) free_storage(storage);
+}
 
-			while ((MidiFileIO_tell(io) < chunk_start + chunk_size) && !at_end_of_track)
-			{
-				tick = read_variable_length_quantity(io) + previous_tick;
-				previous_tick = tick;
+static MidiFileTickIndex_t MidiFileTickIndex_new(void)
+{
+	MidiFileTickIndex_t tick_index = (MidiFileTickIndex_t)(malloc(sizeof(struct MidiFileTickIndex)));
+	tick_index->number_of_levels = 1;
+	tick_index->random_state = 1;
+	memset(tick_index->first_nodes, 0, sizeof (tick_index->first_nodes));
+	return tick_index;
+}
 
-				status = MidiFileIO_getc(io);
+static void MidiFileTickIndex_free(MidiFileTickIndex_t tick_index)
+{
+	MidiFileTickIndexNode_t node, next_node;
 
-				if ((status & 0x80) == 0x00)
-				{
-					status = running_status;
-					MidiFileIO_seek(io, -1, SEEK_CUR);
-				}
-				else
-				{
-					running_status = status;
-				}
+	if (tick_index == NULL) return;
 
-				switch (status & 0xF0)
-				{
-					case 0x80:
-					{
-						int channel = status & 0x0F;
-						int note = MidiFileIO_getc(io);
-						int velocity = MidiFileIO_getc(io);
-						MidiFileTrack_createNoteOffEvent(track, tick, channel, note, velocity);
-						break;
-					}
-					case 0x90:
-					{
-						int channel = status & 0x0F;
-						int note = MidiFileIO_getc(io);
-						int velocity = MidiFileIO_getc(io);
-						MidiFileTrack_createNoteOnEvent(track, tick, channel, note, velocity);
-						break;
-					}
-					case 0xA0:
-					{
-						int channel = status & 0x0F;
-						int note = MidiFileIO_getc(io);
-						int amount = MidiFileIO_getc(io);
-						MidiFileTrack_createKeyPressureEvent(track, tick, channel, note, amount);
-						break;
-					}
-					case 0xB0:
-					{
-						int channel = status & 0x0F;
-						int number = MidiFileIO_getc(io);
-						int value = MidiFileIO_getc(io);
-						MidiFileTrack_createControlChangeEvent(track, tick, channel, number, value);
-						break;
-					}
-					case 0xC0:
-					{
-						int channel = status & 0x0F;
-						int number = MidiFileIO_getc(io);
-						MidiFileTrack_createProgramChangeEvent(track, tick, channel, number);
-						break;
-					}
-					case 0xD0:
-					{
-						int channel = status & 0x0F;
-						int amount = MidiFileIO_getc(io);
-						MidiFileTrack_createChannelPressureEvent(track, tick, channel, amount);
-						break;
-					}
-					case 0xE0:
-					{
-						int channel = status & 0x0F;
-						int value = MidiFileIO_getc(io);
-						value = (MidiFileIO_getc(io) << 7) | value;
-						MidiFileTrack_createPitchWheelEvent(track, tick, channel, value);
-						break;
-					}
-					case 0xF0:
-					{
-						switch (status)
-						{
-							case 0xF0:
-							case 0xF7:
-							{
-								int data_length = read_variable_length_quantity(io) + 1;
-								unsigned char *data_buffer = malloc(data_length);
-								data_buffer[0] = status;
-								MidiFileIO_read(io, data_length - 1, data_buffer + 1);
-								MidiFileTrack_createSysexEvent(track, tick, data_length, data_buffer);
-								free(data_buffer);
-								break;
-							}
-							case 0xFF:
-							{
-								int number = MidiFileIO_getc(io);
-								int data_length = read_variable_length_quantity(io);
-								unsigned char *data_buffer = malloc(data_length);
-								MidiFileIO_read(io, data_length, data_buffer);
-
-								if (number == 0x2F)
-								{
-									MidiFileTrack_setEndTick(track, tick);
-									at_end_of_track = 1;
-								}
-								else
-								{
-									MidiFileTrack_createMetaEvent(track, tick, number, data_length, data_buffer);
-								}
-
-								free(data_buffer);
-								break;
-							}
-						}
+	for (node = tick_index->first_nodes[0]; node != NULL; node = next_node)
+	{
+		next_node = node->next_nodes[0];
+		free(node);
+	}
 
-						break;
-					}
-				}
-			}
+	free(tick_index);
+}
 
-			number_of_tracks_read++;
-		}
+static MidiFileTickIndexNode_t MidiFileTickIndex_getNodeAtOrAfter(MidiFileTickIndex_t tick_index, long tick, MidiFileTickIndexNode_t **links)
+{
+	/* optionally fills in the link on each level which would have to change to insert or remove a node for this tick */
 
-		/* forwards compatibility:  skip over any unrecognized chunks, or extra data at the end of tracks */
-		MidiFileIO_seek(io, chunk_start + chunk_size, SEEK_SET);
+	MidiFileTickIndexNode_t *level_links = tick_index->first_nodes;
+	int level;
+
+	for (level = tick_index->number_of_levels - 1; level >= 0; level--)
+	{
+		while ((level_links[level] != NULL) && (level_links[level]->tick < tick)) level_links = level_links[level]->next_nodes;
+		if (links != NULL) links[level] = &(level_links[level]);
 	}
 
-	return midi_file;
+	return level_links[0];
 }
 
-static void save_midi_file(MidiFile_t midi_file, MidiFileIO_t io)
+static MidiFileTickIndexNode_t MidiFileTickIndex_getNodeAtOrBefore(MidiFileTickIndex_t tick_index, long tick)
 {
-	MidiFileTrack_t track;
+	MidiFileTickIndexNode_t *level_links = tick_index->first_nodes;
+	MidiFileTickIndexNode_t node = NULL;
+	int level;
 
-	MidiFileIO_write(io, 4, (unsigned char *)("MThd"));
-	write_uint32(io, 6);
-	write_uint16(io, (unsigned short)(MidiFile_getFileFormat(midi_file)));
-	write_uint16(io, (unsigned short)(MidiFile_getNumberOfTracks(midi_file)));
-
-	switch (MidiFile_getDivisionType(midi_file))
+	for (level = tick_index->number_of_levels - 1; level >= 0; level--)
 	{
-		case MIDI_FILE_DIVISION_TYPE_PPQ:
-		{
-			write_uint16(io, (unsigned short)(MidiFile_getResolution(midi_file)));
-			break;
-		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
-		{
-			MidiFileIO_putc(io, -24);
-			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
-			break;
-		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
-		{
-			MidiFileIO_putc(io, -25);
-			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
-			break;
-		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
-		{
-			MidiFileIO_putc(io, -29);
-			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
-			break;
-		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
-		{
-			MidiFileIO_putc(io, -30);
-			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
-			break;
-		}
-		default:
+		while ((level_links[level] != NULL) && (level_links[level]->tick <= tick))
 		{
-			break;
+			node = level_links[level];
+			level_links = node->next_nodes;
 		}
 	}
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
-	{
-		MidiFileEvent_t event;
-		long track_size_offset, track_start_offset, track_end_offset, tick, previous_tick;
+	return node;
+}
 
-		MidiFileIO_write(io, 4, (unsigned char *)("MTrk"));
+static MidiFileTickIndexNode_t MidiFileTickIndex_newNode(MidiFileTickIndex_t tick_index, MidiFileEvent_t event, int *number_of_levels_out)
+{
+	MidiFileTickIndexNode_t node;
+	int number_of_levels;
 
-		track_size_offset = MidiFileIO_tell(io);
-		write_uint32(io, 0);
+	/* each level holds about a quarter of the nodes of the one below */
+	for (number_of_levels = 1; number_of_levels < MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL; number_of_levels++)
+	{
+		tick_index->random_state = (tick_index->random_state * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+		if (((tick_index->random_state >> 16) & 3) != 0) break;
+	}
 
-		track_start_offset = MidiFileIO_tell(io);
+	if (number_of_levels > tick_index->number_of_levels) tick_index->number_of_levels = number_of_levels;
 
-		previous_tick = 0;
+	node = (MidiFileTickIndexNode_t)(malloc(sizeof(struct MidiFileTickIndexNode) + ((number_of_levels - 1) * sizeof(MidiFileTickIndexNode_t))));
+	node->tick = event->tick;
+	node->first_event = event;
+	node->last_event = event;
+	*number_of_levels_out = number_of_levels;
+	return node;
+}
 
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			tick = MidiFileEvent_getTick(event);
-			write_variable_length_quantity(io, tick - previous_tick);
+static void MidiFileTickIndex_addEvent(MidiFileTickIndex_t tick_index, MidiFileEvent_t event, MidiFileEvent_t previous_event, MidiFileEvent_t next_event)
+{
+	/* call after linking the event into the list which the index covers, passing its new neighbors in that list */
 
-			switch (MidiFileEvent_getType(event))
-			{
-				case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-				{
-					MidiFileIO_putc(io, 0x80 | (MidiFileNoteOffEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileNoteOffEvent_getNote(event) & 0x7F);
-					MidiFileIO_putc(io, MidiFileNoteOffEvent_getVelocity(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-				{
-					MidiFileIO_putc(io, 0x90 | (MidiFileNoteOnEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileNoteOnEvent_getNote(event) & 0x7F);
-					MidiFileIO_putc(io, MidiFileNoteOnEvent_getVelocity(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-				{
-					MidiFileIO_putc(io, 0xA0 | (MidiFileKeyPressureEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileKeyPressureEvent_getNote(event) & 0x7F);
-					MidiFileIO_putc(io, MidiFileKeyPressureEvent_getAmount(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
-				{
-					MidiFileIO_putc(io, 0xB0 | (MidiFileControlChangeEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileControlChangeEvent_getNumber(event) & 0x7F);
-					MidiFileIO_putc(io, MidiFileControlChangeEvent_getValue(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
-				{
-					MidiFileIO_putc(io, 0xC0 | (MidiFileProgramChangeEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileProgramChangeEvent_getNumber(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-				{
-					MidiFileIO_putc(io, 0xD0 | (MidiFileChannelPressureEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, MidiFileChannelPressureEvent_getAmount(event) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
-				{
-					int value = MidiFilePitchWheelEvent_getValue(event);
-					MidiFileIO_putc(io, 0xE0 | (MidiFilePitchWheelEvent_getChannel(event) & 0x0F));
-					MidiFileIO_putc(io, value & 0x7F);
-					MidiFileIO_putc(io, (value >> 7) & 0x7F);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_SYSEX:
-				{
-					int data_length = MidiFileSysexEvent_getDataLength(event);
-					unsigned char *data = MidiFileSysexEvent_getData(event);
-					MidiFileIO_putc(io, data[0]);
-					write_variable_length_quantity(io, data_length - 1);
-					MidiFileIO_write(io, data_length - 1, data + 1);
-					break;
-				}
-				case MIDI_FILE_EVENT_TYPE_META:
-				{
-					int data_length = MidiFileMetaEvent_getDataLength(event);
-					unsigned char *data = MidiFileMetaEvent_getData(event);
-					MidiFileIO_putc(io, 0xFF);
-					MidiFileIO_putc(io, MidiFileMetaEvent_getNumber(event) & 0x7F);
-					write_variable_length_quantity(io, data_length);
-					MidiFileIO_write(io, data_length, data);
-					break;
-				}
-				default:
-				{
-					break;
-				}
-			}
+	MidiFileTickIndexNode_t *links[MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL];
+	MidiFileTickIndexNode_t node;
+	int number_of_levels, level;
 
-			previous_tick = tick;
-		}
+	if (tick_index == NULL) return;
 
-		write_variable_length_quantity(io, MidiFileTrack_getEndTick(track) - previous_tick);
-		MidiFileIO_write(io, 3, (unsigned char *)("\xFF\x2F\x00"));
+	node = MidiFileTickIndex_getNodeAtOrAfter(tick_index, event->tick, links);
 
-		track_end_offset = MidiFileIO_tell(io);
+	if ((node != NULL) && (node->tick == event->tick))
+	{
+		if ((previous_event == NULL) || (previous_event->tick != event->tick)) node->first_event = event;
+		if ((next_event == NULL) || (next_event->tick != event->tick)) node->last_event = event;
+		return;
+	}
 
-		MidiFileIO_seek(io, track_size_offset, SEEK_SET);
-		write_uint32(io, track_end_offset - track_start_offset);
+	for (level = tick_index->number_of_levels; level < MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL; level++) links[level] = &(tick_index->first_nodes[level]);
+	node = MidiFileTickIndex_newNode(tick_index, event, &number_of_levels);
 
-		MidiFileIO_seek(io, track_end_offset, SEEK_SET);
+	for (level = 0; level < number_of_levels; level++)
+	{
+		node->next_nodes[level] = *(links[level]);
+		*(links[level]) = node;
 	}
 }
 
-/*
- * Public API
- */
-
-MidiFile_t MidiFile_load(char *filename)
+static MidiFileTickIndexNode_t MidiFileTickIndex_appendEvent(MidiFileTickIndex_t tick_index, MidiFileEvent_t event, MidiFileTickIndexNode_t last_node, MidiFileTickIndexNode_t **links)
 {
-	FILE *in;
-	MidiFileIO_t io;
-	MidiFile_t midi_file;
+	/*
+	 * For building an index from a list in order, without searching.  The
+	 * links (one per level, initially pointing into first_nodes) track
+	 * where the next node goes.  Returns the new last node.
+	 */
 
-	if ((filename == NULL) || ((in = fopen(filename, "rb")) == NULL)) return NULL;
+	MidiFileTickIndexNode_t node;
+	int number_of_levels, level;
 
-	io = MidiFileIO_newFromFile(in);
-	midi_file = load_midi_file(io);
-	MidiFileIO_free(io);
-	return midi_file;
+	if ((last_node != NULL) && (last_node->tick == event->tick))
+	{
+		last_node->last_event = event;
+		return last_node;
+	}
+
+	node = MidiFileTickIndex_newNode(tick_index, event, &number_of_levels);
+
+	for (level = 0; level < number_of_levels; level++)
+	{
+		node->next_nodes[level] = NULL;
+		*(links[level]) = node;
+		links[level] = &(node->next_nodes[level]);
+	}
+
+	return node;
 }
 
-int MidiFile_save(MidiFile_t midi_file, const char* filename)
+static void MidiFileTickIndex_removeEvent(MidiFileTickIndex_t tick_index, MidiFileEvent_t event, MidiFileEvent_t previous_event, MidiFileEvent_t next_event)
 {
-	FILE *out;
-	MidiFileIO_t io;
+	/* call while the event is still in the list, passing its current neighbors */
 
-	if ((midi_file == NULL) || (filename == NULL) || ((out = fopen(filename, "wb")) == NULL)) return -1;
+	MidiFileTickIndexNode_t *links[MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL];
+	MidiFileTickIndexNode_t node;
+	int level;
 
-	io = MidiFileIO_newFromFile(out);
-	save_midi_file(midi_file, io);
-	MidiFileIO_free(io);
-	return 0;
+	if (tick_index == NULL) return;
+
+	node = MidiFileTickIndex_getNodeAtOrAfter(tick_index, event->tick, links);
+	if ((node == NULL) || (node->tick != event->tick)) return;
+
+	if ((node->first_event == event) && (node->last_event == event))
+	{
+		for (level = 0; (level < tick_index->number_of_levels) && (*(links[level]) == node); level++) *(links[level]) = node->next_nodes[level];
+		while ((tick_index->number_of_levels > 1) && (tick_index->first_nodes[tick_index->number_of_levels - 1] == NULL)) (tick_index->number_of_levels)--;
+		free(node);
+	}
+	else if (node->first_event == event)
+	{
+		node->first_event = next_event;
+	}
+	else if (node->last_event == event)
+	{
+		node->last_event = previous_event;
+	}
 }
 
-MidiFile_t MidiFile_loadFromBuffer(unsigned char *buffer)
+static MidiFileTickIndex_t build_tick_index_for_track(MidiFileTrack_t track)
 {
-	MidiFileIO_t io;
-	MidiFile_t midi_file;
+	MidiFileTickIndex_t tick_index = MidiFileTickIndex_new();
+	MidiFileTickIndexNode_t *links[MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL];
+	MidiFileTickIndexNode_t last_node = NULL;
+	MidiFileEvent_t event;
+	int level;
 
-	if (buffer == NULL) return NULL;
+	for (level = 0; level < MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL; level++) links[level] = &(tick_index->first_nodes[level]);
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track)) last_node = MidiFileTickIndex_appendEvent(tick_index, event, last_node, links);
+	return tick_index;
+}
 
-	io = MidiFileIO_newFromBuffer(buffer);
-	midi_file = load_midi_file(io);
-	MidiFileIO_free(io);
-	return midi_file;
+static MidiFileTickIndex_t build_tick_index_for_file(MidiFile_t midi_file)
+{
+	MidiFileTickIndex_t tick_index = MidiFileTickIndex_new();
+	MidiFileTickIndexNode_t *links[MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL];
+	MidiFileTickIndexNode_t last_node = NULL;
+	MidiFileEvent_t event;
+	int level;
+
+	for (level = 0; level < MIDI_FILE_TICK_INDEX_MAXIMUM_LEVEL; level++) links[level] = &(tick_index->first_nodes[level]);
+	for (event = midi_file->first_event; event != NULL; event = get_event(event->next_event_in_file)) last_node = MidiFileTickIndex_appendEvent(tick_index, event, last_node, links);
+	return tick_index;
 }
 
-int MidiFile_saveToBuffer(MidiFile_t midi_file, unsigned char *buffer)
+/*
+ * Inside a batch, events which are added or change tick are simply appended
+ * to their lists, and the lists are put back in order with a stable sort by
+ * tick when the batch ends, or sooner if something needs them in order.
+ * Adding one at a time puts an event after any others with the same tick,
+ * so appending in the order of the operations and sorting stably gives
+ * exactly the same lists.  The sort merges the runs which are already in
+ * order, so the usual case of a mostly sorted list is close to linear.
+ */
+
+static int sort_events_by_tick(MidiFileEvent_t *events, long number_of_events)
 {
-	MidiFileIO_t io;
+	MidiFileEvent_t *buffer = (MidiFileEvent_t *)(malloc((number_of_events + 1) * sizeof (MidiFileEvent_t)));
+	MidiFileEvent_t *source = events, *destination = buffer, *swap;
+	long number_of_runs;
 
-	if ((midi_file == NULL) || (buffer == NULL)) return -1;
+	if (buffer == NULL) return -1;
 
-	io = MidiFileIO_newFromBuffer(buffer);
-	save_midi_file(midi_file, io);
-	MidiFileIO_free(io);
+	do
+	{
+		long start = 0;
+		number_of_runs = 0;
+
+		while (start < number_of_events)
+		{
+			long middle = start + 1, end, left, right, i;
+
+			while ((middle < number_of_events) && (source[middle - 1]->tick <= source[middle]->tick)) middle++;
+
+			for (end = middle + 1; (end < number_of_events) && (source[end - 1]->tick <= source[end]->tick); end++) {}
+			if (end > number_of_events) end = number_of_events;
+
+			/* on equal ticks, take from the left run first to keep the sort stable */
+			for (left = start, right = middle, i = start; i < end; i++) destination[i] = ((right >= end) || ((left < middle) && (source[left]->tick <= source[right]->tick))) ? source[left++] : source[right++];
+
+			number_of_runs++;
+			start = end;
+		}
+
+		swap = source;
+		source = destination;
+		destination = swap;
+	}
+	while (number_of_runs > 1);
+
+	if (source != events) memcpy(events, source, number_of_events * sizeof (MidiFileEvent_t));
+	free(buffer);
 	return 0;
 }
 
-int MidiFile_getFileSize(MidiFile_t midi_file)
+static int sort_record_keys_by_tick(struct MidiFileRecordKey *keys, long number_of_keys)
 {
-	MidiFileIO_t io;
-	int file_size;
+	/*
+	 * Programs that generate events mostly do so nearly in order, with only
+	 * the odd one (such as a note off) a few places late, so an insertion
+	 * sort has little to do.  If it turns out to have too much, what it has
+	 * done so far is finished off with the same merging as
+	 * sort_events_by_tick(), but with the ticks right there to compare.
+	 */
 
-	if (midi_file == NULL) return -1;
+	struct MidiFileRecordKey *buffer, *source = keys, *destination, *swap, key;
+	long number_of_moves = 0, number_of_runs, i, j;
 
-	io = MidiFileIO_newFromBuffer(NULL);
-	save_midi_file(midi_file, io);
-	file_size = (int)(MidiFileIO_tell(io));
-	MidiFileIO_free(io);
-	return file_size;
-}
+	for (i = 1; (i < number_of_keys) && (number_of_moves < number_of_keys * 16); i++)
+	{
+		key = keys[i];
+		for (j = i; (j > 0) && (keys[j - 1].tick > key.tick) && (number_of_moves < number_of_keys * 16); j--, number_of_moves++) keys[j] = keys[j - 1];
+		keys[j] = key;
+	}
 
-MidiFile_t MidiFile_new(int file_format, MidiFileDivisionType_t division_type, int resolution)
-{
-	MidiFile_t midi_file = (MidiFile_t)(malloc(sizeof(struct MidiFile)));
-	midi_file->file_format = file_format;
-	midi_file->division_type = division_type;
-	midi_file->resolution = resolution;
+	if (number_of_moves < number_of_keys * 16) return 0;
+	if ((buffer = (struct MidiFileRecordKey *)(malloc((number_of_keys + 1) * sizeof (struct MidiFileRecordKey)))) == NULL) return -1;
+	destination = buffer;
 
-	switch (division_type)
+	do
 	{
-		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		long start = 0;
+		number_of_runs = 0;
+
+		while (start < number_of_keys)
 		{
-			midi_file->number_of_frames_per_second = 30.0;
-			break;
+			long middle = start + 1, end, left, right;
+
+			while ((middle < number_of_keys) && (source[middle - 1].tick <= source[middle].tick)) middle++;
+
+			for (end = middle + 1; (end < number_of_keys) && (source[end - 1].tick <= source[end].tick); end++) {}
+			if (end > number_of_keys) end = number_of_keys;
+
+			for (left = start, right = middle, i = start; i < end; i++) destination[i] = ((right >= end) || ((left < middle) && (source[left].tick <= source[right].tick))) ? source[left++] : source[right++];
+
+			number_of_runs++;
+			start = end;
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+
+		swap = source;
+		source = destination;
+		destination = swap;
+	}
+	while (number_of_runs > 1);
+
+	if (source != keys) memcpy(keys, source, number_of_keys * sizeof (struct MidiFileRecordKey));
+	free(buffer);
+	return 0;
+}
+
+static void sort_track_event_list(MidiFileTrack_t track)
+{
+	MidiFileEvent_t *events, event;
+	long number_of_events = 0, i;
+
+	if (! track->batch_is_unsorted) return;
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track)) number_of_events++;
+	if ((events = (MidiFileEvent_t *)(malloc((number_of_events + 1) * sizeof (MidiFileEvent_t)))) == NULL) return;
+	for (event = track->first_event, i = 0; event != NULL; event = get_event(event->next_event_in_track)) events[i++] = event;
+
+	if (sort_events_by_tick(events, number_of_events) == 0)
+	{
+		for (i = 0; i < number_of_events; i++)
 		{
-			midi_file->number_of_frames_per_second = 24.0;
-			break;
+			events[i]->previous_event_in_track = get_event_reference((i == 0) ? NULL : events[i - 1]);
+			events[i]->next_event_in_track = get_event_reference((i == number_of_events - 1) ? NULL : events[i + 1]);
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+
+		track->first_event = (number_of_events == 0) ? NULL : events[0];
+		track->last_event = (number_of_events == 0) ? NULL : events[number_of_events - 1];
+		track->batch_is_unsorted = 0;
+	}
+
+	free(events);
+}
+
+static void sort_file_event_list(MidiFile_t midi_file)
+{
+	MidiFileEvent_t *events, event;
+	long number_of_events = 0, i;
+
+	if (! midi_file->batch_is_unsorted) return;
+	for (event = midi_file->first_event; event != NULL; event = get_event(event->next_event_in_file)) number_of_events++;
+	if ((events = (MidiFileEvent_t *)(malloc((number_of_events + 1) * sizeof (MidiFileEvent_t)))) == NULL) return;
+	for (event = midi_file->first_event, i = 0; event != NULL; event = get_event(event->next_event_in_file)) events[i++] = event;
+
+	if (sort_events_by_tick(events, number_of_events) == 0)
+	{
+		for (i = 0; i < number_of_events; i++)
 		{
-			midi_file->number_of_frames_per_second = 25.0;
-			break;
+			events[i]->previous_event_in_file = get_event_reference((i == 0) ? NULL : events[i - 1]);
+			events[i]->next_event_in_file = get_event_reference((i == number_of_events - 1) ? NULL : events[i + 1]);
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+
+		midi_file->first_event = (number_of_events == 0) ? NULL : events[0];
+		midi_file->last_event = (number_of_events == 0) ? NULL : events[number_of_events - 1];
+		midi_file->batch_is_unsorted = 0;
+	}
+
+	free(events);
+}
+
+static void sort_batch(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+
+	for (track = midi_file->first_track; track != NULL; track = track->next_track) sort_track_event_list(track);
+	sort_file_event_list(midi_file);
+}
+
+static int get_rank_at_tick(MidiFileEvent_t event)
+{
+	switch (event->placement_at_tick)
+	{
+		case MIDI_FILE_PLACEMENT_FIRST_AT_TICK:
 		{
-			midi_file->number_of_frames_per_second = 29.97;
-			break;
+			return -1;
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		case MIDI_FILE_PLACEMENT_LAST_AT_TICK:
 		{
-			midi_file->number_of_frames_per_second = 30.0;
-			break;
+			return INT_MAX;
 		}
 		default:
 		{
-			midi_file->number_of_frames_per_second = 30.0;
-			break;
+			return get_track(event->track)->number;
 		}
 	}
+}
 
-	midi_file->number_of_tracks = 0;
-	midi_file->first_track = NULL;
-	midi_file->last_track = NULL;
-	midi_file->first_event = NULL;
-	midi_file->last_event = NULL;
-	midi_file->measure_beat = MidiFileMeasureBeat_new();
-	midi_file->measure_beat_tick = MidiFileMeasureBeatTick_new();
-	midi_file->hour_minute_second = MidiFileHourMinuteSecond_new();
-	midi_file->hour_minute_second_frame = MidiFileHourMinuteSecondFrame_new();
-	midi_file->event_iterator_current = NULL;
-	midi_file->event_iterator_next = NULL;
-	return midi_file;
+static int event_precedes_in_file(MidiFileEvent_t event, MidiFileEvent_t other_event)
+{
+	return ((event->tick < other_event->tick) || ((event->tick == other_event->tick) && (get_rank_at_tick(event) < get_rank_at_tick(other_event))));
 }
 
-MidiFile_t MidiFile_newFromTemplate(MidiFile_t template_midi_file)
+static MidiFileEvent_t get_unplaced_event_at_or_after(MidiFileEvent_t event)
 {
-	if (template_midi_file == NULL) return MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
-	return MidiFile_new(MidiFile_getFileFormat(template_midi_file), MidiFile_getDivisionType(template_midi_file), MidiFile_getResolution(template_midi_file));
+	while ((event != NULL) && (event->placement_at_tick != 0)) event = get_event(event->next_event_in_track);
+	return event;
 }
 
-int MidiFile_free(MidiFile_t midi_file)
+static void push_event_for_merge(MidiFileEvent_t *heap, int *heap_size_p, MidiFileEvent_t event)
 {
-	MidiFileTrack_t track, next_track;
+	int child;
 
-	if (midi_file == NULL) return -1;
-	MidiFileHourMinuteSecondFrame_free(midi_file->hour_minute_second_frame);
-	MidiFileHourMinuteSecond_free(midi_file->hour_minute_second);
-	MidiFileMeasureBeatTick_free(midi_file->measure_beat_tick);
-	MidiFileMeasureBeat_free(midi_file->measure_beat);
-
-	for (track = midi_file->first_track; track != NULL; track = next_track)
+	for (child = (*heap_size_p)++; (child > 0) && event_precedes_in_file(event, heap[(child - 1) / 2]); )
 	{
-		next_track = track->next_track;
-		MidiFileTrack_delete(track);
+		heap[child] = heap[(child - 1) / 2];
+		child = (child - 1) / 2;
 	}
 
-	free(midi_file);
-	return 0;
+	heap[child] = event;
 }
 
-int MidiFile_getFileFormat(MidiFile_t midi_file)
+static void merge_file_event_list(MidiFile_t midi_file)
 {
-	if (midi_file == NULL) return -1;
-	return midi_file->file_format;
-}
+	/*
+	 * Rebuild the file-wide list from the per-track lists with a k-way merge.
+	 * Loaded events are taken in track order at each tick, which is the
+	 * order that adding them one at a time, track by track, would produce.
+	 * Events added since the file was made are already in the stale list,
+	 * in the order adding them would have put them in, and marked with
+	 * where they went among the others at their tick: first, if added
+	 * before the events there, or else last.  That list is sorted and
+	 * merged in as one more track, ranking ahead of the loaded events or
+	 * behind them.
+	 */
 
-int MidiFile_setFileFormat(MidiFile_t midi_file, int file_format)
-{
-	if (midi_file == NULL) return -1;
-	midi_file->file_format = file_format;
-	return 0;
-}
+	MidiFileEvent_t *heap = (MidiFileEvent_t *)(malloc((midi_file->number_of_tracks + 1) * sizeof (MidiFileEvent_t)));
+	MidiFileEvent_t previous_event = NULL, event;
+	MidiFileTrack_t track;
+	int heap_size = 0, has_placed_events;
 
-MidiFileDivisionType_t MidiFile_getDivisionType(MidiFile_t midi_file)
-{
-	if (midi_file == NULL) return MIDI_FILE_DIVISION_TYPE_INVALID;
-	return midi_file->division_type;
-}
+	for (track = midi_file->first_track; track != NULL; track = track->next_track)
+	{
+		if ((event = get_unplaced_event_at_or_after(track->first_event)) != NULL) push_event_for_merge(heap, &heap_size, event);
+	}
 
-int MidiFile_setDivisionType(MidiFile_t midi_file, MidiFileDivisionType_t division_type)
-{
-	if (midi_file == NULL) return -1;
-	midi_file->division_type = division_type;
+	if ((has_placed_events = (midi_file->first_event != NULL))) push_event_for_merge(heap, &heap_size, midi_file->first_event);
+	midi_file->first_event = NULL;
 
-	switch (division_type)
+	while (heap_size > 0)
 	{
-		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		int parent = 0;
+
+		event = heap[0];
+		event->previous_event_in_file = get_event_reference(previous_event);
+
+		if (previous_event == NULL)
 		{
-			midi_file->number_of_frames_per_second = 24.0;
-			break;
+			midi_file->first_event = event;
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		else
 		{
-			midi_file->number_of_frames_per_second = 25.0;
-			break;
+			previous_event->next_event_in_file = get_event_reference(event);
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+
+		previous_event = event;
+
+		if (event->placement_at_tick != 0)
 		{
-			midi_file->number_of_frames_per_second = 29.97;
-			break;
+			event = get_event(event->next_event_in_file);
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		else
 		{
-			midi_file->number_of_frames_per_second = 30.0;
-			break;
+			event = get_unplaced_event_at_or_after(get_event(event->next_event_in_track));
 		}
-		default:
+
+		if (event == NULL) event = heap[--heap_size];
+
+		while (2 * parent + 1 < heap_size)
 		{
-			break;
+			int child = 2 * parent + 1;
+			if ((child + 1 < heap_size) && event_precedes_in_file(heap[child + 1], heap[child])) child++;
+			if (! event_precedes_in_file(heap[child], event)) break;
+			heap[parent] = heap[child];
+			parent = child;
 		}
-	}
 
-	return 0;
-}
+		heap[parent] = event;
+	}
 
-int MidiFile_getResolution(MidiFile_t midi_file)
-{
-	if (midi_file == NULL) return -1;
-	return midi_file->resolution;
-}
+	if (previous_event != NULL) previous_event->next_event_in_file = 0;
+	midi_file->last_event = previous_event;
 
-int MidiFile_setResolution(MidiFile_t midi_file, int resolution)
-{
-	if (midi_file == NULL) return -1;
-	midi_file->resolution = resolution;
-	return 0;
-}
+	/* only now, since the tracks still have to skip them until the end */
+	if (has_placed_events)
+	{
+		for (event = midi_file->first_event; event != NULL; event = get_event(event->next_event_in_file)) event->placement_at_tick = 0;
+	}
 
-float MidiFile_getNumberOfFramesPerSecond(MidiFile_t midi_file)
-{
-	if (midi_file == NULL) return -1;
-	return midi_file->number_of_frames_per_second;
-}
+	midi_file->file_event_list_is_stale = 0;
+	midi_file->batch_is_unsorted = 0;
+	free(heap);
 
-int MidiFile_setNumberOfFramesPerSecond(MidiFile_t midi_file, float number_of_frames_per_second)
-{
-	if (midi_file == NULL) return -1;
-	midi_file->number_of_frames_per_second = number_of_frames_per_second;
-	return 0;
+	if (midi_file->tick_index != NULL)
+	{
+		MidiFileTickIndex_free(midi_file->tick_index);
+		midi_file->tick_index = build_tick_index_for_file(midi_file);
+	}
 }
 
-MidiFileTrack_t MidiFile_createTrack(MidiFile_t midi_file)
+static void prepare_file_event_list(MidiFile_t midi_file)
 {
-	MidiFileTrack_t new_track;
+	/*
+	 * Anything which walks the file-wide list calls this first.  Iterators
+	 * may be started on several threads at once over a file nobody is
+	 * changing, so whichever comes first merges or sorts the list for all
+	 * of them, under the file's own lock.
+	 */
 
-	if (midi_file == NULL) return NULL;
+	MidiFileTrack_t track;
 
-	new_track = (MidiFileTrack_t)(malloc(sizeof(struct MidiFileTrack)));
-	new_track->midi_file = midi_file;
-	new_track->number = midi_file->number_of_tracks;
-	new_track->end_tick = 0;
-	new_track->previous_track = midi_file->last_track;
-	new_track->next_track = NULL;
-	midi_file->last_track = new_track;
+	lock_mutex(&(midi_file->file_event_list_mutex));
 
-	if (new_track->previous_track == NULL)
+	if (midi_file->file_event_list_is_stale)
 	{
-		midi_file->first_track = new_track;
+		for (track = midi_file->first_track; track != NULL; track = track->next_track) sort_track_event_list(track);
+		sort_file_event_list(midi_file);
+		merge_file_event_list(midi_file);
 	}
 	else
 	{
-		new_track->previous_track->next_track = new_track;
+		sort_file_event_list(midi_file);
 	}
 
-	(midi_file->number_of_tracks)++;
+	unlock_mutex(&(midi_file->file_event_list_mutex));
+}
 
-	new_track->first_event = NULL;
-	new_track->last_event = NULL;
-	new_track->event_iterator_current = NULL;
-	new_track->event_iterator_next = NULL;
+static MidiFileEvent_t get_first_event_in_track_at_or_after_tick(MidiFileTrack_t track, long tick)
+{
+	MidiFileEvent_t event;
 
-	return new_track;
+	sort_track_event_list(track);
+
+	if (track->tick_index != NULL)
+	{
+		MidiFileTickIndexNode_t node = MidiFileTickIndex_getNodeAtOrAfter(track->tick_index, tick, NULL);
+		return (node == NULL) ? NULL : node->first_event;
+	}
+
+	for (event = track->first_event; (event != NULL) && (event->tick < tick); event = get_event(event->next_event_in_track)) {}
+	return event;
 }
 
-int MidiFile_getNumberOfTracks(MidiFile_t midi_file)
+static MidiFileEvent_t get_last_event_in_track_at_or_before_tick(MidiFileTrack_t track, long tick)
 {
-	if (midi_file == NULL) return -1;
-	return midi_file->number_of_tracks;
+	MidiFileEvent_t event;
+
+	sort_track_event_list(track);
+
+	if (track->tick_index != NULL)
+	{
+		MidiFileTickIndexNode_t node = MidiFileTickIndex_getNodeAtOrBefore(track->tick_index, tick);
+		return (node == NULL) ? NULL : node->last_event;
+	}
+
+	for (event = track->last_event; (event != NULL) && (event->tick > tick); event = get_event(event->previous_event_in_track)) {}
+	return event;
 }
 
-MidiFileTrack_t MidiFile_getTrackByNumber(MidiFile_t midi_file, int number, int create)
+static MidiFileEvent_t get_first_event_in_file_at_or_after_tick(MidiFile_t midi_file, long tick)
 {
-	int current_track_number;
-	MidiFileTrack_t track = NULL;
+	MidiFileEvent_t event;
 
-	for (current_track_number = 0; current_track_number <= number; current_track_number++)
+	prepare_file_event_list(midi_file);
+
+	if (midi_file->tick_index != NULL)
 	{
-		if (track == NULL)
-		{
-			track = MidiFile_getFirstTrack(midi_file);
-		}
-		else
-		{
-			track = MidiFileTrack_getNextTrack(track);
-		}
+		MidiFileTickIndexNode_t node = MidiFileTickIndex_getNodeAtOrAfter(midi_file->tick_index, tick, NULL);
+		return (node == NULL) ? NULL : node->first_event;
+	}
 
-		if ((track == NULL) && create)
-		{
-			track = MidiFile_createTrack(midi_file);
-		}
+	for (event = midi_file->first_event; (event != NULL) && (event->tick < tick); event = get_event(event->next_event_in_file)) {}
+	return event;
+}
+
+static MidiFileEvent_t get_last_event_in_file_at_or_before_tick(MidiFile_t midi_file, long tick)
+{
+	MidiFileEvent_t event;
+
+	prepare_file_event_list(midi_file);
+
+	if (midi_file->tick_index != NULL)
+	{
+		MidiFileTickIndexNode_t node = MidiFileTickIndex_getNodeAtOrBefore(midi_file->tick_index, tick);
+		return (node == NULL) ? NULL : node->last_event;
 	}
 
-	return track;
+	for (event = midi_file->last_event; (event != NULL) && (event->tick > tick); event = get_event(event->previous_event_in_file)) {}
+	return event;
 }
 
-MidiFileTrack_t MidiFile_getFirstTrack(MidiFile_t midi_file)
+static void invalidate_tempo_map(MidiFile_t midi_file)
 {
-	if (midi_file == NULL) return NULL;
-	return midi_file->first_track;
+	/* the meter map depends on the tempo map for SMPTE files, so it goes too */
+	midi_file->tempo_segments_are_valid = 0;
+	midi_file->meter_segments_are_valid = 0;
 }
 
-MidiFileTrack_t MidiFile_getLastTrack(MidiFile_t midi_file)
+static void invalidate_tempo_map_for_event(MidiFileEvent_t event)
 {
-	if (midi_file == NULL) return NULL;
-	return midi_file->last_track;
+	/* only meta events in the conductor track can affect the tempo map */
+	if ((event->type == MIDI_FILE_EVENT_TYPE_META) && (event->track != 0) && (get_track(event->track)->previous_track == NULL)) invalidate_tempo_map(get_track(event->track)->midi_file);
 }
 
-MidiFileEvent_t MidiFile_getFirstEvent(MidiFile_t midi_file)
+/*
+ * Note starts and ends are paired up per track the first time a pairing is
+ * asked for.  From then on, each note on or note off is threaded onto a
+ * chain of the events in its track with the same channel and note, and
+ * remembers its partner:  a start points to the first end that follows it,
+ * and an end to the closest start that precedes it (so overlapping notes of
+ * the same pitch share an end, just as a scan would find).  The chains keep
+ * the pairing up to date as events come and go without rescanning.
+ */
+
+static int is_note_event(MidiFileEvent_t event)
 {
-	if (midi_file == NULL) return NULL;
-	return midi_file->first_event;
+	return ((event->type == MIDI_FILE_EVENT_TYPE_NOTE_ON) || (event->type == MIDI_FILE_EVENT_TYPE_NOTE_OFF));
 }
 
-MidiFileEvent_t MidiFile_getLastEvent(MidiFile_t midi_file)
+static int is_note_start_event(MidiFileEvent_t event)
 {
-	if (midi_file == NULL) return NULL;
-	return midi_file->last_event;
+	return ((event->type == MIDI_FILE_EVENT_TYPE_NOTE_ON) && (event->u.note_on.velocity > 0));
 }
 
-MidiFileEvent_t MidiFile_iterateEvents(MidiFile_t midi_file)
+static int have_same_note(MidiFileEvent_t event, MidiFileEvent_t other_event)
 {
-	if (midi_file == NULL) return NULL;
+	return (is_note_event(other_event) && (other_event->u.note_on.channel == event->u.note_on.channel) && (other_event->u.note_on.note == event->u.note_on.note));
+}
 
-	if (midi_file->event_iterator_current == NULL)
-	{
-		for (midi_file->event_iterator_current = MidiFile_getFirstEvent(midi_file); midi_file->event_iterator_current != NULL; midi_file->event_iterator_current = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current)) midi_file->event_iterator_current->should_be_visited = 1;
-		midi_file->event_iterator_current = MidiFile_getFirstEvent(midi_file);
-	}
-	else
-	{
-		midi_file->event_iterator_current = midi_file->event_iterator_next;
-	}
+static MidiFileEvent_t get_note_start_at_or_before(MidiFileEvent_t event)
+{
+	if (event == NULL) return NULL;
+	if (is_note_start_event(event)) return event;
+	return get_event(event->u.note_on.partner);
+}
 
-	while ((midi_file->event_iterator_current != NULL) && !(midi_file->event_iterator_current->should_be_visited))
-	{
-		midi_file->event_iterator_current = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current);
-	}
+static MidiFileEvent_t get_note_end_at_or_after(MidiFileEvent_t event)
+{
+	if (event == NULL) return NULL;
+	if (is_note_start_event(event)) return get_event(event->u.note_on.partner);
+	return event;
+}
 
-	if (midi_file->event_iterator_current == NULL)
+static void set_partner_for_starts_up_to(MidiFileEvent_t event, MidiFileEvent_t partner)
+{
+	for (; (event != NULL) && is_note_start_event(event); event = get_event(event->u.note_on.previous_event_with_same_note)) event->u.note_on.partner = get_event_reference(partner);
+}
+
+static void set_partner_for_ends_from(MidiFileEvent_t event, MidiFileEvent_t partner)
+{
+	for (; (event != NULL) && ! is_note_start_event(event); event = get_event(event->u.note_on.next_event_with_same_note)) event->u.note_on.partner = get_event_reference(partner);
+}
+
+static void link_note_partners(MidiFileEvent_t event, MidiFileEvent_t previous_event, MidiFileEvent_t next_event)
+{
+	event->u.note_on.previous_event_with_same_note = get_event_reference(previous_event);
+	event->u.note_on.next_event_with_same_note = get_event_reference(next_event);
+	if (previous_event != NULL) previous_event->u.note_on.next_event_with_same_note = get_event_reference(event);
+	if (next_event != NULL) next_event->u.note_on.previous_event_with_same_note = get_event_reference(event);
+
+	if (is_note_start_event(event))
 	{
-		midi_file->event_iterator_next = NULL;
+		event->u.note_on.partner = get_event_reference(get_note_end_at_or_after(next_event));
+		set_partner_for_ends_from(next_event, event);
 	}
 	else
 	{
-		midi_file->event_iterator_current->should_be_visited = 0;
-		midi_file->event_iterator_next = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current);
+		event->u.note_on.partner = get_event_reference(get_note_start_at_or_before(previous_event));
+		set_partner_for_starts_up_to(previous_event, event);
 	}
-
-	return midi_file->event_iterator_current;
 }
 
-int MidiFile_visitEvents(MidiFile_t midi_file, MidiFileEventVisitorCallback_t visitor_callback, void *user_data)
+static void build_note_partners(MidiFileTrack_t track)
 {
-	MidiFileEvent_t event;
+	MidiFileEvent_t last_events[16][128];
+	MidiFileEvent_t event, previous_event;
 
-	if ((midi_file == NULL) || (visitor_callback == NULL)) return -1;
+	memset(last_events, 0, sizeof (last_events));
+	sort_track_event_list(track);
 
-	for (event = MidiFile_iterateEvents(midi_file); event != NULL; event = MidiFile_iterateEvents(midi_file))
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track))
 	{
-		(*visitor_callback)(event, user_data);
+		if (! is_note_event(event)) continue;
+
+		if ((event->u.note_on.channel < 16) && (event->u.note_on.note < 128))
+		{
+			previous_event = last_events[event->u.note_on.channel][event->u.note_on.note];
+			last_events[event->u.note_on.channel][event->u.note_on.note] = event;
+		}
+		else
+		{
+			for (previous_event = get_event(event->previous_event_in_track); (previous_event != NULL) && ! have_same_note(event, previous_event); previous_event = get_event(previous_event->previous_event_in_track)) {}
+		}
+
+		link_note_partners(event, previous_event, NULL);
 	}
 
-	return 0;
+	track->note_partners_are_valid = 1;
 }
 
-int MidiFile_convertSelectionFlagsToTextEvents(MidiFile_t midi_file, char *label)
+static void add_note_partners(MidiFileEvent_t event)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event;
+	MidiFileEvent_t previous_event, next_event;
 
-	if (midi_file == NULL) return -1;
+	if ((event->track == 0) || ! get_track(event->track)->note_partners_are_valid || ! is_note_event(event)) return;
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	/* search outwards for the nearest event with the same note; its chain supplies the neighbor on the other side */
+
+	previous_event = get_event(event->previous_event_in_track);
+	next_event = get_event(event->next_event_in_track);
+
+	while ((previous_event != NULL) || (next_event != NULL))
 	{
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		if (previous_event != NULL)
 		{
-			if (MidiFileEvent_isSelected(event))
+			if (have_same_note(event, previous_event))
 			{
-				MidiFileEvent_setNextEvent(MidiFileTrack_createTextEvent(MidiFileEvent_getTrack(event), MidiFileEvent_getTick(event), label), event);
-				MidiFileEvent_setSelected(event, 0);
+				next_event = get_event(previous_event->u.note_on.next_event_with_same_note);
+				break;
+			}
+
+			previous_event = get_event(previous_event->previous_event_in_track);
+		}
+
+		if (next_event != NULL)
+		{
+			if (have_same_note(event, next_event))
+			{
+				previous_event = get_event(next_event->u.note_on.previous_event_with_same_note);
+				break;
 			}
+
+			next_event = get_event(next_event->next_event_in_track);
 		}
 	}
 
-	return 0;
+	link_note_partners(event, previous_event, next_event);
 }
 
-int MidiFile_convertTextEventsToSelectionFlags(MidiFile_t midi_file, char *label)
+static void remove_note_partners(MidiFileEvent_t event)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event, next_event;
+	MidiFileEvent_t previous_event, next_event;
 
-	if (midi_file == NULL) return -1;
+	if ((event->track == 0) || ! get_track(event->track)->note_partners_are_valid || ! is_note_event(event)) return;
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	previous_event = get_event(event->u.note_on.previous_event_with_same_note);
+	next_event = get_event(event->u.note_on.next_event_with_same_note);
+	if (previous_event != NULL) previous_event->u.note_on.next_event_with_same_note = get_event_reference(next_event);
+	if (next_event != NULL) next_event->u.note_on.previous_event_with_same_note = get_event_reference(previous_event);
+
+	if (is_note_start_event(event))
 	{
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
-		{
-			next_event = MidiFileEvent_getNextEventInTrack(event);
+		set_partner_for_ends_from(next_event, get_note_start_at_or_before(previous_event));
+	}
+	else
+	{
+		set_partner_for_starts_up_to(previous_event, get_note_end_at_or_after(next_event));
+	}
+}
 
-			if (MidiFileEvent_isTextEvent(event) && (strcmp(MidiFileTextEvent_getText(event), label) == 0))
-			{
-				MidiFileEvent_setSelected(next_event, 1);
-				MidiFileEvent_delete(event);
-			}
-		}
+static void append_event_to_file_list(MidiFile_t midi_file, MidiFileEvent_t new_event)
+{
+	/* in a batch, or while the list is stale; either way, it is sorted before it is next needed */
+
+	new_event->previous_event_in_file = get_event_reference(midi_file->last_event);
+	new_event->next_event_in_file = 0;
+
+	if (midi_file->last_event == NULL)
+	{
+		midi_file->first_event = new_event;
+	}
+	else
+	{
+		if (new_event->tick < midi_file->last_event->tick) midi_file->batch_is_unsorted = 1;
+		midi_file->last_event->next_event_in_file = get_event_reference(new_event);
 	}
 
-	return 0;
+	midi_file->last_event = new_event;
 }
 
-int MidiFile_convertStandardEventsToNoteEvents(MidiFile_t midi_file)
+static void prepend_event_to_file_list(MidiFile_t midi_file, MidiFileEvent_t new_event)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event;
-
-	if (midi_file == NULL) return -1;
+	new_event->previous_event_in_file = 0;
+	new_event->next_event_in_file = get_event_reference(midi_file->first_event);
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	if (midi_file->first_event == NULL)
 	{
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
+		midi_file->last_event = new_event;
+	}
+	else
+	{
+		if (new_event->tick > midi_file->first_event->tick) midi_file->batch_is_unsorted = 1;
+		midi_file->first_event->previous_event_in_file = get_event_reference(new_event);
+	}
 
-			if (end_event != NULL)
-			{
-				MidiFileEvent_t new_event = MidiFileTrack_createNoteEvent(
-					MidiFileEvent_getTrack(event),
-					MidiFileEvent_getTick(event),
-					MidiFileEvent_getTick(end_event) - MidiFileEvent_getTick(event),
-					MidiFileNoteStartEvent_getChannel(event),
-					MidiFileNoteStartEvent_getNote(event),
-					MidiFileNoteStartEvent_getVelocity(event),
-					MidiFileNoteEndEvent_getVelocity(end_event));
+	midi_file->first_event = new_event;
+}
 
-				MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
-				MidiFileEvent_setPreviousEvent(new_event, event);
-				MidiFileEvent_delete(event);
-				MidiFileEvent_delete(end_event);
-				event = new_event;
-			}
-		}
+static void unlink_event_from_file_list(MidiFile_t midi_file, MidiFileEvent_t event)
+{
+	if (event->previous_event_in_file == 0)
+	{
+		midi_file->first_event = get_event(event->next_event_in_file);
+	}
+	else
+	{
+		get_event(event->previous_event_in_file)->next_event_in_file = event->next_event_in_file;
 	}
 
-	return 0;
+	if (event->next_event_in_file == 0)
+	{
+		midi_file->last_event = get_event(event->previous_event_in_file);
+	}
+	else
+	{
+		get_event(event->next_event_in_file)->previous_event_in_file = event->previous_event_in_file;
+	}
 }
 
-int MidiFile_convertNoteEventsToStandardEvents(MidiFile_t midi_file)
+static void append_event_in_batch(MidiFileEvent_t new_event)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event;
+	MidiFileTrack_t track = get_track(new_event->track);
+	MidiFile_t midi_file = track->midi_file;
 
-	if (midi_file == NULL) return -1;
+	new_event->previous_event_in_track = get_event_reference(track->last_event);
+	new_event->next_event_in_track = 0;
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	if (track->last_event == NULL)
 	{
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE)
-			{
-				MidiFileEvent_t note_start_event = MidiFileTrack_createNoteStartAndEndEvents(
-					MidiFileEvent_getTrack(event),
-					MidiFileEvent_getTick(event),
-					MidiFileEvent_getTick(event) + MidiFileNoteEvent_getDurationTicks(event),
-					MidiFileNoteEvent_getChannel(event),
-					MidiFileNoteEvent_getNote(event),
-					MidiFileNoteEvent_getVelocity(event),
-					MidiFileNoteEvent_getEndVelocity(event));
-
-				MidiFileEvent_setSelected(note_start_event, MidiFileEvent_isSelected(event));
-				MidiFileEvent_setSelected(MidiFileNoteStartEvent_getNoteEndEvent(note_start_event), MidiFileEvent_isSelected(event));
-				MidiFileEvent_setPreviousEvent(note_start_event, event);
-				MidiFileEvent_delete(event);
-				event = note_start_event;
-			}
-		}
+		track->first_event = new_event;
+	}
+	else
+	{
+		if (new_event->tick < track->last_event->tick) track->batch_is_unsorted = 1;
+		track->last_event->next_event_in_track = get_event_reference(new_event);
 	}
 
-	return 0;
+	track->last_event = new_event;
+	if (midi_file->file_event_list_is_stale) new_event->placement_at_tick = MIDI_FILE_PLACEMENT_LAST_AT_TICK;
+	append_event_to_file_list(midi_file, new_event);
+
+	/* the pairing is rebuilt from scratch the next time it is needed */
+	if (is_note_event(new_event)) track->note_partners_are_valid = 0;
+
+	if (new_event->tick > track->end_tick) track->end_tick = new_event->tick;
+	invalidate_tempo_map_for_event(new_event);
 }
 
-int MidiFile_convertStandardEventsToFineControlChangeEvents(MidiFile_t midi_file)
+static void lock_track_images(void)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event, next_event;
-	int values[16][64];
+	lock_mutex(&track_image_mutex);
+}
 
-	if (midi_file == NULL) return -1;
+static void unlock_track_images(void)
+{
+	unlock_mutex(&track_image_mutex);
+}
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
-	{
-		memset(values, 0, sizeof (int) * 16 * 64);
+static unsigned char *pack_number(unsigned char *p, long value)
+{
+	/* zigzag, so that small negative numbers stay small too, then seven bits at a time */
 
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
-		{
-			next_event = MidiFileEvent_getNextEventInTrack(event);
+	unsigned long bits = (value < 0) ? ((~(unsigned long)(value)) << 1) | 1 : ((unsigned long)(value)) << 1;
 
-			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)
-			{
-				if (MidiFileControlChangeEvent_getNumber(event) < 32)
-				{
-					if ((MidiFileEvent_getType(next_event) == MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)
-						&& (MidiFileControlChangeEvent_getChannel(next_event) == MidiFileControlChangeEvent_getChannel(event))
-						&& (MidiFileControlChangeEvent_getNumber(next_event) == MidiFileControlChangeEvent_getNumber(event) + 32))
-					{
-						MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
-							track,
-							MidiFileEvent_getTick(event),
-							MidiFileControlChangeEvent_getChannel(event),
-							MidiFileControlChangeEvent_getNumber(event),
-							0);
+	while (bits >= 0x80)
+	{
+		*p++ = (unsigned char)((bits & 0x7F) | 0x80);
+		bits >>= 7;
+	}
 
-						MidiFileFineControlChangeEvent_setCoarseValue(new_event, MidiFileControlChangeEvent_getValue(event));
-						MidiFileFineControlChangeEvent_setFineValue(new_event, MidiFileControlChangeEvent_getValue(next_event));
-						values[MidiFileControlChangeEvent_getChannel(event)][MidiFileControlChangeEvent_getNumber(event)] = MidiFileControlChangeEvent_getValue(event);
-						values[MidiFileControlChangeEvent_getChannel(next_event)][MidiFileControlChangeEvent_getNumber(next_event)] = MidiFileControlChangeEvent_getValue(next_event);
-						MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
-						MidiFileEvent_setPreviousEvent(new_event, next_event);
-						MidiFileEvent_delete(event);
-						MidiFileEvent_delete(next_event);
-						next_event = MidiFileEvent_getNextEventInTrack(new_event);
-					}
-					else
-					{
-						MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
-							track,
-							MidiFileEvent_getTick(event),
-							MidiFileControlChangeEvent_getChannel(event),
-							MidiFileControlChangeEvent_getNumber(event),
-							0);
+	*p++ = (unsigned char)(bits);
+	return p;
+}
 
-						MidiFileFineControlChangeEvent_setCoarseValue(new_event, MidiFileControlChangeEvent_getValue(event));
-						MidiFileFineControlChangeEvent_setFineValue(new_event, values[MidiFileControlChangeEvent_getChannel(event)][MidiFileControlChangeEvent_getNumber(event) + 32]);
-						values[MidiFileControlChangeEvent_getChannel(event)][MidiFileControlChangeEvent_getNumber(event)] = MidiFileControlChangeEvent_getValue(event);
-						MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
-						MidiFileEvent_setPreviousEvent(new_event, event);
-						MidiFileEvent_delete(event);
-						next_event = MidiFileEvent_getNextEventInTrack(new_event);
-					}
-				}
-				else if (MidiFileControlChangeEvent_getNumber(event) < 64)
-				{
-					MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
-						track,
-						MidiFileEvent_getTick(event),
-						MidiFileControlChangeEvent_getChannel(event),
-						MidiFileControlChangeEvent_getNumber(event),
-						0);
+static long unpack_number(unsigned char **p)
+{
+	unsigned long bits = 0;
+	int shift = 0;
 
-					MidiFileFineControlChangeEvent_setCoarseValue(new_event, values[MidiFileControlChangeEvent_getChannel(event)][MidiFileControlChangeEvent_getNumber(event) - 32]);
-					MidiFileFineControlChangeEvent_setFineValue(new_event, MidiFileControlChangeEvent_getValue(event));
-					values[MidiFileControlChangeEvent_getChannel(event)][MidiFileControlChangeEvent_getNumber(event)] = MidiFileControlChangeEvent_getValue(event);
-					MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
-					MidiFileEvent_setPreviousEvent(new_event, event);
-					MidiFileEvent_delete(event);
-					next_event = MidiFileEvent_getNextEventInTrack(new_event);
-				}
-			}
-		}
+	do
+	{
+		bits |= ((unsigned long)(**p & 0x7F)) << shift;
+		shift += 7;
 	}
+	while (*((*p)++) & 0x80);
 
-	return 0;
+	return (bits & 1) ? (long)(~(bits >> 1)) : (long)(bits >> 1);
 }
 
-int MidiFile_convertFineControlChangeEventsToStandardEvents(MidiFile_t midi_file)
+static long get_maximum_packed_event_length(MidiFileEvent_t event)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event;
-
-	if (midi_file == NULL) return -1;
+	/* an event packs into at most 64 bytes before its payload */
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	switch (event->type)
 	{
-		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
 		{
-			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)
-			{
-				MidiFileEvent_t coarse_event = MidiFileTrack_createControlChangeEvent(
-					MidiFileEvent_getTrack(event),
-					MidiFileEvent_getTick(event),
-					MidiFileFineControlChangeEvent_getChannel(event),
-					MidiFileFineControlChangeEvent_getCoarseNumber(event),
-					MidiFileFineControlChangeEvent_getCoarseValue(event));
+			return 64 + event->u.sysex.data_length;
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			return 64 + event->u.meta.data_length + 1;
+		}
+		default:
+		{
+			return 64;
+		}
+	}
+}
 
-				MidiFileEvent_t fine_event = MidiFileTrack_createControlChangeEvent(
-					MidiFileEvent_getTrack(event),
-					MidiFileEvent_getTick(event),
-					MidiFileFineControlChangeEvent_getChannel(event),
-					MidiFileFineControlChangeEvent_getFineNumber(event),
-					MidiFileFineControlChangeEvent_getFineValue(event));
+static unsigned char *pack_event(unsigned char *p, MidiFileEvent_t event, long previous_tick)
+{
+	p = pack_number(p, event->tick - previous_tick);
+	*p++ = (unsigned char)((event->type << 1) | (event->is_selected ? 1 : 0));
 
-				MidiFileEvent_setSelected(coarse_event, MidiFileEvent_isSelected(event));
-				MidiFileEvent_setSelected(fine_event, MidiFileEvent_isSelected(event));
-				MidiFileEvent_setPreviousEvent(coarse_event, event);
-				MidiFileEvent_setPreviousEvent(fine_event, coarse_event);
-				MidiFileEvent_delete(event);
-				event = fine_event;
-			}
+	switch (event->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			/* not the pairing links, which the live file may be rebuilding as we go */
+			p = pack_number(p, event->u.note_on.channel);
+			p = pack_number(p, event->u.note_on.note);
+			p = pack_number(p, event->u.note_on.velocity);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_RPN:
+		case MIDI_FILE_EVENT_TYPE_NRPN:
+		{
+			/* these all have three ints in the same places */
+			p = pack_number(p, event->u.control_change.channel);
+			p = pack_number(p, event->u.control_change.number);
+			p = pack_number(p, event->u.control_change.value);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			p = pack_number(p, event->u.program_change.channel);
+			p = pack_number(p, event->u.program_change.number);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			p = pack_number(p, event->u.sysex.data_length);
+			memcpy(p, event->u.sysex.data_buffer, event->u.sysex.data_length);
+			p += event->u.sysex.data_length;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			p = pack_number(p, event->u.meta.number);
+			p = pack_number(p, event->u.meta.data_length);
+			memcpy(p, event->u.meta.data_buffer, event->u.meta.data_length + 1);
+			p += event->u.meta.data_length + 1;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE:
+		{
+			p = pack_number(p, event->u.note.duration_ticks);
+			p = pack_number(p, event->u.note.channel);
+			p = pack_number(p, event->u.note.note);
+			p = pack_number(p, event->u.note.velocity);
+			p = pack_number(p, event->u.note.end_velocity);
+			break;
+		}
+		default:
+		{
+			break;
 		}
 	}
 
-	return 0;
+	return p;
 }
 
-int MidiFile_convertStandardEventsToRpnAndNrpnEvents(MidiFile_t midi_file)
+static int copy_track_image(struct MidiFileTrackImage *image)
 {
-	MidiFileTrack_t track;
-	MidiFileEvent_t event, next_event;
-	int is_nrpn[16];
-	int numbers[16];
-	int values[16];
+	/* with the lock held; a no-op if the events have already been copied, and if memory runs out, the image is left sharing the track */
 
-	if (midi_file == NULL) return -1;
+	MidiFileTrack_t track = image->track;
+	MidiFileEvent_t event;
+	long number_of_events = 0, maximum_data_length = 0, previous_tick = 0;
+	unsigned char *p, *data;
 
-	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	if (track == NULL) return 0;
+
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track))
 	{
-		memset(is_nrpn, 0, sizeof (int) * 16);
-		memset(numbers, 0, sizeof (int) * 16);
-		memset(values, 0, sizeof (int) * 16);
+		number_of_events++;
+		maximum_data_length += get_maximum_packed_event_length(event);
+	}
+
+	if ((p = image->data = (unsigned char *)(malloc(maximum_data_length + 1))) == NULL) return -1;
+	image->number_of_events = number_of_events;
+	image->end_tick = track->end_tick;
+
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track))
+	{
+		p = pack_event(p, event, previous_tick);
+		previous_tick = event->tick;
+	}
+
+	image->data_length = p - image->data;
+	if ((data = (unsigned char *)(realloc(image->data, image->data_length + 1))) != NULL) image->data = data;
+	image->track = NULL;
+	return 0;
+}
+
+static unsigned char *unpack_event(unsigned char *p, MidiFileEvent_t event)
+{
+	/* the opposite of pack_event(), onto the event before; payloads are left in place */
+
+	event->tick += unpack_number(&p);
+	event->type = (MidiFileEventType_t)(*p >> 1);
+	event->is_selected = *p++ & 1;
+
+	switch (event->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			event->u.note_on.channel = unpack_number(&p);
+			event->u.note_on.note = unpack_number(&p);
+			event->u.note_on.velocity = unpack_number(&p);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_RPN:
+		case MIDI_FILE_EVENT_TYPE_NRPN:
+		{
+			event->u.control_change.channel = unpack_number(&p);
+			event->u.control_change.number = unpack_number(&p);
+			event->u.control_change.value = unpack_number(&p);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			event->u.program_change.channel = unpack_number(&p);
+			event->u.program_change.number = unpack_number(&p);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			event->u.sysex.data_length = unpack_number(&p);
+			event->u.sysex.data_buffer = p;
+			p += event->u.sysex.data_length;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			event->u.meta.number = unpack_number(&p);
+			event->u.meta.data_length = unpack_number(&p);
+			event->u.meta.data_buffer = p;
+			p += event->u.meta.data_length + 1;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE:
+		{
+			event->u.note.duration_ticks = unpack_number(&p);
+			event->u.note.channel = unpack_number(&p);
+			event->u.note.note = unpack_number(&p);
+			event->u.note.velocity = unpack_number(&p);
+			event->u.note.end_velocity = unpack_number(&p);
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	return p;
+}
+
+static void release_track_image(struct MidiFileTrackImage *image)
+{
+	/* with the lock held */
+
+	if (--(image->reference_count) > 0) return;
+	free(image->data);
+	free(image);
+}
+
+static void copy_track_for_snapshots(MidiFileTrack_t track)
+{
+	/* called before anything in a track changes, to leave the snapshots still sharing it with a copy of how it was */
+
+	struct MidiFileTrackImage *image;
+
+	if ((track == NULL) || (track->snapshot_image == NULL)) return;
+	image = track->snapshot_image;
+	track->snapshot_image = NULL;
+
+	lock_track_images();
+
+	if ((image->reference_count > 1) && (copy_track_image(image) != 0))
+	{
+		/* rather than let the snapshots see the change, they lose the track, and can no longer be turned back into files */
+		image->number_of_events = -1;
+	}
+
+	image->track = NULL;
+	release_track_image(image);
+	unlock_track_images();
+}
+
+static void prepare_track_for_change(MidiFileTrack_t track)
+{
+	/* for changes anywhere but the end, which the next journal save will have to rewrite the whole track for */
+
+	if (track == NULL) return;
+	copy_track_for_snapshots(track);
+	track->journal_is_stale = 1;
+}
+
+static void note_added_event_for_journal(MidiFileEvent_t new_event)
+{
+	/* events added at the end of a track, in order, are all the next journal save has to write out */
+
+	if ((new_event->next_event_in_track != 0) || ((new_event->previous_event_in_track != 0) && (get_event(new_event->previous_event_in_track)->tick > new_event->tick)))
+	{
+		get_track(new_event->track)->journal_is_stale = 1;
+	}
+}
+
+static void add_event_before(MidiFileEvent_t new_event, MidiFileEvent_t next_event)
+{
+	/* Add in proper sorted order.  Search forwards to optimize for inserting. */
+
+	MidiFileEvent_t event;
+
+	copy_track_for_snapshots(get_track(new_event->track));
+	event = get_first_event_in_track_at_or_after_tick(get_track(new_event->track), new_event->tick);
+
+	if ((event != NULL) && (next_event != NULL) && (get_track(event->track) == get_track(next_event->track)) && (event->tick == next_event->tick))
+	{
+		while (event != next_event) event = get_event(event->next_event_in_track);
+	}
+
+	new_event->next_event_in_track = get_event_reference(event);
+
+	if (event == NULL)
+	{
+		new_event->previous_event_in_track = get_event_reference(get_track(new_event->track)->last_event);
+		get_track(new_event->track)->last_event = new_event;
+	}
+	else
+	{
+		new_event->previous_event_in_track = event->previous_event_in_track;
+		event->previous_event_in_track = get_event_reference(new_event);
+	}
+
+	if (new_event->previous_event_in_track == 0)
+	{
+		get_track(new_event->track)->first_event = new_event;
+	}
+	else
+	{
+		get_event(new_event->previous_event_in_track)->next_event_in_track = get_event_reference(new_event);
+	}
+
+	MidiFileTickIndex_addEvent(get_track(new_event->track)->tick_index, new_event, get_event(new_event->previous_event_in_track), get_event(new_event->next_event_in_track));
+
+	if (! get_track(new_event->track)->midi_file->file_event_list_is_stale)
+	{
+		event = get_first_event_in_file_at_or_after_tick(get_track(new_event->track)->midi_file, new_event->tick);
+
+		new_event->next_event_in_file = get_event_reference(event);
+
+		if (event == NULL)
+		{
+			new_event->previous_event_in_file = get_event_reference(get_track(new_event->track)->midi_file->last_event);
+			get_track(new_event->track)->midi_file->last_event = new_event;
+		}
+		else
+		{
+			new_event->previous_event_in_file = event->previous_event_in_file;
+			event->previous_event_in_file = get_event_reference(new_event);
+		}
+
+		if (new_event->previous_event_in_file == 0)
+		{
+			get_track(new_event->track)->midi_file->first_event = new_event;
+		}
+		else
+		{
+			get_event(new_event->previous_event_in_file)->next_event_in_file = get_event_reference(new_event);
+		}
+
+		MidiFileTickIndex_addEvent(get_track(new_event->track)->midi_file->tick_index, new_event, get_event(new_event->previous_event_in_file), get_event(new_event->next_event_in_file));
+	}
+	else
+	{
+		new_event->placement_at_tick = MIDI_FILE_PLACEMENT_FIRST_AT_TICK;
+		prepend_event_to_file_list(get_track(new_event->track)->midi_file, new_event);
+	}
+
+	if (new_event->tick > get_track(new_event->track)->end_tick) get_track(new_event->track)->end_tick = new_event->tick;
+	invalidate_tempo_map_for_event(new_event);
+	add_note_partners(new_event);
+	note_added_event_for_journal(new_event);
+}
+
+static void add_event_after(MidiFileEvent_t new_event, MidiFileEvent_t previous_event)
+{
+	/* Add in proper sorted order.  Search backwards to optimize for appending. */
+
+	MidiFileEvent_t event;
+
+	copy_track_for_snapshots(get_track(new_event->track));
+
+	/* inside a batch, defer the search unless the event is being placed relative to another */
+	if ((previous_event == NULL) && (get_track(new_event->track)->midi_file->batch_depth > 0))
+	{
+		append_event_in_batch(new_event);
+		note_added_event_for_journal(new_event);
+		return;
+	}
+
+	event = get_last_event_in_track_at_or_before_tick(get_track(new_event->track), new_event->tick);
+
+	if ((event != NULL) && (previous_event != NULL) && (get_track(event->track) == get_track(previous_event->track)) && (event->tick == previous_event->tick))
+	{
+		while (event != previous_event) event = get_event(event->previous_event_in_track);
+	}
+
+	new_event->previous_event_in_track = get_event_reference(event);
+
+	if (event == NULL)
+	{
+		new_event->next_event_in_track = get_event_reference(get_track(new_event->track)->first_event);
+		get_track(new_event->track)->first_event = new_event;
+	}
+	else
+	{
+		new_event->next_event_in_track = event->next_event_in_track;
+		event->next_event_in_track = get_event_reference(new_event);
+	}
+
+	if (new_event->next_event_in_track == 0)
+	{
+		get_track(new_event->track)->last_event = new_event;
+	}
+	else
+	{
+		get_event(new_event->next_event_in_track)->previous_event_in_track = get_event_reference(new_event);
+	}
+
+	MidiFileTickIndex_addEvent(get_track(new_event->track)->tick_index, new_event, get_event(new_event->previous_event_in_track), get_event(new_event->next_event_in_track));
+
+	if (! get_track(new_event->track)->midi_file->file_event_list_is_stale)
+	{
+		event = get_last_event_in_file_at_or_before_tick(get_track(new_event->track)->midi_file, new_event->tick);
+
+		new_event->previous_event_in_file = get_event_reference(event);
+
+		if (event == NULL)
+		{
+			new_event->next_event_in_file = get_event_reference(get_track(new_event->track)->midi_file->first_event);
+			get_track(new_event->track)->midi_file->first_event = new_event;
+		}
+		else
+		{
+			new_event->next_event_in_file = event->next_event_in_file;
+			event->next_event_in_file = get_event_reference(new_event);
+		}
+
+		if (new_event->next_event_in_file == 0)
+		{
+			get_track(new_event->track)->midi_file->last_event = new_event;
+		}
+		else
+		{
+			get_event(new_event->next_event_in_file)->previous_event_in_file = get_event_reference(new_event);
+		}
+
+		MidiFileTickIndex_addEvent(get_track(new_event->track)->midi_file->tick_index, new_event, get_event(new_event->previous_event_in_file), get_event(new_event->next_event_in_file));
+	}
+	else
+	{
+		new_event->placement_at_tick = MIDI_FILE_PLACEMENT_LAST_AT_TICK;
+		append_event_to_file_list(get_track(new_event->track)->midi_file, new_event);
+	}
+
+	if (new_event->tick > get_track(new_event->track)->end_tick) get_track(new_event->track)->end_tick = new_event->tick;
+	invalidate_tempo_map_for_event(new_event);
+	add_note_partners(new_event);
+	note_added_event_for_journal(new_event);
+}
+
+static void add_event(MidiFileEvent_t new_event)
+{
+	add_event_after(new_event, NULL);
+}
+
+static void remove_event(MidiFileEvent_t event)
+{
+	prepare_track_for_change(get_track(event->track));
+	invalidate_tempo_map_for_event(event);
+	remove_note_partners(event);
+	MidiFileTickIndex_removeEvent(get_track(event->track)->tick_index, event, get_event(event->previous_event_in_track), get_event(event->next_event_in_track));
+
+	if (event->previous_event_in_track == 0)
+	{
+		get_track(event->track)->first_event = get_event(event->next_event_in_track);
+	}
+	else
+	{
+		get_event(event->previous_event_in_track)->next_event_in_track = event->next_event_in_track;
+	}
+
+	if (event->next_event_in_track == 0)
+	{
+		get_track(event->track)->last_event = get_event(event->previous_event_in_track);
+	}
+	else
+	{
+		get_event(event->next_event_in_track)->previous_event_in_track = event->previous_event_in_track;
+	}
+
+	if (! get_track(event->track)->midi_file->file_event_list_is_stale)
+	{
+		MidiFileTickIndex_removeEvent(get_track(event->track)->midi_file->tick_index, event, get_event(event->previous_event_in_file), get_event(event->next_event_in_file));
+		unlink_event_from_file_list(get_track(event->track)->midi_file, event);
+	}
+	else if (event->placement_at_tick != 0)
+	{
+		unlink_event_from_file_list(get_track(event->track)->midi_file, event);
+		event->placement_at_tick = 0;
+	}
+}
+
+static int record_is_valid(const struct MidiFileEventRecord *record, const unsigned char *payloads)
+{
+	if ((record->tick < 0) || (record->type < MIDI_FILE_EVENT_TYPE_NOTE_OFF) || (record->type > MIDI_FILE_EVENT_TYPE_NRPN) || (record->type == MIDI_FILE_EVENT_TYPE_NOTE)) return 0;
+	if (record->type == MIDI_FILE_EVENT_TYPE_SYSEX) return ((record->value >= 1) && (record->payload_offset >= 0) && (payloads != NULL));
+	if (record->type == MIDI_FILE_EVENT_TYPE_META) return ((record->value >= 0) && (record->payload_offset >= 0) && ((payloads != NULL) || (record->value == 0)));
+	return 1;
+}
+
+static void set_event_from_record(MidiFileEvent_t event, const struct MidiFileEventRecord *record, const unsigned char *payloads, MidiFile_t storage)
+{
+	event->tick = record->tick;
+	event->type = record->type;
+	event->should_be_visited = 0;
+	event->is_selected = 0;
+
+	switch (record->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			event->u.note_off.channel = record->channel;
+			event->u.note_off.note = record->number;
+			event->u.note_off.velocity = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			event->u.note_on.channel = record->channel;
+			event->u.note_on.note = record->number;
+			event->u.note_on.velocity = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			event->u.key_pressure.channel = record->channel;
+			event->u.key_pressure.note = record->number;
+			event->u.key_pressure.amount = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		{
+			event->u.control_change.channel = record->channel;
+			event->u.control_change.number = record->number;
+			event->u.control_change.value = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		{
+			event->u.program_change.channel = record->channel;
+			event->u.program_change.number = record->number;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			event->u.channel_pressure.channel = record->channel;
+			event->u.channel_pressure.amount = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			event->u.pitch_wheel.channel = record->channel;
+			event->u.pitch_wheel.value = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			event->u.sysex.data_length = record->value;
+			event->u.sysex.data_buffer = allocate_data(storage, record->value);
+			memcpy(event->u.sysex.data_buffer, payloads + record->payload_offset, record->value);
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			event->u.meta.number = record->number;
+			event->u.meta.data_length = record->value;
+			event->u.meta.data_buffer = allocate_data(storage, record->value + 1);
+			if (record->value > 0) memcpy(event->u.meta.data_buffer, payloads + record->payload_offset, record->value);
+			event->u.meta.data_buffer[record->value] = '\0';
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE:
+		{
+			event->u.fine_control_change.channel = record->channel;
+			event->u.fine_control_change.coarse_number = record->number;
+			event->u.fine_control_change.value = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_RPN:
+		{
+			event->u.rpn.channel = record->channel;
+			event->u.rpn.number = record->number;
+			event->u.rpn.value = record->value;
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NRPN:
+		{
+			event->u.nrpn.channel = record->channel;
+			event->u.nrpn.number = record->number;
+			event->u.nrpn.value = record->value;
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+}
+
+static void link_new_event_into_track(MidiFileTrack_t track, MidiFileEvent_t new_event, MidiFileEvent_t previous_event)
+{
+	/*
+	 * The new event goes after any with the same tick, starting the search
+	 * from the given event, or the start of the track if NULL.  Each of a run
+	 * of new events in order by tick can start from the one before it, and
+	 * usually goes after the last one already there, so the search never
+	 * takes a step.
+	 */
+
+	MidiFileEvent_t next_event;
+
+	for (next_event = (previous_event == NULL) ? track->first_event : get_event(previous_event->next_event_in_track); (next_event != NULL) && (next_event->tick <= new_event->tick); next_event = get_event(next_event->next_event_in_track)) previous_event = next_event;
+
+	new_event->previous_event_in_track = get_event_reference(previous_event);
+	new_event->next_event_in_track = get_event_reference(next_event);
+
+	if (previous_event == NULL)
+	{
+		track->first_event = new_event;
+	}
+	else
+	{
+		previous_event->next_event_in_track = get_event_reference(new_event);
+	}
+
+	if (next_event == NULL)
+	{
+		track->last_event = new_event;
+	}
+	else
+	{
+		next_event->previous_event_in_track = get_event_reference(new_event);
+	}
+
+	MidiFileTickIndex_addEvent(track->tick_index, new_event, previous_event, next_event);
+	note_added_event_for_journal(new_event);
+	if (new_event->tick > track->end_tick) track->end_tick = new_event->tick;
+}
+
+static void link_new_event_into_file(MidiFile_t midi_file, MidiFileEvent_t new_event, MidiFileEvent_t previous_event)
+{
+	/* the same for the file-wide list */
+
+	MidiFileEvent_t next_event;
+
+	for (next_event = (previous_event == NULL) ? midi_file->first_event : get_event(previous_event->next_event_in_file); (next_event != NULL) && (next_event->tick <= new_event->tick); next_event = get_event(next_event->next_event_in_file)) previous_event = next_event;
+
+	new_event->previous_event_in_file = get_event_reference(previous_event);
+	new_event->next_event_in_file = get_event_reference(next_event);
+
+	if (previous_event == NULL)
+	{
+		midi_file->first_event = new_event;
+	}
+	else
+	{
+		previous_event->next_event_in_file = get_event_reference(new_event);
+	}
+
+	if (next_event == NULL)
+	{
+		midi_file->last_event = new_event;
+	}
+	else
+	{
+		next_event->previous_event_in_file = get_event_reference(new_event);
+	}
+
+	MidiFileTickIndex_addEvent(midi_file->tick_index, new_event, previous_event, next_event);
+}
+
+static MidiFileEvent_t append_record(MidiFileTrack_t track, const struct MidiFileEventRecord *record, const unsigned char *payloads, MidiFileEvent_t previous_event)
+{
+	/* the record has already been checked */
+
+	MidiFileEvent_t new_event = allocate_event(track->midi_file);
+
+	set_event_from_record(new_event, record, payloads, track->midi_file);
+	new_event->track = get_track_reference(track);
+	link_new_event_into_track(track, new_event, previous_event);
+
+	/* as in a batch, the note pairing is rebuilt from scratch the next time it is needed */
+	if (is_note_event(new_event)) track->note_partners_are_valid = 0;
+	invalidate_tempo_map_for_event(new_event);
+	return new_event;
+}
+
+static double get_frames_per_second_for_division_type(MidiFileDivisionType_t division_type)
+{
+	switch (division_type)
+	{
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			return 24.0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			return 25.0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			return 29.97;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			return 30.0;
+		}
+		default:
+		{
+			return 30.0;
+		}
+	}
+}
+
+static int get_frames_per_second_fraction_for_division_type(MidiFileDivisionType_t division_type, long *numerator_out, long *denominator_out)
+{
+	/* exact, for integer time arithmetic; 30 drop frame is really 30000/1001 */
+
+	*denominator_out = 1;
+
+	switch (division_type)
+	{
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			*numerator_out = 24;
+			return 0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			*numerator_out = 25;
+			return 0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			*numerator_out = 30000;
+			*denominator_out = 1001;
+			return 0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			*numerator_out = 30;
+			return 0;
+		}
+		default:
+		{
+			*numerator_out = 0;
+			return -1;
+		}
+	}
+}
+
+static void build_tempo_map(MidiFile_t midi_file)
+{
+	MidiFileEvent_t event;
+	long number_of_tempo_segments = 1;
+	double frames_per_second = get_frames_per_second_for_division_type(midi_file->division_type);
+
+	if (midi_file->first_track != NULL) sort_track_event_list(midi_file->first_track);
+
+	for (event = MidiFileTrack_getFirstEvent(midi_file->first_track); event != NULL; event = get_event(event->next_event_in_track))
+	{
+		if (MidiFileEvent_isTempoEvent(event)) number_of_tempo_segments++;
+	}
+
+	if (number_of_tempo_segments > midi_file->maximum_number_of_tempo_segments)
+	{
+		free(midi_file->tempo_segments);
+		midi_file->tempo_segments = (struct MidiFileTempoSegment *)(malloc(number_of_tempo_segments * sizeof(struct MidiFileTempoSegment)));
+		midi_file->maximum_number_of_tempo_segments = number_of_tempo_segments;
+	}
+
+	midi_file->tempo_segments[0].start_tick = 0;
+	midi_file->tempo_segments[0].start_position = 0.0;
+	midi_file->tempo_segments[0].tempo = 120.0;
+	midi_file->tempo_segments[0].start_time = 0;
+	midi_file->tempo_segments[0].microseconds_per_beat = 500000;
+	midi_file->number_of_tempo_segments = 1;
+	midi_file->tempo_segments_are_sorted = 1;
+
+	for (event = MidiFileTrack_getFirstEvent(midi_file->first_track); event != NULL; event = get_event(event->next_event_in_track))
+	{
+		if (MidiFileEvent_isTempoEvent(event))
+		{
+			struct MidiFileTempoSegment *previous_segment = &(midi_file->tempo_segments[midi_file->number_of_tempo_segments - 1]);
+			struct MidiFileTempoSegment *segment = &(midi_file->tempo_segments[midi_file->number_of_tempo_segments]);
+			segment->start_tick = event->tick;
+
+			if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
+			{
+				segment->start_position = previous_segment->start_position + (((float)(event->tick - previous_segment->start_tick)) / midi_file->resolution / (previous_segment->tempo / 60));
+			}
+			else
+			{
+				segment->start_position = previous_segment->start_position + (((float)(event->tick - previous_segment->start_tick)) / midi_file->resolution / (float)(frames_per_second) / (float)(60.0) * previous_segment->tempo);
+			}
+
+			segment->tempo = MidiFileTempoEvent_getTempo(event);
+			segment->start_time = previous_segment->start_time + ((long long)(event->tick - previous_segment->start_tick) * previous_segment->microseconds_per_beat);
+			segment->microseconds_per_beat = (event->u.meta.data_length >= 3) ? ((event->u.meta.data_buffer[0] << 16) | (event->u.meta.data_buffer[1] << 8) | event->u.meta.data_buffer[2]) : previous_segment->microseconds_per_beat;
+			if (! (segment->start_position >= previous_segment->start_position)) midi_file->tempo_segments_are_sorted = 0;
+			(midi_file->number_of_tempo_segments)++;
+		}
+	}
+
+	midi_file->tempo_segments_are_valid = 1;
+}
+
+static int compare_meter_segment_labels(struct MidiFileMeterSegment *segment, long measure, float beat, long whole_beat, float tick, int with_tick)
+{
+	/* orders a segment's measure:beat (or measure:beat:tick) label against the given one */
+
+	if (segment->visible_measure != measure) return (segment->visible_measure < measure) ? -1 : 1;
+
+	if (with_tick)
+	{
+		if (segment->visible_whole_beat != whole_beat) return (segment->visible_whole_beat < whole_beat) ? -1 : 1;
+		return (segment->visible_tick >= tick) ? ((segment->visible_tick > tick) ? 1 : 0) : -1;
+	}
+	else
+	{
+		return (segment->visible_beat >= beat) ? ((segment->visible_beat > beat) ? 1 : 0) : -1;
+	}
+}
+
+static void build_meter_map(MidiFile_t midi_file)
+{
+	MidiFileEvent_t event;
+	long number_of_meter_segments = 1;
+
+	if (midi_file->first_track != NULL) sort_track_event_list(midi_file->first_track);
+
+	for (event = MidiFileTrack_getFirstEvent(midi_file->first_track); event != NULL; event = get_event(event->next_event_in_track))
+	{
+		if (MidiFileEvent_isTimeSignatureEvent(event)) number_of_meter_segments++;
+	}
+
+	if (number_of_meter_segments > midi_file->maximum_number_of_meter_segments)
+	{
+		free(midi_file->meter_segments);
+		midi_file->meter_segments = (struct MidiFileMeterSegment *)(malloc(number_of_meter_segments * sizeof(struct MidiFileMeterSegment)));
+		midi_file->maximum_number_of_meter_segments = number_of_meter_segments;
+	}
+
+	midi_file->meter_segments[0].start_tick = 0;
+	midi_file->meter_segments[0].start_beat = 0.0;
+	midi_file->meter_segments[0].start_measure = 0.0;
+	midi_file->meter_segments[0].visible_measure = 1;
+	midi_file->meter_segments[0].visible_beat = 1.0;
+	midi_file->meter_segments[0].visible_whole_beat = 1;
+	midi_file->meter_segments[0].visible_tick = 0.0;
+	midi_file->meter_segments[0].numerator = 4;
+	midi_file->meter_segments[0].denominator = 4;
+	midi_file->number_of_meter_segments = 1;
+	midi_file->meter_segments_are_sorted_by_measure = 1;
+	midi_file->meter_segments_are_sorted_by_measure_beat = 1;
+	midi_file->meter_segments_are_sorted_by_measure_beat_tick = 1;
+
+	for (event = MidiFileTrack_getFirstEvent(midi_file->first_track); event != NULL; event = get_event(event->next_event_in_track))
+	{
+		if (MidiFileEvent_isTimeSignatureEvent(event))
+		{
+			/* the arithmetic matches the conductor track scans this replaced, so results don't shift by a rounding */
+			struct MidiFileMeterSegment *previous_segment = &(midi_file->meter_segments[midi_file->number_of_meter_segments - 1]);
+			struct MidiFileMeterSegment *segment = &(midi_file->meter_segments[midi_file->number_of_meter_segments]);
+			segment->start_tick = event->tick;
+			segment->start_beat = MidiFile_getBeatFromTick(midi_file, event->tick);
+			segment->start_measure = previous_segment->start_measure + ((segment->start_beat - previous_segment->start_beat) * ((float)(previous_segment->denominator) / previous_segment->numerator / 4));
+			segment->visible_measure = (long)(segment->start_measure) + 1;
+			segment->visible_beat = ((segment->start_measure - (float)(segment->visible_measure - 1)) * previous_segment->numerator) + 1.0;
+			segment->visible_whole_beat = (long)((segment->start_measure - (float)(segment->visible_measure - 1)) * previous_segment->numerator) + 1;
+			segment->visible_tick = event->tick - MidiFile_getTickFromBeat(midi_file, (float)((long)(segment->start_beat)));
+			segment->numerator = MidiFileTimeSignatureEvent_getNumerator(event);
+			segment->denominator = MidiFileTimeSignatureEvent_getDenominator(event);
+
+			/* the first segment never takes part in a search by label, so only later ones need to be in order */
+
+			if (midi_file->number_of_meter_segments > 1)
+			{
+				if (! (segment->start_measure >= previous_segment->start_measure)) midi_file->meter_segments_are_sorted_by_measure = 0;
+				if (compare_meter_segment_labels(segment, previous_segment->visible_measure, previous_segment->visible_beat, 0, 0.0, 0) < 0) midi_file->meter_segments_are_sorted_by_measure_beat = 0;
+				if (compare_meter_segment_labels(segment, previous_segment->visible_measure, 0.0, previous_segment->visible_whole_beat, previous_segment->visible_tick, 1) < 0) midi_file->meter_segments_are_sorted_by_measure_beat_tick = 0;
+			}
+
+			(midi_file->number_of_meter_segments)++;
+		}
+	}
+
+	midi_file->meter_segments_are_valid = 1;
+}
+
+static void build_time_maps(MidiFile_t midi_file)
+{
+	/* both maps are built together, so that after any lookup, others only read the file */
+	if (! midi_file->tempo_segments_are_valid) build_tempo_map(midi_file);
+	if (! midi_file->meter_segments_are_valid) build_meter_map(midi_file);
+}
+
+static struct MidiFileTempoSegment *get_tempo_segment_for_tick(MidiFile_t midi_file, long tick)
+{
+	/* the segment of the last tempo event strictly before the tick */
+
+	long low = 0, high;
+
+	if (! midi_file->tempo_segments_are_valid) build_time_maps(midi_file);
+
+	for (high = midi_file->number_of_tempo_segments - 1; low < high; )
+	{
+		long middle = (low + high + 1) / 2;
+
+		if (midi_file->tempo_segments[middle].start_tick < tick)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return &(midi_file->tempo_segments[low]);
+}
+
+static struct MidiFileTempoSegment *get_tempo_segment_for_position(MidiFile_t midi_file, float position)
+{
+	/* the segment before the first tempo event whose position reaches the target */
+
+	long low = 0, high;
+
+	if (! midi_file->tempo_segments_are_valid) build_time_maps(midi_file);
+
+	if (midi_file->tempo_segments_are_sorted)
+	{
+		for (high = midi_file->number_of_tempo_segments - 1; low < high; )
+		{
+			long middle = (low + high + 1) / 2;
+
+			if (! (midi_file->tempo_segments[middle].start_position >= position))
+			{
+				low = middle;
+			}
+			else
+			{
+				high = middle - 1;
+			}
+		}
+	}
+	else
+	{
+		while ((low + 1 < midi_file->number_of_tempo_segments) && ! (midi_file->tempo_segments[low + 1].start_position >= position)) low++;
+	}
+
+	return &(midi_file->tempo_segments[low]);
+}
+
+static struct MidiFileTempoSegment *get_tempo_segment_for_time(MidiFile_t midi_file, long long time)
+{
+	/* the last segment starting at or before the time, in microseconds times the resolution; unlike positions, exact times are always in order */
+
+	long low = 0, high;
+
+	if (! midi_file->tempo_segments_are_valid) build_time_maps(midi_file);
+
+	for (high = midi_file->number_of_tempo_segments - 1; low < high; )
+	{
+		long middle = (low + high + 1) / 2;
+
+		if (midi_file->tempo_segments[middle].start_time <= time)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return &(midi_file->tempo_segments[low]);
+}
+
+static struct MidiFileMeterSegment *get_meter_segment_for_tick(MidiFile_t midi_file, long tick)
+{
+	/* the segment of the last time signature strictly before the tick */
+
+	long low = 0, high;
+
+	if (! midi_file->meter_segments_are_valid) build_time_maps(midi_file);
+
+	for (high = midi_file->number_of_meter_segments - 1; low < high; )
+	{
+		long middle = (low + high + 1) / 2;
+
+		if (midi_file->meter_segments[middle].start_tick < tick)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return &(midi_file->meter_segments[low]);
+}
+
+static int meter_segment_reaches(struct MidiFileMeterSegment *segment, float measure, long visible_measure, float visible_beat, long visible_whole_beat, float visible_tick, int kind)
+{
+	switch (kind)
+	{
+		case 0:
+		{
+			return (segment->start_measure >= measure);
+		}
+		case 1:
+		{
+			return (compare_meter_segment_labels(segment, visible_measure, visible_beat, 0, 0.0, 0) >= 0);
+		}
+		default:
+		{
+			return (compare_meter_segment_labels(segment, visible_measure, 0.0, visible_whole_beat, visible_tick, 1) >= 0);
+		}
+	}
+}
+
+static struct MidiFileMeterSegment *get_meter_segment_for_position(MidiFile_t midi_file, float measure, long visible_measure, float visible_beat, long visible_whole_beat, float visible_tick, int kind)
+{
+	/* the segment before the first time signature that reaches the target, which is a measure (kind 0), a measure:beat (kind 1), or a measure:beat:tick (kind 2) */
+
+	long low = 0, high;
+	int segments_are_sorted;
+
+	if (! midi_file->meter_segments_are_valid) build_time_maps(midi_file);
+
+	switch (kind)
+	{
+		case 0:
+		{
+			segments_are_sorted = midi_file->meter_segments_are_sorted_by_measure;
+			break;
+		}
+		case 1:
+		{
+			segments_are_sorted = midi_file->meter_segments_are_sorted_by_measure_beat;
+			break;
+		}
+		default:
+		{
+			segments_are_sorted = midi_file->meter_segments_are_sorted_by_measure_beat_tick;
+			break;
+		}
+	}
+
+	if (segments_are_sorted)
+	{
+		for (high = midi_file->number_of_meter_segments - 1; low < high; )
+		{
+			long middle = (low + high + 1) / 2;
+
+			if (! meter_segment_reaches(&(midi_file->meter_segments[middle]), measure, visible_measure, visible_beat, visible_whole_beat, visible_tick, kind))
+			{
+				low = middle;
+			}
+			else
+			{
+				high = middle - 1;
+			}
+		}
+	}
+	else
+	{
+		while ((low + 1 < midi_file->number_of_meter_segments) && ! meter_segment_reaches(&(midi_file->meter_segments[low + 1]), measure, visible_measure, visible_beat, visible_whole_beat, visible_tick, kind)) low++;
+	}
+
+	return &(midi_file->meter_segments[low]);
+}
+
+static int read_header(MidiFileIO_t io, int *file_format_out, MidiFileDivisionType_t *division_type_out, int *resolution_out, int *number_of_tracks_out)
+{
+	/* leaves the io positioned at the first chunk after the header */
+
+	unsigned char chunk_id[4], division_type_and_resolution[4];
+	long chunk_size, chunk_start;
+
+	MidiFileIO_read(io, 4, chunk_id);
+	chunk_size = read_uint32(io);
+	chunk_start = MidiFileIO_tell(io);
+
+	/* check for the RMID variation on SMF */
+
+	if (memcmp(chunk_id, "RIFF", 4) == 0)
+	{
+		MidiFileIO_read(io, 4, chunk_id); /* technically this one is a type id rather than a chunk id, but we'll reuse the buffer anyway */
+
+		if (memcmp(chunk_id, "RMID", 4) != 0)
+		{
+			return -1;
+		}
+
+		MidiFileIO_read(io, 4, chunk_id);
+		chunk_size = read_uint32(io);
+
+		if (memcmp(chunk_id, "data", 4) != 0)
+		{
+			return -1;
+		}
+
+		MidiFileIO_read(io, 4, chunk_id);
+		chunk_size = read_uint32(io);
+		chunk_start = MidiFileIO_tell(io);
+	}
+
+	if (memcmp(chunk_id, "MThd", 4) != 0)
+	{
+		return -1;
+	}
+
+	*file_format_out = read_uint16(io);
+	*number_of_tracks_out = read_uint16(io);
+	MidiFileIO_read(io, 2, division_type_and_resolution);
+
+	switch ((signed char)(division_type_and_resolution[0]))
+	{
+		case -24:
+		{
+			*division_type_out = MIDI_FILE_DIVISION_TYPE_SMPTE24;
+			*resolution_out = division_type_and_resolution[1];
+			break;
+		}
+		case -25:
+		{
+			*division_type_out = MIDI_FILE_DIVISION_TYPE_SMPTE25;
+			*resolution_out = division_type_and_resolution[1];
+			break;
+		}
+		case -29:
+		{
+			*division_type_out = MIDI_FILE_DIVISION_TYPE_SMPTE30DROP;
+			*resolution_out = division_type_and_resolution[1];
+			break;
+		}
+		case -30:
+		{
+			*division_type_out = MIDI_FILE_DIVISION_TYPE_SMPTE30;
+			*resolution_out = division_type_and_resolution[1];
+			break;
+		}
+		default:
+		{
+			*division_type_out = MIDI_FILE_DIVISION_TYPE_PPQ;
+			*resolution_out = interpret_uint16(division_type_and_resolution);
+			break;
+		}
+	}
+
+	/* forwards compatibility:  skip over any extra header data */
+	MidiFileIO_seek(io, chunk_start + chunk_size, SEEK_SET);
+	return 0;
+}
+
+static void MidiFileTrackParser_init(struct MidiFileTrackParser *parser, long end_offset)
+{
+	parser->end_offset = end_offset;
+	parser->tick = 0;
+	parser->running_status = 0;
+	parser->at_end_of_track = 0;
+	parser->end_tick = -1;
+}
+
+static int MidiFileTrackParser_reserve(struct MidiFileTrackParser *parser, long data_length)
+{
+	if (data_length > parser->maximum_data_length)
+	{
+		unsigned char *new_data_buffer = (unsigned char *)(realloc(parser->data_buffer, data_length));
+		if (new_data_buffer == NULL) return -1;
+		parser->data_buffer = new_data_buffer;
+		parser->maximum_data_length = data_length;
+	}
+
+	return 0;
+}
+
+static int read_event(MidiFileIO_t io, struct MidiFileTrackParser *parser, MidiFileEvent_t event)
+{
+	/*
+	 * Decode the next event of an MTrk chunk into the caller's event, which
+	 * is not attached to anything.  Sysex and meta payloads are left in the
+	 * parser's data buffer until the next call.  Returns 0 at the end of the
+	 * track.
+	 */
+
+	while ((MidiFileIO_tell(io) < parser->end_offset) && ! parser->at_end_of_track)
+	{
+		long tick = read_variable_length_quantity(io) + parser->tick;
+		unsigned char status;
+
+		parser->tick = tick;
+
+		if (MidiFileIO_isAtEnd(io)) break;
+		status = MidiFileIO_getc(io);
+
+		if ((status & 0x80) == 0x00)
+		{
+			status = parser->running_status;
+			MidiFileIO_seek(io, -1, SEEK_CUR);
+		}
+		else
+		{
+			parser->running_status = status;
+		}
+
+		/* a truncated buffer ends the track rather than producing a partial event */
+		if (MidiFileIO_getRemainingLength(io) < get_minimum_message_length(status)) break;
+
+		event->tick = tick;
+
+		switch (status & 0xF0)
+		{
+			case 0x80:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
+				event->u.note_off.channel = status & 0x0F;
+				event->u.note_off.note = MidiFileIO_getc(io);
+				event->u.note_off.velocity = MidiFileIO_getc(io);
+				event->u.note_off.partner = 0;
+				event->u.note_off.previous_event_with_same_note = 0;
+				event->u.note_off.next_event_with_same_note = 0;
+				return 1;
+			}
+			case 0x90:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_NOTE_ON;
+				event->u.note_on.channel = status & 0x0F;
+				event->u.note_on.note = MidiFileIO_getc(io);
+				event->u.note_on.velocity = MidiFileIO_getc(io);
+				event->u.note_on.partner = 0;
+				event->u.note_on.previous_event_with_same_note = 0;
+				event->u.note_on.next_event_with_same_note = 0;
+				return 1;
+			}
+			case 0xA0:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
+				event->u.key_pressure.channel = status & 0x0F;
+				event->u.key_pressure.note = MidiFileIO_getc(io);
+				event->u.key_pressure.amount = MidiFileIO_getc(io);
+				return 1;
+			}
+			case 0xB0:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE;
+				event->u.control_change.channel = status & 0x0F;
+				event->u.control_change.number = MidiFileIO_getc(io);
+				event->u.control_change.value = MidiFileIO_getc(io);
+				return 1;
+			}
+			case 0xC0:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE;
+				event->u.program_change.channel = status & 0x0F;
+				event->u.program_change.number = MidiFileIO_getc(io);
+				return 1;
+			}
+			case 0xD0:
+			{
+				event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
+				event->u.channel_pressure.channel = status & 0x0F;
+				event->u.channel_pressure.amount = MidiFileIO_getc(io);
+				return 1;
+			}
+			case 0xE0:
+			{
+				int value = MidiFileIO_getc(io);
+				event->type = MIDI_FILE_EVENT_TYPE_PITCH_WHEEL;
+				event->u.pitch_wheel.channel = status & 0x0F;
+				event->u.pitch_wheel.value = (MidiFileIO_getc(io) << 7) | value;
+				return 1;
+			}
+			case 0xF0:
+			{
+				switch (status)
+				{
+					case 0xF0:
+					case 0xF7:
+					{
+						int data_length = read_variable_length_quantity(io) + 1;
+
+						if ((data_length < 1) || (MidiFileIO_getRemainingLength(io) < data_length - 1) || ((parser->payloads_in_input == NULL) && (MidiFileTrackParser_reserve(parser, data_length) < 0)))
+						{
+							parser->at_end_of_track = 1;
+							break;
+						}
+
+						event->type = MIDI_FILE_EVENT_TYPE_SYSEX;
+						event->u.sysex.data_length = data_length;
+
+						if (parser->payloads_in_input != NULL)
+						{
+							/* the status byte goes where the last byte of the length was, just before the data */
+							event->u.sysex.data_buffer = io->u.buffer.buffer + io->u.buffer.offset - 1;
+							event->u.sysex.data_buffer[0] = status;
+							MidiFileIO_seek(io, data_length - 1, SEEK_CUR);
+						}
+						else
+						{
+							parser->data_buffer[0] = status;
+							MidiFileIO_read(io, data_length - 1, parser->data_buffer + 1);
+							event->u.sysex.data_buffer = parser->data_buffer;
+						}
+
+						return 1;
+					}
+					case 0xFF:
+					{
+						int number = MidiFileIO_getc(io);
+						int data_length = read_variable_length_quantity(io);
+
+						/* keep room for a terminator, like meta events created any other way */
+						if ((data_length < 0) || (MidiFileIO_getRemainingLength(io) < data_length) || ((parser->payloads_in_input == NULL) && (MidiFileTrackParser_reserve(parser, (long)(data_length) + 1) < 0)))
+						{
+							parser->at_end_of_track = 1;
+							break;
+						}
+
+						if (number == 0x2F)
+						{
+							MidiFileIO_seek(io, data_length, SEEK_CUR);
+							parser->end_tick = tick;
+							parser->at_end_of_track = 1;
+							break;
+						}
+
+						event->type = MIDI_FILE_EVENT_TYPE_META;
+						event->u.meta.number = number;
+						event->u.meta.data_length = data_length;
+
+						if (parser->payloads_in_input != NULL)
+						{
+							/* shift the data back over the last byte of the length, to make room for the terminator */
+							event->u.meta.data_buffer = io->u.buffer.buffer + io->u.buffer.offset - 1;
+							memmove(event->u.meta.data_buffer, event->u.meta.data_buffer + 1, data_length);
+							event->u.meta.data_buffer[data_length] = '\0';
+							MidiFileIO_seek(io, data_length, SEEK_CUR);
+						}
+						else
+						{
+							MidiFileIO_read(io, data_length, parser->data_buffer);
+							parser->data_buffer[data_length] = '\0';
+							event->u.meta.data_buffer = parser->data_buffer;
+						}
+
+						return 1;
+					}
+				}
+
+				break;
+			}
+		}
+	}
+
+	parser->at_end_of_track = 1;
+	return 0;
+}
+
+static MidiFileEvent_t append_copy_of_event(MidiFileTrack_t track, MidiFileEvent_t event, MidiFile_t storage, int copy_payload)
+{
+	/*
+	 * For building a track in one pass, when the events arrive in order.  The
+	 * copy and its payload come from the storage of the given file, which is
+	 * the track's own except when loading in parallel.  Meta payloads are
+	 * copied along with their terminator.  Otherwise the payload is shared.
+	 */
+
+	MidiFileEvent_t new_event = allocate_event(storage);
+#ifdef MIDI_FILE_NO_POOL
+	new_event->midi_file = track->midi_file;
+#endif
+	new_event->track = get_track_reference(track);
+	new_event->tick = event->tick;
+	new_event->type = event->type;
+	new_event->u = event->u;
+	new_event->should_be_visited = 0;
+	new_event->is_selected = event->is_selected;
+
+	if (copy_payload && (event->type == MIDI_FILE_EVENT_TYPE_SYSEX))
+	{
+		new_event->u.sysex.data_buffer = allocate_data(storage, event->u.sysex.data_length);
+		memcpy(new_event->u.sysex.data_buffer, event->u.sysex.data_buffer, event->u.sysex.data_length);
+	}
+	else if (copy_payload && (event->type == MIDI_FILE_EVENT_TYPE_META))
+	{
+		new_event->u.meta.data_buffer = allocate_data(storage, event->u.meta.data_length + 1);
+		memcpy(new_event->u.meta.data_buffer, event->u.meta.data_buffer, event->u.meta.data_length + 1);
+	}
+
+	new_event->previous_event_in_track = get_event_reference(track->last_event);
+	new_event->next_event_in_track = 0;
+
+	if (track->last_event == NULL)
+	{
+		track->first_event = new_event;
+	}
+	else
+	{
+		/* only possible if the tick wraps around */
+		if (new_event->tick < track->last_event->tick) track->batch_is_unsorted = 1;
+		track->last_event->next_event_in_track = get_event_reference(new_event);
+	}
+
+	track->last_event = new_event;
+	if (new_event->tick > track->end_tick) track->end_tick = new_event->tick;
+	return new_event;
+}
+
+static void add_payload_in_input(struct MidiFilePayloadsInInput *payloads_in_input, MidiFileEvent_t event)
+{
+	if (payloads_in_input->number_of_events == payloads_in_input->maximum_number_of_events)
+	{
+		long maximum_number_of_events = (payloads_in_input->maximum_number_of_events == 0) ? 1024 : (payloads_in_input->maximum_number_of_events * 2);
+		MidiFileEvent_t *events = (MidiFileEvent_t *)(realloc(payloads_in_input->events, maximum_number_of_events * sizeof (MidiFileEvent_t)));
+
+		if (events == NULL)
+		{
+			payloads_in_input->is_incomplete = 1;
+			return;
+		}
+
+		payloads_in_input->events = events;
+		payloads_in_input->maximum_number_of_events = maximum_number_of_events;
+	}
+
+	payloads_in_input->events[(payloads_in_input->number_of_events)++] = event;
+	payloads_in_input->length += (event->type == MIDI_FILE_EVENT_TYPE_SYSEX) ? event->u.sysex.data_length : (event->u.meta.data_length + 1);
+}
+
+static void read_track(MidiFileIO_t io, struct MidiFileTrackParser *parser, MidiFileTrack_t track, MidiFile_t storage)
+{
+	/* Decode an MTrk chunk onto the end of an empty track.  Delta times are never negative, so the events arrive in order. */
+
+	struct MidiFileEvent event;
+	MidiFileEvent_t new_event;
+
+	event.is_selected = 0;
+
+	while (read_event(io, parser, &event))
+	{
+		new_event = append_copy_of_event(track, &event, storage, (parser->payloads_in_input == NULL));
+		if ((parser->payloads_in_input != NULL) && ((event.type == MIDI_FILE_EVENT_TYPE_SYSEX) || (event.type == MIDI_FILE_EVENT_TYPE_META))) add_payload_in_input(parser->payloads_in_input, new_event);
+	}
+
+	sort_track_event_list(track);
+	if (parser->end_tick >= 0) MidiFileTrack_setEndTick(track, parser->end_tick);
+}
+
+static void *read_tracks_in_thread(void *argument)
+{
+	struct MidiFileLoadThread *thread = (struct MidiFileLoadThread *)(argument);
+	struct MidiFileLoader *loader = thread->loader;
+	struct MidiFileIO io = *(loader->io);
+	struct MidiFileTrackParser parser;
+	struct MidiFilePayloadsInInput payloads_in_input;
+	int job_number;
+
+	memset(&payloads_in_input, 0, sizeof (struct MidiFilePayloadsInInput));
+	parser.data_buffer = NULL;
+	parser.maximum_data_length = 0;
+	parser.payloads_in_input = (loader->payloads_in_input == NULL) ? NULL : &payloads_in_input;
+
+#ifdef MIDI_FILE_THREADS
+	pthread_mutex_lock(&(loader->mutex));
+#endif
+
+	while (loader->next_job < loader->number_of_jobs)
+	{
+		struct MidiFileLoadJob *job;
+
+		job_number = (loader->next_job)++;
+		job = &(loader->jobs[job_number]);
+#ifdef MIDI_FILE_THREADS
+		pthread_mutex_unlock(&(loader->mutex));
+#endif
+
+		MidiFileIO_seek(&io, job->chunk_start, SEEK_SET);
+		MidiFileTrackParser_init(&parser, job->chunk_start + job->chunk_size);
+		read_track(&io, &parser, job->track, &(thread->storage));
+
+#ifdef MIDI_FILE_THREADS
+		pthread_mutex_lock(&(loader->mutex));
+#endif
+	}
+
+	if (parser.payloads_in_input != NULL)
+	{
+		long event_number;
+		for (event_number = 0; event_number < payloads_in_input.number_of_events; event_number++) add_payload_in_input(loader->payloads_in_input, payloads_in_input.events[event_number]);
+		if (payloads_in_input.is_incomplete) loader->payloads_in_input->is_incomplete = 1;
+	}
+
+#ifdef MIDI_FILE_THREADS
+	pthread_mutex_unlock(&(loader->mutex));
+#endif
+
+	free(payloads_in_input.events);
+	free(parser.data_buffer);
+	return NULL;
+}
+
+static void read_tracks_in_parallel(MidiFile_t midi_file, struct MidiFileLoader *loader, int number_of_threads)
+{
+	/*
+	 * The calling thread works through the jobs alongside the others, so the
+	 * load still completes if no more threads can be started.  Which thread
+	 * does which job makes no difference to the result.
+	 */
+
+	struct MidiFileLoadThread *threads, only_thread;
+	int i;
+#ifdef MIDI_FILE_THREADS
+	int number_of_threads_started = 1;
+#endif
+
+	if (number_of_threads > loader->number_of_jobs) number_of_threads = loader->number_of_jobs;
+
+	if ((threads = (struct MidiFileLoadThread *)(malloc(number_of_threads * sizeof (struct MidiFileLoadThread)))) == NULL)
+	{
+		threads = &only_thread;
+		number_of_threads = 1;
+	}
+
+	for (i = 0; i < number_of_threads; i++)
+	{
+		threads[i].loader = loader;
+		init_storage(&(threads[i].storage));
+	}
+
+	loader->next_job = 0;
+
+#ifdef MIDI_FILE_THREADS
+	pthread_mutex_init(&(loader->mutex), NULL);
+
+	while ((number_of_threads_started < number_of_threads) && (pthread_create(&(threads[number_of_threads_started].thread), NULL, read_tracks_in_thread, &(threads[number_of_threads_started])) == 0))
+	{
+		number_of_threads_started++;
+	}
+#endif
+
+	read_tracks_in_thread(&(threads[0]));
+
+#ifdef MIDI_FILE_THREADS
+	for (i = 1; i < number_of_threads_started; i++) pthread_join(threads[i].thread, NULL);
+	pthread_mutex_destroy(&(loader->mutex));
+#endif
+
+	for (i = 0; i < number_of_threads; i++) adopt_storage(midi_file, &(threads[i].storage));
+	if (threads != &only_thread) free(threads);
+}
+
+static MidiFile_t load_midi_file(MidiFileIO_t io, int number_of_threads, struct MidiFilePayloadsInInput *payloads_in_input)
+{
+	/* if given somewhere to note them, sysex and meta payloads are left in the buffer being read from; see load_midi_file_from_owned_buffer() */
+
+	MidiFile_t midi_file;
+	unsigned char chunk_id[4];
+	long chunk_size, chunk_start;
+	int file_format, resolution, number_of_tracks, number_of_tracks_read = 0;
+	MidiFileDivisionType_t division_type;
+	struct MidiFileTrackParser parser;
+	struct MidiFileLoader loader;
+
+	if (read_header(io, &file_format, &division_type, &resolution, &number_of_tracks) < 0) return NULL;
+	midi_file = MidiFile_new(file_format, division_type, resolution);
+
+	parser.data_buffer = NULL;
+	parser.maximum_data_length = 0;
+	parser.payloads_in_input = payloads_in_input;
+
+	/* when loading in parallel, the chunks are only located here, and read afterwards */
+	loader.io = io;
+	loader.payloads_in_input = payloads_in_input;
+	loader.jobs = NULL;
+	loader.number_of_jobs = 0;
+
+	if ((number_of_threads > 1) && (number_of_tracks > 1))
+	{
+		loader.jobs = (struct MidiFileLoadJob *)(malloc(number_of_tracks * sizeof (struct MidiFileLoadJob)));
+	}
+
+	while ((number_of_tracks_read < number_of_tracks) && ! MidiFileIO_isAtEnd(io))
+	{
+		MidiFileIO_read(io, 4, chunk_id);
+		chunk_size = read_uint32(io);
+		chunk_start = MidiFileIO_tell(io);
+
+		if (memcmp(chunk_id, "MTrk", 4) == 0)
+		{
+			MidiFileTrack_t track = MidiFile_createTrack(midi_file);
+
+			if (loader.jobs != NULL)
+			{
+				loader.jobs[loader.number_of_jobs].track = track;
+				loader.jobs[loader.number_of_jobs].chunk_start = chunk_start;
+				loader.jobs[loader.number_of_jobs].chunk_size = chunk_size;
+				loader.number_of_jobs++;
+			}
+			else
+			{
+				MidiFileTrackParser_init(&parser, chunk_start + chunk_size);
+				read_track(io, &parser, track, midi_file);
+			}
+
+			number_of_tracks_read++;
+		}
+
+		/* forwards compatibility:  skip over any unrecognized chunks, or extra data at the end of tracks */
+		MidiFileIO_seek(io, chunk_start + chunk_size, SEEK_SET);
+	}
+
+	free(parser.data_buffer);
+
+	if ((loader.jobs != NULL) && (loader.number_of_jobs > 0)) read_tracks_in_parallel(midi_file, &loader, number_of_threads);
+	free(loader.jobs);
+	return midi_file;
+}
+
+static void probe_track(MidiFileIO_t io, struct MidiFileTrackParser *parser, MidiFileTrack_t track, int flags)
+{
+	/* like read_track(), but keeping only the meta events and the last event, as the flags ask */
+
+	struct MidiFileEvent event, last_event;
+	int last_event_is_kept = 1;
+
+	event.is_selected = 0;
+
+	while (read_event(io, parser, &event))
+	{
+		last_event = event;
+		last_event_is_kept = ((flags & MIDI_FILE_PROBE_META_EVENTS) && (event.type == MIDI_FILE_EVENT_TYPE_META));
+		if (last_event_is_kept) append_copy_of_event(track, &event, track->midi_file, 1);
+	}
+
+	/* reading the end of track overwrote the event's tick, and may even have moved the buffer its payload is still in */
+	if ((flags & MIDI_FILE_PROBE_LAST_EVENTS) && !last_event_is_kept)
+	{
+		if (last_event.type == MIDI_FILE_EVENT_TYPE_SYSEX) last_event.u.sysex.data_buffer = parser->data_buffer;
+		if (last_event.type == MIDI_FILE_EVENT_TYPE_META) last_event.u.meta.data_buffer = parser->data_buffer;
+		append_copy_of_event(track, &last_event, track->midi_file, 1);
+	}
+
+	if (parser->end_tick >= 0) MidiFileTrack_setEndTick(track, parser->end_tick);
+}
+
+static MidiFile_t probe_midi_file(MidiFileIO_t io, int flags)
+{
+	/* the tracks that aren't wanted are skipped over by their chunk lengths, without reading them at all */
+
+	MidiFile_t midi_file;
+	unsigned char chunk_id[4];
+	long chunk_size, chunk_start;
+	int file_format, resolution, number_of_tracks, number_of_tracks_read = 0;
+	MidiFileDivisionType_t division_type;
+	struct MidiFileTrackParser parser;
+
+	if (read_header(io, &file_format, &division_type, &resolution, &number_of_tracks) < 0) return NULL;
+	midi_file = MidiFile_new(file_format, division_type, resolution);
+
+	parser.data_buffer = NULL;
+	parser.maximum_data_length = 0;
+	parser.payloads_in_input = NULL;
+
+	while ((number_of_tracks_read < number_of_tracks) && ! MidiFileIO_isAtEnd(io))
+	{
+		MidiFileIO_read(io, 4, chunk_id);
+		chunk_size = read_uint32(io);
+		chunk_start = MidiFileIO_tell(io);
+
+		if (memcmp(chunk_id, "MTrk", 4) == 0)
+		{
+			MidiFileTrack_t track = MidiFile_createTrack(midi_file);
+
+			if ((flags & MIDI_FILE_PROBE_CONDUCTOR_TRACK) && (number_of_tracks_read == 0))
+			{
+				MidiFileTrackParser_init(&parser, chunk_start + chunk_size);
+				read_track(io, &parser, track, midi_file);
+			}
+			else if (flags & (MIDI_FILE_PROBE_META_EVENTS | MIDI_FILE_PROBE_LAST_EVENTS))
+			{
+				MidiFileTrackParser_init(&parser, chunk_start + chunk_size);
+				probe_track(io, &parser, track, flags);
+			}
+
+			number_of_tracks_read++;
+		}
+
+		MidiFileIO_seek(io, chunk_start + chunk_size, SEEK_SET);
+	}
+
+	free(parser.data_buffer);
+	return midi_file;
+}
+
+static MidiFile_t load_midi_file_from_owned_buffer(unsigned char *buffer, long buffer_length, int number_of_threads)
+{
+	/*
+	 * The buffer is ours, so the sysex and meta payloads can stay in it
+	 * rather than being copied.  That's worth holding on to the whole buffer
+	 * for only if they make up most of it, as in patch archives and sample
+	 * dumps.  Otherwise they are copied out after all, and the buffer freed.
+	 */
+
+	MidiFileIO_t io;
+	MidiFile_t midi_file;
+	struct MidiFilePayloadsInInput payloads_in_input;
+	long event_number;
+
+	memset(&payloads_in_input, 0, sizeof (struct MidiFilePayloadsInInput));
+	io = MidiFileIO_newFromBufferWithLength(buffer, buffer_length);
+	midi_file = load_midi_file(io, number_of_threads, &payloads_in_input);
+	MidiFileIO_free(io);
+
+	if ((midi_file != NULL) && ((payloads_in_input.length >= buffer_length / 2) || payloads_in_input.is_incomplete))
+	{
+		midi_file->input_buffer = buffer;
+		midi_file->input_buffer_length = buffer_length;
+		free(payloads_in_input.events);
+		return midi_file;
+	}
+
+	for (event_number = 0; event_number < payloads_in_input.number_of_events; event_number++)
+	{
+		MidiFileEvent_t event = payloads_in_input.events[event_number];
+
+		if (event->type == MIDI_FILE_EVENT_TYPE_SYSEX)
+		{
+			unsigned char *data_buffer = allocate_data(midi_file, event->u.sysex.data_length);
+			memcpy(data_buffer, event->u.sysex.data_buffer, event->u.sysex.data_length);
+			event->u.sysex.data_buffer = data_buffer;
+		}
+		else
+		{
+			unsigned char *data_buffer = allocate_data(midi_file, event->u.meta.data_length + 1);
+			memcpy(data_buffer, event->u.meta.data_buffer, event->u.meta.data_length + 1);
+			event->u.meta.data_buffer = data_buffer;
+		}
+	}
+
+	free(payloads_in_input.events);
+	free(buffer);
+	return midi_file;
+}
+
+static void start_encoding_track(struct MidiFileTrackEncoder *encoder, MidiFileTrack_t track)
+{
+	encoder->flags = track->midi_file->save_flags;
+
+	/* tempo and time signature events only count in the conductor track, unless every track is a sequence of its own */
+	encoder->may_trim_tempo_and_time_signature_events = ((track->previous_track == NULL) || (track->midi_file->file_format == 2));
+
+	encoder->running_status = 0;
+	encoder->last_tempo_event = NULL;
+	encoder->last_time_signature_event = NULL;
+	encoder->last_key_signature_event = NULL;
+}
+
+static int should_skip_event(struct MidiFileTrackEncoder *encoder, MidiFileEvent_t event)
+{
+	/* a tempo, time signature, or key signature event which only repeats the last one written is redundant */
+
+	MidiFileEvent_t *last_event;
+
+	if (! (encoder->flags & MIDI_FILE_SAVE_TRIM_META_EVENTS) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return 0;
+
+	switch (event->u.meta.number)
+	{
+		case 0x51:
+		{
+			if (! encoder->may_trim_tempo_and_time_signature_events) return 0;
+			last_event = &(encoder->last_tempo_event);
+			break;
+		}
+		case 0x58:
+		{
+			if (! encoder->may_trim_tempo_and_time_signature_events) return 0;
+			last_event = &(encoder->last_time_signature_event);
+			break;
+		}
+		case 0x59:
+		{
+			last_event = &(encoder->last_key_signature_event);
+			break;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+
+	if ((*last_event != NULL) && ((*last_event)->u.meta.data_length == event->u.meta.data_length) && (memcmp((*last_event)->u.meta.data_buffer, event->u.meta.data_buffer, event->u.meta.data_length) == 0)) return 1;
+	*last_event = event;
+	return 0;
+}
+
+static unsigned char get_event_status(struct MidiFileTrackEncoder *encoder, MidiFileEvent_t event)
+{
+	/* the status byte the event is saved with, or 0 if it isn't saved as a message of its own */
+
+	switch (event->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			/* a note on with a velocity of zero has the same status as the note ons around it, so that running status carries on through it */
+			return ((encoder->flags & MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS) ? 0x90 : 0x80) | (event->u.note_off.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return 0x90 | (event->u.note_on.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return 0xA0 | (event->u.key_pressure.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		{
+			return 0xB0 | (event->u.control_change.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		{
+			return 0xC0 | (event->u.program_change.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return 0xD0 | (event->u.channel_pressure.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			return 0xE0 | (event->u.pitch_wheel.channel & 0x0F);
+		}
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			return event->u.sysex.data_buffer[0];
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			return 0xFF;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
+}
+
+static int encode_status(struct MidiFileTrackEncoder *encoder, unsigned char *buffer, unsigned char status)
+{
+	/* returns the number of bytes needed, which is none when running status covers it */
+
+	if ((encoder->flags & MIDI_FILE_SAVE_RUNNING_STATUS) && (status == encoder->running_status)) return 0;
+
+	/* sysex and meta events cancel running status */
+	encoder->running_status = (status < 0xF0) ? status : 0;
+
+	buffer[0] = status;
+	return 1;
+}
+
+static long get_event_size(MidiFileEvent_t event, long previous_tick)
+{
+	/* the number of bytes save_track_events() will write for this event, with a status byte of its own */
+
+	long size = get_variable_length_quantity_size(event->tick - previous_tick);
+
+	switch (event->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			return size + 3;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return size + 2;
+		}
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			int data_length = event->u.sysex.data_length;
+			return size + 1 + get_variable_length_quantity_size(data_length - 1) + (data_length - 1);
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			int data_length = event->u.meta.data_length;
+			return size + 2 + get_variable_length_quantity_size(data_length) + data_length;
+		}
+		default:
+		{
+			return size;
+		}
+	}
+}
+
+static long get_track_size(MidiFileTrack_t track)
+{
+	/* the length of the MTrk chunk body, including the end of track meta event */
+
+	struct MidiFileTrackEncoder encoder;
+	MidiFileEvent_t event;
+	long size = 0, previous_tick = 0;
+	unsigned char status;
+
+	start_encoding_track(&encoder, track);
+
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track))
+	{
+		if (should_skip_event(&encoder, event)) continue;
+		size += get_event_size(event, previous_tick);
+		if ((encoder.flags & MIDI_FILE_SAVE_RUNNING_STATUS) && ((status = get_event_status(&encoder, event)) != 0)) size -= 1 - encode_status(&encoder, &status, status);
+		previous_tick = event->tick;
+	}
+
+	return size + get_variable_length_quantity_size(track->end_tick - previous_tick) + 3;
+}
+
+static long get_file_size(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	long size = 14;
+
+	sort_batch(midi_file);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		size += 8 + get_track_size(track);
+	}
+
+	return size;
+}
+
+static void save_track_events(MidiFileTrack_t track, MidiFileIO_t io)
+{
+	struct MidiFileTrackEncoder encoder;
+	MidiFileEvent_t event;
+	long tick, previous_tick;
+
+	start_encoding_track(&encoder, track);
+	previous_tick = 0;
+
+	for (event = track->first_event; event != NULL; event = get_event(event->next_event_in_track))
+	{
+		/* assemble the delta time and message header in one piece, to keep the number of writes down */
+		unsigned char message[12];
+		int message_length;
+
+		if (should_skip_event(&encoder, event)) continue;
+		tick = event->tick;
+		message_length = encode_variable_length_quantity(message, tick - previous_tick);
+
+		switch (event->type)
+		{
+			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			{
+				message_length += encode_status(&encoder, message + message_length, ((encoder.flags & MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS) ? 0x90 : 0x80) | (event->u.note_off.channel & 0x0F));
+				message[message_length++] = event->u.note_off.note & 0x7F;
+				message[message_length++] = (encoder.flags & MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS) ? 0 : (event->u.note_off.velocity & 0x7F);
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+			{
+				message_length += encode_status(&encoder, message + message_length, 0x90 | (event->u.note_on.channel & 0x0F));
+				message[message_length++] = event->u.note_on.note & 0x7F;
+				message[message_length++] = event->u.note_on.velocity & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+			{
+				message_length += encode_status(&encoder, message + message_length, 0xA0 | (event->u.key_pressure.channel & 0x0F));
+				message[message_length++] = event->u.key_pressure.note & 0x7F;
+				message[message_length++] = event->u.key_pressure.amount & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+			{
+				message_length += encode_status(&encoder, message + message_length, 0xB0 | (event->u.control_change.channel & 0x0F));
+				message[message_length++] = event->u.control_change.number & 0x7F;
+				message[message_length++] = event->u.control_change.value & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+			{
+				message_length += encode_status(&encoder, message + message_length, 0xC0 | (event->u.program_change.channel & 0x0F));
+				message[message_length++] = event->u.program_change.number & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+			{
+				message_length += encode_status(&encoder, message + message_length, 0xD0 | (event->u.channel_pressure.channel & 0x0F));
+				message[message_length++] = event->u.channel_pressure.amount & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+			{
+				int value = event->u.pitch_wheel.value;
+				message_length += encode_status(&encoder, message + message_length, 0xE0 | (event->u.pitch_wheel.channel & 0x0F));
+				message[message_length++] = value & 0x7F;
+				message[message_length++] = (value >> 7) & 0x7F;
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_SYSEX:
+			{
+				int data_length = event->u.sysex.data_length;
+				unsigned char *data = event->u.sysex.data_buffer;
+				message_length += encode_status(&encoder, message + message_length, data[0]);
+				message_length += encode_variable_length_quantity(message + message_length, data_length - 1);
+				MidiFileIO_write(io, message_length, message);
+				MidiFileIO_write(io, data_length - 1, data + 1);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_META:
+			{
+				int data_length = event->u.meta.data_length;
+				unsigned char *data = event->u.meta.data_buffer;
+				message_length += encode_status(&encoder, message + message_length, 0xFF);
+				message[message_length++] = event->u.meta.number & 0x7F;
+				message_length += encode_variable_length_quantity(message + message_length, data_length);
+				MidiFileIO_write(io, message_length, message);
+				MidiFileIO_write(io, data_length, data);
+				break;
+			}
+			default:
+			{
+				MidiFileIO_write(io, message_length, message);
+				break;
+			}
+		}
+
+		previous_tick = tick;
+	}
+
+	write_variable_length_quantity(io, track->end_tick - previous_tick);
+	MidiFileIO_write(io, 3, (unsigned char *)("\xFF\x2F\x00"));
+}
+
+static int save_midi_file(MidiFile_t midi_file, MidiFileIO_t io)
+{
+	MidiFileTrack_t track;
+	MidiFileIO_t track_io = NULL;
+
+	sort_batch(midi_file);
+	MidiFileIO_write(io, 4, (unsigned char *)("MThd"));
+	write_uint32(io, 6);
+	write_uint16(io, (unsigned short)(MidiFile_getFileFormat(midi_file)));
+	write_uint16(io, (unsigned short)(MidiFile_getNumberOfTracks(midi_file)));
+
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			write_uint16(io, (unsigned short)(MidiFile_getResolution(midi_file)));
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			MidiFileIO_putc(io, -24);
+			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			MidiFileIO_putc(io, -25);
+			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			MidiFileIO_putc(io, -29);
+			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			MidiFileIO_putc(io, -30);
+			MidiFileIO_putc(io, MidiFile_getResolution(midi_file));
+			break;
+		}
+		default:
+		{
+			/* keep the header at its declared size even if the division is unusable */
+			write_uint16(io, 0);
+			break;
+		}
+	}
+
+	if (io->type != MIDI_FILE_IO_TYPE_GROWABLE_BUFFER) track_io = MidiFileIO_newGrowableBuffer(0);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		MidiFileIO_write(io, 4, (unsigned char *)("MTrk"));
+
+		if (track_io == NULL)
+		{
+			/* already writing to memory, so the chunk size can be filled in afterwards */
+			long track_size_offset = MidiFileIO_tell(io);
+			write_uint32(io, 0);
+			save_track_events(track, io);
+			if (! io->failed) encode_uint32(io->u.growable_buffer.buffer + track_size_offset, MidiFileIO_tell(io) - track_size_offset - 4);
+		}
+		else
+		{
+			/* stage the track in memory so that its size is known before any of it is written, and the output never has to be rewound */
+			track_io->u.growable_buffer.offset = 0;
+			save_track_events(track, track_io);
+			write_uint32(io, MidiFileIO_tell(track_io));
+
+			if (track_io->failed)
+			{
+				io->failed = 1;
+			}
+			else
+			{
+				MidiFileIO_write(io, MidiFileIO_tell(track_io), track_io->u.growable_buffer.buffer);
+			}
+		}
+	}
+
+	if (track_io != NULL) MidiFileIO_free(track_io);
+	return (io->failed ? -1 : 0);
+}
+
+static unsigned char *read_file(const char *filename, int may_map, long *buffer_length_out, int *buffer_is_mapped_out)
+{
+	FILE *in;
+	unsigned char *buffer = NULL;
+	long buffer_length = 0, maximum_buffer_length = 0, expected_buffer_length = 0;
+	size_t length_read;
+
+#ifndef _WIN32
+	{
+		/* map regular files straight into memory, unless the caller wants a buffer of its own */
+
+		int fd;
+		struct stat file_status;
+
+		if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+
+		if ((fstat(fd, &file_status) == 0) && S_ISREG(file_status.st_mode) && (file_status.st_size > 0) && (file_status.st_size < LONG_MAX))
+		{
+			void *mapping = may_map ? mmap(NULL, (size_t)(file_status.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+
+			if (mapping != MAP_FAILED)
+			{
+				close(fd);
+				*buffer_length_out = (long)(file_status.st_size);
+				*buffer_is_mapped_out = 1;
+				return (unsigned char *)(mapping);
+			}
+
+			expected_buffer_length = (long)(file_status.st_size);
+		}
+
+		close(fd);
+	}
+#endif
+
+	/* otherwise (pipes, or platforms without mmap) slurp it in large blocks, or all at once if the size is known */
+
+	if ((in = fopen(filename, "rb")) == NULL) return NULL;
+
+	do
+	{
+		if (buffer_length == maximum_buffer_length)
+		{
+			unsigned char *new_buffer;
+			maximum_buffer_length = (maximum_buffer_length > 0) ? (maximum_buffer_length * 2) : (expected_buffer_length > 0) ? (expected_buffer_length + 1) : 65536;
+
+			if ((new_buffer = (unsigned char *)(realloc(buffer, maximum_buffer_length))) == NULL)
+			{
+				free(buffer);
+				fclose(in);
+				return NULL;
+			}
+
+			buffer = new_buffer;
+		}
+
+		length_read = fread(buffer + buffer_length, 1, maximum_buffer_length - buffer_length, in);
+		buffer_length += length_read;
+	}
+	while (length_read > 0);
+
+	fclose(in);
+	*buffer_length_out = buffer_length;
+	*buffer_is_mapped_out = 0;
+	return buffer;
+}
+
+static int get_number_of_load_threads(int number_of_threads)
+{
+	/* zero or less means one per processor */
+#ifdef MIDI_FILE_THREADS
+	if (number_of_threads < 1) number_of_threads = (int)(sysconf(_SC_NPROCESSORS_ONLN));
+	return number_of_threads;
+#else
+	(void)(number_of_threads);
+	return 1;
+#endif
+}
+
+static void free_file_buffer(unsigned char *buffer, long buffer_length, int buffer_is_mapped)
+{
+#ifndef _WIN32
+	if (buffer_is_mapped)
+	{
+		munmap(buffer, (size_t)(buffer_length));
+		return;
+	}
+#endif
+
+	free(buffer);
+}
+
+static char *get_temporary_filename(const char *filename)
+{
+	char *temporary_filename = (char *)(malloc(strlen(filename) + 5));
+	if (temporary_filename != NULL) sprintf(temporary_filename, "%s.tmp", filename);
+	return temporary_filename;
+}
+
+static int sync_file(FILE *file)
+{
+	if (fflush(file) != 0) return -1;
+#ifdef _WIN32
+	return (_commit(_fileno(file)) == 0) ? 0 : -1;
+#else
+	return (fsync(fileno(file)) == 0) ? 0 : -1;
+#endif
+}
+
+static int replace_file(const char *temporary_filename, const char *filename)
+{
+#ifdef _WIN32
+	/* rename() won't replace an existing file here */
+	remove(filename);
+#endif
+	return (rename(temporary_filename, filename) == 0) ? 0 : -1;
+}
+
+static int save_midi_file_atomically(MidiFile_t midi_file, const char *filename)
+{
+	/* through a temporary file, so that a crash leaves either the old file or the new one */
+
+	char *temporary_filename;
+	FILE *out;
+	MidiFileIO_t io;
+	int result;
+
+	if ((temporary_filename = get_temporary_filename(filename)) == NULL) return -1;
+
+	if ((out = fopen(temporary_filename, "wb")) == NULL)
+	{
+		free(temporary_filename);
+		return -1;
+	}
+
+	setvbuf(out, NULL, _IOFBF, 65536);
+	io = MidiFileIO_newFromFile(out);
+	result = save_midi_file(midi_file, io);
+	MidiFileIO_free(io);
+	if (sync_file(out) != 0) result = -1;
+	if (fclose(out) != 0) result = -1;
+
+	if ((result == 0) && (replace_file(temporary_filename, filename) != 0)) result = -1;
+
+	if (result != 0) remove(temporary_filename);
+	free(temporary_filename);
+	return result;
+}
+
+static unsigned long get_checksum(unsigned char *buffer, long length)
+{
+	/* 32 bit FNV-1a */
+
+	unsigned long checksum = 2166136261UL;
+	long i;
+
+	for (i = 0; i < length; i++) checksum = ((checksum ^ buffer[i]) * 16777619UL) & 0xFFFFFFFFUL;
+	return checksum;
+}
+
+static unsigned char *reserve_journal_record(MidiFileJournal_t journal, unsigned char *p, long length)
+{
+	/* makes room for another length bytes from p onwards, which may move the record */
+
+	long offset = p - journal->record;
+
+	if (offset + length > journal->maximum_record_length)
+	{
+		long maximum_record_length = journal->maximum_record_length;
+		unsigned char *record;
+
+		while (offset + length > maximum_record_length) maximum_record_length *= 2;
+		if ((record = (unsigned char *)(realloc(journal->record, maximum_record_length))) == NULL) return NULL;
+		journal->record = record;
+		journal->maximum_record_length = maximum_record_length;
+	}
+
+	return journal->record + offset;
+}
+
+static MidiFileEvent_t get_first_unjournaled_event(MidiFileTrack_t track)
+{
+	return (track->journal_is_stale || (track->last_journaled_event == NULL)) ? track->first_event : get_event(track->last_journaled_event->next_event_in_track);
+}
+
+static long build_journal_record(MidiFileJournal_t journal, int is_checkpoint)
+{
+	/* returns the length of the framed record, 0 if nothing has changed, or -1 if out of memory */
+
+	MidiFile_t midi_file = journal->midi_file;
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	int number_of_updates = 0;
+	unsigned char *p;
+
+	for (track = midi_file->first_track; track != NULL; track = track->next_track)
+	{
+		if (is_checkpoint || track->journal_is_stale || (get_first_unjournaled_event(track) != NULL)) number_of_updates++;
+	}
+
+	if (!is_checkpoint && (number_of_updates == 0) && (midi_file->file_format == journal->file_format) && (midi_file->division_type == journal->division_type) && (midi_file->resolution == journal->resolution) && (midi_file->number_of_tracks == journal->number_of_tracks)) return 0;
+	if ((p = reserve_journal_record(journal, journal->record, 64)) == NULL) return -1;
+
+	p += 4;
+	*p++ = is_checkpoint ? 'C' : 'S';
+	p = pack_number(p, midi_file->file_format);
+	p = pack_number(p, midi_file->division_type);
+	p = pack_number(p, midi_file->resolution);
+	p = pack_number(p, midi_file->number_of_tracks);
+	p = pack_number(p, number_of_updates);
+
+	for (track = midi_file->first_track; track != NULL; track = track->next_track)
+	{
+		int should_replace = (is_checkpoint || track->journal_is_stale);
+		MidiFileEvent_t first_event = should_replace ? track->first_event : get_first_unjournaled_event(track);
+		long previous_tick = (should_replace || (track->last_journaled_event == NULL)) ? 0 : track->last_journaled_event->tick;
+		long number_of_events = 0, maximum_length = 64;
+
+		if (!should_replace && (first_event == NULL)) continue;
+
+		for (event = first_event; event != NULL; event = get_event(event->next_event_in_track))
+		{
+			number_of_events++;
+			maximum_length += get_maximum_packed_event_length(event);
+		}
+
+		if ((p = reserve_journal_record(journal, p, maximum_length)) == NULL) return -1;
+		p = pack_number(p, track->number);
+		*p++ = (unsigned char)(should_replace);
+		p = pack_number(p, track->end_tick);
+		p = pack_number(p, previous_tick);
+		p = pack_number(p, number_of_events);
+
+		for (event = first_event; event != NULL; event = get_event(event->next_event_in_track))
+		{
+			p = pack_event(p, event, previous_tick);
+			previous_tick = event->tick;
+		}
+	}
+
+	if ((p = reserve_journal_record(journal, p, 4)) == NULL) return -1;
+	encode_uint32(journal->record, (unsigned long)(p - journal->record - 4));
+	encode_uint32(p, get_checksum(journal->record + 4, p - journal->record - 4));
+	return p + 4 - journal->record;
+}
+
+static void note_journal_saved(MidiFileJournal_t journal)
+{
+	MidiFile_t midi_file = journal->midi_file;
+	MidiFileTrack_t track;
+
+	for (track = midi_file->first_track; track != NULL; track = track->next_track)
+	{
+		track->last_journaled_event = track->last_event;
+		track->journal_is_stale = 0;
+	}
+
+	journal->file_format = midi_file->file_format;
+	journal->division_type = midi_file->division_type;
+	journal->resolution = midi_file->resolution;
+	journal->number_of_tracks = midi_file->number_of_tracks;
+}
+
+static int compact_journal(MidiFileJournal_t journal)
+{
+	/* writes a new journal holding just a checkpoint, and swaps it in, so that a crash part way through leaves the old one */
+
+	char *temporary_filename;
+	FILE *out;
+	long record_length;
+	int result = 0;
+
+	if ((record_length = build_journal_record(journal, 1)) < 0) return -1;
+	if ((temporary_filename = get_temporary_filename(journal->filename)) == NULL) return -1;
+
+	if ((out = fopen(temporary_filename, "wb")) == NULL)
+	{
+		free(temporary_filename);
+		return -1;
+	}
+
+	if ((fwrite(MIDI_FILE_JOURNAL_SIGNATURE, 1, 4, out) != 4) || (fwrite(journal->record, 1, record_length, out) != (size_t)(record_length)) || (sync_file(out) != 0)) result = -1;
+	if (fclose(out) != 0) result = -1;
+
+	if (result == 0)
+	{
+		if (journal->file != NULL) fclose(journal->file);
+		if (replace_file(temporary_filename, journal->filename) != 0) result = -1;
+		if ((journal->file = fopen(journal->filename, "ab")) == NULL) result = -1;
+	}
+
+	if (result != 0) remove(temporary_filename);
+	free(temporary_filename);
+
+	if (result != 0)
+	{
+		/* try again next time */
+		journal->midi_file->journal_needs_compaction = 1;
+		return -1;
+	}
+
+	journal->length = journal->checkpoint_length = 4 + record_length;
+	journal->number_of_saves_since_sync = 0;
+	journal->midi_file->journal_needs_compaction = 0;
+	note_journal_saved(journal);
+	return 0;
+}
+
+static int replay_journal_record(MidiFile_t *midi_file_p, unsigned char *p, long length)
+{
+	/* returns -1 if the record doesn't make sense, which only a bug or deliberate tampering could cause, since it passed the checksum */
+
+	unsigned char *start = p, *end = p + length;
+	MidiFile_t midi_file = *midi_file_p;
+	int is_checkpoint, file_format, resolution, number_of_tracks, number_of_updates, update_number;
+	MidiFileDivisionType_t division_type;
+
+	if (length < 6) return -1;
+	is_checkpoint = (*p++ == 'C');
+	file_format = unpack_number(&p);
+	division_type = (MidiFileDivisionType_t)(unpack_number(&p));
+	resolution = unpack_number(&p);
+	number_of_tracks = unpack_number(&p);
+	number_of_updates = unpack_number(&p);
+
+	if (is_checkpoint)
+	{
+		/* only ever the first record */
+		if ((midi_file != NULL) || ((midi_file = MidiFile_new(file_format, division_type, resolution)) == NULL)) return -1;
+		*midi_file_p = midi_file;
+	}
+	else
+	{
+		if (midi_file == NULL) return -1;
+		MidiFile_setFileFormat(midi_file, file_format);
+		MidiFile_setDivisionType(midi_file, division_type);
+		MidiFile_setResolution(midi_file, resolution);
+	}
+
+	while (midi_file->number_of_tracks < number_of_tracks) MidiFile_createTrack(midi_file);
+	while (midi_file->number_of_tracks > number_of_tracks) MidiFileTrack_delete(midi_file->last_track);
+
+	for (update_number = 0; update_number < number_of_updates; update_number++)
+	{
+		MidiFileTrack_t track;
+		struct MidiFileEvent event;
+		int should_replace;
+		long end_tick, number_of_events, event_number;
+
+		if ((p >= end) || ((track = MidiFile_getTrackByNumber(midi_file, unpack_number(&p), 0)) == NULL)) return -1;
+		should_replace = *p++;
+		end_tick = unpack_number(&p);
+		event.tick = unpack_number(&p);
+		number_of_events = unpack_number(&p);
+
+		if (should_replace)
+		{
+			while (track->first_event != NULL) MidiFileEvent_delete(track->first_event);
+			track->end_tick = 0;
+		}
+
+		for (event_number = 0; event_number < number_of_events; event_number++)
+		{
+			if (p >= end) return -1;
+			p = unpack_event(p, &event);
+			if ((p < start) || (p > end)) return -1;
+			append_copy_of_event(track, &event, midi_file, 1);
+		}
+
+		track->end_tick = end_tick;
+	}
+
+	return (p == end) ? 0 : -1;
+}
+
+/*
+ * Public API
+ */
+
+MidiFile_t MidiFile_load(char *filename)
+{
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_mapped;
+
+	if ((filename == NULL) || ((buffer = read_file(filename, 0, &buffer_length, &buffer_is_mapped)) == NULL)) return NULL;
+	return load_midi_file_from_owned_buffer(buffer, buffer_length, 1);
+}
+
+MidiFile_t MidiFile_probe(char *filename, int flags)
+{
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_mapped;
+	MidiFileIO_t io;
+	MidiFile_t midi_file;
+
+	/* mapped, so that the pages of the tracks being skipped are never even read in */
+	if ((filename == NULL) || ((buffer = read_file(filename, 1, &buffer_length, &buffer_is_mapped)) == NULL)) return NULL;
+
+	io = MidiFileIO_newFromBufferWithLength(buffer, buffer_length);
+	midi_file = probe_midi_file(io, flags);
+	MidiFileIO_free(io);
+	free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+	return midi_file;
+}
+
+int MidiFile_save(MidiFile_t midi_file, const char* filename)
+{
+	FILE *out;
+	MidiFileIO_t io;
+	int result;
+
+	if ((midi_file == NULL) || (filename == NULL) || ((out = fopen(filename, "wb")) == NULL)) return -1;
+
+	/* the writer never seeks, so this works for pipes and devices too */
+	setvbuf(out, NULL, _IOFBF, 65536);
+
+	io = MidiFileIO_newFromFile(out);
+	result = save_midi_file(midi_file, io);
+	MidiFileIO_free(io);
+	if (fclose(out) != 0) result = -1;
+	return result;
+}
+
+MidiFile_t MidiFile_loadFromBuffer(unsigned char *buffer)
+{
+	MidiFileIO_t io;
+	MidiFile_t midi_file;
+
+	if (buffer == NULL) return NULL;
+
+	io = MidiFileIO_newFromBuffer(buffer);
+	midi_file = load_midi_file(io, 1, NULL);
+	MidiFileIO_free(io);
+	return midi_file;
+}
+
+MidiFile_t MidiFile_loadFromBufferWithLength(unsigned char *buffer, long buffer_length)
+{
+	MidiFileIO_t io;
+	MidiFile_t midi_file;
+
+	if ((buffer == NULL) || (buffer_length < 0)) return NULL;
+
+	io = MidiFileIO_newFromBufferWithLength(buffer, buffer_length);
+	midi_file = load_midi_file(io, 1, NULL);
+	MidiFileIO_free(io);
+	return midi_file;
+}
+
+MidiFile_t MidiFile_loadInParallel(char *filename, int number_of_threads)
+{
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_mapped;
+
+	if ((filename == NULL) || ((buffer = read_file(filename, 0, &buffer_length, &buffer_is_mapped)) == NULL)) return NULL;
+	return load_midi_file_from_owned_buffer(buffer, buffer_length, get_number_of_load_threads(number_of_threads));
+}
+
+MidiFile_t MidiFile_loadFromBufferWithLengthInParallel(unsigned char *buffer, long buffer_length, int number_of_threads)
+{
+	MidiFileIO_t io;
+	MidiFile_t midi_file;
+
+	if ((buffer == NULL) || (buffer_length < 0)) return NULL;
+
+	io = MidiFileIO_newFromBufferWithLength(buffer, buffer_length);
+	midi_file = load_midi_file(io, get_number_of_load_threads(number_of_threads), NULL);
+	MidiFileIO_free(io);
+	return midi_file;
+}
+
+int MidiFile_saveToBuffer(MidiFile_t midi_file, unsigned char *buffer)
+{
+	MidiFileIO_t io;
+
+	if ((midi_file == NULL) || (buffer == NULL)) return -1;
+
+	io = MidiFileIO_newFromBuffer(buffer);
+	save_midi_file(midi_file, io);
+	MidiFileIO_free(io);
+	return 0;
+}
+
+unsigned char *MidiFile_saveToGrowableBuffer(MidiFile_t midi_file, int *file_size_out)
+{
+	MidiFileIO_t io;
+	unsigned char *buffer = NULL;
+
+	if ((midi_file == NULL) || (file_size_out == NULL)) return NULL;
+
+	io = MidiFileIO_newGrowableBuffer(65536);
+
+	if (save_midi_file(midi_file, io) == 0)
+	{
+		*file_size_out = (int)(MidiFileIO_tell(io));
+		buffer = MidiFileIO_detachGrowableBuffer(io);
+	}
+
+	MidiFileIO_free(io);
+	return buffer;
+}
+
+int MidiFile_getFileSize(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return (int)(get_file_size(midi_file));
+}
+
+MidiFile_t MidiFile_new(int file_format, MidiFileDivisionType_t division_type, int resolution)
+{
+	MidiFile_t midi_file = (MidiFile_t)(malloc(sizeof(struct MidiFile)));
+	midi_file->file_format = file_format;
+	midi_file->division_type = division_type;
+	midi_file->resolution = resolution;
+
+	switch (division_type)
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			midi_file->number_of_frames_per_second = 30.0;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			midi_file->number_of_frames_per_second = 24.0;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			midi_file->number_of_frames_per_second = 25.0;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			midi_file->number_of_frames_per_second = 29.97;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			midi_file->number_of_frames_per_second = 30.0;
+			break;
+		}
+		default:
+		{
+			midi_file->number_of_frames_per_second = 30.0;
+			break;
+		}
+	}
+
+	midi_file->number_of_tracks = 0;
+	midi_file->first_track = NULL;
+	midi_file->last_track = NULL;
+	midi_file->first_event = NULL;
+	midi_file->last_event = NULL;
+	midi_file->measure_beat = MidiFileMeasureBeat_new();
+	midi_file->measure_beat_tick = MidiFileMeasureBeatTick_new();
+	midi_file->hour_minute_second = MidiFileHourMinuteSecond_new();
+	midi_file->hour_minute_second_frame = MidiFileHourMinuteSecondFrame_new();
+	midi_file->event_iterator_current = NULL;
+	midi_file->event_iterator_next = NULL;
+	midi_file->tempo_segments = NULL;
+	midi_file->number_of_tempo_segments = 0;
+	midi_file->maximum_number_of_tempo_segments = 0;
+	midi_file->tempo_segments_are_valid = 0;
+	midi_file->tempo_segments_are_sorted = 0;
+	midi_file->meter_segments = NULL;
+	midi_file->number_of_meter_segments = 0;
+	midi_file->maximum_number_of_meter_segments = 0;
+	midi_file->meter_segments_are_valid = 0;
+	midi_file->file_event_list_is_stale = 1;
+	init_mutex(&(midi_file->file_event_list_mutex));
+	midi_file->tick_index = NULL;
+	midi_file->batch_depth = 0;
+	midi_file->batch_is_unsorted = 0;
+	midi_file->batch_was_indexed = 0;
+	midi_file->journal = NULL;
+	midi_file->journal_needs_compaction = 0;
+	midi_file->save_flags = MIDI_FILE_SAVE_DEFAULT;
+	midi_file->input_buffer = NULL;
+	midi_file->input_buffer_length = 0;
+	midi_file->number_of_lent_events = 0;
+	midi_file->number_of_borrowed_events = 0;
+	midi_file->is_freed = 0;
+#ifndef MIDI_FILE_NO_POOL
+	MidiFilePool_initForEvents(&(midi_file->event_pool), midi_file);
+	MidiFilePool_init(&(midi_file->small_data_pool), MIDI_FILE_SMALL_DATA_LENGTH);
+	midi_file->first_large_data = NULL;
+#endif
+	return midi_file;
+}
+
+MidiFile_t MidiFile_newFromTemplate(MidiFile_t template_midi_file)
+{
+	if (template_midi_file == NULL) return MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 960);
+	return MidiFile_new(MidiFile_getFileFormat(template_midi_file), MidiFile_getDivisionType(template_midi_file), MidiFile_getResolution(template_midi_file));
+}
+
+int MidiFile_free(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track, next_track;
+
+	if (midi_file == NULL) return -1;
+	MidiFileHourMinuteSecondFrame_free(midi_file->hour_minute_second_frame);
+	MidiFileHourMinuteSecond_free(midi_file->hour_minute_second);
+	MidiFileMeasureBeatTick_free(midi_file->measure_beat_tick);
+	MidiFileMeasureBeat_free(midi_file->measure_beat);
+	free(midi_file->tempo_segments);
+	free(midi_file->meter_segments);
+	MidiFileTickIndex_free(midi_file->tick_index);
+	midi_file->tick_index = NULL;
+
+#ifdef MIDI_FILE_NO_POOL
+	for (track = midi_file->first_track; track != NULL; track = next_track)
+	{
+		next_track = track->next_track;
+		MidiFileTrack_delete(track);
+	}
+#else
+	/* the events and their data live in the pools, so there is no need to unlink them one at a time, except to give back any from another file */
+	for (track = midi_file->first_track; track != NULL; track = next_track)
+	{
+		next_track = track->next_track;
+		copy_track_for_snapshots(track);
+		MidiFileTickIndex_free(track->tick_index);
+
+		if (midi_file->number_of_borrowed_events > 0)
+		{
+			MidiFileEvent_t event, next_event_in_track;
+
+			for (event = track->first_event; event != NULL; event = next_event_in_track)
+			{
+				next_event_in_track = get_event(event->next_event_in_track);
+				if (get_event_storage(event) != midi_file) free_event_and_data(event);
+			}
+		}
+
+		unregister_block(track->reference >> MIDI_FILE_REFERENCE_ITEM_BITS);
+		free(track);
+	}
+#endif
+
+	/* events which are detached or in other files keep the storage in use until they are deleted */
+	if (midi_file->number_of_lent_events > 0)
+	{
+		midi_file->first_track = NULL;
+		midi_file->last_track = NULL;
+		midi_file->number_of_tracks = 0;
+		midi_file->is_freed = 1;
+	}
+	else
+	{
+		free_storage(midi_file);
+	}
+
+	return 0;
+}
+
+int MidiFile_getFileFormat(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return midi_file->file_format;
+}
+
+int MidiFile_setFileFormat(MidiFile_t midi_file, int file_format)
+{
+	if (midi_file == NULL) return -1;
+	midi_file->file_format = file_format;
+	return 0;
+}
+
+MidiFileDivisionType_t MidiFile_getDivisionType(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return MIDI_FILE_DIVISION_TYPE_INVALID;
+	return midi_file->division_type;
+}
+
+int MidiFile_setDivisionType(MidiFile_t midi_file, MidiFileDivisionType_t division_type)
+{
+	if (midi_file == NULL) return -1;
+	midi_file->division_type = division_type;
+	invalidate_tempo_map(midi_file);
+
+	switch (division_type)
+	{
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			midi_file->number_of_frames_per_second = 24.0;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			midi_file->number_of_frames_per_second = 25.0;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			midi_file->number_of_frames_per_second = 29.97;
+			break;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			midi_file->number_of_frames_per_second = 30.0;
+			break;
+		}
+		default:
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+int MidiFile_getResolution(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return midi_file->resolution;
+}
+
+int MidiFile_setResolution(MidiFile_t midi_file, int resolution)
+{
+	if (midi_file == NULL) return -1;
+	midi_file->resolution = resolution;
+	invalidate_tempo_map(midi_file);
+	return 0;
+}
+
+float MidiFile_getNumberOfFramesPerSecond(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return midi_file->number_of_frames_per_second;
+}
+
+int MidiFile_setNumberOfFramesPerSecond(MidiFile_t midi_file, float number_of_frames_per_second)
+{
+	if (midi_file == NULL) return -1;
+	midi_file->number_of_frames_per_second = number_of_frames_per_second;
+	return 0;
+}
+
+int MidiFile_getSaveFlags(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return midi_file->save_flags;
+}
+
+int MidiFile_setSaveFlags(MidiFile_t midi_file, int flags)
+{
+	if ((midi_file == NULL) || ((flags & ~MIDI_FILE_SAVE_COMPACT) != 0)) return -1;
+	midi_file->save_flags = flags;
+	return 0;
+}
+
+int MidiFile_isIndexed(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return 0;
+	if (midi_file->batch_depth > 0) return midi_file->batch_was_indexed;
+	return (midi_file->tick_index != NULL);
+}
+
+int MidiFile_setIndexed(MidiFile_t midi_file, int indexed)
+{
+	MidiFileTrack_t track;
+
+	if (midi_file == NULL) return -1;
+
+	/* the index can't follow the lists while they are out of order, so it is put back when the batch ends */
+	if (midi_file->batch_depth > 0)
+	{
+		midi_file->batch_was_indexed = (indexed != 0);
+		return 0;
+	}
+
+	if (indexed && (midi_file->tick_index == NULL))
+	{
+		/* an empty index stands in until the file-wide list is merged, which builds the real one */
+		midi_file->tick_index = midi_file->file_event_list_is_stale ? MidiFileTickIndex_new() : build_tick_index_for_file(midi_file);
+		for (track = midi_file->first_track; track != NULL; track = track->next_track) track->tick_index = build_tick_index_for_track(track);
+	}
+	else if (! indexed && (midi_file->tick_index != NULL))
+	{
+		MidiFileTickIndex_free(midi_file->tick_index);
+		midi_file->tick_index = NULL;
+
+		for (track = midi_file->first_track; track != NULL; track = track->next_track)
+		{
+			MidiFileTickIndex_free(track->tick_index);
+			track->tick_index = NULL;
+		}
+	}
+
+	return 0;
+}
+
+int MidiFile_beginBatch(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+
+	if (midi_file->batch_depth == 0)
+	{
+		midi_file->batch_was_indexed = (midi_file->tick_index != NULL);
+		MidiFile_setIndexed(midi_file, 0);
+	}
+
+	(midi_file->batch_depth)++;
+	return 0;
+}
+
+int MidiFile_endBatch(MidiFile_t midi_file)
+{
+	if ((midi_file == NULL) || (midi_file->batch_depth == 0)) return -1;
+	if (--(midi_file->batch_depth) > 0) return 0;
+	sort_batch(midi_file);
+	MidiFile_setIndexed(midi_file, midi_file->batch_was_indexed);
+	return 0;
+}
+
+int MidiFile_isInBatch(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return 0;
+	return (midi_file->batch_depth > 0);
+}
+
+MidiFileTrack_t MidiFile_createTrack(MidiFile_t midi_file)
+{
+	MidiFileTrack_t new_track;
+
+	if (midi_file == NULL) return NULL;
+
+	new_track = (MidiFileTrack_t)(malloc(sizeof(struct MidiFileTrack)));
+
+	if (register_track(new_track) < 0)
+	{
+		free(new_track);
+		return NULL;
+	}
+
+	new_track->midi_file = midi_file;
+	new_track->number = midi_file->number_of_tracks;
+	new_track->end_tick = 0;
+	new_track->previous_track = midi_file->last_track;
+	new_track->next_track = NULL;
+	midi_file->last_track = new_track;
+
+	if (new_track->previous_track == NULL)
+	{
+		midi_file->first_track = new_track;
+	}
+	else
+	{
+		new_track->previous_track->next_track = new_track;
+	}
+
+	(midi_file->number_of_tracks)++;
+
+	new_track->first_event = NULL;
+	new_track->last_event = NULL;
+	new_track->event_iterator_current = NULL;
+	new_track->event_iterator_next = NULL;
+	new_track->note_partners_are_valid = 0;
+	new_track->tick_index = (midi_file->tick_index == NULL) ? NULL : MidiFileTickIndex_new();
+	new_track->batch_is_unsorted = 0;
+	new_track->snapshot_image = NULL;
+	new_track->last_journaled_event = NULL;
+	new_track->journal_is_stale = 1;
+
+	return new_track;
+}
+
+int MidiFile_getNumberOfTracks(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return -1;
+	return midi_file->number_of_tracks;
+}
+
+MidiFileTrack_t MidiFile_getTrackByNumber(MidiFile_t midi_file, int number, int create)
+{
+	int current_track_number;
+	MidiFileTrack_t track = NULL;
+
+	for (current_track_number = 0; current_track_number <= number; current_track_number++)
+	{
+		if (track == NULL)
+		{
+			track = MidiFile_getFirstTrack(midi_file);
+		}
+		else
+		{
+			track = MidiFileTrack_getNextTrack(track);
+		}
+
+		if ((track == NULL) && create)
+		{
+			track = MidiFile_createTrack(midi_file);
+		}
+	}
+
+	return track;
+}
+
+int MidiFile_importEvents(MidiFile_t midi_file, const struct MidiFileEventRecord *records, long number_of_records, const unsigned char *payloads)
+{
+	/*
+	 * Unless each track's records are already in order by tick, they are
+	 * split up by track with a counting sort, which keeps each track's in the
+	 * order given, and each track's are then sorted by tick.  The events are
+	 * made going through the records in the order given, but each one from
+	 * its track's next record by tick instead; for records that are nearly
+	 * in order, that is one close by, so the records are read through only
+	 * once, without jumping around.
+	 */
+
+	MidiFileTrack_t track;
+	MidiFileEvent_t *events = NULL;
+	struct MidiFileRecordKey *keys = NULL;
+	struct MidiFileImportTrack *import_tracks;
+	long number_of_keys = 0, i;
+	int number_of_tracks = 0, records_are_in_order = 1, track_number;
+
+	if ((midi_file == NULL) || (number_of_records < 0) || ((records == NULL) && (number_of_records > 0))) return -1;
+
+	for (i = 0; i < number_of_records; i++)
+	{
+		if ((records[i].track_number < 0) || (records[i].track_number > 65535) || ! record_is_valid(&(records[i]), payloads)) return -1;
+		if (records[i].track_number >= number_of_tracks) number_of_tracks = records[i].track_number + 1;
+	}
+
+	if (number_of_records == 0) return 0;
+	if ((import_tracks = (struct MidiFileImportTrack *)(calloc(number_of_tracks, sizeof (struct MidiFileImportTrack)))) == NULL) return -1;
+
+	for (i = 0; i < number_of_records; i++)
+	{
+		struct MidiFileImportTrack *import_track = &(import_tracks[records[i].track_number]);
+
+		if ((import_track->number_of_records == 0) || (records[i].tick < import_track->first_tick)) import_track->first_tick = records[i].tick;
+		if (records[i].tick < import_track->last_tick) records_are_in_order = 0;
+		import_track->last_tick = records[i].tick;
+		import_track->number_of_records++;
+	}
+
+	/* the file-wide list takes the events by record number */
+	events = (MidiFileEvent_t *)(malloc(number_of_records * sizeof (MidiFileEvent_t)));
+	if (! records_are_in_order) keys = (struct MidiFileRecordKey *)(malloc(number_of_records * sizeof (struct MidiFileRecordKey)));
+
+	if ((events == NULL) || (! records_are_in_order && (keys == NULL)))
+	{
+		free(keys);
+		free(import_tracks);
+		free(events);
+		return -1;
+	}
+
+	if (! records_are_in_order)
+	{
+		/* each track's end is counted up from its start as its records are placed */
+		for (track_number = 0; track_number < number_of_tracks; track_number++)
+		{
+			import_tracks[track_number].next_key_number = import_tracks[track_number].end_key_number = number_of_keys;
+			number_of_keys += import_tracks[track_number].number_of_records;
+		}
+
+		for (i = 0; i < number_of_records; i++)
+		{
+			struct MidiFileRecordKey *key = &(keys[(import_tracks[records[i].track_number].end_key_number)++]);
+			key->tick = records[i].tick;
+			key->record_number = i;
+		}
+	}
+
+	while (midi_file->number_of_tracks < number_of_tracks)
+	{
+		if (MidiFile_createTrack(midi_file) == NULL) break;
+	}
+
+	for (track = midi_file->first_track, track_number = 0; track_number < number_of_tracks; track = track->next_track, track_number++)
+	{
+		struct MidiFileImportTrack *import_track = &(import_tracks[track_number]);
+
+		if ((track == NULL) || ((keys != NULL) && (sort_record_keys_by_tick(keys + import_track->next_key_number, import_track->number_of_records) < 0)))
+		{
+			free(keys);
+			free(import_tracks);
+			free(events);
+			return -1;
+		}
+
+		import_track->track = track;
+	}
+
+	for (track_number = 0; track_number < number_of_tracks; track_number++)
+	{
+		struct MidiFileImportTrack *import_track = &(import_tracks[track_number]);
+
+		if (import_track->number_of_records > 0)
+		{
+			copy_track_for_snapshots(import_track->track);
+			import_track->previous_event = get_last_event_in_track_at_or_before_tick(import_track->track, import_track->first_tick);
+		}
+	}
+
+	for (i = 0; i < number_of_records; i++)
+	{
+		struct MidiFileImportTrack *import_track = &(import_tracks[records[i].track_number]);
+		long record_number = (keys == NULL) ? i : keys[(import_track->next_key_number)++].record_number;
+
+		import_track->previous_event = append_record(import_track->track, &(records[record_number]), payloads, import_track->previous_event);
+		events[record_number] = import_track->previous_event;
+	}
+
+	/*
+	 * The file-wide list takes the events from all the tracks together, in
+	 * the order given, just as adding them one at a time would.  If it is
+	 * still to be merged, they join the others added since the file was
+	 * made.  If they can't be sorted, they are linked in one at a time.
+	 */
+	if (midi_file->file_event_list_is_stale)
+	{
+		for (i = 0; i < number_of_records; i++)
+		{
+			events[i]->placement_at_tick = MIDI_FILE_PLACEMENT_LAST_AT_TICK;
+			append_event_to_file_list(midi_file, events[i]);
+		}
+	}
+	else if (sort_events_by_tick(events, number_of_records) == 0)
+	{
+		link_new_event_into_file(midi_file, events[0], get_last_event_in_file_at_or_before_tick(midi_file, events[0]->tick));
+		for (i = 1; i < number_of_records; i++) link_new_event_into_file(midi_file, events[i], events[i - 1]);
+	}
+	else
+	{
+		for (i = 0; i < number_of_records; i++) link_new_event_into_file(midi_file, events[i], get_last_event_in_file_at_or_before_tick(midi_file, events[i]->tick));
+	}
+
+	free(keys);
+	free(import_tracks);
+	free(events);
+	return 0;
+}
+
+MidiFileTrack_t MidiFile_getFirstTrack(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return NULL;
+	return midi_file->first_track;
+}
+
+MidiFileTrack_t MidiFile_getLastTrack(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return NULL;
+	return midi_file->last_track;
+}
+
+MidiFileEvent_t MidiFile_getFirstEvent(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return NULL;
+	prepare_file_event_list(midi_file);
+	return midi_file->first_event;
+}
+
+MidiFileEvent_t MidiFile_getLastEvent(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return NULL;
+	prepare_file_event_list(midi_file);
+	return midi_file->last_event;
+}
+
+MidiFileEvent_t MidiFile_iterateEvents(MidiFile_t midi_file)
+{
+	if (midi_file == NULL) return NULL;
+
+	if (midi_file->event_iterator_current == NULL)
+	{
+		for (midi_file->event_iterator_current = MidiFile_getFirstEvent(midi_file); midi_file->event_iterator_current != NULL; midi_file->event_iterator_current = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current)) midi_file->event_iterator_current->should_be_visited = 1;
+		midi_file->event_iterator_current = MidiFile_getFirstEvent(midi_file);
+	}
+	else
+	{
+		midi_file->event_iterator_current = midi_file->event_iterator_next;
+	}
+
+	while ((midi_file->event_iterator_current != NULL) && !(midi_file->event_iterator_current->should_be_visited))
+	{
+		midi_file->event_iterator_current = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current);
+	}
+
+	if (midi_file->event_iterator_current == NULL)
+	{
+		midi_file->event_iterator_next = NULL;
+	}
+	else
+	{
+		midi_file->event_iterator_current->should_be_visited = 0;
+		midi_file->event_iterator_next = MidiFileEvent_getNextEventInFile(midi_file->event_iterator_current);
+	}
+
+	return midi_file->event_iterator_current;
+}
+
+int MidiFile_visitEvents(MidiFile_t midi_file, MidiFileEventVisitorCallback_t visitor_callback, void *user_data)
+{
+	MidiFileEvent_t event;
+
+	if ((midi_file == NULL) || (visitor_callback == NULL)) return -1;
+
+	for (event = MidiFile_iterateEvents(midi_file); event != NULL; event = MidiFile_iterateEvents(midi_file))
+	{
+		(*visitor_callback)(event, user_data);
+	}
+
+	return 0;
+}
+
+int MidiFile_convertSelectionFlagsToTextEvents(MidiFile_t midi_file, char *label)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+
+	if (midi_file == NULL) return -1;
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		{
+			if (MidiFileEvent_isSelected(event))
+			{
+				MidiFileEvent_setNextEvent(MidiFileTrack_createTextEvent(MidiFileEvent_getTrack(event), MidiFileEvent_getTick(event), label), event);
+				MidiFileEvent_setSelected(event, 0);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int MidiFile_convertTextEventsToSelectionFlags(MidiFile_t midi_file, char *label)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event, next_event;
+
+	if (midi_file == NULL) return -1;
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
+		{
+			next_event = MidiFileEvent_getNextEventInTrack(event);
+
+			if (MidiFileEvent_isTextEvent(event) && (strcmp(MidiFileTextEvent_getText(event), label) == 0))
+			{
+				MidiFileEvent_setSelected(next_event, 1);
+				MidiFileEvent_delete(event);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int MidiFile_convertStandardEventsToNoteEvents(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	int was_indexed;
+
+	if (midi_file == NULL) return -1;
+
+	/* each new event is placed relative to the one it replaces, which needs a tick search per event unless the file is indexed */
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		{
+			MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
+
+			if (end_event != NULL)
+			{
+				MidiFileEvent_t new_event = MidiFileTrack_createNoteEvent(
+					MidiFileEvent_getTrack(event),
+					MidiFileEvent_getTick(event),
+					MidiFileEvent_getTick(end_event) - MidiFileEvent_getTick(event),
+					MidiFileNoteStartEvent_getChannel(event),
+					MidiFileNoteStartEvent_getNote(event),
+					MidiFileNoteStartEvent_getVelocity(event),
+					MidiFileNoteEndEvent_getVelocity(end_event));
+
+				MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
+				MidiFileEvent_setPreviousEvent(new_event, event);
+				MidiFileEvent_delete(event);
+				MidiFileEvent_delete(end_event);
+				event = new_event;
+			}
+		}
+	}
+
+	MidiFile_setIndexed(midi_file, was_indexed);
+	return 0;
+}
+
+int MidiFile_convertNoteEventsToStandardEvents(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	int was_indexed;
+
+	if (midi_file == NULL) return -1;
+
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		{
+			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_NOTE)
+			{
+				MidiFileEvent_t note_start_event = MidiFileTrack_createNoteStartAndEndEvents(
+					MidiFileEvent_getTrack(event),
+					MidiFileEvent_getTick(event),
+					MidiFileEvent_getTick(event) + MidiFileNoteEvent_getDurationTicks(event),
+					MidiFileNoteEvent_getChannel(event),
+					MidiFileNoteEvent_getNote(event),
+					MidiFileNoteEvent_getVelocity(event),
+					MidiFileNoteEvent_getEndVelocity(event));
+
+				MidiFileEvent_setSelected(note_start_event, MidiFileEvent_isSelected(event));
+				MidiFileEvent_setSelected(MidiFileNoteStartEvent_getNoteEndEvent(note_start_event), MidiFileEvent_isSelected(event));
+				MidiFileEvent_setPreviousEvent(note_start_event, event);
+				MidiFileEvent_delete(event);
+				event = note_start_event;
+			}
+		}
+	}
+
+	MidiFile_setIndexed(midi_file, was_indexed);
+	return 0;
+}
+
+int MidiFile_convertStandardEventsToFineControlChangeEvents(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event, next_event;
+	int values[16][64];
+	int was_indexed;
+
+	if (midi_file == NULL) return -1;
+
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		memset(values, 0, sizeof (int) * 16 * 64);
+
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
+		{
+			next_event = MidiFileEvent_getNextEventInTrack(event);
+
+			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)
+			{
+				int channel = MidiFileControlChangeEvent_getChannel(event);
+				int number = MidiFileControlChangeEvent_getNumber(event);
+
+				if (number < 32)
+				{
+					if ((MidiFileEvent_getType(next_event) == MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)
+						&& (MidiFileControlChangeEvent_getChannel(next_event) == channel)
+						&& (MidiFileControlChangeEvent_getNumber(next_event) == number + 32))
+					{
+						MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
+							track,
+							MidiFileEvent_getTick(event),
+							channel,
+							number,
+							0);
+
+						MidiFileFineControlChangeEvent_setCoarseValue(new_event, MidiFileControlChangeEvent_getValue(event));
+						MidiFileFineControlChangeEvent_setFineValue(new_event, MidiFileControlChangeEvent_getValue(next_event));
+						values[channel][number] = MidiFileControlChangeEvent_getValue(event);
+						values[MidiFileControlChangeEvent_getChannel(next_event)][MidiFileControlChangeEvent_getNumber(next_event)] = MidiFileControlChangeEvent_getValue(next_event);
+						MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
+						MidiFileEvent_setPreviousEvent(new_event, next_event);
+						MidiFileEvent_delete(event);
+						MidiFileEvent_delete(next_event);
+						next_event = MidiFileEvent_getNextEventInTrack(new_event);
+					}
+					else
+					{
+						MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
+							track,
+							MidiFileEvent_getTick(event),
+							channel,
+							number,
+							0);
+
+						MidiFileFineControlChangeEvent_setCoarseValue(new_event, MidiFileControlChangeEvent_getValue(event));
+						MidiFileFineControlChangeEvent_setFineValue(new_event, values[channel][number + 32]);
+						values[channel][number] = MidiFileControlChangeEvent_getValue(event);
+						MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
+						MidiFileEvent_setPreviousEvent(new_event, event);
+						MidiFileEvent_delete(event);
+						next_event = MidiFileEvent_getNextEventInTrack(new_event);
+					}
+				}
+				else if (number < 64)
+				{
+					MidiFileEvent_t new_event = MidiFileTrack_createFineControlChangeEvent(
+						track,
+						MidiFileEvent_getTick(event),
+						channel,
+						number,
+						0);
+
+					MidiFileFineControlChangeEvent_setCoarseValue(new_event, values[channel][number - 32]);
+					MidiFileFineControlChangeEvent_setFineValue(new_event, MidiFileControlChangeEvent_getValue(event));
+					values[channel][number] = MidiFileControlChangeEvent_getValue(event);
+					MidiFileEvent_setSelected(new_event, MidiFileEvent_isSelected(event));
+					MidiFileEvent_setPreviousEvent(new_event, event);
+					MidiFileEvent_delete(event);
+					next_event = MidiFileEvent_getNextEventInTrack(new_event);
+				}
+			}
+		}
+	}
+
+	MidiFile_setIndexed(midi_file, was_indexed);
+	return 0;
+}
+
+int MidiFile_convertFineControlChangeEventsToStandardEvents(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+	int was_indexed;
+
+	if (midi_file == NULL) return -1;
+
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+		{
+			if (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)
+			{
+				MidiFileEvent_t coarse_event = MidiFileTrack_createControlChangeEvent(
+					MidiFileEvent_getTrack(event),
+					MidiFileEvent_getTick(event),
+					MidiFileFineControlChangeEvent_getChannel(event),
+					MidiFileFineControlChangeEvent_getCoarseNumber(event),
+					MidiFileFineControlChangeEvent_getCoarseValue(event));
+
+				MidiFileEvent_t fine_event = MidiFileTrack_createControlChangeEvent(
+					MidiFileEvent_getTrack(event),
+					MidiFileEvent_getTick(event),
+					MidiFileFineControlChangeEvent_getChannel(event),
+					MidiFileFineControlChangeEvent_getFineNumber(event),
+					MidiFileFineControlChangeEvent_getFineValue(event));
+
+				MidiFileEvent_setSelected(coarse_event, MidiFileEvent_isSelected(event));
+				MidiFileEvent_setSelected(fine_event, MidiFileEvent_isSelected(event));
+				MidiFileEvent_setPreviousEvent(coarse_event, event);
+				MidiFileEvent_setPreviousEvent(fine_event, coarse_event);
+				MidiFileEvent_delete(event);
+				event = fine_event;
+			}
+		}
+	}
+
+	MidiFile_setIndexed(midi_file, was_indexed);
+	return 0;
+}
+
+int MidiFile_convertStandardEventsToRpnAndNrpnEvents(MidiFile_t midi_file)
+{
+	MidiFileTrack_t track;
+	MidiFileEvent_t event, next_event;
+	int is_nrpn[16];
+	int numbers[16];
+	int values[16];
+	int was_indexed;
+
+	if (midi_file == NULL) return -1;
+
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
+	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
+	{
+		memset(is_nrpn, 0, sizeof (int) * 16);
+		memset(numbers, 0, sizeof (int) * 16);
+		memset(values, 0, sizeof (int) * 16);
 
 		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = next_event)
 		{
@@ -1861,6 +6272,7 @@ int MidiFile_convertStandardEventsToRpnAndNrpnEvents(MidiFile_t midi_file)
 		}
 	}
 
+	MidiFile_setIndexed(midi_file, was_indexed);
 	return 0;
 }
 
@@ -1868,9 +6280,13 @@ int MidiFile_convertRpnAndNrpnEventsToStandardEvents(MidiFile_t midi_file)
 {
 	MidiFileTrack_t track;
 	MidiFileEvent_t event;
+	int was_indexed;
 
 	if (midi_file == NULL) return -1;
 
+	was_indexed = MidiFile_isIndexed(midi_file);
+	MidiFile_setIndexed(midi_file, 1);
+
 	for (track = MidiFile_getFirstTrack(midi_file); track != NULL; track = MidiFileTrack_getNextTrack(track))
 	{
 		for (event = MidiFileTrack_getFirstEvent(track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
@@ -1960,6 +6376,7 @@ int MidiFile_convertRpnAndNrpnEventsToStandardEvents(MidiFile_t midi_file)
 		}
 	}
 
+	MidiFile_setIndexed(midi_file, was_indexed);
 	return 0;
 }
 
@@ -1972,187 +6389,317 @@ float MidiFile_getBeatFromTick(MidiFile_t midi_file, long tick)
 			return (float)(tick) / MidiFile_getResolution(midi_file);
 		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
-
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					tempo_event_beat += (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(24.0) / (float)(60.0) * tempo);
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+			struct MidiFileTempoSegment *segment = get_tempo_segment_for_tick(midi_file, tick);
+			return segment->start_position + (((float)(tick - segment->start_tick)) / MidiFile_getResolution(midi_file) / (float)(get_frames_per_second_for_division_type(midi_file->division_type)) / (float)(60.0) * segment->tempo);
+		}
+		default:
+		{
+			return -1.0;
+		}
+	}
+}
 
-			return tempo_event_beat + (((float)(tick - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(24.0) / (float)(60.0) * tempo);
+long MidiFile_getTickFromBeat(MidiFile_t midi_file, float beat)
+{
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			return (long)(beat * MidiFile_getResolution(midi_file));
 		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
 		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			struct MidiFileTempoSegment *segment = get_tempo_segment_for_position(midi_file, beat);
+			return segment->start_tick + (long)((beat - segment->start_position) / segment->tempo * 60.0 * get_frames_per_second_for_division_type(midi_file->division_type) * MidiFile_getResolution(midi_file));
+		}
+		default:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			return -1;
+		}
+	}
+}
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					tempo_event_beat += (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(25.0) / (float)(60.0) * tempo);
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+float MidiFile_getTimeFromTick(MidiFile_t midi_file, long tick)
+{
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			struct MidiFileTempoSegment *segment = get_tempo_segment_for_tick(midi_file, tick);
+			return segment->start_position + (((float)(tick - segment->start_tick)) / MidiFile_getResolution(midi_file) / (segment->tempo / 60));
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(24.0));
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(25.0));
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		{
+			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(29.97));
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(30.0));
+		}
+		default:
+		{
+			return -1;
+		}
+	}
+}
 
-			return tempo_event_beat + (((float)(tick - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(25.0) / (float)(60.0) * tempo);
+long MidiFile_getTickFromTime(MidiFile_t midi_file, float time)
+{
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			struct MidiFileTempoSegment *segment = get_tempo_segment_for_position(midi_file, time);
+			return segment->start_tick + (long)((time - segment->start_position) * (segment->tempo / 60) * MidiFile_getResolution(midi_file));
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		{
+			return (long)(time * MidiFile_getResolution(midi_file) * 24.0);
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		{
+			return (long)(time * MidiFile_getResolution(midi_file) * 25.0);
 		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			return (long)(time * MidiFile_getResolution(midi_file) * 29.97);
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			return (long)(time * MidiFile_getResolution(midi_file) * 30.0);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
+}
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					tempo_event_beat += (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(29.97) / (float)(60.0) * tempo);
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+static void get_positions_from_ticks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, float *positions)
+{
+	/*
+	 * Positions are as in the tempo map:  seconds for PPQ files, beats for
+	 * SMPTE files.  Sorted ticks take one sweep along the tempo map, and a
+	 * tick lower than the one before it costs a binary search.  Each run of
+	 * ticks within one tempo segment is converted by a loop without
+	 * branches, which the compiler is free to vectorize.  The arithmetic is
+	 * the same as in the single tick functions, so the results are too.
+	 */
 
-			return tempo_event_beat + (((float)(tick - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(29.97) / (float)(60.0) * tempo);
+	struct MidiFileTempoSegment *segment = NULL;
+	float resolution = (float)(MidiFile_getResolution(midi_file));
+	float frames_per_second = (float)(get_frames_per_second_for_division_type(midi_file->division_type));
+	long i, j, k;
+
+	for (i = 0; i < number_of_ticks; i = j)
+	{
+		long start_tick;
+		float start_position, tempo;
+		int segment_is_last;
+
+		if ((segment == NULL) || (ticks[i] < ticks[i - 1]))
+		{
+			segment = get_tempo_segment_for_tick(midi_file, ticks[i]);
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		else
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			while ((segment + 1 < midi_file->tempo_segments + midi_file->number_of_tempo_segments) && (segment[1].start_tick < ticks[i])) segment++;
+		}
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					tempo_event_beat += (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(30.0) / (float)(60.0) * tempo);
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+		segment_is_last = (segment + 1 == midi_file->tempo_segments + midi_file->number_of_tempo_segments);
+		for (j = i + 1; (j < number_of_ticks) && (ticks[j] >= ticks[j - 1]) && (segment_is_last || (ticks[j] <= segment[1].start_tick)); j++) {}
+
+		start_tick = segment->start_tick;
+		start_position = segment->start_position;
+		tempo = segment->tempo;
+
+		if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
+		{
+			float beats_per_second = tempo / 60;
+			for (k = i; k < j; k++) positions[k] = start_position + (((float)(ticks[k] - start_tick)) / resolution / beats_per_second);
+		}
+		else
+		{
+			for (k = i; k < j; k++) positions[k] = start_position + (((float)(ticks[k] - start_tick)) / resolution / frames_per_second / (float)(60.0) * tempo);
+		}
+	}
+}
+
+static void get_ticks_from_positions(MidiFile_t midi_file, long number_of_positions, const float *positions, long *ticks)
+{
+	/* the inverse of get_positions_from_ticks(), except that when the tempo map is out of order every position needs its own search */
+
+	struct MidiFileTempoSegment *segment = NULL;
+	int resolution = MidiFile_getResolution(midi_file);
+	double frames_per_second = get_frames_per_second_for_division_type(midi_file->division_type);
+	long i, j, k;
+
+	for (i = 0; i < number_of_positions; i = j)
+	{
+		long start_tick;
+		float start_position, tempo;
+		int segment_is_last;
+
+		if ((segment == NULL) || ! midi_file->tempo_segments_are_sorted || ! (positions[i] >= positions[i - 1]))
+		{
+			segment = get_tempo_segment_for_position(midi_file, positions[i]);
+		}
+		else
+		{
+			while ((segment + 1 < midi_file->tempo_segments + midi_file->number_of_tempo_segments) && ! (segment[1].start_position >= positions[i])) segment++;
+		}
+
+		segment_is_last = (segment + 1 == midi_file->tempo_segments + midi_file->number_of_tempo_segments);
+
+		if (midi_file->tempo_segments_are_sorted)
+		{
+			for (j = i + 1; (j < number_of_positions) && (positions[j] >= positions[j - 1]) && (segment_is_last || (positions[j] <= segment[1].start_position)); j++) {}
+		}
+		else
+		{
+			j = i + 1;
+		}
+
+		start_tick = segment->start_tick;
+		start_position = segment->start_position;
+		tempo = segment->tempo;
+
+		if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
+		{
+			float beats_per_second = tempo / 60;
+			for (k = i; k < j; k++) ticks[k] = start_tick + (long)((positions[k] - start_position) * beats_per_second * resolution);
+		}
+		else
+		{
+			for (k = i; k < j; k++) ticks[k] = start_tick + (long)((positions[k] - start_position) / tempo * 60.0 * frames_per_second * resolution);
+		}
+	}
+}
+
+int MidiFile_getBeatsFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, float *beats)
+{
+	long i;
+
+	if ((midi_file == NULL) || (number_of_ticks < 0) || ((number_of_ticks > 0) && ((ticks == NULL) || (beats == NULL)))) return -1;
 
-			return tempo_event_beat + (((float)(tick - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(30.0) / (float)(60.0) * tempo);
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			float resolution = (float)(MidiFile_getResolution(midi_file));
+			for (i = 0; i < number_of_ticks; i++) beats[i] = (float)(ticks[i]) / resolution;
+			return 0;
+		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			get_positions_from_ticks(midi_file, number_of_ticks, ticks, beats);
+			return 0;
 		}
 		default:
 		{
-			return -1.0;
+			return -1;
 		}
 	}
 }
 
-long MidiFile_getTickFromBeat(MidiFile_t midi_file, float beat)
+int MidiFile_getTicksFromBeats(MidiFile_t midi_file, long number_of_beats, const float *beats, long *ticks)
 {
+	long i;
+
+	if ((midi_file == NULL) || (number_of_beats < 0) || ((number_of_beats > 0) && ((beats == NULL) || (ticks == NULL)))) return -1;
+
 	switch (MidiFile_getDivisionType(midi_file))
 	{
 		case MIDI_FILE_DIVISION_TYPE_PPQ:
 		{
-			return (long)(beat * MidiFile_getResolution(midi_file));
+			int resolution = MidiFile_getResolution(midi_file);
+			for (i = 0; i < number_of_beats; i++) ticks[i] = (long)(beats[i] * resolution);
+			return 0;
 		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
-
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					float next_tempo_event_beat = tempo_event_beat + (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(24.0) / (float)(60.0) * tempo);
-					if (next_tempo_event_beat >= beat) break;
-					tempo_event_beat = next_tempo_event_beat;
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
-
-			return tempo_event_tick + (long)((beat - tempo_event_beat) / tempo * 60.0 * 24.0 * MidiFile_getResolution(midi_file));
+			get_ticks_from_positions(midi_file, number_of_beats, beats, ticks);
+			return 0;
 		}
-		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		default:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			return -1;
+		}
+	}
+}
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					float next_tempo_event_beat = tempo_event_beat + (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(25.0) / (float)(60.0) * tempo);
-					if (next_tempo_event_beat >= beat) break;
-					tempo_event_beat = next_tempo_event_beat;
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+int MidiFile_getTimesFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, float *times)
+{
+	long i;
 
-			return tempo_event_tick + (long)((beat - tempo_event_beat) / tempo * 60.0 * 25.0 * MidiFile_getResolution(midi_file));
+	if ((midi_file == NULL) || (number_of_ticks < 0) || ((number_of_ticks > 0) && ((ticks == NULL) || (times == NULL)))) return -1;
+
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			get_positions_from_ticks(midi_file, number_of_ticks, ticks, times);
+			return 0;
 		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
+		{
+			float ticks_per_second = MidiFile_getResolution(midi_file) * (float)(get_frames_per_second_for_division_type(midi_file->division_type));
+			for (i = 0; i < number_of_ticks; i++) times[i] = (float)(ticks[i]) / ticks_per_second;
+			return 0;
+		}
+		default:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			return -1;
+		}
+	}
+}
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					float next_tempo_event_beat = tempo_event_beat + (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(29.97) / (float)(60.0) * tempo);
-					if (next_tempo_event_beat >= beat) break;
-					tempo_event_beat = next_tempo_event_beat;
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
+int MidiFile_getTicksFromTimes(MidiFile_t midi_file, long number_of_times, const float *times, long *ticks)
+{
+	long i;
 
-			return tempo_event_tick + (long)((beat - tempo_event_beat) / tempo * 60.0 * 29.97 * MidiFile_getResolution(midi_file));
+	if ((midi_file == NULL) || (number_of_times < 0) || ((number_of_times > 0) && ((times == NULL) || (ticks == NULL)))) return -1;
+
+	switch (MidiFile_getDivisionType(midi_file))
+	{
+		case MIDI_FILE_DIVISION_TYPE_PPQ:
+		{
+			get_ticks_from_positions(midi_file, number_of_times, times, ticks);
+			return 0;
 		}
+		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
+		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_beat = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
-
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-			{
-				if (MidiFileEvent_isTempoEvent(event))
-				{
-					float next_tempo_event_beat = tempo_event_beat + (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (float)(30.0) / (float)(60.0) * tempo);
-					if (next_tempo_event_beat >= beat) break;
-					tempo_event_beat = next_tempo_event_beat;
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
-				}
-			}
-
-			return tempo_event_tick + (long)((beat - tempo_event_beat) / tempo * 60.0 * 30.0 * MidiFile_getResolution(midi_file));
+			int resolution = MidiFile_getResolution(midi_file);
+			double frames_per_second = get_frames_per_second_for_division_type(midi_file->division_type);
+			for (i = 0; i < number_of_times; i++) ticks[i] = (long)(times[i] * resolution * frames_per_second);
+			return 0;
 		}
 		default:
 		{
@@ -2161,45 +6708,99 @@ long MidiFile_getTickFromBeat(MidiFile_t midi_file, float beat)
 	}
 }
 
-float MidiFile_getTimeFromTick(MidiFile_t midi_file, long tick)
+static long long divide_rounding_down(long long dividend, long long divisor)
+{
+	/* C rounds toward zero, which would put times before the start of the file one step out */
+	return ((dividend < 0) ? (dividend - divisor + 1) : dividend) / divisor;
+}
+
+static long long get_latest_time_rounding_to(long long time_us, long long scale)
+{
+	/* the latest scaled time which still rounds to no more than the given whole microseconds, so that time to tick and back is stable */
+	return ((time_us + 1) * scale) - (scale / 2) - 1;
+}
+
+long long MidiFile_getTimeUsFromTick(MidiFile_t midi_file, long tick)
+{
+	long frames_per_second_numerator, frames_per_second_denominator;
+
+	if ((midi_file == NULL) || (midi_file->resolution <= 0)) return -1;
+
+	if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
+	{
+		struct MidiFileTempoSegment *segment = get_tempo_segment_for_tick(midi_file, tick);
+		return divide_rounding_down(segment->start_time + ((long long)(tick - segment->start_tick) * segment->microseconds_per_beat) + (midi_file->resolution / 2), midi_file->resolution);
+	}
+	else if (get_frames_per_second_fraction_for_division_type(midi_file->division_type, &frames_per_second_numerator, &frames_per_second_denominator) == 0)
+	{
+		long long scale = (long long)(frames_per_second_numerator) * midi_file->resolution;
+		return divide_rounding_down(((long long)(tick) * 1000000 * frames_per_second_denominator) + (scale / 2), scale);
+	}
+	else
+	{
+		return -1;
+	}
+}
+
+long MidiFile_getTickFromTimeUs(MidiFile_t midi_file, long long time_us)
+{
+	long frames_per_second_numerator, frames_per_second_denominator;
+
+	if ((midi_file == NULL) || (midi_file->resolution <= 0)) return -1;
+
+	if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
+	{
+		long long time = get_latest_time_rounding_to(time_us, midi_file->resolution);
+		struct MidiFileTempoSegment *segment = get_tempo_segment_for_time(midi_file, time);
+		if (segment->microseconds_per_beat <= 0) return segment->start_tick;
+		return segment->start_tick + (long)(divide_rounding_down(time - segment->start_time, segment->microseconds_per_beat));
+	}
+	else if (get_frames_per_second_fraction_for_division_type(midi_file->division_type, &frames_per_second_numerator, &frames_per_second_denominator) == 0)
+	{
+		return (long)(divide_rounding_down(get_latest_time_rounding_to(time_us, (long long)(frames_per_second_numerator) * midi_file->resolution), 1000000LL * frames_per_second_denominator));
+	}
+	else
+	{
+		return -1;
+	}
+}
+
+int MidiFile_getTimesUsFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, long long *times_us)
 {
+	long i;
+
+	if ((midi_file == NULL) || (midi_file->resolution <= 0) || (number_of_ticks < 0) || ((number_of_ticks > 0) && ((ticks == NULL) || (times_us == NULL)))) return -1;
+
 	switch (MidiFile_getDivisionType(midi_file))
 	{
 		case MIDI_FILE_DIVISION_TYPE_PPQ:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_time = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			struct MidiFileTempoSegment *segment = NULL;
+			int resolution = midi_file->resolution;
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
+			for (i = 0; i < number_of_ticks; i++)
 			{
-				if (MidiFileEvent_isTempoEvent(event))
+				if ((segment == NULL) || (ticks[i] < ticks[i - 1]))
+				{
+					segment = get_tempo_segment_for_tick(midi_file, ticks[i]);
+				}
+				else
 				{
-					tempo_event_time += (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (tempo / 60));
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
+					while ((segment + 1 < midi_file->tempo_segments + midi_file->number_of_tempo_segments) && (segment[1].start_tick < ticks[i])) segment++;
 				}
+
+				times_us[i] = divide_rounding_down(segment->start_time + ((long long)(ticks[i] - segment->start_tick) * segment->microseconds_per_beat) + (resolution / 2), resolution);
 			}
 
-			return tempo_event_time + (((float)(tick - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (tempo / 60));
+			return 0;
 		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
-		{
-			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(24.0));
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
-		{
-			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(25.0));
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
-		{
-			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(29.97));
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
 		{
-			return (float)(tick) / (MidiFile_getResolution(midi_file) * (float)(30.0));
+			for (i = 0; i < number_of_ticks; i++) times_us[i] = MidiFile_getTimeUsFromTick(midi_file, ticks[i]);
+			return 0;
 		}
 		default:
 		{
@@ -2208,47 +6809,44 @@ float MidiFile_getTimeFromTick(MidiFile_t midi_file, long tick)
 	}
 }
 
-long MidiFile_getTickFromTime(MidiFile_t midi_file, float time)
+int MidiFile_getTicksFromTimesUs(MidiFile_t midi_file, long number_of_times, const long long *times_us, long *ticks)
 {
+	long i;
+
+	if ((midi_file == NULL) || (midi_file->resolution <= 0) || (number_of_times < 0) || ((number_of_times > 0) && ((times_us == NULL) || (ticks == NULL)))) return -1;
+
 	switch (MidiFile_getDivisionType(midi_file))
 	{
 		case MIDI_FILE_DIVISION_TYPE_PPQ:
 		{
-			MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-			MidiFileEvent_t event;
-			float tempo_event_time = 0.0;
-			long tempo_event_tick = 0;
-			float tempo = 120.0;
+			struct MidiFileTempoSegment *segment = NULL;
+			int resolution = midi_file->resolution;
 
-			for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
+			for (i = 0; i < number_of_times; i++)
 			{
-				if (MidiFileEvent_isTempoEvent(event))
+				long long time = get_latest_time_rounding_to(times_us[i], resolution);
+
+				if ((segment == NULL) || (times_us[i] < times_us[i - 1]))
+				{
+					segment = get_tempo_segment_for_time(midi_file, time);
+				}
+				else
 				{
-					float next_tempo_event_time = tempo_event_time + (((float)(MidiFileEvent_getTick(event) - tempo_event_tick)) / MidiFile_getResolution(midi_file) / (tempo / 60));
-					if (next_tempo_event_time >= time) break;
-					tempo_event_time = next_tempo_event_time;
-					tempo_event_tick = MidiFileEvent_getTick(event);
-					tempo = MidiFileTempoEvent_getTempo(event);
+					while ((segment + 1 < midi_file->tempo_segments + midi_file->number_of_tempo_segments) && (segment[1].start_time <= time)) segment++;
 				}
+
+				ticks[i] = (segment->microseconds_per_beat <= 0) ? segment->start_tick : (segment->start_tick + (long)(divide_rounding_down(time - segment->start_time, segment->microseconds_per_beat)));
 			}
 
-			return tempo_event_tick + (long)((time - tempo_event_time) * (tempo / 60) * MidiFile_getResolution(midi_file));
+			return 0;
 		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE24:
-		{
-			return (long)(time * MidiFile_getResolution(midi_file) * 24.0);
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE25:
-		{
-			return (long)(time * MidiFile_getResolution(midi_file) * 25.0);
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30DROP:
-		{
-			return (long)(time * MidiFile_getResolution(midi_file) * 29.97);
-		}
 		case MIDI_FILE_DIVISION_TYPE_SMPTE30:
 		{
-			return (long)(time * MidiFile_getResolution(midi_file) * 30.0);
+			for (i = 0; i < number_of_times; i++) ticks[i] = MidiFile_getTickFromTimeUs(midi_file, times_us[i]);
+			return 0;
 		}
 		default:
 		{
@@ -2265,27 +6863,8 @@ float MidiFile_getMeasureFromTick(MidiFile_t midi_file, long tick)
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float measure = 0.0;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, MidiFileEvent_getTick(event));
-				measure += ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				time_signature_event_beat = next_time_signature_event_beat;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		measure += ((MidiFile_getBeatFromTick(midi_file, tick) - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-		return measure;
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_tick(midi_file, tick);
+		return segment->start_measure + ((MidiFile_getBeatFromTick(midi_file, tick) - segment->start_beat) * ((float)(segment->denominator) / segment->numerator / 4));
 	}
 }
 
@@ -2297,28 +6876,8 @@ long MidiFile_getTickFromMeasure(MidiFile_t midi_file, float measure)
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float time_signature_event_measure = 0.0;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, MidiFileEvent_getTick(event));
-				float next_time_signature_event_measure = time_signature_event_measure + ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				if (next_time_signature_event_measure >= measure) break;
-				time_signature_event_beat = next_time_signature_event_beat;
-				time_signature_event_measure = next_time_signature_event_measure;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		return MidiFile_getTickFromBeat(midi_file, time_signature_event_beat + ((measure - time_signature_event_measure) / ((float)(denominator) / numerator / 4)));
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_position(midi_file, measure, 0, 0.0, 0, 0.0, 0);
+		return MidiFile_getTickFromBeat(midi_file, segment->start_beat + ((measure - segment->start_measure) / ((float)(segment->denominator) / segment->numerator / 4)));
 	}
 }
 
@@ -2330,28 +6889,10 @@ int MidiFile_setMeasureBeatFromTick(MidiFile_t midi_file, long tick, MidiFileMea
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float measure = 0.0;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, MidiFileEvent_getTick(event));
-				measure += ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				time_signature_event_beat = next_time_signature_event_beat;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		measure += ((MidiFile_getBeatFromTick(midi_file, tick) - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_tick(midi_file, tick);
+		float measure = segment->start_measure + ((MidiFile_getBeatFromTick(midi_file, tick) - segment->start_beat) * ((float)(segment->denominator) / segment->numerator / 4));
 		MidiFileMeasureBeat_setMeasure(measure_beat, (long)(measure) + 1);
-		MidiFileMeasureBeat_setBeat(measure_beat, ((measure - (float)(MidiFileMeasureBeat_getMeasure(measure_beat) - 1)) * numerator) + 1.0);
+		MidiFileMeasureBeat_setBeat(measure_beat, ((measure - (float)(MidiFileMeasureBeat_getMeasure(measure_beat) - 1)) * segment->numerator) + 1.0);
 		return 0;
 	}
 }
@@ -2364,34 +6905,8 @@ long MidiFile_getTickFromMeasureBeat(MidiFile_t midi_file, MidiFileMeasureBeat_t
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float time_signature_event_measure = 0.0;
-		long time_signature_event_visible_measure = 1;
-		float time_signature_event_visible_beat = 1.0;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, MidiFileEvent_getTick(event));
-				float next_time_signature_event_measure = time_signature_event_measure + ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				long next_time_signature_event_visible_measure = (long)(next_time_signature_event_measure) + 1;
-				float next_time_signature_event_visible_beat = ((next_time_signature_event_measure - (float)(next_time_signature_event_visible_measure - 1)) * numerator) + 1.0;
-				if ((next_time_signature_event_visible_measure > MidiFileMeasureBeat_getMeasure(measure_beat)) || ((next_time_signature_event_visible_measure == MidiFileMeasureBeat_getMeasure(measure_beat)) && (next_time_signature_event_visible_beat >= MidiFileMeasureBeat_getBeat(measure_beat)))) break;
-				time_signature_event_beat = next_time_signature_event_beat;
-				time_signature_event_measure = next_time_signature_event_measure;
-				time_signature_event_visible_measure = next_time_signature_event_visible_measure;
-				time_signature_event_visible_beat = next_time_signature_event_visible_beat;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		return MidiFile_getTickFromBeat(midi_file, time_signature_event_beat + ((((MidiFileMeasureBeat_getMeasure(measure_beat) - time_signature_event_visible_measure) * numerator) + (MidiFileMeasureBeat_getBeat(measure_beat) - time_signature_event_visible_beat)) * 4 / denominator));
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_position(midi_file, 0.0, MidiFileMeasureBeat_getMeasure(measure_beat), MidiFileMeasureBeat_getBeat(measure_beat), 0, 0.0, 1);
+		return MidiFile_getTickFromBeat(midi_file, segment->start_beat + ((((MidiFileMeasureBeat_getMeasure(measure_beat) - segment->visible_measure) * segment->numerator) + (MidiFileMeasureBeat_getBeat(measure_beat) - segment->visible_beat)) * 4 / segment->denominator));
 	}
 }
 
@@ -2403,28 +6918,10 @@ int MidiFile_setMeasureBeatTickFromTick(MidiFile_t midi_file, long tick, MidiFil
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float measure = 0.0;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); (event != NULL) && (MidiFileEvent_getTick(event) < tick); event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, MidiFileEvent_getTick(event));
-				measure += ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				time_signature_event_beat = next_time_signature_event_beat;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		measure += ((MidiFile_getBeatFromTick(midi_file, tick) - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_tick(midi_file, tick);
+		float measure = segment->start_measure + ((MidiFile_getBeatFromTick(midi_file, tick) - segment->start_beat) * ((float)(segment->denominator) / segment->numerator / 4));
 		MidiFileMeasureBeatTick_setMeasure(measure_beat_tick, (long)(measure) + 1);
-		MidiFileMeasureBeatTick_setBeat(measure_beat_tick, (long)((measure - (float)(MidiFileMeasureBeatTick_getMeasure(measure_beat_tick) - 1)) * numerator) + 1);
+		MidiFileMeasureBeatTick_setBeat(measure_beat_tick, (long)((measure - (float)(MidiFileMeasureBeatTick_getMeasure(measure_beat_tick) - 1)) * segment->numerator) + 1);
 		MidiFileMeasureBeatTick_setTick(measure_beat_tick, tick - MidiFile_getTickFromBeat(midi_file, (float)((long)(MidiFile_getBeatFromTick(midi_file, tick)))));
 		return 0;
 	}
@@ -2438,36 +6935,8 @@ long MidiFile_getTickFromMeasureBeatTick(MidiFile_t midi_file, MidiFileMeasureBe
 	}
 	else
 	{
-		MidiFileTrack_t conductor_track = MidiFile_getFirstTrack(midi_file);
-		MidiFileEvent_t event;
-		float time_signature_event_beat = 0.0;
-		float time_signature_event_measure = 0.0;
-		long time_signature_event_visible_measure = 1;
-		long time_signature_event_visible_beat = 1;
-		int numerator = 4;
-		int denominator = 4;
-
-		for (event = MidiFileTrack_getFirstEvent(conductor_track); event != NULL; event = MidiFileEvent_getNextEventInTrack(event))
-		{
-			if (MidiFileEvent_isTimeSignatureEvent(event))
-			{
-				long next_time_signature_event_tick = MidiFileEvent_getTick(event);
-				float next_time_signature_event_beat = MidiFile_getBeatFromTick(midi_file, next_time_signature_event_tick);
-				float next_time_signature_event_measure = time_signature_event_measure + ((next_time_signature_event_beat - time_signature_event_beat) * ((float)(denominator) / numerator / 4));
-				long next_time_signature_event_visible_measure = (long)(next_time_signature_event_measure) + 1;
-				long next_time_signature_event_visible_beat = (long)((next_time_signature_event_measure - (float)(next_time_signature_event_visible_measure - 1)) * numerator) + 1;
-				float next_time_signature_event_visible_tick = next_time_signature_event_tick - MidiFile_getTickFromBeat(midi_file, (float)((long)(next_time_signature_event_beat)));
-				if ((next_time_signature_event_visible_measure > MidiFileMeasureBeatTick_getMeasure(measure_beat_tick)) || ((next_time_signature_event_visible_measure == MidiFileMeasureBeatTick_getMeasure(measure_beat_tick)) && ((next_time_signature_event_visible_beat > MidiFileMeasureBeatTick_getBeat(measure_beat_tick)) || ((next_time_signature_event_visible_measure == MidiFileMeasureBeatTick_getBeat(measure_beat_tick)) && (next_time_signature_event_visible_tick >= MidiFileMeasureBeatTick_getTick(measure_beat_tick)))))) break;
-				time_signature_event_beat = next_time_signature_event_beat;
-				time_signature_event_measure = next_time_signature_event_measure;
-				time_signature_event_visible_measure = next_time_signature_event_visible_measure;
-				time_signature_event_visible_beat = next_time_signature_event_visible_beat;
-				numerator = MidiFileTimeSignatureEvent_getNumerator(event);
-				denominator = MidiFileTimeSignatureEvent_getDenominator(event);
-			}
-		}
-
-		return MidiFile_getTickFromBeat(midi_file, time_signature_event_beat + (((((MidiFileMeasureBeatTick_getMeasure(measure_beat_tick) - time_signature_event_visible_measure) * numerator) + (MidiFileMeasureBeatTick_getBeat(measure_beat_tick) - time_signature_event_visible_beat))) * 4 / denominator)) + MidiFileMeasureBeatTick_getTick(measure_beat_tick);
+		struct MidiFileMeterSegment *segment = get_meter_segment_for_position(midi_file, 0.0, MidiFileMeasureBeatTick_getMeasure(measure_beat_tick), 0.0, MidiFileMeasureBeatTick_getBeat(measure_beat_tick), MidiFileMeasureBeatTick_getTick(measure_beat_tick), 2);
+		return MidiFile_getTickFromBeat(midi_file, segment->start_beat + (((((MidiFileMeasureBeatTick_getMeasure(measure_beat_tick) - segment->visible_measure) * segment->numerator) + (MidiFileMeasureBeatTick_getBeat(measure_beat_tick) - segment->visible_whole_beat))) * 4 / segment->denominator)) + MidiFileMeasureBeatTick_getTick(measure_beat_tick);
 	}
 }
 
@@ -2584,6 +7053,34 @@ int MidiFile_getTickFromHourMinuteSecondFrameString(MidiFile_t midi_file, char *
 	return MidiFile_getTickFromHourMinuteSecondFrame(midi_file, midi_file->hour_minute_second_frame);
 }
 
+int MidiFile_formatMeasureBeatFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size)
+{
+	struct MidiFileMeasureBeat measure_beat;
+	if (MidiFile_setMeasureBeatFromTick(midi_file, tick, &measure_beat) < 0) return -1;
+	return MidiFileMeasureBeat_format(&measure_beat, buffer, buffer_size);
+}
+
+int MidiFile_formatMeasureBeatTickFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size)
+{
+	struct MidiFileMeasureBeatTick measure_beat_tick;
+	if (MidiFile_setMeasureBeatTickFromTick(midi_file, tick, &measure_beat_tick) < 0) return -1;
+	return MidiFileMeasureBeatTick_format(&measure_beat_tick, buffer, buffer_size);
+}
+
+int MidiFile_formatHourMinuteSecondFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size)
+{
+	struct MidiFileHourMinuteSecond hour_minute_second;
+	if (MidiFile_setHourMinuteSecondFromTick(midi_file, tick, &hour_minute_second) < 0) return -1;
+	return MidiFileHourMinuteSecond_format(&hour_minute_second, buffer, buffer_size);
+}
+
+int MidiFile_formatHourMinuteSecondFrameFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size)
+{
+	struct MidiFileHourMinuteSecondFrame hour_minute_second_frame;
+	if (MidiFile_setHourMinuteSecondFrameFromTick(midi_file, tick, &hour_minute_second_frame) < 0) return -1;
+	return MidiFileHourMinuteSecondFrame_format(&hour_minute_second_frame, buffer, buffer_size);
+}
+
 long MidiFile_getTickFromMarker(MidiFile_t midi_file, char *marker)
 {
 	MidiFileEvent_t event;
@@ -2615,6 +7112,12 @@ MidiFileEvent_t MidiFile_getFirstEventForTick(MidiFile_t midi_file, long tick)
 	MidiFileEvent_t first_event_for_tick = NULL;
 	MidiFileEvent_t event;
 
+	if ((midi_file != NULL) && (midi_file->tick_index != NULL))
+	{
+		event = get_first_event_in_file_at_or_after_tick(midi_file, tick);
+		return ((event != NULL) && (event->tick == tick)) ? event : NULL;
+	}
+
 	for (event = MidiFile_getLastEvent(midi_file); (event != NULL) && (MidiFileEvent_getTick(event) >= tick); event = MidiFileEvent_getPreviousEventInFile(event))
 	{
 		if (MidiFileEvent_getTick(event) == tick) first_event_for_tick = event;
@@ -2628,6 +7131,12 @@ MidiFileEvent_t MidiFile_getLastEventForTick(MidiFile_t midi_file, long tick)
 	MidiFileEvent_t last_event_for_tick = NULL;
 	MidiFileEvent_t event;
 
+	if ((midi_file != NULL) && (midi_file->tick_index != NULL))
+	{
+		event = get_last_event_in_file_at_or_before_tick(midi_file, tick);
+		return ((event != NULL) && (event->tick == tick)) ? event : NULL;
+	}
+
 	for (event = MidiFile_getFirstEvent(midi_file); (event != NULL) && (MidiFileEvent_getTick(event) <= tick); event = MidiFileEvent_getNextEventInFile(event))
 	{
 		if (MidiFileEvent_getTick(event) == tick) last_event_for_tick = event;
@@ -2684,6 +7193,8 @@ int MidiFileTrack_delete(MidiFileTrack_t track)
 	MidiFileEvent_t event, next_event_in_track;
 
 	if (track == NULL) return -1;
+	copy_track_for_snapshots(track);
+	track->midi_file->journal_needs_compaction = 1;
 
 	for (subsequent_track = track->next_track; subsequent_track != NULL; subsequent_track = subsequent_track->next_track)
 	{
@@ -2695,6 +7206,7 @@ int MidiFileTrack_delete(MidiFileTrack_t track)
 	if (track->previous_track == NULL)
 	{
 		track->midi_file->first_track = track->next_track;
+		invalidate_tempo_map(track->midi_file);
 	}
 	else
 	{
@@ -2710,12 +7222,18 @@ int MidiFileTrack_delete(MidiFileTrack_t track)
 		track->next_track->previous_track = track->previous_track;
 	}
 
+	/* no point keeping the note pairing or index up to date for events which are going away */
+	track->note_partners_are_valid = 0;
+	MidiFileTickIndex_free(track->tick_index);
+	track->tick_index = NULL;
+
 	for (event = track->first_event; event != NULL; event = next_event_in_track)
 	{
-		next_event_in_track = event->next_event_in_track;
+		next_event_in_track = get_event(event->next_event_in_track);
 		MidiFileEvent_delete(event);
 	}
 
+	unregister_block(track->reference >> MIDI_FILE_REFERENCE_ITEM_BITS);
 	free(track);
 	return 0;
 }
@@ -2741,6 +7259,7 @@ long MidiFileTrack_getEndTick(MidiFileTrack_t track)
 int MidiFileTrack_setEndTick(MidiFileTrack_t track, long end_tick)
 {
 	if ((track == NULL) || ((track->last_event != NULL) && (end_tick < track->last_event->tick))) return -1;
+	prepare_track_for_change(track);
 	track->end_tick = end_tick;
 	return 0;
 }
@@ -2750,6 +7269,12 @@ MidiFileEvent_t MidiFileTrack_getFirstEventForTick(MidiFileTrack_t track, long t
 	MidiFileEvent_t first_event_for_tick = NULL;
 	MidiFileEvent_t event;
 
+	if ((track != NULL) && (track->tick_index != NULL))
+	{
+		event = get_first_event_in_track_at_or_after_tick(track, tick);
+		return ((event != NULL) && (event->tick == tick)) ? event : NULL;
+	}
+
 	for (event = MidiFileTrack_getLastEvent(track); (event != NULL) && (MidiFileEvent_getTick(event) >= tick); event = MidiFileEvent_getPreviousEventInTrack(event))
 	{
 		if (MidiFileEvent_getTick(event) == tick) first_event_for_tick = event;
@@ -2763,6 +7288,12 @@ MidiFileEvent_t MidiFileTrack_getLastEventForTick(MidiFileTrack_t track, long ti
 	MidiFileEvent_t last_event_for_tick = NULL;
 	MidiFileEvent_t event;
 
+	if ((track != NULL) && (track->tick_index != NULL))
+	{
+		event = get_last_event_in_track_at_or_before_tick(track, tick);
+		return ((event != NULL) && (event->tick == tick)) ? event : NULL;
+	}
+
 	for (event = MidiFileTrack_getFirstEvent(track); (event != NULL) && (MidiFileEvent_getTick(event) <= tick); event = MidiFileEvent_getNextEventInTrack(event))
 	{
 		if (MidiFileEvent_getTick(event) == tick) last_event_for_tick = event;
@@ -2778,6 +7309,13 @@ MidiFileTrack_t MidiFileTrack_createTrackBefore(MidiFileTrack_t track)
 	if (track == NULL) return NULL;
 
 	new_track = (MidiFileTrack_t)(malloc(sizeof(struct MidiFileTrack)));
+
+	if (register_track(new_track) < 0)
+	{
+		free(new_track);
+		return NULL;
+	}
+
 	new_track->midi_file = track->midi_file;
 	new_track->number = track->number;
 	new_track->end_tick = 0;
@@ -2788,6 +7326,7 @@ MidiFileTrack_t MidiFileTrack_createTrackBefore(MidiFileTrack_t track)
 	if (new_track->previous_track == NULL)
 	{
 		track->midi_file->first_track = new_track;
+		invalidate_tempo_map(track->midi_file);
 	}
 	else
 	{
@@ -2799,10 +7338,19 @@ MidiFileTrack_t MidiFileTrack_createTrackBefore(MidiFileTrack_t track)
 		(subsequent_track->number)++;
 	}
 
+	(track->midi_file->number_of_tracks)++;
+	track->midi_file->journal_needs_compaction = 1;
+
 	new_track->first_event = NULL;
 	new_track->last_event = NULL;
 	new_track->event_iterator_current = NULL;
 	new_track->event_iterator_next = NULL;
+	new_track->note_partners_are_valid = 0;
+	new_track->tick_index = (track->midi_file->tick_index == NULL) ? NULL : MidiFileTickIndex_new();
+	new_track->batch_is_unsorted = 0;
+	new_track->snapshot_image = NULL;
+	new_track->last_journaled_event = NULL;
+	new_track->journal_is_stale = 1;
 
 	return new_track;
 }
@@ -2825,8 +7373,8 @@ MidiFileEvent_t MidiFileTrack_createNoteOffEvent(MidiFileTrack_t track, long tic
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
 	new_event->u.note_off.channel = channel;
@@ -2845,8 +7393,8 @@ MidiFileEvent_t MidiFileTrack_createNoteOnEvent(MidiFileTrack_t track, long tick
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_NOTE_ON;
 	new_event->u.note_on.channel = channel;
@@ -2865,8 +7413,8 @@ MidiFileEvent_t MidiFileTrack_createKeyPressureEvent(MidiFileTrack_t track, long
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
 	new_event->u.key_pressure.channel = channel;
@@ -2885,8 +7433,8 @@ MidiFileEvent_t MidiFileTrack_createControlChangeEvent(MidiFileTrack_t track, lo
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE;
 	new_event->u.control_change.channel = channel;
@@ -2905,8 +7453,8 @@ MidiFileEvent_t MidiFileTrack_createProgramChangeEvent(MidiFileTrack_t track, lo
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE;
 	new_event->u.program_change.channel = channel;
@@ -2924,8 +7472,8 @@ MidiFileEvent_t MidiFileTrack_createChannelPressureEvent(MidiFileTrack_t track,
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
 	new_event->u.channel_pressure.channel = channel;
@@ -2943,8 +7491,8 @@ MidiFileEvent_t MidiFileTrack_createPitchWheelEvent(MidiFileTrack_t track, long
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_PITCH_WHEEL;
 	new_event->u.pitch_wheel.channel = channel;
@@ -2962,12 +7510,12 @@ MidiFileEvent_t MidiFileTrack_createSysexEvent(MidiFileTrack_t track, long tick,
 
 	if ((track == NULL) || (data_length < 1) || (data_buffer == NULL)) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_SYSEX;
 	new_event->u.sysex.data_length = data_length;
-	new_event->u.sysex.data_buffer = malloc(data_length);
+	new_event->u.sysex.data_buffer = allocate_data(track->midi_file, data_length);
 	memcpy(new_event->u.sysex.data_buffer, data_buffer, data_length);
 	new_event->should_be_visited = 0;
 	new_event->is_selected = 0;
@@ -2982,13 +7530,13 @@ MidiFileEvent_t MidiFileTrack_createMetaEvent(MidiFileTrack_t track, long tick,
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_META;
 	new_event->u.meta.number = number;
 	new_event->u.meta.data_length = data_length;
-	new_event->u.meta.data_buffer = malloc(data_length + 1);
+	new_event->u.meta.data_buffer = allocate_data(track->midi_file, data_length + 1);
 	memcpy(new_event->u.meta.data_buffer, data_buffer, data_length);
 	new_event->u.meta.data_buffer[data_length] = '\0';
 	new_event->should_be_visited = 0;
@@ -3004,8 +7552,8 @@ MidiFileEvent_t MidiFileTrack_createNoteEvent(MidiFileTrack_t track, long tick,
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_NOTE;
 	new_event->u.note.duration_ticks = duration_ticks;
@@ -3026,8 +7574,8 @@ MidiFileEvent_t MidiFileTrack_createFineControlChangeEvent(MidiFileTrack_t track
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE;
 	new_event->u.fine_control_change.channel = channel;
@@ -3046,8 +7594,8 @@ MidiFileEvent_t MidiFileTrack_createRpnEvent(MidiFileTrack_t track, long tick, i
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_RPN;
 	new_event->u.rpn.channel = channel;
@@ -3066,8 +7614,8 @@ MidiFileEvent_t MidiFileTrack_createNrpnEvent(MidiFileTrack_t track, long tick,
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = get_track_reference(track);
 	new_event->tick = tick;
 	new_event->type = MIDI_FILE_EVENT_TYPE_NRPN;
 	new_event->u.nrpn.channel = channel;
@@ -3195,10 +7743,11 @@ MidiFileEvent_t MidiFileTrack_createVoiceEvent(MidiFileTrack_t track, long tick,
 
 	if (track == NULL) return NULL;
 
-	new_event = (MidiFileEvent_t)(malloc(sizeof(struct MidiFileEvent)));
-	new_event->track = track;
+	new_event = allocate_event(track->midi_file);
+	new_event->track = 0; /* not in the track's lists yet */
 	new_event->tick = tick;
 	MidiFileVoiceEvent_setData(new_event, data);
+	new_event->track = get_track_reference(track);
 	new_event->should_be_visited = 0;
 	new_event->is_selected = 0;
 	add_event(new_event);
@@ -3287,15 +7836,79 @@ MidiFileEvent_t MidiFileTrack_copyEvent(MidiFileTrack_t track, MidiFileEvent_t e
 	return new_event;
 }
 
+int MidiFileTrack_appendEvents(MidiFileTrack_t track, const struct MidiFileEventRecord *records, long number_of_records, const unsigned char *payloads)
+{
+	/* see MidiFile_importEvents(); with only one track, the file-wide list can be kept up to date as the events are made */
+
+	MidiFileEvent_t previous_event_in_track, previous_event_in_file = NULL;
+	struct MidiFileRecordKey *keys = NULL;
+	int records_are_in_order = 1, is_stale;
+	long first_tick, i;
+
+	if ((track == NULL) || (number_of_records < 0) || ((records == NULL) && (number_of_records > 0))) return -1;
+
+	for (i = 0; i < number_of_records; i++)
+	{
+		if (! record_is_valid(&(records[i]), payloads)) return -1;
+		if ((i > 0) && (records[i].tick < records[i - 1].tick)) records_are_in_order = 0;
+	}
+
+	if (number_of_records == 0) return 0;
+
+	if (! records_are_in_order)
+	{
+		if ((keys = (struct MidiFileRecordKey *)(malloc(number_of_records * sizeof (struct MidiFileRecordKey)))) == NULL) return -1;
+
+		for (i = 0; i < number_of_records; i++)
+		{
+			keys[i].tick = records[i].tick;
+			keys[i].record_number = i;
+		}
+
+		if (sort_record_keys_by_tick(keys, number_of_records) < 0)
+		{
+			free(keys);
+			return -1;
+		}
+	}
+
+	copy_track_for_snapshots(track);
+	first_tick = (keys == NULL) ? records[0].tick : keys[0].tick;
+	is_stale = track->midi_file->file_event_list_is_stale;
+	previous_event_in_track = get_last_event_in_track_at_or_before_tick(track, first_tick);
+	if (! is_stale) previous_event_in_file = get_last_event_in_file_at_or_before_tick(track->midi_file, first_tick);
+
+	for (i = 0; i < number_of_records; i++)
+	{
+		previous_event_in_track = append_record(track, &(records[(keys == NULL) ? i : keys[i].record_number]), payloads, previous_event_in_track);
+
+		if (is_stale)
+		{
+			previous_event_in_track->placement_at_tick = MIDI_FILE_PLACEMENT_LAST_AT_TICK;
+			append_event_to_file_list(track->midi_file, previous_event_in_track);
+		}
+		else
+		{
+			link_new_event_into_file(track->midi_file, previous_event_in_track, previous_event_in_file);
+			previous_event_in_file = previous_event_in_track;
+		}
+	}
+
+	free(keys);
+	return 0;
+}
+
 MidiFileEvent_t MidiFileTrack_getFirstEvent(MidiFileTrack_t track)
 {
 	if (track == NULL) return NULL;
+	sort_track_event_list(track);
 	return track->first_event;
 }
 
 MidiFileEvent_t MidiFileTrack_getLastEvent(MidiFileTrack_t track)
 {
 	if (track == NULL) return NULL;
+	sort_track_event_list(track);
 	return track->last_event;
 }
 
@@ -3347,28 +7960,9 @@ int MidiFileTrack_visitEvents(MidiFileTrack_t track, MidiFileEventVisitorCallbac
 
 int MidiFileEvent_delete(MidiFileEvent_t event)
 {
-	if (event == NULL) return -1;
-	if (event->track != NULL) remove_event(event);
-
-	switch (event->type)
-	{
-		case MIDI_FILE_EVENT_TYPE_SYSEX:
-		{
-			free(event->u.sysex.data_buffer);
-			break;
-		}
-		case MIDI_FILE_EVENT_TYPE_META:
-		{
-			free(event->u.meta.data_buffer);
-			break;
-		}
-		default:
-		{
-			break;
-		}
-	}
-
-	free(event);
+	if (event == NULL) return -1;
+	if (event->track != 0) remove_event(event);
+	free_event_and_data(event);
 	return 0;
 }
 
@@ -3376,14 +7970,15 @@ int MidiFileEvent_detach(MidiFileEvent_t event)
 {
 	if (event == NULL) return -1;
 
-	if (event->track != NULL)
+	if (event->track != 0)
 	{
 		remove_event(event);
-		event->track = NULL;
-		event->previous_event_in_track = NULL;
-		event->next_event_in_track = NULL;
-		event->previous_event_in_file = NULL;
-		event->next_event_in_file = NULL;
+		note_event_moving_between_files(event, get_track(event->track), NULL);
+		event->track = 0;
+		event->previous_event_in_track = 0;
+		event->next_event_in_track = 0;
+		event->previous_event_in_file = 0;
+		event->next_event_in_file = 0;
 	}
 
 	return 0;
@@ -3392,17 +7987,18 @@ int MidiFileEvent_detach(MidiFileEvent_t event)
 MidiFileTrack_t MidiFileEvent_getTrack(MidiFileEvent_t event)
 {
 	if (event == NULL) return NULL;
-	return event->track;
+	return get_track(event->track);
 }
 
 int MidiFileEvent_setTrack(MidiFileEvent_t event, MidiFileTrack_t track)
 {
 	if ((event == NULL) || (track == NULL)) return -1;
 
-	if (event->track != track)
+	if (get_track(event->track) != track)
 	{
-		if (event->track != NULL) remove_event(event);
-		event->track = track;
+		if (event->track != 0) remove_event(event);
+		note_event_moving_between_files(event, get_track(event->track), track);
+		event->track = get_track_reference(track);
 		add_event(event);
 	}
 
@@ -3422,10 +8018,12 @@ MidiFileEvent_t MidiFileEvent_getNextEvent(MidiFileEvent_t event)
 int MidiFileEvent_setPreviousEvent(MidiFileEvent_t event, MidiFileEvent_t previous_event)
 {
 	if ((event == NULL) || (event == previous_event)) return -1;
-	remove_event(event);
+	if ((previous_event == NULL) ? (event->track == 0) : (previous_event->track == 0)) return -1;
+	if (event->track != 0) remove_event(event);
 
 	if (previous_event != NULL)
 	{
+		note_event_moving_between_files(event, get_track(event->track), get_track(previous_event->track));
 		event->track = previous_event->track;
 		event->tick = previous_event->tick;
 	}
@@ -3437,10 +8035,12 @@ int MidiFileEvent_setPreviousEvent(MidiFileEvent_t event, MidiFileEvent_t previo
 int MidiFileEvent_setNextEvent(MidiFileEvent_t event, MidiFileEvent_t next_event)
 {
 	if ((event == NULL) || (event == next_event)) return -1;
-	remove_event(event);
+	if ((next_event == NULL) ? (event->track == 0) : (next_event->track == 0)) return -1;
+	if (event->track != 0) remove_event(event);
 
 	if (next_event != NULL)
 	{
+		note_event_moving_between_files(event, get_track(event->track), get_track(next_event->track));
 		event->track = next_event->track;
 		event->tick = next_event->tick;
 	}
@@ -3452,25 +8052,27 @@ int MidiFileEvent_setNextEvent(MidiFileEvent_t event, MidiFileEvent_t next_event
 MidiFileEvent_t MidiFileEvent_getPreviousEventInTrack(MidiFileEvent_t event)
 {
 	if (event == NULL) return NULL;
-	return event->previous_event_in_track;
+	return get_event(event->previous_event_in_track);
 }
 
 MidiFileEvent_t MidiFileEvent_getNextEventInTrack(MidiFileEvent_t event)
 {
 	if (event == NULL) return NULL;
-	return event->next_event_in_track;
+	return get_event(event->next_event_in_track);
 }
 
 MidiFileEvent_t MidiFileEvent_getPreviousEventInFile(MidiFileEvent_t event)
 {
 	if (event == NULL) return NULL;
-	return event->previous_event_in_file;
+	if ((event->track != 0) && get_track(event->track)->midi_file->file_event_list_is_stale) prepare_file_event_list(get_track(event->track)->midi_file);
+	return get_event(event->previous_event_in_file);
 }
 
 MidiFileEvent_t MidiFileEvent_getNextEventInFile(MidiFileEvent_t event)
 {
 	if (event == NULL) return NULL;
-	return event->next_event_in_file;
+	if ((event->track != 0) && get_track(event->track)->midi_file->file_event_list_is_stale) prepare_file_event_list(get_track(event->track)->midi_file);
+	return get_event(event->next_event_in_file);
 }
 
 long MidiFileEvent_getTick(MidiFileEvent_t event)
@@ -3482,9 +8084,9 @@ long MidiFileEvent_getTick(MidiFileEvent_t event)
 int MidiFileEvent_setTick(MidiFileEvent_t event, long tick)
 {
 	if (event == NULL) return -1;
-	if (event->track != NULL) remove_event(event);
+	if (event->track != 0) remove_event(event);
 	event->tick = tick;
-	if (event->track != NULL) add_event(event);
+	if (event->track != 0) add_event(event);
 	return 0;
 }
 
@@ -3503,7 +8105,8 @@ int MidiFileEvent_isSelected(MidiFileEvent_t event)
 int MidiFileEvent_setSelected(MidiFileEvent_t event, int is_selected)
 {
 	if (event == NULL) return -1;
-	event->is_selected = is_selected;
+	prepare_track_for_change(get_track(event->track));
+	event->is_selected = (is_selected != 0);
 	return 0;
 }
 
@@ -3587,7 +8190,10 @@ int MidiFileNoteOffEvent_getChannel(MidiFileEvent_t event)
 int MidiFileNoteOffEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_OFF)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	remove_note_partners(event);
 	event->u.note_off.channel = channel;
+	add_note_partners(event);
 	return 0;
 }
 
@@ -3600,7 +8206,10 @@ int MidiFileNoteOffEvent_getNote(MidiFileEvent_t event)
 int MidiFileNoteOffEvent_setNote(MidiFileEvent_t event, int note)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_OFF)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	remove_note_partners(event);
 	event->u.note_off.note = note;
+	add_note_partners(event);
 	return 0;
 }
 
@@ -3613,6 +8222,7 @@ int MidiFileNoteOffEvent_getVelocity(MidiFileEvent_t event)
 int MidiFileNoteOffEvent_setVelocity(MidiFileEvent_t event, int velocity)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_OFF)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.note_off.velocity = velocity;
 	return 0;
 }
@@ -3626,7 +8236,10 @@ int MidiFileNoteOnEvent_getChannel(MidiFileEvent_t event)
 int MidiFileNoteOnEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_ON)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	remove_note_partners(event);
 	event->u.note_on.channel = channel;
+	add_note_partners(event);
 	return 0;
 }
 
@@ -3639,7 +8252,10 @@ int MidiFileNoteOnEvent_getNote(MidiFileEvent_t event)
 int MidiFileNoteOnEvent_setNote(MidiFileEvent_t event, int note)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_ON)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	remove_note_partners(event);
 	event->u.note_on.note = note;
+	add_note_partners(event);
 	return 0;
 }
 
@@ -3652,7 +8268,20 @@ int MidiFileNoteOnEvent_getVelocity(MidiFileEvent_t event)
 int MidiFileNoteOnEvent_setVelocity(MidiFileEvent_t event, int velocity)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE_ON)) return -1;
-	event->u.note_on.velocity = velocity;
+	prepare_track_for_change(get_track(event->track));
+
+	if ((event->u.note_on.velocity > 0) == ((unsigned char)(velocity) > 0))
+	{
+		event->u.note_on.velocity = velocity;
+	}
+	else
+	{
+		/* switching between a note start and a note end */
+		remove_note_partners(event);
+		event->u.note_on.velocity = velocity;
+		add_note_partners(event);
+	}
+
 	return 0;
 }
 
@@ -3665,6 +8294,7 @@ int MidiFileKeyPressureEvent_getChannel(MidiFileEvent_t event)
 int MidiFileKeyPressureEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_KEY_PRESSURE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.key_pressure.channel = channel;
 	return 0;
 }
@@ -3678,6 +8308,7 @@ int MidiFileKeyPressureEvent_getNote(MidiFileEvent_t event)
 int MidiFileKeyPressureEvent_setNote(MidiFileEvent_t event, int note)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_KEY_PRESSURE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.key_pressure.note = note;
 	return 0;
 }
@@ -3691,6 +8322,7 @@ int MidiFileKeyPressureEvent_getAmount(MidiFileEvent_t event)
 int MidiFileKeyPressureEvent_setAmount(MidiFileEvent_t event, int amount)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_KEY_PRESSURE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.key_pressure.amount = amount;
 	return 0;
 }
@@ -3704,6 +8336,7 @@ int MidiFileControlChangeEvent_getChannel(MidiFileEvent_t event)
 int MidiFileControlChangeEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.control_change.channel = channel;
 	return 0;
 }
@@ -3717,6 +8350,7 @@ int MidiFileControlChangeEvent_getNumber(MidiFileEvent_t event)
 int MidiFileControlChangeEvent_setNumber(MidiFileEvent_t event, int number)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.control_change.number = number;
 	return 0;
 }
@@ -3730,6 +8364,7 @@ int MidiFileControlChangeEvent_getValue(MidiFileEvent_t event)
 int MidiFileControlChangeEvent_setValue(MidiFileEvent_t event, int value)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.control_change.value = value;
 	return 0;
 }
@@ -3743,6 +8378,7 @@ int MidiFileProgramChangeEvent_getChannel(MidiFileEvent_t event)
 int MidiFileProgramChangeEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.program_change.channel = channel;
 	return 0;
 }
@@ -3756,6 +8392,7 @@ int MidiFileProgramChangeEvent_getNumber(MidiFileEvent_t event)
 int MidiFileProgramChangeEvent_setNumber(MidiFileEvent_t event, int number)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.program_change.number = number;
 	return 0;
 }
@@ -3769,6 +8406,7 @@ int MidiFileChannelPressureEvent_getChannel(MidiFileEvent_t event)
 int MidiFileChannelPressureEvent_setChannel(MidiFileEvent_t event, int channel)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.channel_pressure.channel = channel;
 	return 0;
 }
@@ -3782,6 +8420,7 @@ int MidiFileChannelPressureEvent_getAmount(MidiFileEvent_t event)
 int MidiFileChannelPressureEvent_setAmount(MidiFileEvent_t event, int amount)
 {
 	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE)) return -1;
+	prepare_track_for_change(get_track(event->track));
 	event->u.channel_pressure.amount = amount;
 	return 0;
 }
@@ -3794,541 +8433,1256 @@ int MidiFilePitchWheelEvent_getChannel(MidiFileEvent_t event)
 
 int MidiFilePitchWheelEvent_setChannel(MidiFileEvent_t event, int channel)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
-	event->u.pitch_wheel.channel = channel;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.pitch_wheel.channel = channel;
+	return 0;
+}
+
+int MidiFilePitchWheelEvent_getValue(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
+	return event->u.pitch_wheel.value;
+}
+
+int MidiFilePitchWheelEvent_setValue(MidiFileEvent_t event, int value)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.pitch_wheel.value = value;
+	return 0;
+}
+
+int MidiFileSysexEvent_getDataLength(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX)) return -1;
+	return event->u.sysex.data_length;
+}
+
+unsigned char *MidiFileSysexEvent_getData(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX)) return NULL;
+	return event->u.sysex.data_buffer;
+}
+
+int MidiFileSysexEvent_setData(MidiFileEvent_t event, int data_length, unsigned char *data_buffer)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX) || (data_length < 1) || (data_buffer == NULL)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	free_data(get_event_storage(event), event->u.sysex.data_buffer, event->u.sysex.data_length);
+	event->u.sysex.data_length = data_length;
+	event->u.sysex.data_buffer = allocate_data(get_event_storage(event), data_length);
+	memcpy(event->u.sysex.data_buffer, data_buffer, data_length);
+	return 0;
+}
+
+int MidiFileMetaEvent_getNumber(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
+	return event->u.meta.number;
+}
+
+int MidiFileMetaEvent_setNumber(MidiFileEvent_t event, int number)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	invalidate_tempo_map_for_event(event);
+	event->u.meta.number = number;
+	return 0;
+}
+
+int MidiFileMetaEvent_getDataLength(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
+	return event->u.meta.data_length;
+}
+
+unsigned char *MidiFileMetaEvent_getData(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return NULL;
+	return event->u.meta.data_buffer;
+}
+
+int MidiFileMetaEvent_setData(MidiFileEvent_t event, int data_length, unsigned char *data_buffer)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META) || (data_buffer == NULL)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	invalidate_tempo_map_for_event(event);
+	free_data(get_event_storage(event), event->u.meta.data_buffer, event->u.meta.data_length + 1);
+	event->u.meta.data_length = data_length;
+	event->u.meta.data_buffer = allocate_data(get_event_storage(event), data_length + 1);
+	memcpy(event->u.meta.data_buffer, data_buffer, data_length);
+	event->u.meta.data_buffer[data_length] = '\0';
+	return 0;
+}
+
+long MidiFileNoteEvent_getDurationTicks(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	return event->u.note.duration_ticks;
+}
+
+int MidiFileNoteEvent_setDurationTicks(MidiFileEvent_t event, long duration_ticks)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.note.duration_ticks = duration_ticks;
+	return 0;
+}
+
+int MidiFileNoteEvent_getChannel(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	return event->u.note.channel;
+}
+
+int MidiFileNoteEvent_setChannel(MidiFileEvent_t event, int channel)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.note.channel = channel;
+	return 0;
+}
+
+int MidiFileNoteEvent_getNote(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	return event->u.note.note;
+}
+
+int MidiFileNoteEvent_setNote(MidiFileEvent_t event, int note)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.note.note = note;
+	return 0;
+}
+
+int MidiFileNoteEvent_getVelocity(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	return event->u.note.velocity;
+}
+
+int MidiFileNoteEvent_setVelocity(MidiFileEvent_t event, int velocity)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.note.velocity = velocity;
+	return 0;
+}
+
+int MidiFileNoteEvent_getEndVelocity(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	return event->u.note.end_velocity;
+}
+
+int MidiFileNoteEvent_setEndVelocity(MidiFileEvent_t event, int end_velocity)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.note.end_velocity = end_velocity;
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getChannel(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return event->u.fine_control_change.channel;
+}
+
+int MidiFileFineControlChangeEvent_setChannel(MidiFileEvent_t event, int channel)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.channel = channel;
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getCoarseNumber(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return event->u.fine_control_change.coarse_number;
+}
+
+int MidiFileFineControlChangeEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.coarse_number = coarse_number;
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getFineNumber(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return event->u.fine_control_change.coarse_number + 32;
+}
+
+int MidiFileFineControlChangeEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.coarse_number = fine_number - 32;
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getValue(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return event->u.fine_control_change.value;
+}
+
+int MidiFileFineControlChangeEvent_setValue(MidiFileEvent_t event, int value)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.value = value;
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getCoarseValue(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return ((event->u.fine_control_change.value >> 7) & 0x7F);
+}
+
+int MidiFileFineControlChangeEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.value = (coarse_value << 7) | (event->u.fine_control_change.value & 0x7F);
+	return 0;
+}
+
+int MidiFileFineControlChangeEvent_getFineValue(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	return (event->u.fine_control_change.value & 0x7F);
+}
+
+int MidiFileFineControlChangeEvent_setFineValue(MidiFileEvent_t event, int fine_value)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.fine_control_change.value = (event->u.fine_control_change.value & ~0x7F) | (fine_value & 0x7F);
+	return 0;
+}
+
+int MidiFileRpnEvent_getChannel(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return event->u.rpn.channel;
+}
+
+int MidiFileRpnEvent_setChannel(MidiFileEvent_t event, int channel)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.channel = channel;
+	return 0;
+}
+
+int MidiFileRpnEvent_getNumber(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return event->u.rpn.number;
+}
+
+int MidiFileRpnEvent_setNumber(MidiFileEvent_t event, int number)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.number = number;
+	return 0;
+}
+
+int MidiFileRpnEvent_getCoarseNumber(MidiFileEvent_t event)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return ((event->u.rpn.number >> 7) & 0x7F);
+}
+
+int MidiFileRpnEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
+{
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.number = (coarse_number << 7) | (event->u.rpn.number & 0x7F);
 	return 0;
 }
 
-int MidiFilePitchWheelEvent_getValue(MidiFileEvent_t event)
+int MidiFileRpnEvent_getFineNumber(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
-	return event->u.pitch_wheel.value;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return (event->u.rpn.number & 0x7F);
 }
 
-int MidiFilePitchWheelEvent_setValue(MidiFileEvent_t event, int value)
+int MidiFileRpnEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_PITCH_WHEEL)) return -1;
-	event->u.pitch_wheel.value = value;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.number = (event->u.rpn.number & ~0x7F) | (fine_number & 0x7F);
 	return 0;
 }
 
-int MidiFileSysexEvent_getDataLength(MidiFileEvent_t event)
+int MidiFileRpnEvent_getValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX)) return -1;
-	return event->u.sysex.data_length;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return event->u.rpn.value;
 }
 
-unsigned char *MidiFileSysexEvent_getData(MidiFileEvent_t event)
+int MidiFileRpnEvent_setValue(MidiFileEvent_t event, int value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX)) return NULL;
-	return event->u.sysex.data_buffer;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.value = value;
+	return 0;
 }
 
-int MidiFileSysexEvent_setData(MidiFileEvent_t event, int data_length, unsigned char *data_buffer)
+int MidiFileRpnEvent_getCoarseValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_SYSEX) || (data_length < 1) || (data_buffer == NULL)) return -1;
-	free(event->u.sysex.data_buffer);
-	event->u.sysex.data_length = data_length;
-	event->u.sysex.data_buffer = malloc(data_length);
-	memcpy(event->u.sysex.data_buffer, data_buffer, data_length);
-	return 0;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return ((event->u.rpn.value >> 7) & 0x7F);
 }
 
-int MidiFileMetaEvent_getNumber(MidiFileEvent_t event)
+int MidiFileRpnEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
-	return event->u.meta.number;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.value = (coarse_value << 7) | (event->u.rpn.value & 0x7F);
+	return 0;
 }
 
-int MidiFileMetaEvent_setNumber(MidiFileEvent_t event, int number)
+int MidiFileRpnEvent_getFineValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
-	event->u.meta.number = number;
-	return 0;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	return (event->u.rpn.value & 0x7F);
 }
 
-int MidiFileMetaEvent_getDataLength(MidiFileEvent_t event)
+int MidiFileRpnEvent_setFineValue(MidiFileEvent_t event, int fine_value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return -1;
-	return event->u.meta.data_length;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.rpn.value = (event->u.rpn.value & ~0x7F) | (fine_value & 0x7F);
+	return 0;
 }
 
-unsigned char *MidiFileMetaEvent_getData(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getChannel(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META)) return NULL;
-	return event->u.meta.data_buffer;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return event->u.nrpn.channel;
 }
 
-int MidiFileMetaEvent_setData(MidiFileEvent_t event, int data_length, unsigned char *data_buffer)
+int MidiFileNrpnEvent_setChannel(MidiFileEvent_t event, int channel)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_META) || (data_buffer == NULL)) return -1;
-	free(event->u.meta.data_buffer);
-	event->u.meta.data_length = data_length;
-	event->u.meta.data_buffer = malloc(data_length + 1);
-	memcpy(event->u.meta.data_buffer, data_buffer, data_length);
-	event->u.meta.data_buffer[data_length] = '\0';
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.channel = channel;
 	return 0;
 }
 
-long MidiFileNoteEvent_getDurationTicks(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getNumber(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	return event->u.note.duration_ticks;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return event->u.nrpn.number;
 }
 
-int MidiFileNoteEvent_setDurationTicks(MidiFileEvent_t event, long duration_ticks)
+int MidiFileNrpnEvent_setNumber(MidiFileEvent_t event, int number)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	event->u.note.duration_ticks = duration_ticks;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.number = number;
 	return 0;
 }
 
-int MidiFileNoteEvent_getChannel(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getCoarseNumber(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	return event->u.note.channel;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return ((event->u.nrpn.number >> 7) & 0x7F);
 }
 
-int MidiFileNoteEvent_setChannel(MidiFileEvent_t event, int channel)
+int MidiFileNrpnEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	event->u.note.channel = channel;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.number = (coarse_number << 7) | (event->u.nrpn.number & 0x7F);
 	return 0;
 }
 
-int MidiFileNoteEvent_getNote(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getFineNumber(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	return event->u.note.note;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return (event->u.nrpn.number & 0x7F);
 }
 
-int MidiFileNoteEvent_setNote(MidiFileEvent_t event, int note)
+int MidiFileNrpnEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	event->u.note.note = note;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.number = (event->u.nrpn.number & ~0x7F) | (fine_number & 0x7F);
 	return 0;
 }
 
-int MidiFileNoteEvent_getVelocity(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	return event->u.note.velocity;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return event->u.nrpn.value;
 }
 
-int MidiFileNoteEvent_setVelocity(MidiFileEvent_t event, int velocity)
+int MidiFileNrpnEvent_setValue(MidiFileEvent_t event, int value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	event->u.note.velocity = velocity;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.value = value;
 	return 0;
 }
 
-int MidiFileNoteEvent_getEndVelocity(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getCoarseValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	return event->u.note.end_velocity;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return ((event->u.nrpn.value >> 7) & 0x7F);
 }
 
-int MidiFileNoteEvent_setEndVelocity(MidiFileEvent_t event, int end_velocity)
+int MidiFileNrpnEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NOTE)) return -1;
-	event->u.note.end_velocity = end_velocity;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.value = (coarse_value << 7) | (event->u.nrpn.value & 0x7F);
 	return 0;
 }
 
-int MidiFileFineControlChangeEvent_getChannel(MidiFileEvent_t event)
+int MidiFileNrpnEvent_getFineValue(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return event->u.fine_control_change.channel;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	return (event->u.nrpn.value & 0x7F);
 }
 
-int MidiFileFineControlChangeEvent_setChannel(MidiFileEvent_t event, int channel)
+int MidiFileNrpnEvent_setFineValue(MidiFileEvent_t event, int fine_value)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.channel = channel;
+	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
+	prepare_track_for_change(get_track(event->track));
+	event->u.nrpn.value = (event->u.nrpn.value & ~0x7F) | (fine_value & 0x7F);
 	return 0;
 }
 
-int MidiFileFineControlChangeEvent_getCoarseNumber(MidiFileEvent_t event)
+int MidiFileNoteStartEvent_getChannel(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return event->u.fine_control_change.coarse_number;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+	return MidiFileNoteOnEvent_getChannel(event);
 }
 
-int MidiFileFineControlChangeEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
+int MidiFileNoteStartEvent_setChannel(MidiFileEvent_t event, int channel)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.coarse_number = coarse_number;
-	return 0;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+
+	{
+		MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
+
+		switch (MidiFileEvent_getType(end_event))
+		{
+			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+			{
+				MidiFileNoteOnEvent_setChannel(end_event, channel);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			{
+				MidiFileNoteOffEvent_setChannel(end_event, channel);
+				break;
+			}
+			default:
+			{
+				break;
+			}
+		}
+	}
+
+	return MidiFileNoteOnEvent_setChannel(event, channel);
 }
 
-int MidiFileFineControlChangeEvent_getFineNumber(MidiFileEvent_t event)
+int MidiFileNoteStartEvent_getNote(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return event->u.fine_control_change.coarse_number + 32;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+	return MidiFileNoteOnEvent_getNote(event);
 }
 
-int MidiFileFineControlChangeEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
+int MidiFileNoteStartEvent_setNote(MidiFileEvent_t event, int note)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.coarse_number = fine_number - 32;
-	return 0;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+
+	{
+		MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
+
+		switch (MidiFileEvent_getType(end_event))
+		{
+			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+			{
+				MidiFileNoteOnEvent_setNote(end_event, note);
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			{
+				MidiFileNoteOffEvent_setNote(end_event, note);
+				break;
+			}
+			default:
+			{
+				break;
+			}
+		}
+	}
+
+	return MidiFileNoteOnEvent_setNote(event, note);
 }
 
-int MidiFileFineControlChangeEvent_getValue(MidiFileEvent_t event)
+int MidiFileNoteStartEvent_getVelocity(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return event->u.fine_control_change.value;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+	return MidiFileNoteOnEvent_getVelocity(event);
 }
 
-int MidiFileFineControlChangeEvent_setValue(MidiFileEvent_t event, int value)
+int MidiFileNoteStartEvent_setVelocity(MidiFileEvent_t event, int velocity)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.value = value;
-	return 0;
+	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+	return MidiFileNoteOnEvent_setVelocity(event, velocity);
 }
 
-int MidiFileFineControlChangeEvent_getCoarseValue(MidiFileEvent_t event)
+MidiFileEvent_t MidiFileNoteStartEvent_getNoteEndEvent(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return ((event->u.fine_control_change.value >> 7) & 0x7F);
+	if ((! MidiFileEvent_isNoteStartEvent(event)) || (event->track == 0)) return NULL;
+	if (! get_track(event->track)->note_partners_are_valid) build_note_partners(get_track(event->track));
+	return get_event(event->u.note_on.partner);
 }
 
-int MidiFileFineControlChangeEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
+int MidiFileNoteEndEvent_getChannel(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.value = (coarse_value << 7) | (event->u.fine_control_change.value & 0x7F);
-	return 0;
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return MidiFileNoteOnEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_getChannel(event);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileFineControlChangeEvent_getFineValue(MidiFileEvent_t event)
+int MidiFileNoteEndEvent_setChannel(MidiFileEvent_t event, int channel)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	return (event->u.fine_control_change.value & 0x7F);
-}
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	MidiFileNoteOnEvent_setChannel(MidiFileNoteEndEvent_getNoteStartEvent(event), channel);
 
-int MidiFileFineControlChangeEvent_setFineValue(MidiFileEvent_t event, int fine_value)
-{
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE)) return -1;
-	event->u.fine_control_change.value = (event->u.fine_control_change.value & ~0x7F) | (fine_value & 0x7F);
-	return 0;
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return MidiFileNoteOnEvent_setChannel(event, channel);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_setChannel(event, channel);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_getChannel(MidiFileEvent_t event)
+int MidiFileNoteEndEvent_getNote(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return event->u.rpn.channel;
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return MidiFileNoteOnEvent_getNote(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_getNote(event);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_setChannel(MidiFileEvent_t event, int channel)
+int MidiFileNoteEndEvent_setNote(MidiFileEvent_t event, int note)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.channel = channel;
-	return 0;
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	MidiFileNoteOnEvent_setNote(MidiFileNoteEndEvent_getNoteStartEvent(event), note);
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return MidiFileNoteOnEvent_setNote(event, note);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_setNote(event, note);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_getNumber(MidiFileEvent_t event)
+int MidiFileNoteEndEvent_getVelocity(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return event->u.rpn.number;
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_getVelocity(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return 0;
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_setNumber(MidiFileEvent_t event, int number)
+int MidiFileNoteEndEvent_setVelocity(MidiFileEvent_t event, int velocity)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.number = number;
-	return 0;
+	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_setVelocity(event, velocity);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			if (velocity == 0) return 0;
+			prepare_track_for_change(get_track(event->track));
+			event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
+			return MidiFileNoteOffEvent_setVelocity(event, velocity);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_getCoarseNumber(MidiFileEvent_t event)
+MidiFileEvent_t MidiFileNoteEndEvent_getNoteStartEvent(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return ((event->u.rpn.number >> 7) & 0x7F);
+	if ((! MidiFileEvent_isNoteEndEvent(event)) || (event->track == 0)) return NULL;
+	if (! get_track(event->track)->note_partners_are_valid) build_note_partners(get_track(event->track));
+	return get_event(event->u.note_on.partner);
 }
 
-int MidiFileRpnEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
+int MidiFilePressureEvent_getChannel(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.number = (coarse_number << 7) | (event->u.rpn.number & 0x7F);
-	return 0;
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return MidiFileKeyPressureEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return MidiFileChannelPressureEvent_getChannel(event);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_getFineNumber(MidiFileEvent_t event)
+int MidiFilePressureEvent_setChannel(MidiFileEvent_t event, int channel)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return (event->u.rpn.number & 0x7F);
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return MidiFileKeyPressureEvent_setChannel(event, channel);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return MidiFileChannelPressureEvent_setChannel(event, channel);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
+int MidiFilePressureEvent_getNote(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.number = (event->u.rpn.number & ~0x7F) | (fine_number & 0x7F);
-	return 0;
+	return MidiFileKeyPressureEvent_getNote(event);
 }
 
-int MidiFileRpnEvent_getValue(MidiFileEvent_t event)
+int MidiFilePressureEvent_setNote(MidiFileEvent_t event, int note)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return event->u.rpn.value;
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			if (note < 0)
+			{
+				int amount = MidiFileKeyPressureEvent_getAmount(event);
+				prepare_track_for_change(get_track(event->track));
+				event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
+				return MidiFileChannelPressureEvent_setAmount(event, amount);
+			}
+			else
+			{
+				return MidiFileKeyPressureEvent_setNote(event, note);
+			}
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			if (note < 0)
+			{
+				return 0;
+			}
+			else
+			{
+				int amount = MidiFileChannelPressureEvent_getAmount(event);
+				prepare_track_for_change(get_track(event->track));
+				event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
+				MidiFileKeyPressureEvent_setAmount(event, amount);
+				return MidiFileKeyPressureEvent_setNote(event, note);
+			}
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_setValue(MidiFileEvent_t event, int value)
+int MidiFilePressureEvent_getAmount(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.value = value;
-	return 0;
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return MidiFileKeyPressureEvent_getAmount(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return MidiFileChannelPressureEvent_getAmount(event);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_getCoarseValue(MidiFileEvent_t event)
+int MidiFilePressureEvent_setAmount(MidiFileEvent_t event, int amount)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return ((event->u.rpn.value >> 7) & 0x7F);
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return MidiFileKeyPressureEvent_setAmount(event, amount);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return MidiFileChannelPressureEvent_setAmount(event, amount);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileRpnEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
+char *MidiFileTextEvent_getText(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.value = (coarse_value << 7) | (event->u.rpn.value & 0x7F);
-	return 0;
+	if (! MidiFileEvent_isTextEvent(event)) return NULL;
+	return (char *)(MidiFileMetaEvent_getData(event));
 }
 
-int MidiFileRpnEvent_getFineValue(MidiFileEvent_t event)
+int MidiFileTextEvent_setText(MidiFileEvent_t event, char *text)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	return (event->u.rpn.value & 0x7F);
+	if (! MidiFileEvent_isTextEvent(event)) return -1;
+	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
 }
 
-int MidiFileRpnEvent_setFineValue(MidiFileEvent_t event, int fine_value)
+char *MidiFileLyricEvent_getText(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_RPN)) return -1;
-	event->u.rpn.value = (event->u.rpn.value & ~0x7F) | (fine_value & 0x7F);
-	return 0;
+	if (! MidiFileEvent_isLyricEvent(event)) return NULL;
+	return (char *)(MidiFileMetaEvent_getData(event));
 }
 
-int MidiFileNrpnEvent_getChannel(MidiFileEvent_t event)
+int MidiFileLyricEvent_setText(MidiFileEvent_t event, char *text)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return event->u.nrpn.channel;
+	if (! MidiFileEvent_isLyricEvent(event)) return -1;
+	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
 }
 
-int MidiFileNrpnEvent_setChannel(MidiFileEvent_t event, int channel)
+char *MidiFileMarkerEvent_getText(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.channel = channel;
-	return 0;
+	if (! MidiFileEvent_isMarkerEvent(event)) return NULL;
+	return (char *)(MidiFileMetaEvent_getData(event));
 }
 
-int MidiFileNrpnEvent_getNumber(MidiFileEvent_t event)
+int MidiFileMarkerEvent_setText(MidiFileEvent_t event, char *text)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return event->u.nrpn.number;
+	if (! MidiFileEvent_isMarkerEvent(event)) return -1;
+	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
 }
 
-int MidiFileNrpnEvent_setNumber(MidiFileEvent_t event, int number)
+char *MidiFilePortEvent_getName(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.number = number;
-	return 0;
+	if (! MidiFileEvent_isPortEvent(event)) return NULL;
+	return (char *)(MidiFileMetaEvent_getData(event));
 }
 
-int MidiFileNrpnEvent_getCoarseNumber(MidiFileEvent_t event)
+int MidiFilePortEvent_setName(MidiFileEvent_t event, char *name)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return ((event->u.nrpn.number >> 7) & 0x7F);
+	if (! MidiFileEvent_isPortEvent(event)) return -1;
+	return MidiFileMetaEvent_setData(event, strlen(name), (unsigned char *)(name));
 }
 
-int MidiFileNrpnEvent_setCoarseNumber(MidiFileEvent_t event, int coarse_number)
+float MidiFileTempoEvent_getTempo(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.number = (coarse_number << 7) | (event->u.nrpn.number & 0x7F);
-	return 0;
+	unsigned char *buffer;
+	long midi_tempo;
+
+	if (! MidiFileEvent_isTempoEvent(event)) return 120.0;
+
+	buffer = MidiFileMetaEvent_getData(event);
+	midi_tempo = (buffer[0] << 16) | (buffer[1] << 8) | buffer[2];
+	return (float)(60000000.0 / midi_tempo);
 }
 
-int MidiFileNrpnEvent_getFineNumber(MidiFileEvent_t event)
+int MidiFileTempoEvent_setTempo(MidiFileEvent_t event, float tempo)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return (event->u.nrpn.number & 0x7F);
+	long midi_tempo;
+	unsigned char buffer[3];
+
+	if (! MidiFileEvent_isTempoEvent(event)) return -1;
+
+	midi_tempo = (long)(60000000 / tempo);
+	buffer[0] = (midi_tempo >> 16) & 0xFF;
+	buffer[1] = (midi_tempo >> 8) & 0xFF;
+	buffer[2] = midi_tempo & 0xFF;
+	return MidiFileMetaEvent_setData(event, 3, buffer);
 }
 
-int MidiFileNrpnEvent_setFineNumber(MidiFileEvent_t event, int fine_number)
+int MidiFileTimeSignatureEvent_getNumerator(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.number = (event->u.nrpn.number & ~0x7F) | (fine_number & 0x7F);
-	return 0;
+	unsigned char *buffer;
+
+	if (! MidiFileEvent_isTimeSignatureEvent(event)) return 4;
+
+	buffer = MidiFileMetaEvent_getData(event);
+	return (int)(buffer[0]);
 }
 
-int MidiFileNrpnEvent_getValue(MidiFileEvent_t event)
+int MidiFileTimeSignatureEvent_getDenominator(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return event->u.nrpn.value;
+	unsigned char *buffer;
+
+	if (! MidiFileEvent_isTimeSignatureEvent(event)) return 4;
+
+	buffer = MidiFileMetaEvent_getData(event);
+
+	switch (buffer[1])
+	{
+		case 0:
+		{
+			return 1;
+		}
+		case 1:
+		{
+			return 2;
+		}
+		case 2:
+		{
+			return 4;
+		}
+		case 3:
+		{
+			return 8;
+		}
+		case 4:
+		{
+			return 16;
+		}
+		case 5:
+		{
+			return 32;
+		}
+		case 6:
+		{
+			return 64;
+		}
+		case 7:
+		{
+			return 128;
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileNrpnEvent_setValue(MidiFileEvent_t event, int value)
+int MidiFileTimeSignatureEvent_setTimeSignature(MidiFileEvent_t event, int numerator, int denominator)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.value = value;
-	return 0;
+	unsigned char buffer[4];
+	buffer[0] = numerator & 0xFF;
+
+	switch (denominator)
+	{
+		case 1:
+		{
+			buffer[1] = 0;
+			break;
+		}
+		case 2:
+		{
+			buffer[1] = 1;
+			break;
+		}
+		case 4:
+		{
+			buffer[1] = 2;
+			break;
+		}
+		case 8:
+		{
+			buffer[1] = 3;
+			break;
+		}
+		case 16:
+		{
+			buffer[1] = 4;
+			break;
+		}
+		case 32:
+		{
+			buffer[1] = 5;
+			break;
+		}
+		case 64:
+		{
+			buffer[1] = 6;
+			break;
+		}
+		case 128:
+		{
+			buffer[1] = 7;
+			break;
+		}
+		default:
+		{
+			return -1;
+		}
+	}
+
+	buffer[2] = 96 / denominator;
+	buffer[3] = 8;
+	return MidiFileMetaEvent_setData(event, 4, buffer);
 }
 
-int MidiFileNrpnEvent_getCoarseValue(MidiFileEvent_t event)
+int MidiFileKeySignatureEvent_getNumber(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return ((event->u.nrpn.value >> 7) & 0x7F);
+	union
+	{
+		unsigned char unsigned_value;
+		char signed_value;
+	}
+	u;
+
+	if (! MidiFileEvent_isKeySignatureEvent(event)) return 0;
+	u.unsigned_value = MidiFileMetaEvent_getData(event)[0];
+	return u.signed_value;
 }
 
-int MidiFileNrpnEvent_setCoarseValue(MidiFileEvent_t event, int coarse_value)
+int MidiFileKeySignatureEvent_isMinor(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.value = (coarse_value << 7) | (event->u.nrpn.value & 0x7F);
-	return 0;
+	if (! MidiFileEvent_isKeySignatureEvent(event)) return 0;
+	return MidiFileMetaEvent_getData(event)[1];
 }
 
-int MidiFileNrpnEvent_getFineValue(MidiFileEvent_t event)
+int MidiFileKeySignatureEvent_setKeySignature(MidiFileEvent_t event, int number, int minor)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	return (event->u.nrpn.value & 0x7F);
+	union
+	{
+		unsigned char unsigned_buffer[2];
+		char signed_buffer[2];
+	}
+	u;
+
+	u.signed_buffer[0] = number;
+	u.signed_buffer[1] = minor ? 1 : 0;
+	return MidiFileMetaEvent_setData(event, 2, u.unsigned_buffer);
 }
 
-int MidiFileNrpnEvent_setFineValue(MidiFileEvent_t event, int fine_value)
+int MidiFileVoiceEvent_getChannel(MidiFileEvent_t event)
 {
-	if ((event == NULL) || (event->type != MIDI_FILE_EVENT_TYPE_NRPN)) return -1;
-	event->u.nrpn.value = (event->u.nrpn.value & ~0x7F) | (fine_value & 0x7F);
-	return 0;
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return MidiFileNoteOffEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return MidiFileNoteOnEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return MidiFileKeyPressureEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		{
+			return MidiFileControlChangeEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			return MidiFilePitchWheelEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		{
+			return MidiFileProgramChangeEvent_getChannel(event);
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return MidiFileChannelPressureEvent_getChannel(event);
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileNoteStartEvent_getChannel(MidiFileEvent_t event)
+int MidiFileVoiceEvent_getDataLength(MidiFileEvent_t event)
 {
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
-	return MidiFileNoteOnEvent_getChannel(event);
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			return 3;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return 2;
+		}
+		default:
+		{
+			return 0;
+		}
+	}
 }
 
-int MidiFileNoteStartEvent_setChannel(MidiFileEvent_t event, int channel)
+unsigned long MidiFileVoiceEvent_getData(MidiFileEvent_t event)
 {
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
-
+	switch (MidiFileEvent_getType(event))
 	{
-		MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
-
-		switch (MidiFileEvent_getType(end_event))
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
 		{
-			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+			union
 			{
-				MidiFileNoteOnEvent_setChannel(end_event, channel);
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
-			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			u;
+
+			u.data_as_bytes[0] = 0x80 | MidiFileNoteOffEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileNoteOffEvent_getNote(event);
+			u.data_as_bytes[2] = MidiFileNoteOffEvent_getVelocity(event);
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			union
 			{
-				MidiFileNoteOffEvent_setChannel(end_event, channel);
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
-			default:
+			u;
+
+			u.data_as_bytes[0] = 0x90 | MidiFileNoteOnEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileNoteOnEvent_getNote(event);
+			u.data_as_bytes[2] = MidiFileNoteOnEvent_getVelocity(event);
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			union
 			{
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
-		}
-	}
-
-	return MidiFileNoteOnEvent_setChannel(event, channel);
-}
-
-int MidiFileNoteStartEvent_getNote(MidiFileEvent_t event)
-{
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
-	return MidiFileNoteOnEvent_getNote(event);
-}
-
-int MidiFileNoteStartEvent_setNote(MidiFileEvent_t event, int note)
-{
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
+			u;
 
-	{
-		MidiFileEvent_t end_event = MidiFileNoteStartEvent_getNoteEndEvent(event);
+			u.data_as_bytes[0] = 0xA0 | MidiFileKeyPressureEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileKeyPressureEvent_getNote(event);
+			u.data_as_bytes[2] = MidiFileKeyPressureEvent_getAmount(event);
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		{
+			union
+			{
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
+			}
+			u;
 
-		switch (MidiFileEvent_getType(end_event))
+			u.data_as_bytes[0] = 0xB0 | MidiFileControlChangeEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileControlChangeEvent_getNumber(event);
+			u.data_as_bytes[2] = MidiFileControlChangeEvent_getValue(event);
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
 		{
-			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+			union
 			{
-				MidiFileNoteOnEvent_setNote(end_event, note);
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
-			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			u;
+
+			u.data_as_bytes[0] = 0xC0 | MidiFileProgramChangeEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileProgramChangeEvent_getNumber(event);
+			u.data_as_bytes[2] = 0;
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			union
 			{
-				MidiFileNoteOffEvent_setNote(end_event, note);
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
-			default:
+			u;
+
+			u.data_as_bytes[0] = 0xD0 | MidiFileChannelPressureEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFileChannelPressureEvent_getAmount(event);
+			u.data_as_bytes[2] = 0;
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			union
 			{
-				break;
+				unsigned char data_as_bytes[4];
+				unsigned long data_as_uint32;
 			}
+			u;
+
+			u.data_as_bytes[0] = 0xE0 | MidiFilePitchWheelEvent_getChannel(event);
+			u.data_as_bytes[1] = MidiFilePitchWheelEvent_getValue(event) & 0x0F;
+			u.data_as_bytes[2] = MidiFilePitchWheelEvent_getValue(event) >> 7;
+			u.data_as_bytes[3] = 0;
+			return u.data_as_uint32;
+		}
+		default:
+		{
+			return 0;
 		}
 	}
-
-	return MidiFileNoteOnEvent_setNote(event, note);
-}
-
-int MidiFileNoteStartEvent_getVelocity(MidiFileEvent_t event)
-{
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
-	return MidiFileNoteOnEvent_getVelocity(event);
-}
-
-int MidiFileNoteStartEvent_setVelocity(MidiFileEvent_t event, int velocity)
-{
-	if (! MidiFileEvent_isNoteStartEvent(event)) return -1;
-	return MidiFileNoteOnEvent_setVelocity(event, velocity);
 }
 
-MidiFileEvent_t MidiFileNoteStartEvent_getNoteEndEvent(MidiFileEvent_t event)
+static int set_voice_event_data(MidiFileEvent_t event, unsigned long data)
 {
-	MidiFileEvent_t subsequent_event;
-
-	if (! MidiFileEvent_isNoteStartEvent(event)) return NULL;
-
-	for (subsequent_event = MidiFileEvent_getNextEventInTrack(event); subsequent_event != NULL; subsequent_event = MidiFileEvent_getNextEventInTrack(subsequent_event))
+	union
 	{
-		if (MidiFileEvent_isNoteEndEvent(subsequent_event) && (MidiFileNoteEndEvent_getChannel(subsequent_event) == MidiFileNoteStartEvent_getChannel(event)) && (MidiFileNoteEndEvent_getNote(subsequent_event) == MidiFileNoteStartEvent_getNote(event)))
-		{
-			return subsequent_event;
-		}
+		unsigned long data_as_uint32;
+		unsigned char data_as_bytes[4];
 	}
+	u;
 
-	return NULL;
-}
-
-int MidiFileNoteEndEvent_getChannel(MidiFileEvent_t event)
-{
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	u.data_as_uint32 = data;
 
-	switch (MidiFileEvent_getType(event))
+	switch (u.data_as_bytes[0] & 0xF0)
 	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		case 0x80:
 		{
-			return MidiFileNoteOnEvent_getChannel(event);
+			event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
+			event->u.note_off.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.note_off.note = u.data_as_bytes[1];
+			event->u.note_off.velocity = u.data_as_bytes[2];
+			return 0;
 		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case 0x90:
 		{
-			return MidiFileNoteOffEvent_getChannel(event);
+			event->type = MIDI_FILE_EVENT_TYPE_NOTE_ON;
+			event->u.note_on.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.note_on.note = u.data_as_bytes[1];
+			event->u.note_on.velocity = u.data_as_bytes[2];
+			return 0;
 		}
-		default:
+		case 0xA0:
 		{
-			return -1;
+			event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
+			event->u.key_pressure.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.key_pressure.note = u.data_as_bytes[1];
+			event->u.key_pressure.amount = u.data_as_bytes[2];
+			return 0;
 		}
-	}
-}
-
-int MidiFileNoteEndEvent_setChannel(MidiFileEvent_t event, int channel)
-{
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
-	MidiFileNoteOnEvent_setChannel(MidiFileNoteEndEvent_getNoteStartEvent(event), channel);
-
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		case 0xB0:
 		{
-			return MidiFileNoteOnEvent_setChannel(event, channel);
+			event->type = MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE;
+			event->u.control_change.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.control_change.number = u.data_as_bytes[1];
+			event->u.control_change.value = u.data_as_bytes[2];
+			return 0;
 		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		case 0xC0:
 		{
-			return MidiFileNoteOffEvent_setChannel(event, channel);
+			event->type = MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE;
+			event->u.program_change.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.program_change.number = u.data_as_bytes[1];
+			return 0;
+		}
+		case 0xD0:
+		{
+			event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
+			event->u.channel_pressure.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.channel_pressure.amount = u.data_as_bytes[1];
+			return 0;
+		}
+		case 0xE0:
+		{
+			event->type = MIDI_FILE_EVENT_TYPE_PITCH_WHEEL;
+			event->u.pitch_wheel.channel = u.data_as_bytes[0] & 0x0F;
+			event->u.pitch_wheel.value = (u.data_as_bytes[2] << 7) | u.data_as_bytes[1];
+			return 0;
 		}
 		default:
 		{
@@ -4337,997 +9691,1492 @@ int MidiFileNoteEndEvent_setChannel(MidiFileEvent_t event, int channel)
 	}
 }
 
-int MidiFileNoteEndEvent_getNote(MidiFileEvent_t event)
+int MidiFileVoiceEvent_setData(MidiFileEvent_t event, unsigned long data)
 {
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	int result;
 
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			return MidiFileNoteOnEvent_getNote(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		{
-			return MidiFileNoteOffEvent_getNote(event);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	if (event == NULL) return -1;
+	prepare_track_for_change(get_track(event->track));
+	remove_note_partners(event);
+	result = set_voice_event_data(event, data);
+	add_note_partners(event);
+	return result;
 }
 
-int MidiFileNoteEndEvent_setNote(MidiFileEvent_t event, int note)
+static int copy_formatted_string(char *formatted_string, char *buffer, int buffer_size)
 {
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
-	MidiFileNoteOnEvent_setNote(MidiFileNoteEndEvent_getNoteStartEvent(event), note);
+	/* the callers format into a local buffer big enough for any value, so that this is the only place that needs to know about the caller's buffer size */
 
-	switch (MidiFileEvent_getType(event))
+	int length = strlen(formatted_string);
+
+	if ((buffer == NULL) || (buffer_size < 1)) return -1;
+
+	if (length >= buffer_size)
 	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			return MidiFileNoteOnEvent_setNote(event, note);
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		{
-			return MidiFileNoteOffEvent_setNote(event, note);
-		}
-		default:
-		{
-			return -1;
-		}
+		buffer[0] = '\0';
+		return -1;
 	}
+
+	memcpy(buffer, formatted_string, length + 1);
+	return length;
 }
 
-int MidiFileNoteEndEvent_getVelocity(MidiFileEvent_t event)
+MidiFileMeasureBeat_t MidiFileMeasureBeat_new(void)
 {
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	MidiFileMeasureBeat_t measure_beat = (MidiFileMeasureBeat_t)(malloc(sizeof(struct MidiFileMeasureBeat)));
+	measure_beat->measure = 1;
+	measure_beat->beat = 1.0;
+	measure_beat->string[0] = '\0';
+	return measure_beat;
+}
 
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		{
-			return MidiFileNoteOffEvent_getVelocity(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			return 0;
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+int MidiFileMeasureBeat_free(MidiFileMeasureBeat_t measure_beat)
+{
+	if (measure_beat == NULL) return -1;
+	free(measure_beat);
+	return 0;
 }
 
-int MidiFileNoteEndEvent_setVelocity(MidiFileEvent_t event, int velocity)
+long MidiFileMeasureBeat_getMeasure(MidiFileMeasureBeat_t measure_beat)
 {
-	if (! MidiFileEvent_isNoteEndEvent(event)) return -1;
+	if (measure_beat == NULL) return -1;
+	return measure_beat->measure;
+}
 
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		{
-			return MidiFileNoteOffEvent_setVelocity(event, velocity);
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			if (velocity == 0) return 0;
-			event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
-			return MidiFileNoteOffEvent_setVelocity(event, velocity);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+int MidiFileMeasureBeat_setMeasure(MidiFileMeasureBeat_t measure_beat, long measure)
+{
+	if (measure_beat == NULL) return -1;
+	measure_beat->measure = measure;
+	return 0;
 }
 
-MidiFileEvent_t MidiFileNoteEndEvent_getNoteStartEvent(MidiFileEvent_t event)
+float MidiFileMeasureBeat_getBeat(MidiFileMeasureBeat_t measure_beat)
 {
-	MidiFileEvent_t preceding_event;
+	if (measure_beat == NULL) return -1.0;
+	return measure_beat->beat;
+}
 
-	if (! MidiFileEvent_isNoteEndEvent(event)) return NULL;
+int MidiFileMeasureBeat_setBeat(MidiFileMeasureBeat_t measure_beat, float beat)
+{
+	if (measure_beat == NULL) return -1;
+	measure_beat->beat = beat;
+	return 0;
+}
 
-	for (preceding_event = MidiFileEvent_getPreviousEventInTrack(event); preceding_event != NULL; preceding_event = MidiFileEvent_getPreviousEventInTrack(preceding_event))
-	{
-		if (MidiFileEvent_isNoteStartEvent(preceding_event) && (MidiFileNoteStartEvent_getChannel(preceding_event) == MidiFileNoteEndEvent_getChannel(event)) && (MidiFileNoteStartEvent_getNote(preceding_event) == MidiFileNoteEndEvent_getNote(event)))
-		{
-			return preceding_event;
-		}
-	}
+char *MidiFileMeasureBeat_toString(MidiFileMeasureBeat_t measure_beat)
+{
+	if (measure_beat == NULL) return NULL;
+	sprintf(measure_beat->string, "%ld:%.3f", measure_beat->measure, measure_beat->beat);
+	return measure_beat->string;
+}
 
-	return NULL;
+int MidiFileMeasureBeat_format(MidiFileMeasureBeat_t measure_beat, char *buffer, int buffer_size)
+{
+	char formatted_string[256];
+	if (measure_beat == NULL) return -1;
+	sprintf(formatted_string, "%ld:%.3f", measure_beat->measure, measure_beat->beat);
+	return copy_formatted_string(formatted_string, buffer, buffer_size);
 }
 
-int MidiFilePressureEvent_getChannel(MidiFileEvent_t event)
+int MidiFileMeasureBeat_parse(MidiFileMeasureBeat_t measure_beat, char *string)
 {
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			return MidiFileKeyPressureEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			return MidiFileChannelPressureEvent_getChannel(event);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	if ((measure_beat == NULL) || (string == NULL)) return -1;
+	measure_beat->measure = 1;
+	measure_beat->beat = 1.0;
+	sscanf(string, "%ld:%f", &(measure_beat->measure), &(measure_beat->beat));
+	return 0;
 }
 
-int MidiFilePressureEvent_setChannel(MidiFileEvent_t event, int channel)
+MidiFileMeasureBeatTick_t MidiFileMeasureBeatTick_new(void)
 {
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			return MidiFileKeyPressureEvent_setChannel(event, channel);
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			return MidiFileChannelPressureEvent_setChannel(event, channel);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	MidiFileMeasureBeatTick_t measure_beat_tick = (MidiFileMeasureBeatTick_t)(malloc(sizeof(struct MidiFileMeasureBeatTick)));
+	measure_beat_tick->measure = 1;
+	measure_beat_tick->beat = 1;
+	measure_beat_tick->tick = 0.0;
+	measure_beat_tick->string[0] = '\0';
+	return measure_beat_tick;
 }
 
-int MidiFilePressureEvent_getNote(MidiFileEvent_t event)
+int MidiFileMeasureBeatTick_free(MidiFileMeasureBeatTick_t measure_beat_tick)
 {
-	return MidiFileKeyPressureEvent_getNote(event);
+	if (measure_beat_tick == NULL) return -1;
+	free(measure_beat_tick);
+	return 0;
 }
 
-int MidiFilePressureEvent_setNote(MidiFileEvent_t event, int note)
+long MidiFileMeasureBeatTick_getMeasure(MidiFileMeasureBeatTick_t measure_beat_tick)
 {
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			if (note < 0)
-			{
-				int amount = MidiFileKeyPressureEvent_getAmount(event);
-				event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
-				return MidiFileChannelPressureEvent_setAmount(event, amount);
-			}
-			else
-			{
-				return MidiFileKeyPressureEvent_setNote(event, note);
-			}
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			if (note < 0)
-			{
-				return 0;
-			}
-			else
-			{
-				int amount = MidiFileChannelPressureEvent_getAmount(event);
-				event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
-				MidiFileKeyPressureEvent_setAmount(event, amount);
-				return MidiFileKeyPressureEvent_setNote(event, note);
-			}
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	if (measure_beat_tick == NULL) return -1;
+	return measure_beat_tick->measure;
 }
 
-int MidiFilePressureEvent_getAmount(MidiFileEvent_t event)
+int MidiFileMeasureBeatTick_setMeasure(MidiFileMeasureBeatTick_t measure_beat_tick, long measure)
 {
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			return MidiFileKeyPressureEvent_getAmount(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			return MidiFileChannelPressureEvent_getAmount(event);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	if (measure_beat_tick == NULL) return -1;
+	measure_beat_tick->measure = measure;
+	return 0;
 }
 
-int MidiFilePressureEvent_setAmount(MidiFileEvent_t event, int amount)
+long MidiFileMeasureBeatTick_getBeat(MidiFileMeasureBeatTick_t measure_beat_tick)
 {
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			return MidiFileKeyPressureEvent_setAmount(event, amount);
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			return MidiFileChannelPressureEvent_setAmount(event, amount);
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+	if (measure_beat_tick == NULL) return -1;
+	return measure_beat_tick->beat;
+}
+
+int MidiFileMeasureBeatTick_setBeat(MidiFileMeasureBeatTick_t measure_beat_tick, long beat)
+{
+	if (measure_beat_tick == NULL) return -1;
+	measure_beat_tick->beat = beat;
+	return 0;
+}
+
+float MidiFileMeasureBeatTick_getTick(MidiFileMeasureBeatTick_t measure_beat_tick)
+{
+	if (measure_beat_tick == NULL) return -1.0;
+	return measure_beat_tick->tick;
 }
 
-char *MidiFileTextEvent_getText(MidiFileEvent_t event)
+int MidiFileMeasureBeatTick_setTick(MidiFileMeasureBeatTick_t measure_beat_tick, float tick)
 {
-	if (! MidiFileEvent_isTextEvent(event)) return NULL;
-	return (char *)(MidiFileMetaEvent_getData(event));
+	if (measure_beat_tick == NULL) return -1;
+	measure_beat_tick->tick = tick;
+	return 0;
 }
 
-int MidiFileTextEvent_setText(MidiFileEvent_t event, char *text)
+char *MidiFileMeasureBeatTick_toString(MidiFileMeasureBeatTick_t measure_beat_tick)
 {
-	if (! MidiFileEvent_isTextEvent(event)) return -1;
-	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
+	if (measure_beat_tick == NULL) return NULL;
+	sprintf(measure_beat_tick->string, "%ld:%ld:%.3f", measure_beat_tick->measure, measure_beat_tick->beat, measure_beat_tick->tick);
+	return measure_beat_tick->string;
 }
 
-char *MidiFileLyricEvent_getText(MidiFileEvent_t event)
+int MidiFileMeasureBeatTick_format(MidiFileMeasureBeatTick_t measure_beat_tick, char *buffer, int buffer_size)
 {
-	if (! MidiFileEvent_isLyricEvent(event)) return NULL;
-	return (char *)(MidiFileMetaEvent_getData(event));
+	char formatted_string[256];
+	if (measure_beat_tick == NULL) return -1;
+	sprintf(formatted_string, "%ld:%ld:%.3f", measure_beat_tick->measure, measure_beat_tick->beat, measure_beat_tick->tick);
+	return copy_formatted_string(formatted_string, buffer, buffer_size);
 }
 
-int MidiFileLyricEvent_setText(MidiFileEvent_t event, char *text)
+int MidiFileMeasureBeatTick_parse(MidiFileMeasureBeatTick_t measure_beat_tick, char *string)
 {
-	if (! MidiFileEvent_isLyricEvent(event)) return -1;
-	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
+	if ((measure_beat_tick == NULL) || (string == NULL)) return -1;
+	measure_beat_tick->measure = 1;
+	measure_beat_tick->beat = 1;
+	measure_beat_tick->tick = 0.0;
+	sscanf(string, "%ld:%ld:%f", &(measure_beat_tick->measure), &(measure_beat_tick->beat), &(measure_beat_tick->tick));
+	return 0;
 }
 
-char *MidiFileMarkerEvent_getText(MidiFileEvent_t event)
+MidiFileHourMinuteSecond_t MidiFileHourMinuteSecond_new(void)
 {
-	if (! MidiFileEvent_isMarkerEvent(event)) return NULL;
-	return (char *)(MidiFileMetaEvent_getData(event));
+	MidiFileHourMinuteSecond_t hour_minute_second = (MidiFileHourMinuteSecond_t)(malloc(sizeof(struct MidiFileHourMinuteSecond)));
+	hour_minute_second->hour = 0;
+	hour_minute_second->minute = 0;
+	hour_minute_second->second = 0.0;
+	hour_minute_second->string[0] = '\0';
+	return hour_minute_second;
 }
 
-int MidiFileMarkerEvent_setText(MidiFileEvent_t event, char *text)
+int MidiFileHourMinuteSecond_free(MidiFileHourMinuteSecond_t hour_minute_second)
 {
-	if (! MidiFileEvent_isMarkerEvent(event)) return -1;
-	return MidiFileMetaEvent_setData(event, strlen(text), (unsigned char *)(text));
+	if (hour_minute_second == NULL) return -1;
+	free(hour_minute_second);
+	return 0;
 }
 
-char *MidiFilePortEvent_getName(MidiFileEvent_t event)
+long MidiFileHourMinuteSecond_getHour(MidiFileHourMinuteSecond_t hour_minute_second)
 {
-	if (! MidiFileEvent_isPortEvent(event)) return NULL;
-	return (char *)(MidiFileMetaEvent_getData(event));
+	if (hour_minute_second == NULL) return -1;
+	return hour_minute_second->hour;
 }
 
-int MidiFilePortEvent_setName(MidiFileEvent_t event, char *name)
+int MidiFileHourMinuteSecond_setHour(MidiFileHourMinuteSecond_t hour_minute_second, long hour)
 {
-	if (! MidiFileEvent_isPortEvent(event)) return -1;
-	return MidiFileMetaEvent_setData(event, strlen(name), (unsigned char *)(name));
+	if (hour_minute_second == NULL) return -1;
+	hour_minute_second->hour = hour;
+	return 0;
 }
 
-float MidiFileTempoEvent_getTempo(MidiFileEvent_t event)
+long MidiFileHourMinuteSecond_getMinute(MidiFileHourMinuteSecond_t hour_minute_second)
 {
-	unsigned char *buffer;
-	long midi_tempo;
+	if (hour_minute_second == NULL) return -1;
+	return hour_minute_second->minute;
+}
 
-	if (! MidiFileEvent_isTempoEvent(event)) return 120.0;
+int MidiFileHourMinuteSecond_setMinute(MidiFileHourMinuteSecond_t hour_minute_second, long minute)
+{
+	if (hour_minute_second == NULL) return -1;
+	hour_minute_second->minute = minute;
+	return 0;
+}
 
-	buffer = MidiFileMetaEvent_getData(event);
-	midi_tempo = (buffer[0] << 16) | (buffer[1] << 8) | buffer[2];
-	return (float)(60000000.0 / midi_tempo);
+float MidiFileHourMinuteSecond_getSecond(MidiFileHourMinuteSecond_t hour_minute_second)
+{
+	if (hour_minute_second == NULL) return -1.0;
+	return hour_minute_second->second;
 }
 
-int MidiFileTempoEvent_setTempo(MidiFileEvent_t event, float tempo)
+int MidiFileHourMinuteSecond_setSecond(MidiFileHourMinuteSecond_t hour_minute_second, float second)
 {
-	long midi_tempo;
-	unsigned char buffer[3];
+	if (hour_minute_second == NULL) return -1;
+	hour_minute_second->second = second;
+	return 0;
+}
 
-	if (! MidiFileEvent_isTempoEvent(event)) return -1;
+char *MidiFileHourMinuteSecond_toString(MidiFileHourMinuteSecond_t hour_minute_second)
+{
+	if (hour_minute_second == NULL) return NULL;
+	sprintf(hour_minute_second->string, "%ld:%02ld:%06.3f", hour_minute_second->hour, hour_minute_second->minute, hour_minute_second->second);
+	return hour_minute_second->string;
+}
 
-	midi_tempo = (long)(60000000 / tempo);
-	buffer[0] = (midi_tempo >> 16) & 0xFF;
-	buffer[1] = (midi_tempo >> 8) & 0xFF;
-	buffer[2] = midi_tempo & 0xFF;
-	return MidiFileMetaEvent_setData(event, 3, buffer);
+int MidiFileHourMinuteSecond_format(MidiFileHourMinuteSecond_t hour_minute_second, char *buffer, int buffer_size)
+{
+	char formatted_string[256];
+	if (hour_minute_second == NULL) return -1;
+	sprintf(formatted_string, "%ld:%02ld:%06.3f", hour_minute_second->hour, hour_minute_second->minute, hour_minute_second->second);
+	return copy_formatted_string(formatted_string, buffer, buffer_size);
 }
 
-int MidiFileTimeSignatureEvent_getNumerator(MidiFileEvent_t event)
+int MidiFileHourMinuteSecond_parse(MidiFileHourMinuteSecond_t hour_minute_second, char *string)
 {
-	unsigned char *buffer;
+	if ((hour_minute_second == NULL) || (string == NULL)) return -1;
+	hour_minute_second->hour = 0;
+	hour_minute_second->minute = 0;
+	hour_minute_second->second = 0.0;
+	sscanf(string, "%ld:%ld:%f", &(hour_minute_second->hour), &(hour_minute_second->minute), &(hour_minute_second->second));
+	return 0;
+}
 
-	if (! MidiFileEvent_isTimeSignatureEvent(event)) return 4;
+MidiFileHourMinuteSecondFrame_t MidiFileHourMinuteSecondFrame_new(void)
+{
+	MidiFileHourMinuteSecondFrame_t hour_minute_second_frame = (MidiFileHourMinuteSecondFrame_t)(malloc(sizeof(struct MidiFileHourMinuteSecondFrame)));
+	hour_minute_second_frame->hour = 0;
+	hour_minute_second_frame->minute = 0;
+	hour_minute_second_frame->second = 0;
+	hour_minute_second_frame->frame = 0.0;
+	hour_minute_second_frame->string[0] = '\0';
+	return hour_minute_second_frame;
+}
 
-	buffer = MidiFileMetaEvent_getData(event);
-	return (int)(buffer[0]);
+int MidiFileHourMinuteSecondFrame_free(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+{
+	if (hour_minute_second_frame == NULL) return -1;
+	free(hour_minute_second_frame);
+	return 0;
 }
 
-int MidiFileTimeSignatureEvent_getDenominator(MidiFileEvent_t event)
+long MidiFileHourMinuteSecondFrame_getHour(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
 {
-	unsigned char *buffer;
+	if (hour_minute_second_frame == NULL) return -1;
+	return hour_minute_second_frame->hour;
+}
 
-	if (! MidiFileEvent_isTimeSignatureEvent(event)) return 4;
+int MidiFileHourMinuteSecondFrame_setHour(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long hour)
+{
+	if (hour_minute_second_frame == NULL) return -1;
+	hour_minute_second_frame->hour = hour;
+	return 0;
+}
 
-	buffer = MidiFileMetaEvent_getData(event);
+long MidiFileHourMinuteSecondFrame_getMinute(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+{
+	if (hour_minute_second_frame == NULL) return -1;
+	return hour_minute_second_frame->minute;
+}
 
-	switch (buffer[1])
-	{
-		case 0:
-		{
-			return 1;
-		}
-		case 1:
-		{
-			return 2;
-		}
-		case 2:
-		{
-			return 4;
-		}
-		case 3:
-		{
-			return 8;
-		}
-		case 4:
-		{
-			return 16;
-		}
-		case 5:
-		{
-			return 32;
-		}
-		case 6:
-		{
-			return 64;
-		}
-		case 7:
-		{
-			return 128;
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+int MidiFileHourMinuteSecondFrame_setMinute(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long minute)
+{
+	if (hour_minute_second_frame == NULL) return -1;
+	hour_minute_second_frame->minute = minute;
+	return 0;
 }
 
-int MidiFileTimeSignatureEvent_setTimeSignature(MidiFileEvent_t event, int numerator, int denominator)
+long MidiFileHourMinuteSecondFrame_getSecond(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
 {
-	unsigned char buffer[4];
-	buffer[0] = numerator & 0xFF;
+	if (hour_minute_second_frame == NULL) return -1;
+	return hour_minute_second_frame->second;
+}
 
-	switch (denominator)
-	{
-		case 1:
-		{
-			buffer[1] = 0;
-			break;
-		}
-		case 2:
-		{
-			buffer[1] = 1;
-			break;
-		}
-		case 4:
-		{
-			buffer[1] = 2;
-			break;
-		}
-		case 8:
-		{
-			buffer[1] = 3;
-			break;
-		}
-		case 16:
-		{
-			buffer[1] = 4;
-			break;
-		}
-		case 32:
-		{
-			buffer[1] = 5;
-			break;
-		}
-		case 64:
-		{
-			buffer[1] = 6;
-			break;
-		}
-		case 128:
-		{
-			buffer[1] = 7;
-			break;
-		}
-		default:
-		{
-			return -1;
-		}
-	}
+int MidiFileHourMinuteSecondFrame_setSecond(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long second)
+{
+	if (hour_minute_second_frame == NULL) return -1;
+	hour_minute_second_frame->second = second;
+	return 0;
+}
 
-	buffer[2] = 96 / denominator;
-	buffer[3] = 8;
-	return MidiFileMetaEvent_setData(event, 4, buffer);
+float MidiFileHourMinuteSecondFrame_getFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+{
+	if (hour_minute_second_frame == NULL) return -1.0;
+	return hour_minute_second_frame->frame;
 }
 
-int MidiFileKeySignatureEvent_getNumber(MidiFileEvent_t event)
+int MidiFileHourMinuteSecondFrame_setFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, float frame)
 {
-	union
-	{
-		unsigned char unsigned_value;
-		char signed_value;
-	}
-	u;
+	if (hour_minute_second_frame == NULL) return -1;
+	hour_minute_second_frame->frame = frame;
+	return 0;
+}
 
-	if (! MidiFileEvent_isKeySignatureEvent(event)) return 0;
-	u.unsigned_value = MidiFileMetaEvent_getData(event)[0];
-	return u.signed_value;
+char *MidiFileHourMinuteSecondFrame_toString(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+{
+	if (hour_minute_second_frame == NULL) return NULL;
+	sprintf(hour_minute_second_frame->string, "%ld:%02ld:%02ld:%.3f", hour_minute_second_frame->hour, hour_minute_second_frame->minute, hour_minute_second_frame->second, hour_minute_second_frame->frame);
+	return hour_minute_second_frame->string;
 }
 
-int MidiFileKeySignatureEvent_isMinor(MidiFileEvent_t event)
+int MidiFileHourMinuteSecondFrame_format(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, char *buffer, int buffer_size)
 {
-	if (! MidiFileEvent_isKeySignatureEvent(event)) return 0;
-	return MidiFileMetaEvent_getData(event)[1];
+	char formatted_string[256];
+	if (hour_minute_second_frame == NULL) return -1;
+	sprintf(formatted_string, "%ld:%02ld:%02ld:%.3f", hour_minute_second_frame->hour, hour_minute_second_frame->minute, hour_minute_second_frame->second, hour_minute_second_frame->frame);
+	return copy_formatted_string(formatted_string, buffer, buffer_size);
 }
 
-int MidiFileKeySignatureEvent_setKeySignature(MidiFileEvent_t event, int number, int minor)
+int MidiFileHourMinuteSecondFrame_parse(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, char *string)
 {
-	union
+	if ((hour_minute_second_frame == NULL) || (string == NULL)) return -1;
+	hour_minute_second_frame->hour = 0;
+	hour_minute_second_frame->minute = 0;
+	hour_minute_second_frame->second = 0;
+	hour_minute_second_frame->frame = 0.0;
+	sscanf(string, "%ld:%ld:%ld:%f", &(hour_minute_second_frame->hour), &(hour_minute_second_frame->minute), &(hour_minute_second_frame->second), &(hour_minute_second_frame->frame));
+	return 0;
+}
+
+MidiFileFrozen_t MidiFile_freeze(MidiFile_t midi_file)
+{
+	MidiFileFrozen_t frozen;
+	MidiFileEvent_t event;
+	long number_of_events = 0, payload_length = 0, i;
+	long long elapsed = 0; /* in microseconds times the resolution, so that no rounding builds up */
+	long segment_start_tick = 0, microseconds_per_beat = 500000;
+	long frames_per_second_numerator, frames_per_second_denominator;
+
+	if (midi_file == NULL) return NULL;
+	sort_batch(midi_file);
+	prepare_file_event_list(midi_file);
+
+	for (event = midi_file->first_event; event != NULL; event = get_event(event->next_event_in_file))
 	{
-		unsigned char unsigned_buffer[2];
-		char signed_buffer[2];
+		number_of_events++;
+		if (event->type == MIDI_FILE_EVENT_TYPE_SYSEX) payload_length += event->u.sysex.data_length;
+		if (event->type == MIDI_FILE_EVENT_TYPE_META) payload_length += event->u.meta.data_length;
 	}
-	u;
 
-	u.signed_buffer[0] = number;
-	u.signed_buffer[1] = minor ? 1 : 0;
-	return MidiFileMetaEvent_setData(event, 2, u.unsigned_buffer);
-}
+	frozen = (MidiFileFrozen_t)(malloc(sizeof(struct MidiFileFrozen)));
+	frozen->number_of_events = number_of_events;
+	frozen->ticks = (long *)(malloc((number_of_events + 1) * sizeof(long)));
+	frozen->times_us = (long long *)(malloc((number_of_events + 1) * sizeof(long long)));
+	frozen->track_numbers = (unsigned short *)(malloc((number_of_events + 1) * sizeof(unsigned short)));
+	frozen->types = (signed char *)(malloc(number_of_events + 1));
+	frozen->channels = (unsigned char *)(malloc(number_of_events + 1));
+	frozen->numbers = (short *)(malloc((number_of_events + 1) * sizeof(short)));
+	frozen->values = (int *)(malloc((number_of_events + 1) * sizeof(int)));
+	frozen->payload_offsets = (long *)(malloc((number_of_events + 1) * sizeof(long)));
+	frozen->payloads = (unsigned char *)(malloc(payload_length + 1));
+	frozen->cache = NULL;
+	frozen->cache_length = 0;
+	frozen->cache_is_mapped = 0;
 
-int MidiFileVoiceEvent_getChannel(MidiFileEvent_t event)
-{
-	switch (MidiFileEvent_getType(event))
+	get_frames_per_second_fraction_for_division_type(midi_file->division_type, &frames_per_second_numerator, &frames_per_second_denominator);
+	payload_length = 0;
+
+	for (event = midi_file->first_event, i = 0; event != NULL; event = get_event(event->next_event_in_file), i++)
 	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		{
-			return MidiFileNoteOffEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			return MidiFileNoteOnEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			return MidiFileKeyPressureEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
-		{
-			return MidiFileControlChangeEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
-		{
-			return MidiFilePitchWheelEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
-		{
-			return MidiFileProgramChangeEvent_getChannel(event);
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		frozen->ticks[i] = event->tick;
+		frozen->track_numbers[i] = (unsigned short)(get_track(event->track)->number);
+		frozen->types[i] = (signed char)(event->type);
+		frozen->channels[i] = 0;
+		frozen->numbers[i] = 0;
+		frozen->values[i] = 0;
+		frozen->payload_offsets[i] = payload_length;
+
+		if (midi_file->resolution <= 0)
 		{
-			return MidiFileChannelPressureEvent_getChannel(event);
+			frozen->times_us[i] = 0;
 		}
-		default:
+		else if (midi_file->division_type == MIDI_FILE_DIVISION_TYPE_PPQ)
 		{
-			return -1;
-		}
-	}
-}
+			/* tempo changes come from the conductor track, as for the other time conversions */
+			frozen->times_us[i] = (elapsed + ((long long)(event->tick - segment_start_tick) * microseconds_per_beat) + (midi_file->resolution / 2)) / midi_file->resolution;
 
-int MidiFileVoiceEvent_getDataLength(MidiFileEvent_t event)
-{
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
-		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
-		{
-			return 3;
+			if ((get_track(event->track)->previous_track == NULL) && MidiFileEvent_isTempoEvent(event) && (event->u.meta.data_length >= 3))
+			{
+				elapsed += (long long)(event->tick - segment_start_tick) * microseconds_per_beat;
+				segment_start_tick = event->tick;
+				microseconds_per_beat = (event->u.meta.data_buffer[0] << 16) | (event->u.meta.data_buffer[1] << 8) | event->u.meta.data_buffer[2];
+			}
 		}
-		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		else if (frames_per_second_numerator > 0)
 		{
-			return 2;
+			long long divisor = (long long)(frames_per_second_numerator) * midi_file->resolution;
+			frozen->times_us[i] = ((long long)(event->tick) * 1000000 * frames_per_second_denominator + (divisor / 2)) / divisor;
 		}
-		default:
+		else
 		{
-			return 0;
+			frozen->times_us[i] = 0;
 		}
-	}
-}
 
-unsigned long MidiFileVoiceEvent_getData(MidiFileEvent_t event)
-{
-	switch (MidiFileEvent_getType(event))
-	{
-		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		switch (event->type)
 		{
-			union
+			case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+			case MIDI_FILE_EVENT_TYPE_NOTE_ON:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.note_on.channel);
+				frozen->numbers[i] = (short)(event->u.note_on.note);
+				frozen->values[i] = event->u.note_on.velocity;
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0x80 | MidiFileNoteOffEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileNoteOffEvent_getNote(event);
-			u.data_as_bytes[2] = MidiFileNoteOffEvent_getVelocity(event);
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.key_pressure.channel);
+				frozen->numbers[i] = (short)(event->u.key_pressure.note);
+				frozen->values[i] = event->u.key_pressure.amount;
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0x90 | MidiFileNoteOnEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileNoteOnEvent_getNote(event);
-			u.data_as_bytes[2] = MidiFileNoteOnEvent_getVelocity(event);
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.control_change.channel);
+				frozen->numbers[i] = (short)(event->u.control_change.number);
+				frozen->values[i] = event->u.control_change.value;
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0xA0 | MidiFileKeyPressureEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileKeyPressureEvent_getNote(event);
-			u.data_as_bytes[2] = MidiFileKeyPressureEvent_getAmount(event);
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.program_change.channel);
+				frozen->numbers[i] = (short)(event->u.program_change.number);
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0xB0 | MidiFileControlChangeEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileControlChangeEvent_getNumber(event);
-			u.data_as_bytes[2] = MidiFileControlChangeEvent_getValue(event);
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.channel_pressure.channel);
+				frozen->values[i] = event->u.channel_pressure.amount;
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0xC0 | MidiFileProgramChangeEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileProgramChangeEvent_getNumber(event);
-			u.data_as_bytes[2] = 0;
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->channels[i] = (unsigned char)(event->u.pitch_wheel.channel);
+				frozen->values[i] = event->u.pitch_wheel.value;
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0xD0 | MidiFileChannelPressureEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFileChannelPressureEvent_getAmount(event);
-			u.data_as_bytes[2] = 0;
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
-		{
-			union
+			case MIDI_FILE_EVENT_TYPE_SYSEX:
 			{
-				unsigned char data_as_bytes[4];
-				unsigned long data_as_uint32;
+				frozen->values[i] = event->u.sysex.data_length;
+				memcpy(frozen->payloads + payload_length, event->u.sysex.data_buffer, event->u.sysex.data_length);
+				payload_length += event->u.sysex.data_length;
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_META:
+			{
+				frozen->numbers[i] = (short)(event->u.meta.number);
+				frozen->values[i] = event->u.meta.data_length;
+				memcpy(frozen->payloads + payload_length, event->u.meta.data_buffer, event->u.meta.data_length);
+				payload_length += event->u.meta.data_length;
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_NOTE:
+			{
+				frozen->channels[i] = (unsigned char)(event->u.note.channel);
+				frozen->numbers[i] = (short)(event->u.note.note);
+				frozen->values[i] = event->u.note.velocity;
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE:
+			{
+				frozen->channels[i] = (unsigned char)(event->u.fine_control_change.channel);
+				frozen->numbers[i] = (short)(event->u.fine_control_change.coarse_number);
+				frozen->values[i] = event->u.fine_control_change.value;
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_RPN:
+			{
+				frozen->channels[i] = (unsigned char)(event->u.rpn.channel);
+				frozen->numbers[i] = (short)(event->u.rpn.number);
+				frozen->values[i] = event->u.rpn.value;
+				break;
+			}
+			case MIDI_FILE_EVENT_TYPE_NRPN:
+			{
+				frozen->channels[i] = (unsigned char)(event->u.nrpn.channel);
+				frozen->numbers[i] = (short)(event->u.nrpn.number);
+				frozen->values[i] = event->u.nrpn.value;
+				break;
+			}
+			default:
+			{
+				break;
 			}
-			u;
-
-			u.data_as_bytes[0] = 0xE0 | MidiFilePitchWheelEvent_getChannel(event);
-			u.data_as_bytes[1] = MidiFilePitchWheelEvent_getValue(event) & 0x0F;
-			u.data_as_bytes[2] = MidiFilePitchWheelEvent_getValue(event) >> 7;
-			u.data_as_bytes[3] = 0;
-			return u.data_as_uint32;
-		}
-		default:
-		{
-			return 0;
 		}
 	}
+
+	frozen->payload_offsets[number_of_events] = payload_length;
+	return frozen;
 }
 
-int MidiFileVoiceEvent_setData(MidiFileEvent_t event, unsigned long data)
+int MidiFileFrozen_free(MidiFileFrozen_t frozen)
 {
-	union
+	if (frozen == NULL) return -1;
+
+	if (frozen->cache != NULL)
 	{
-		unsigned long data_as_uint32;
-		unsigned char data_as_bytes[4];
+		free_file_buffer(frozen->cache, frozen->cache_length, frozen->cache_is_mapped);
+		free(frozen);
+		return 0;
 	}
-	u;
 
-	if (event == NULL) return -1;
+	free(frozen->ticks);
+	free(frozen->times_us);
+	free(frozen->track_numbers);
+	free(frozen->types);
+	free(frozen->channels);
+	free(frozen->numbers);
+	free(frozen->values);
+	free(frozen->payload_offsets);
+	free(frozen->payloads);
+	free(frozen);
+	return 0;
+}
 
-	u.data_as_uint32 = data;
+long MidiFileFrozen_getNumberOfEvents(MidiFileFrozen_t frozen)
+{
+	if (frozen == NULL) return -1;
+	return frozen->number_of_events;
+}
+
+long MidiFileFrozen_getIndexForTick(MidiFileFrozen_t frozen, long tick)
+{
+	/* the first event at or after the tick, or the number of events if there is none */
+
+	long low = 0, high;
+
+	if (frozen == NULL) return -1;
+	high = frozen->number_of_events;
 
-	switch (u.data_as_bytes[0] & 0xF0)
+	while (low < high)
 	{
-		case 0x80:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_NOTE_OFF;
-			event->u.note_off.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.note_off.note = u.data_as_bytes[1];
-			event->u.note_off.velocity = u.data_as_bytes[2];
-			return 0;
-		}
-		case 0x90:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_NOTE_ON;
-			event->u.note_on.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.note_on.note = u.data_as_bytes[1];
-			event->u.note_on.velocity = u.data_as_bytes[2];
-			return 0;
-		}
-		case 0xA0:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_KEY_PRESSURE;
-			event->u.key_pressure.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.key_pressure.note = u.data_as_bytes[1];
-			event->u.key_pressure.amount = u.data_as_bytes[2];
-			return 0;
-		}
-		case 0xB0:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE;
-			event->u.control_change.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.control_change.number = u.data_as_bytes[1];
-			event->u.control_change.value = u.data_as_bytes[2];
-			return 0;
-		}
-		case 0xC0:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE;
-			event->u.program_change.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.program_change.number = u.data_as_bytes[1];
-			return 0;
-		}
-		case 0xD0:
-		{
-			event->type = MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE;
-			event->u.channel_pressure.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.channel_pressure.amount = u.data_as_bytes[1];
-			return 0;
-		}
-		case 0xE0:
+		long middle = low + ((high - low) / 2);
+
+		if (frozen->ticks[middle] < tick)
 		{
-			event->type = MIDI_FILE_EVENT_TYPE_PITCH_WHEEL;
-			event->u.pitch_wheel.channel = u.data_as_bytes[0] & 0x0F;
-			event->u.pitch_wheel.value = (u.data_as_bytes[2] << 7) | u.data_as_bytes[1];
-			return 0;
+			low = middle + 1;
 		}
-		default:
+		else
 		{
-			return -1;
+			high = middle;
 		}
 	}
+
+	return low;
 }
 
-MidiFileMeasureBeat_t MidiFileMeasureBeat_new(void)
+const long *MidiFileFrozen_getTicks(MidiFileFrozen_t frozen)
 {
-	MidiFileMeasureBeat_t measure_beat = (MidiFileMeasureBeat_t)(malloc(sizeof(struct MidiFileMeasureBeat)));
-	measure_beat->measure = 1;
-	measure_beat->beat = 1.0;
-	measure_beat->string[0] = '\0';
-	return measure_beat;
+	if (frozen == NULL) return NULL;
+	return frozen->ticks;
 }
 
-int MidiFileMeasureBeat_free(MidiFileMeasureBeat_t measure_beat)
+const long long *MidiFileFrozen_getTimesUs(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return -1;
-	free(measure_beat);
-	return 0;
+	if (frozen == NULL) return NULL;
+	return frozen->times_us;
 }
 
-long MidiFileMeasureBeat_getMeasure(MidiFileMeasureBeat_t measure_beat)
+const unsigned short *MidiFileFrozen_getTrackNumbers(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return -1;
-	return measure_beat->measure;
+	if (frozen == NULL) return NULL;
+	return frozen->track_numbers;
 }
 
-int MidiFileMeasureBeat_setMeasure(MidiFileMeasureBeat_t measure_beat, long measure)
+const signed char *MidiFileFrozen_getTypes(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return -1;
-	measure_beat->measure = measure;
-	return 0;
+	if (frozen == NULL) return NULL;
+	return frozen->types;
 }
 
-float MidiFileMeasureBeat_getBeat(MidiFileMeasureBeat_t measure_beat)
+const unsigned char *MidiFileFrozen_getChannels(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return -1.0;
-	return measure_beat->beat;
+	if (frozen == NULL) return NULL;
+	return frozen->channels;
 }
 
-int MidiFileMeasureBeat_setBeat(MidiFileMeasureBeat_t measure_beat, float beat)
+const short *MidiFileFrozen_getNumbers(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return -1;
-	measure_beat->beat = beat;
-	return 0;
+	if (frozen == NULL) return NULL;
+	return frozen->numbers;
 }
 
-char *MidiFileMeasureBeat_toString(MidiFileMeasureBeat_t measure_beat)
+const int *MidiFileFrozen_getValues(MidiFileFrozen_t frozen)
 {
-	if (measure_beat == NULL) return NULL;
-	sprintf(measure_beat->string, "%ld:%.3f", measure_beat->measure, measure_beat->beat);
-	return measure_beat->string;
+	if (frozen == NULL) return NULL;
+	return frozen->values;
 }
 
-int MidiFileMeasureBeat_parse(MidiFileMeasureBeat_t measure_beat, char *string)
+const long *MidiFileFrozen_getPayloadOffsets(MidiFileFrozen_t frozen)
 {
-	if ((measure_beat == NULL) || (string == NULL)) return -1;
-	measure_beat->measure = 1;
-	measure_beat->beat = 1.0;
-	sscanf(string, "%ld:%f", &(measure_beat->measure), &(measure_beat->beat));
-	return 0;
+	if (frozen == NULL) return NULL;
+	return frozen->payload_offsets;
 }
 
-MidiFileMeasureBeatTick_t MidiFileMeasureBeatTick_new(void)
+const unsigned char *MidiFileFrozen_getPayloads(MidiFileFrozen_t frozen)
 {
-	MidiFileMeasureBeatTick_t measure_beat_tick = (MidiFileMeasureBeatTick_t)(malloc(sizeof(struct MidiFileMeasureBeatTick)));
-	measure_beat_tick->measure = 1;
-	measure_beat_tick->beat = 1;
-	measure_beat_tick->tick = 0.0;
-	measure_beat_tick->string[0] = '\0';
-	return measure_beat_tick;
+	if (frozen == NULL) return NULL;
+	return frozen->payloads;
 }
 
-int MidiFileMeasureBeatTick_free(MidiFileMeasureBeatTick_t measure_beat_tick)
+static long get_frozen_cache_layout(void)
 {
-	if (measure_beat_tick == NULL) return -1;
-	free(measure_beat_tick);
-	return 0;
+	int one = 1;
+	return (long)(sizeof (long) | (sizeof (long long) << 4) | (sizeof (int) << 8) | (sizeof (short) << 12) | (*((unsigned char *)(&one)) << 16));
 }
 
-long MidiFileMeasureBeatTick_getMeasure(MidiFileMeasureBeatTick_t measure_beat_tick)
+static void get_frozen_arrays(MidiFileFrozen_t frozen, long payload_length, void **arrays[], long lengths[])
 {
-	if (measure_beat_tick == NULL) return -1;
-	return measure_beat_tick->measure;
+	long number_of_events = frozen->number_of_events;
+
+	arrays[0] = (void **)(&(frozen->ticks));
+	lengths[0] = number_of_events * sizeof (long);
+	arrays[1] = (void **)(&(frozen->times_us));
+	lengths[1] = number_of_events * sizeof (long long);
+	arrays[2] = (void **)(&(frozen->track_numbers));
+	lengths[2] = number_of_events * sizeof (unsigned short);
+	arrays[3] = (void **)(&(frozen->types));
+	lengths[3] = number_of_events;
+	arrays[4] = (void **)(&(frozen->channels));
+	lengths[4] = number_of_events;
+	arrays[5] = (void **)(&(frozen->numbers));
+	lengths[5] = number_of_events * sizeof (short);
+	arrays[6] = (void **)(&(frozen->values));
+	lengths[6] = number_of_events * sizeof (int);
+	arrays[7] = (void **)(&(frozen->payload_offsets));
+	lengths[7] = (number_of_events + 1) * sizeof (long);
+	arrays[8] = (void **)(&(frozen->payloads));
+	lengths[8] = payload_length;
 }
 
-int MidiFileMeasureBeatTick_setMeasure(MidiFileMeasureBeatTick_t measure_beat_tick, long measure)
+static int get_file_identity(const char *filename, long long *length_out, long long *modification_time_out)
 {
-	if (measure_beat_tick == NULL) return -1;
-	measure_beat_tick->measure = measure;
+	struct stat file_status;
+
+	if (stat(filename, &file_status) != 0) return -1;
+	*length_out = (long long)(file_status.st_size);
+	*modification_time_out = (long long)(file_status.st_mtime);
 	return 0;
 }
 
-long MidiFileMeasureBeatTick_getBeat(MidiFileMeasureBeatTick_t measure_beat_tick)
+static int save_frozen_cache(MidiFileFrozen_t frozen, const char *cache_filename, long long source_length, long long source_modification_time)
 {
-	if (measure_beat_tick == NULL) return -1;
-	return measure_beat_tick->beat;
+	static const unsigned char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	struct MidiFileFrozenCacheHeader header;
+	void **arrays[MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS];
+	long lengths[MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS], offset;
+	char *temporary_filename;
+	FILE *out;
+	int array_number, result = 0;
+
+	memset(&header, 0, sizeof (header));
+	memcpy(header.signature, MIDI_FILE_FROZEN_CACHE_SIGNATURE, 4);
+	header.version = MIDI_FILE_FROZEN_CACHE_VERSION;
+	header.layout = get_frozen_cache_layout();
+	header.source_length = source_length;
+	header.source_modification_time = source_modification_time;
+	header.number_of_events = frozen->number_of_events;
+	header.payload_length = frozen->payload_offsets[frozen->number_of_events];
+	get_frozen_arrays(frozen, header.payload_length, arrays, lengths);
+	offset = (sizeof (header) + 7) & ~7L;
+
+	for (array_number = 0; array_number < MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS; array_number++)
+	{
+		header.array_offsets[array_number] = offset;
+		offset += (lengths[array_number] + 7) & ~7L;
+	}
+
+	if ((temporary_filename = get_temporary_filename(cache_filename)) == NULL) return -1;
+
+	if ((out = fopen(temporary_filename, "wb")) == NULL)
+	{
+		free(temporary_filename);
+		return -1;
+	}
+
+	if ((fwrite(&header, sizeof (header), 1, out) != 1) || (fwrite(padding, 1, header.array_offsets[0] - sizeof (header), out) != (size_t)(header.array_offsets[0] - sizeof (header)))) result = -1;
+
+	for (array_number = 0; (result == 0) && (array_number < MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS); array_number++)
+	{
+		long padding_length = ((lengths[array_number] + 7) & ~7L) - lengths[array_number];
+		if ((fwrite(*(arrays[array_number]), 1, lengths[array_number], out) != (size_t)(lengths[array_number])) || (fwrite(padding, 1, padding_length, out) != (size_t)(padding_length))) result = -1;
+	}
+
+	if (fclose(out) != 0) result = -1;
+
+	/* renamed into place, so that a reader never maps a cache which is still being written */
+	if ((result == 0) && (replace_file(temporary_filename, cache_filename) != 0)) result = -1;
+	if (result != 0) remove(temporary_filename);
+	free(temporary_filename);
+	return result;
 }
 
-int MidiFileMeasureBeatTick_setBeat(MidiFileMeasureBeatTick_t measure_beat_tick, long beat)
+static int frozen_arrays_are_consistent(MidiFileFrozen_t frozen, long payload_length)
 {
-	if (measure_beat_tick == NULL) return -1;
-	measure_beat_tick->beat = beat;
-	return 0;
+	/*
+	 * A damaged cache of the right length would otherwise be trusted, so
+	 * check what the accessors rely on:  that the ticks are in order for
+	 * the binary search, and that the payloads lie end to end within their
+	 * array.
+	 */
+
+	long event_number;
+
+	if ((frozen->payload_offsets[0] != 0) || (frozen->payload_offsets[frozen->number_of_events] != payload_length)) return 0;
+
+	for (event_number = 0; event_number < frozen->number_of_events; event_number++)
+	{
+		if (frozen->payload_offsets[event_number + 1] < frozen->payload_offsets[event_number]) return 0;
+		if ((event_number > 0) && (frozen->ticks[event_number] < frozen->ticks[event_number - 1])) return 0;
+	}
+
+	return 1;
 }
 
-float MidiFileMeasureBeatTick_getTick(MidiFileMeasureBeatTick_t measure_beat_tick)
+static MidiFileFrozen_t load_frozen_cache(const char *cache_filename, long long source_length, long long source_modification_time)
 {
-	if (measure_beat_tick == NULL) return -1.0;
-	return measure_beat_tick->tick;
+	/* NULL if the cache is missing, stale, damaged, or from another kind of machine */
+
+	struct MidiFileFrozenCacheHeader *header;
+	MidiFileFrozen_t frozen;
+	void **arrays[MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS];
+	long lengths[MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS];
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_mapped, array_number;
+
+	if ((buffer = read_file(cache_filename, 1, &buffer_length, &buffer_is_mapped)) == NULL) return NULL;
+	header = (struct MidiFileFrozenCacheHeader *)(buffer);
+
+	if ((buffer_length < (long)(sizeof (struct MidiFileFrozenCacheHeader))) || (memcmp(header->signature, MIDI_FILE_FROZEN_CACHE_SIGNATURE, 4) != 0) || (header->version != MIDI_FILE_FROZEN_CACHE_VERSION) || (header->layout != get_frozen_cache_layout()) || (header->source_length != source_length) || (header->source_modification_time != source_modification_time) || (header->number_of_events < 0) || (header->number_of_events > buffer_length) || (header->payload_length < 0) || (header->payload_length > buffer_length))
+	{
+		free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+		return NULL;
+	}
+
+	frozen = (MidiFileFrozen_t)(malloc(sizeof(struct MidiFileFrozen)));
+	frozen->number_of_events = header->number_of_events;
+	get_frozen_arrays(frozen, header->payload_length, arrays, lengths);
+
+	for (array_number = 0; array_number < MIDI_FILE_FROZEN_CACHE_NUMBER_OF_ARRAYS; array_number++)
+	{
+		long offset = header->array_offsets[array_number];
+
+		if ((offset < (long)(sizeof (struct MidiFileFrozenCacheHeader))) || ((offset & 7) != 0) || (offset > buffer_length) || (lengths[array_number] > buffer_length - offset))
+		{
+			free(frozen);
+			free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+			return NULL;
+		}
+
+		*(arrays[array_number]) = buffer + offset;
+	}
+
+	if (! frozen_arrays_are_consistent(frozen, header->payload_length))
+	{
+		free(frozen);
+		free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+		return NULL;
+	}
+
+	frozen->cache = buffer;
+	frozen->cache_length = buffer_length;
+	frozen->cache_is_mapped = buffer_is_mapped;
+	return frozen;
 }
 
-int MidiFileMeasureBeatTick_setTick(MidiFileMeasureBeatTick_t measure_beat_tick, float tick)
+MidiFileFrozen_t MidiFile_loadFrozen(const char *filename, const char *cache_filename)
 {
-	if (measure_beat_tick == NULL) return -1;
-	measure_beat_tick->tick = tick;
-	return 0;
+	/* from the cache if it is up to date, otherwise from the file itself, leaving a fresh cache behind for next time */
+
+	MidiFile_t midi_file;
+	MidiFileFrozen_t frozen;
+	long long source_length, source_modification_time;
+
+	if ((filename == NULL) || (get_file_identity(filename, &source_length, &source_modification_time) != 0)) return NULL;
+	if ((cache_filename != NULL) && ((frozen = load_frozen_cache(cache_filename, source_length, source_modification_time)) != NULL)) return frozen;
+	if ((midi_file = MidiFile_load((char *)(filename))) == NULL) return NULL;
+	frozen = MidiFile_freeze(midi_file);
+	MidiFile_free(midi_file);
+	if (cache_filename != NULL) save_frozen_cache(frozen, cache_filename, source_length, source_modification_time);
+	return frozen;
+}
+
+static MidiFileReader_t new_reader(unsigned char *buffer, long buffer_length, int buffer_is_owned, int buffer_is_mapped)
+{
+	MidiFileReader_t reader = (MidiFileReader_t)(malloc(sizeof(struct MidiFileReader)));
+	int number_of_tracks, maximum_number_of_tracks = 0;
+
+	if (reader == NULL) return NULL;
+	reader->buffer = buffer;
+	reader->buffer_length = buffer_length;
+	reader->buffer_is_owned = buffer_is_owned;
+	reader->buffer_is_mapped = buffer_is_mapped;
+	reader->number_of_tracks = 0;
+	reader->tracks = NULL;
+	reader->heap = NULL;
+	reader->heap_size = 0;
+	reader->heap_is_stale = 1;
+	reader->current_track_number = -1;
+
+	if ((reader->io = MidiFileIO_newFromBufferWithLength(buffer, buffer_length)) == NULL)
+	{
+		free(reader);
+		return NULL;
+	}
+
+	if (read_header(reader->io, &(reader->file_format), &(reader->division_type), &(reader->resolution), &number_of_tracks) < 0)
+	{
+		reader->buffer_is_owned = 0;
+		MidiFileReader_free(reader);
+		return NULL;
+	}
+
+	/* only the chunk headers are read up front; track data is decoded on demand */
+
+	while ((reader->number_of_tracks < number_of_tracks) && ! MidiFileIO_isAtEnd(reader->io))
+	{
+		unsigned char chunk_id[4];
+		long chunk_size, chunk_start;
+
+		MidiFileIO_read(reader->io, 4, chunk_id);
+		chunk_size = read_uint32(reader->io);
+		chunk_start = MidiFileIO_tell(reader->io);
+
+		if (memcmp(chunk_id, "MTrk", 4) == 0)
+		{
+			struct MidiFileReaderTrack *reader_track;
+
+			if (reader->number_of_tracks == maximum_number_of_tracks)
+			{
+				struct MidiFileReaderTrack *new_tracks;
+				maximum_number_of_tracks = (maximum_number_of_tracks == 0) ? 16 : (maximum_number_of_tracks * 2);
+
+				if ((new_tracks = (struct MidiFileReaderTrack *)(realloc(reader->tracks, maximum_number_of_tracks * sizeof(struct MidiFileReaderTrack)))) == NULL)
+				{
+					reader->buffer_is_owned = 0;
+					MidiFileReader_free(reader);
+					return NULL;
+				}
+
+				reader->tracks = new_tracks;
+			}
+
+			reader_track = &(reader->tracks[reader->number_of_tracks++]);
+			memset(reader_track, 0, sizeof(struct MidiFileReaderTrack));
+			reader_track->offset = chunk_start;
+			MidiFileTrackParser_init(&(reader_track->parser), chunk_start + chunk_size);
+		}
+
+		MidiFileIO_seek(reader->io, chunk_start + chunk_size, SEEK_SET);
+	}
+
+	if ((reader->heap = (struct MidiFileReaderHeapEntry *)(malloc((reader->number_of_tracks + 1) * sizeof(struct MidiFileReaderHeapEntry)))) == NULL)
+	{
+		reader->buffer_is_owned = 0;
+		MidiFileReader_free(reader);
+		return NULL;
+	}
+
+	return reader;
 }
 
-char *MidiFileMeasureBeatTick_toString(MidiFileMeasureBeatTick_t measure_beat_tick)
+static MidiFileEvent_t MidiFileReader_peekEventInTrack(MidiFileReader_t reader, int track_number)
 {
-	if (measure_beat_tick == NULL) return NULL;
-	sprintf(measure_beat_tick->string, "%ld:%ld:%.3f", measure_beat_tick->measure, measure_beat_tick->beat, measure_beat_tick->tick);
-	return measure_beat_tick->string;
+	struct MidiFileReaderTrack *reader_track = &(reader->tracks[track_number]);
+
+	if (! reader_track->has_pending_event)
+	{
+		if (reader_track->parser.at_end_of_track) return NULL;
+		MidiFileIO_seek(reader->io, reader_track->offset, SEEK_SET);
+		if (! read_event(reader->io, &(reader_track->parser), &(reader_track->pending_event))) return NULL;
+		reader_track->offset = MidiFileIO_tell(reader->io);
+		reader_track->has_pending_event = 1;
+	}
+
+	return &(reader_track->pending_event);
 }
 
-int MidiFileMeasureBeatTick_parse(MidiFileMeasureBeatTick_t measure_beat_tick, char *string)
+static int MidiFileReader_heapIsBefore(struct MidiFileReaderHeapEntry *entry, struct MidiFileReaderHeapEntry *other_entry)
 {
-	if ((measure_beat_tick == NULL) || (string == NULL)) return -1;
-	measure_beat_tick->measure = 1;
-	measure_beat_tick->beat = 1;
-	measure_beat_tick->tick = 0.0;
-	sscanf(string, "%ld:%ld:%f", &(measure_beat_tick->measure), &(measure_beat_tick->beat), &(measure_beat_tick->tick));
+	return ((entry->tick < other_entry->tick) || ((entry->tick == other_entry->tick) && (entry->track_number < other_entry->track_number)));
+}
+
+static void MidiFileReader_siftDown(MidiFileReader_t reader, int position)
+{
+	struct MidiFileReaderHeapEntry entry = reader->heap[position];
+
+	while (1)
+	{
+		int child_position = (position * 2) + 1;
+
+		if (child_position >= reader->heap_size) break;
+		if ((child_position + 1 < reader->heap_size) && MidiFileReader_heapIsBefore(&(reader->heap[child_position + 1]), &(reader->heap[child_position]))) child_position++;
+		if (! MidiFileReader_heapIsBefore(&(reader->heap[child_position]), &entry)) break;
+		reader->heap[position] = reader->heap[child_position];
+		position = child_position;
+	}
+
+	reader->heap[position] = entry;
+}
+
+static void MidiFileReader_rebuildHeap(MidiFileReader_t reader)
+{
+	int track_number, position;
+	MidiFileEvent_t event;
+
+	reader->heap_size = 0;
+
+	for (track_number = 0; track_number < reader->number_of_tracks; track_number++)
+	{
+		if ((event = MidiFileReader_peekEventInTrack(reader, track_number)) != NULL)
+		{
+			reader->heap[reader->heap_size].tick = event->tick;
+			reader->heap[reader->heap_size].track_number = track_number;
+			reader->heap_size++;
+		}
+	}
+
+	for (position = (reader->heap_size / 2) - 1; position >= 0; position--) MidiFileReader_siftDown(reader, position);
+	reader->heap_is_stale = 0;
+}
+
+MidiFileReader_t MidiFileReader_open(const char *filename)
+{
+	unsigned char *buffer;
+	long buffer_length;
+	int buffer_is_mapped;
+	MidiFileReader_t reader;
+
+	if ((filename == NULL) || ((buffer = read_file(filename, 1, &buffer_length, &buffer_is_mapped)) == NULL)) return NULL;
+	if ((reader = new_reader(buffer, buffer_length, 1, buffer_is_mapped)) == NULL) free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+	return reader;
+}
+
+MidiFileReader_t MidiFileReader_newFromBuffer(unsigned char *buffer, long buffer_length)
+{
+	if ((buffer == NULL) || (buffer_length < 0)) return NULL;
+	return new_reader(buffer, buffer_length, 0, 0);
+}
+
+int MidiFileReader_free(MidiFileReader_t reader)
+{
+	int track_number;
+
+	if (reader == NULL) return -1;
+
+	for (track_number = 0; track_number < reader->number_of_tracks; track_number++)
+	{
+		free(reader->tracks[track_number].parser.data_buffer);
+	}
+
+	free(reader->tracks);
+	free(reader->heap);
+	MidiFileIO_free(reader->io);
+	if (reader->buffer_is_owned) free_file_buffer(reader->buffer, reader->buffer_length, reader->buffer_is_mapped);
+	free(reader);
 	return 0;
 }
 
-MidiFileHourMinuteSecond_t MidiFileHourMinuteSecond_new(void)
+int MidiFileReader_getFileFormat(MidiFileReader_t reader)
 {
-	MidiFileHourMinuteSecond_t hour_minute_second = (MidiFileHourMinuteSecond_t)(malloc(sizeof(struct MidiFileHourMinuteSecond)));
-	hour_minute_second->hour = 0;
-	hour_minute_second->minute = 0;
-	hour_minute_second->second = 0.0;
-	hour_minute_second->string[0] = '\0';
-	return hour_minute_second;
+	if (reader == NULL) return -1;
+	return reader->file_format;
+}
+
+MidiFileDivisionType_t MidiFileReader_getDivisionType(MidiFileReader_t reader)
+{
+	if (reader == NULL) return MIDI_FILE_DIVISION_TYPE_INVALID;
+	return reader->division_type;
 }
 
-int MidiFileHourMinuteSecond_free(MidiFileHourMinuteSecond_t hour_minute_second)
+int MidiFileReader_getResolution(MidiFileReader_t reader)
 {
-	if (hour_minute_second == NULL) return -1;
-	free(hour_minute_second);
-	return 0;
+	if (reader == NULL) return -1;
+	return reader->resolution;
 }
 
-long MidiFileHourMinuteSecond_getHour(MidiFileHourMinuteSecond_t hour_minute_second)
+int MidiFileReader_getNumberOfTracks(MidiFileReader_t reader)
 {
-	if (hour_minute_second == NULL) return -1;
-	return hour_minute_second->hour;
+	if (reader == NULL) return -1;
+	return reader->number_of_tracks;
 }
 
-int MidiFileHourMinuteSecond_setHour(MidiFileHourMinuteSecond_t hour_minute_second, long hour)
+MidiFileEvent_t MidiFileReader_getNextEvent(MidiFileReader_t reader)
 {
-	if (hour_minute_second == NULL) return -1;
-	hour_minute_second->hour = hour;
-	return 0;
+	struct MidiFileReaderTrack *reader_track;
+
+	if (reader == NULL) return NULL;
+
+	/*
+	 * Merge by tick, breaking ties by track number, which is the order of the
+	 * file-wide event list after loading.  The track at the top of the heap
+	 * is only advanced on the following call, since the event last returned
+	 * from it must stay valid until then.
+	 */
+
+	if (reader->heap_is_stale)
+	{
+		MidiFileReader_rebuildHeap(reader);
+	}
+	else if ((reader->heap_size > 0) && ! reader->tracks[reader->heap[0].track_number].has_pending_event)
+	{
+		MidiFileEvent_t event = MidiFileReader_peekEventInTrack(reader, reader->heap[0].track_number);
+
+		if (event == NULL)
+		{
+			reader->heap[0] = reader->heap[--(reader->heap_size)];
+		}
+		else
+		{
+			reader->heap[0].tick = event->tick;
+		}
+
+		if (reader->heap_size > 0) MidiFileReader_siftDown(reader, 0);
+	}
+
+	if (reader->heap_size == 0)
+	{
+		reader->current_track_number = -1;
+		return NULL;
+	}
+
+	reader->current_track_number = reader->heap[0].track_number;
+	reader_track = &(reader->tracks[reader->current_track_number]);
+	reader_track->has_pending_event = 0;
+	return &(reader_track->pending_event);
 }
 
-long MidiFileHourMinuteSecond_getMinute(MidiFileHourMinuteSecond_t hour_minute_second)
+MidiFileEvent_t MidiFileReader_getNextEventInTrack(MidiFileReader_t reader, int track_number)
 {
-	if (hour_minute_second == NULL) return -1;
-	return hour_minute_second->minute;
+	MidiFileEvent_t event;
+
+	if ((reader == NULL) || (track_number < 0) || (track_number >= reader->number_of_tracks)) return NULL;
+	if ((event = MidiFileReader_peekEventInTrack(reader, track_number)) != NULL) reader->tracks[track_number].has_pending_event = 0;
+	reader->heap_is_stale = 1;
+	reader->current_track_number = (event == NULL) ? -1 : track_number;
+	return event;
 }
 
-int MidiFileHourMinuteSecond_setMinute(MidiFileHourMinuteSecond_t hour_minute_second, long minute)
+int MidiFileReader_getTrackNumber(MidiFileReader_t reader)
 {
-	if (hour_minute_second == NULL) return -1;
-	hour_minute_second->minute = minute;
-	return 0;
+	if (reader == NULL) return -1;
+	return reader->current_track_number;
 }
 
-float MidiFileHourMinuteSecond_getSecond(MidiFileHourMinuteSecond_t hour_minute_second)
+long MidiFileReader_getTrackEndTick(MidiFileReader_t reader, int track_number)
 {
-	if (hour_minute_second == NULL) return -1.0;
-	return hour_minute_second->second;
+	/* only known once the track has been read to its end */
+	if ((reader == NULL) || (track_number < 0) || (track_number >= reader->number_of_tracks)) return -1;
+	return reader->tracks[track_number].parser.end_tick;
 }
 
-int MidiFileHourMinuteSecond_setSecond(MidiFileHourMinuteSecond_t hour_minute_second, float second)
+int MidiFileReader_visitEvents(MidiFileReader_t reader, MidiFileEventVisitorCallback_t visitor_callback, void *user_data)
 {
-	if (hour_minute_second == NULL) return -1;
-	hour_minute_second->second = second;
+	MidiFileEvent_t event;
+
+	if ((reader == NULL) || (visitor_callback == NULL)) return -1;
+
+	while ((event = MidiFileReader_getNextEvent(reader)) != NULL)
+	{
+		(*visitor_callback)(event, user_data);
+	}
+
 	return 0;
 }
 
-char *MidiFileHourMinuteSecond_toString(MidiFileHourMinuteSecond_t hour_minute_second)
+static int get_event_channel(MidiFileEvent_t event)
 {
-	if (hour_minute_second == NULL) return NULL;
-	sprintf(hour_minute_second->string, "%ld:%02ld:%06.3f", hour_minute_second->hour, hour_minute_second->minute, hour_minute_second->second);
-	return hour_minute_second->string;
+	switch (event->type)
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			return event->u.note_off.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			return event->u.note_on.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_KEY_PRESSURE:
+		{
+			return event->u.key_pressure.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_CONTROL_CHANGE:
+		{
+			return event->u.control_change.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_PROGRAM_CHANGE:
+		{
+			return event->u.program_change.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_CHANNEL_PRESSURE:
+		{
+			return event->u.channel_pressure.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_PITCH_WHEEL:
+		{
+			return event->u.pitch_wheel.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE:
+		{
+			return event->u.note.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_FINE_CONTROL_CHANGE:
+		{
+			return event->u.fine_control_change.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_RPN:
+		{
+			return event->u.rpn.channel;
+		}
+		case MIDI_FILE_EVENT_TYPE_NRPN:
+		{
+			return event->u.nrpn.channel;
+		}
+		default:
+		{
+			return -1;
+		}
+	}
 }
 
-int MidiFileHourMinuteSecond_parse(MidiFileHourMinuteSecond_t hour_minute_second, char *string)
+int MidiFileIterator_initForFile(struct MidiFileIterator *iterator, MidiFile_t midi_file)
 {
-	if ((hour_minute_second == NULL) || (string == NULL)) return -1;
-	hour_minute_second->hour = 0;
-	hour_minute_second->minute = 0;
-	hour_minute_second->second = 0.0;
-	sscanf(string, "%ld:%ld:%f", &(hour_minute_second->hour), &(hour_minute_second->minute), &(hour_minute_second->second));
+	if ((iterator == NULL) || (midi_file == NULL)) return -1;
+	iterator->midi_file = midi_file;
+	iterator->track = NULL;
+	iterator->channel = -1;
+	iterator->end_tick = -1;
+	iterator->next_event = MidiFile_getFirstEvent(midi_file);
 	return 0;
 }
 
-MidiFileHourMinuteSecondFrame_t MidiFileHourMinuteSecondFrame_new(void)
+int MidiFileIterator_initForTrack(struct MidiFileIterator *iterator, MidiFileTrack_t track)
 {
-	MidiFileHourMinuteSecondFrame_t hour_minute_second_frame = (MidiFileHourMinuteSecondFrame_t)(malloc(sizeof(struct MidiFileHourMinuteSecondFrame)));
-	hour_minute_second_frame->hour = 0;
-	hour_minute_second_frame->minute = 0;
-	hour_minute_second_frame->second = 0;
-	hour_minute_second_frame->frame = 0.0;
-	hour_minute_second_frame->string[0] = '\0';
-	return hour_minute_second_frame;
+	if ((iterator == NULL) || (track == NULL)) return -1;
+	iterator->midi_file = track->midi_file;
+	iterator->track = track;
+	iterator->channel = -1;
+	iterator->end_tick = -1;
+	iterator->next_event = MidiFileTrack_getFirstEvent(track);
+	return 0;
 }
 
-int MidiFileHourMinuteSecondFrame_free(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+int MidiFileIterator_initForChannel(struct MidiFileIterator *iterator, MidiFile_t midi_file, int channel)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	free(hour_minute_second_frame);
+	if ((iterator == NULL) || (midi_file == NULL) || (channel < 0)) return -1;
+	iterator->midi_file = midi_file;
+	iterator->track = NULL;
+	iterator->channel = channel;
+	iterator->end_tick = -1;
+	iterator->next_event = MidiFile_getFirstEvent(midi_file);
 	return 0;
 }
 
-long MidiFileHourMinuteSecondFrame_getHour(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+int MidiFileIterator_initForTickRange(struct MidiFileIterator *iterator, MidiFile_t midi_file, long start_tick, long end_tick)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	return hour_minute_second_frame->hour;
+	/* events with start_tick <= tick < end_tick */
+	if ((iterator == NULL) || (midi_file == NULL) || (start_tick < 0) || (end_tick < start_tick)) return -1;
+	iterator->midi_file = midi_file;
+	iterator->track = NULL;
+	iterator->channel = -1;
+	iterator->end_tick = end_tick;
+	iterator->next_event = get_first_event_in_file_at_or_after_tick(midi_file, start_tick);
+	return 0;
 }
 
-int MidiFileHourMinuteSecondFrame_setHour(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long hour)
+MidiFileEvent_t MidiFileIterator_getNextEvent(struct MidiFileIterator *iterator)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	hour_minute_second_frame->hour = hour;
+	/* the next event is looked up before the current one is returned, so that the caller is free to delete it */
+
+	MidiFileEvent_t event;
+
+	if (iterator == NULL) return NULL;
+
+	while ((event = iterator->next_event) != NULL)
+	{
+		if ((iterator->end_tick >= 0) && (event->tick >= iterator->end_tick))
+		{
+			iterator->next_event = NULL;
+			return NULL;
+		}
+
+		iterator->next_event = (iterator->track == NULL) ? get_event(event->next_event_in_file) : get_event(event->next_event_in_track);
+		if ((iterator->channel < 0) || (get_event_channel(event) == iterator->channel)) return event;
+	}
+
+	return NULL;
+}
+
+int MidiFileIterator_visitEvents(struct MidiFileIterator *iterator, MidiFileEventVisitorCallback_t visitor_callback, void *user_data)
+{
+	MidiFileEvent_t event;
+
+	if ((iterator == NULL) || (visitor_callback == NULL)) return -1;
+
+	while ((event = MidiFileIterator_getNextEvent(iterator)) != NULL)
+	{
+		(*visitor_callback)(event, user_data);
+	}
+
 	return 0;
 }
 
-long MidiFileHourMinuteSecondFrame_getMinute(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+MidiFileSnapshot_t MidiFile_snapshot(MidiFile_t midi_file)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	return hour_minute_second_frame->minute;
+	MidiFileSnapshot_t snapshot;
+	MidiFileTrack_t track;
+	int track_number = 0;
+
+	if (midi_file == NULL) return NULL;
+	if ((snapshot = (MidiFileSnapshot_t)(malloc(sizeof(struct MidiFileSnapshot)))) == NULL) return NULL;
+	snapshot->file_format = midi_file->file_format;
+	snapshot->division_type = midi_file->division_type;
+	snapshot->resolution = midi_file->resolution;
+	snapshot->number_of_tracks = midi_file->number_of_tracks;
+	snapshot->track_images = (struct MidiFileTrackImage **)(malloc((midi_file->number_of_tracks + 1) * sizeof (struct MidiFileTrackImage *)));
+
+	if (snapshot->track_images == NULL)
+	{
+		free(snapshot);
+		return NULL;
+	}
+
+	/* the images must capture the tracks in order, so settle any batch first */
+	sort_batch(midi_file);
+	lock_track_images();
+
+	for (track = midi_file->first_track; track != NULL; track = track->next_track)
+	{
+		if (track->snapshot_image == NULL)
+		{
+			struct MidiFileTrackImage *image = (struct MidiFileTrackImage *)(malloc(sizeof(struct MidiFileTrackImage)));
+
+			if (image == NULL)
+			{
+				while (track_number > 0) release_track_image(snapshot->track_images[--track_number]);
+				unlock_track_images();
+				free(snapshot->track_images);
+				free(snapshot);
+				return NULL;
+			}
+
+			image->reference_count = 1;
+			image->track = track;
+			image->end_tick = 0;
+			image->number_of_events = 0;
+			image->data = NULL;
+			image->data_length = 0;
+			track->snapshot_image = image;
+		}
+
+		(track->snapshot_image->reference_count)++;
+		snapshot->track_images[track_number++] = track->snapshot_image;
+	}
+
+	unlock_track_images();
+	return snapshot;
 }
 
-int MidiFileHourMinuteSecondFrame_setMinute(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long minute)
+int MidiFileSnapshot_free(MidiFileSnapshot_t snapshot)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	hour_minute_second_frame->minute = minute;
+	int track_number;
+
+	if (snapshot == NULL) return -1;
+	lock_track_images();
+	for (track_number = 0; track_number < snapshot->number_of_tracks; track_number++) release_track_image(snapshot->track_images[track_number]);
+	unlock_track_images();
+	free(snapshot->track_images);
+	free(snapshot);
 	return 0;
 }
 
-long MidiFileHourMinuteSecondFrame_getSecond(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+MidiFile_t MidiFileSnapshot_toMidiFile(MidiFileSnapshot_t snapshot)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	return hour_minute_second_frame->second;
+	MidiFile_t midi_file;
+	int track_number;
+
+	if (snapshot == NULL) return NULL;
+	midi_file = MidiFile_new(snapshot->file_format, snapshot->division_type, snapshot->resolution);
+
+	for (track_number = 0; track_number < snapshot->number_of_tracks; track_number++)
+	{
+		struct MidiFileTrackImage *image = snapshot->track_images[track_number];
+		MidiFileTrack_t track = MidiFile_createTrack(midi_file);
+		struct MidiFileEvent event;
+		unsigned char *p;
+		long event_number;
+		int result;
+
+		/* if the live track hasn't changed yet, the copy is made here, and kept for the other snapshots sharing it */
+		lock_track_images();
+		result = copy_track_image(image);
+		unlock_track_images();
+
+		if ((result != 0) || (image->number_of_events < 0))
+		{
+			MidiFile_free(midi_file);
+			return NULL;
+		}
+
+		event.tick = 0;
+		p = image->data;
+
+		for (event_number = 0; event_number < image->number_of_events; event_number++)
+		{
+			p = unpack_event(p, &event);
+			append_copy_of_event(track, &event, midi_file, 1);
+		}
+
+		track->end_tick = image->end_tick;
+	}
+
+	return midi_file;
 }
 
-int MidiFileHourMinuteSecondFrame_setSecond(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, long second)
+long MidiFileSnapshot_getSize(MidiFileSnapshot_t snapshot)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	hour_minute_second_frame->second = second;
-	return 0;
+	/* tracks still shared with the live file cost nothing extra, and copies shared between snapshots are split between them */
+
+	long size;
+	int track_number;
+
+	if (snapshot == NULL) return -1;
+	size = sizeof(struct MidiFileSnapshot) + (snapshot->number_of_tracks * (sizeof (struct MidiFileTrackImage *) + sizeof (struct MidiFileTrackImage)));
+	lock_track_images();
+
+	for (track_number = 0; track_number < snapshot->number_of_tracks; track_number++)
+	{
+		struct MidiFileTrackImage *image = snapshot->track_images[track_number];
+		if (image->track == NULL) size += image->data_length / image->reference_count;
+	}
+
+	unlock_track_images();
+	return size;
 }
 
-float MidiFileHourMinuteSecondFrame_getFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+MidiFileJournal_t MidiFileJournal_open(MidiFile_t midi_file, const char *filename)
 {
-	if (hour_minute_second_frame == NULL) return -1.0;
-	return hour_minute_second_frame->frame;
+	MidiFileJournal_t journal;
+
+	if ((midi_file == NULL) || (filename == NULL) || (midi_file->journal != NULL)) return NULL;
+
+	journal = (MidiFileJournal_t)(malloc(sizeof (struct MidiFileJournal)));
+	journal->midi_file = midi_file;
+	journal->filename = (char *)(malloc(strlen(filename) + 1));
+	strcpy(journal->filename, filename);
+	journal->file = NULL;
+	journal->length = 0;
+	journal->checkpoint_length = 0;
+	journal->sync_interval = 1;
+	journal->number_of_saves_since_sync = 0;
+	journal->maximum_record_length = 65536;
+	journal->record = (unsigned char *)(malloc(journal->maximum_record_length));
+	sort_batch(midi_file);
+
+	if (compact_journal(journal) != 0)
+	{
+		free(journal->record);
+		free(journal->filename);
+		free(journal);
+		return NULL;
+	}
+
+	midi_file->journal = journal;
+	return journal;
 }
 
-int MidiFileHourMinuteSecondFrame_setFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, float frame)
+int MidiFileJournal_setSyncInterval(MidiFileJournal_t journal, int number_of_saves)
 {
-	if (hour_minute_second_frame == NULL) return -1;
-	hour_minute_second_frame->frame = frame;
+	if ((journal == NULL) || (number_of_saves < 0)) return -1;
+	journal->sync_interval = number_of_saves;
 	return 0;
 }
 
-char *MidiFileHourMinuteSecondFrame_toString(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame)
+int MidiFileJournal_save(MidiFileJournal_t journal)
 {
-	if (hour_minute_second_frame == NULL) return NULL;
-	sprintf(hour_minute_second_frame->string, "%ld:%02ld:%02ld:%.3f", hour_minute_second_frame->hour, hour_minute_second_frame->minute, hour_minute_second_frame->second, hour_minute_second_frame->frame);
-	return hour_minute_second_frame->string;
+	long record_length;
+
+	if (journal == NULL) return -1;
+	sort_batch(journal->midi_file);
+
+	/* once the saves outweigh the checkpoint, rewriting it costs no more than they did, so the cost stays in proportion to the changes */
+	if (journal->midi_file->journal_needs_compaction || (journal->length - journal->checkpoint_length > journal->checkpoint_length + MIDI_FILE_JOURNAL_MINIMUM_COMPACTION_LENGTH)) return compact_journal(journal);
+
+	if ((record_length = build_journal_record(journal, 0)) <= 0) return (int)(record_length);
+
+	if ((fwrite(journal->record, 1, record_length, journal->file) != (size_t)(record_length)) || (fflush(journal->file) != 0))
+	{
+		/* recovery would stop at whatever part of the record got written, so nothing after it can go in this journal */
+		journal->midi_file->journal_needs_compaction = 1;
+		return -1;
+	}
+
+	journal->length += record_length;
+	note_journal_saved(journal);
+	if ((journal->sync_interval == 0) || (++(journal->number_of_saves_since_sync) < journal->sync_interval)) return 0;
+	journal->number_of_saves_since_sync = 0;
+	return sync_file(journal->file);
 }
 
-int MidiFileHourMinuteSecondFrame_parse(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, char *string)
+int MidiFileJournal_close(MidiFileJournal_t journal, const char *filename)
 {
-	if ((hour_minute_second_frame == NULL) || (string == NULL)) return -1;
-	hour_minute_second_frame->hour = 0;
-	hour_minute_second_frame->minute = 0;
-	hour_minute_second_frame->second = 0;
-	hour_minute_second_frame->frame = 0.0;
-	sscanf(string, "%ld:%ld:%ld:%f", &(hour_minute_second_frame->hour), &(hour_minute_second_frame->minute), &(hour_minute_second_frame->second), &(hour_minute_second_frame->frame));
-	return 0;
+	int result;
+
+	if (journal == NULL) return -1;
+	result = MidiFileJournal_save(journal);
+	if ((journal->file != NULL) && (sync_file(journal->file) != 0)) result = -1;
+	if ((journal->file != NULL) && (fclose(journal->file) != 0)) result = -1;
+
+	if (filename != NULL)
+	{
+		/* once the file is safely saved, the journal is no longer needed, even if it couldn't be brought up to date */
+		if (save_midi_file_atomically(journal->midi_file, filename) == 0)
+		{
+			remove(journal->filename);
+			result = 0;
+		}
+		else
+		{
+			result = -1;
+		}
+	}
+
+	journal->midi_file->journal = NULL;
+	free(journal->record);
+	free(journal->filename);
+	free(journal);
+	return result;
 }
 
+MidiFile_t MidiFile_loadFromJournal(const char *filename)
+{
+	MidiFile_t midi_file = NULL;
+	unsigned char *buffer;
+	long buffer_length, offset;
+	int buffer_is_mapped;
+
+	if ((filename == NULL) || ((buffer = read_file(filename, 0, &buffer_length, &buffer_is_mapped)) == NULL)) return NULL;
+
+	if ((buffer_length >= 4) && (memcmp(buffer, MIDI_FILE_JOURNAL_SIGNATURE, 4) == 0))
+	{
+		/* replay up to the first record which didn't make it out whole */
+		for (offset = 4; buffer_length - offset >= 8; )
+		{
+			long payload_length = (long)(interpret_uint32(buffer + offset));
+
+			if ((payload_length > buffer_length - offset - 8) || (interpret_uint32(buffer + offset + 4 + payload_length) != get_checksum(buffer + offset + 4, payload_length))) break;
+			if (replay_journal_record(&midi_file, buffer + offset + 4, payload_length) != 0) break;
+			offset += payload_length + 8;
+		}
+	}
+
+	free_file_buffer(buffer, buffer_length, buffer_is_mapped);
+	return midi_file;
+}
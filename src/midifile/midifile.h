@@ -21,7 +21,10 @@
  *     Any data returned from these functions is memory-managed by the API.
  *     Don't forget to call MidiFile_free().
  *
- * 4.  This API is not thread-safe.
+ * 4.  This API is not thread-safe.  Separate files can be used on separate
+ *     threads, though, since the little they share is locked (with SRW
+ *     locks on Windows).  Compile with -DMIDI_FILE_NO_THREADS to leave the
+ *     locks out of single-threaded programs.
  *
  * 5.  All numbers in this API are zero-based, to correspond with the actual
  *     byte values of the MIDI protocol, rather than one-based, as they are
@@ -63,10 +66,219 @@
  * 13. An event can be "detached", which means that it is no longer part of
  *     a track or the file, but retains the rest of its properties.  It can
  *     be reattached to the same or a different file by setting its track
- *     property, or explicitly deleted.
+ *     property, or explicitly deleted.  Events are allocated from storage
+ *     belonging to the file in which they were created, which outlives
+ *     MidiFile_free() for as long as any of them are detached or in other
+ *     files, so be sure to delete the detached ones.
  *
  * 14. Events can be marked as "selected" but this is only meaningful in
  *     memory; it is not persisted to disk.
+ *
+ * 15. MidiFile_loadFromBuffer() trusts the buffer to hold a complete file.
+ *     Use MidiFile_loadFromBufferWithLength() for data of uncertain origin;
+ *     it never reads past the given length, and ends a truncated track at
+ *     the last complete event.
+ *
+ * 16. Saving never seeks, so MidiFile_save() can write to pipes and other
+ *     non-seekable outputs.  MidiFile_saveToGrowableBuffer() returns a
+ *     newly allocated copy of the file, which the caller must free().
+ *
+ * 17. Adding an event, or looking one up by tick, normally walks the event
+ *     list.  For heavy random access editing, MidiFile_setIndexed() keeps
+ *     an index by tick for the file and each of its tracks, which makes
+ *     these O(log N) at the cost of some memory.
+ *
+ * 18. For read-only processing, MidiFile_freeze() copies the events into a
+ *     frozen view of parallel arrays indexed by position in the file.  Each
+ *     event's number and value hold its note and velocity, controller
+ *     number and value, meta type and data length, and so on, and its
+ *     time is worked out to the microsecond without rounding errors
+ *     accumulating across tempo changes.  A frozen view never changes,
+ *     so any number of threads may read it at once, but it also doesn't
+ *     follow later edits to the file.  Sysex and meta data for event i are
+ *     found in the payloads from offset i up to offset i + 1.
+ *
+ * 19. To look at each event once without building a MidiFile, open a
+ *     MidiFileReader and pull events from it, either merged in file order
+ *     or one track at a time.  Only one pending event per track is kept,
+ *     so memory use does not grow with the length of the file.  The events
+ *     it returns belong to the reader and are only valid until the next
+ *     one is read; they are not in any track, so use only the getters
+ *     that describe the event itself, and don't modify or delete them.
+ *
+ * 20. When changing the ticks of many events, or adding many events, do it
+ *     between MidiFile_beginBatch() and MidiFile_endBatch().  Within a
+ *     batch, events are just appended to their tracks and the file, and
+ *     the lists are sorted back into order when the batch ends.  The
+ *     result is exactly the same as doing the operations one at a time.
+ *     Until then, walking the lists directly shows the events out of
+ *     order.  MidiFile_iterateEvents() still visits each event once.
+ *     Anything that needs the lists in order sorts them first:  lookups
+ *     by tick, note pairing, tempo conversions, placing an event next to
+ *     another, and saving.  Doing that repeatedly inside a batch gives
+ *     back the savings.  Batches may be nested.
+ *
+ * 21. MidiFile_loadInParallel() reads the tracks of a file on several
+ *     threads at once (as many as there are processors if the count given
+ *     is zero), which helps files with many large tracks.  The result is
+ *     exactly what MidiFile_load() would give.  The file is not shared
+ *     with the threads once it is returned, so note 4 still applies.
+ *     Where threads aren't available, or with -DMIDI_FILE_NO_THREADS, it
+ *     loads on the calling thread.  Otherwise, except on Windows, compile
+ *     and link with -pthread, as the makefiles here do.
+ *
+ * 22. MidiFile_iterateEvents() and MidiFileTrack_iterateEvents() keep their
+ *     place in the file and mark each event as they go, so only one pass
+ *     can be under way per file or track.  A struct MidiFileIterator keeps
+ *     its place in itself instead; declare one on the stack, initialize it
+ *     for the whole file, a track, a channel, or a range of ticks, and call
+ *     MidiFileIterator_getNextEvent() until it returns null.  Any number of
+ *     them can be used at once, from several threads if nothing is
+ *     modifying the file.  The event just returned can be deleted,
+ *     detached, or moved earlier without upsetting the iterator.  Don't
+ *     delete any other event.  Events added after the iterator's position,
+ *     including the current event moved later, are visited when it gets to
+ *     them.  So for passes that push events later, like quantizing, stick
+ *     with MidiFile_visitEvents().
+ *
+ * 23. The time signatures in the conductor track are cached alongside the
+ *     tempo map, so converting between ticks and measures takes a binary
+ *     search rather than a scan of the conductor track.  Both maps are
+ *     rebuilt on the first lookup after the conductor track changes, so to
+ *     share a file between threads, do one lookup first.  The string
+ *     functions like MidiFile_getMeasureBeatStringFromTick() and
+ *     MidiFileMeasureBeat_toString() return a buffer which the next call
+ *     overwrites.  The format functions write into a buffer that you pass
+ *     in instead, without allocating.  They return the length of the
+ *     string, or -1 if it doesn't fit (in which case the buffer is left
+ *     empty).
+ *
+ * 24. MidiFile_getTimesFromTicks() and the other array conversions give the
+ *     same results as calling MidiFile_getTimeFromTick() and friends on
+ *     each element, but when the input is sorted, they convert it all in
+ *     one sweep along the tempo map.  Input in any other order works too,
+ *     but costs a search whenever a value is lower than the one before.
+ *
+ * 25. MidiFile_snapshot() captures the file as it is, for undo or for
+ *     saving in the background, without copying it.  The snapshot shares
+ *     each track with the live file until one of them needs its own:  the
+ *     first change to a track copies it for the snapshots still sharing it,
+ *     and MidiFileSnapshot_toMidiFile() copies the tracks that haven't
+ *     changed yet.  Either way, each track is copied at most once however
+ *     many snapshots share it, and unchanged tracks are shared between
+ *     successive snapshots.  MidiFileSnapshot_getSize() counts the memory
+ *     a snapshot holds on to beyond what it shares with the live file,
+ *     with copies shared between snapshots split evenly, so that the sizes
+ *     of all the snapshots add up to what they cost together.
+ *     Snapshots are taken and freed on the thread that owns the file, but
+ *     may be turned back into files on another, even while the live file
+ *     is being edited.  For that to be safe, don't modify the buffers from
+ *     MidiFileSysexEvent_getData() or MidiFileMetaEvent_getData() in
+ *     place; set new data instead.
+ *
+ * 26. MidiFile_load() and MidiFile_loadInParallel() read the file into a
+ *     buffer of their own.  If most of the file is sysex or meta data, as
+ *     in patch archives and sample dumps, the payloads are left where they
+ *     are in that buffer rather than being copied, and the buffer is kept
+ *     until the file is freed, even if those events are deleted or given
+ *     new data.  Otherwise the payloads are copied and the buffer freed
+ *     straight away.  The functions that load from your own buffers always
+ *     copy, since the buffers stay yours.
+ *
+ * 27. For saving often, say every few seconds while recording, a journal
+ *     costs in proportion to what changed rather than to the whole file.
+ *     MidiFileJournal_open() writes the file to the journal as it is, then
+ *     each MidiFileJournal_save() appends what has changed since:  just the
+ *     new events for tracks which have only been added to at the end, or
+ *     the whole track for any other change.  Every so often the journal is
+ *     compacted, by rewriting it as a single record, so that it never grows
+ *     much beyond a few times the size of the file.  Each save is synced to
+ *     disk unless MidiFileJournal_setSyncInterval() says to do so only every
+ *     so many saves, trading how much a crash could lose for speed.
+ *     MidiFileJournal_close() writes a standard file and removes the
+ *     journal, or with a NULL filename, leaves the journal to carry on from
+ *     later.  After a crash, MidiFile_loadFromJournal() gets back the file
+ *     as of the last save to make it out whole.  Only one journal can be
+ *     open on a file at a time, and it must be closed before the file is
+ *     freed.  Journals keep note, fine control change, RPN, and NRPN events
+ *     intact, but not the frames per second of a PPQ file.
+ *
+ * 28. MidiFile_loadFrozen() gives the frozen view of a file, from a cache
+ *     file if one is given and up to date.  The cache holds the arrays as
+ *     they are in memory, so loading it maps it in (or on platforms without
+ *     mmap, reads it in one go) without decoding anything, and the times
+ *     and the search by tick come with it.  A cache that is missing, out of
+ *     date, damaged (ticks out of order, or payloads out of bounds), or from
+ *     another kind of machine is quietly rebuilt from the file.  A cache counts as out of date once the file's length or
+ *     modification time changes, so the one change it can miss is a
+ *     rewrite to the same length within the same second.  Caches are
+ *     written to a temporary file and renamed into place, so a cache being
+ *     rebuilt never disturbs one that is mapped.
+ *
+ * 29. When all you need is a summary, MidiFile_probe() loads only parts of
+ *     a file.  With MIDI_FILE_PROBE_HEADER_ONLY, you get the header and
+ *     the right number of tracks, all empty, with the track chunks skipped
+ *     over by their lengths rather than read.  Add flags to get more:
+ *     MIDI_FILE_PROBE_CONDUCTOR_TRACK loads all of the first track, which
+ *     is enough for the time conversions; MIDI_FILE_PROBE_META_EVENTS
+ *     keeps the meta events of every track, such as names and markers;
+ *     and MIDI_FILE_PROBE_LAST_EVENTS keeps the last event of every track,
+ *     so that MidiFile_getLastEvent() gives the length.  Tracks which are
+ *     read at all get their proper end ticks.  The result is an ordinary
+ *     file, but saving it would of course lose everything left out.
+ *
+ * 30. Events are kept small, 48 bytes each on a 64-bit machine, so that
+ *     big files fit in the cache.  To get there, the channel, note, and
+ *     velocity of note on, note off, and note events are kept in a byte
+ *     each, so values outside the MIDI range do not survive setting them.
+ *     The links between events are 32-bit references rather than pointers,
+ *     which limits a process to about four billion events at a time.
+ *
+ * 31. The list of all events in the file, in time order, is only merged
+ *     together from the tracks the first time something needs it, such as
+ *     MidiFile_getFirstEvent() or an iterator over the whole file.  Until
+ *     then, loading, editing, and saving a file track by track never pays
+ *     to keep it in order.  Once merged, it is kept up to date like the
+ *     tracks are.  Either way, the order is the same as if the list had been
+ *     kept all along: simultaneous events from different tracks come in
+ *     track order as loaded, and in the order they were added otherwise.
+ *
+ * 32. To generate lots of events at once, fill an array of struct
+ *     MidiFileEventRecord and hand it to MidiFileTrack_appendEvents(), or
+ *     to MidiFile_importEvents() to spread it over several tracks (which
+ *     are created as needed).  The records give the number and value of
+ *     each event as the frozen view does, and the payloads of sysex and meta
+ *     events as an offset and length into one shared block of data, which
+ *     is copied.  The result is the same as creating the events one at a
+ *     time in the order given, but the records are sorted once and linked
+ *     in one pass.  Note events with a duration can't be given this way;
+ *     use note on and note off events.  If any record is invalid, nothing
+ *     is added.
+ *
+ * 33. By default, every event is saved with a status byte of its own, as
+ *     it was created.  For smaller files, MidiFile_setSaveFlags() with
+ *     MIDI_FILE_SAVE_RUNNING_STATUS leaves out status bytes which repeat
+ *     the one before; MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS saves note offs
+ *     as note ons with a velocity of zero, which mean the same but make for
+ *     longer runs, at the cost of any release velocities; and
+ *     MIDI_FILE_SAVE_TRIM_META_EVENTS leaves out tempo, time signature, and
+ *     key signature events which only repeat the one before them in the
+ *     same track.  MIDI_FILE_SAVE_COMPACT is all three.  The flags belong to
+ *     the file, and apply to every way of saving it, including
+ *     MidiFile_getFileSize().  Tempo and time signature events outside the
+ *     first track are only trimmed in format 2 files, where they apply.
+ *
+ * 34. MidiFile_getTimeUsFromTick() and friends convert to and from whole
+ *     microseconds, without floating point.  Tempo changes are added up
+ *     exactly, so the only rounding is that of the result, and a time late
+ *     in a long file with thousands of tempo changes is as accurate as one
+ *     near the start.  The results are the same as those of
+ *     MidiFileFrozen_getTimesUs().  MidiFile_getTickFromTimeUs() gives the
+ *     last tick whose time rounds to no later than the one given, so
+ *     converting a tick to a time and back gives the same tick whenever
+ *     ticks are at least a microsecond apart.  SMPTE 30 drop frame files
+ *     run at exactly 30000/1001 frames per second here, rather than the
+ *     29.97 used by the conversions in seconds.
  */
 
 #ifdef __cplusplus
@@ -82,6 +294,20 @@ typedef struct MidiFileMeasureBeat *MidiFileMeasureBeat_t;
 typedef struct MidiFileMeasureBeatTick *MidiFileMeasureBeatTick_t;
 typedef struct MidiFileHourMinuteSecond *MidiFileHourMinuteSecond_t;
 typedef struct MidiFileHourMinuteSecondFrame *MidiFileHourMinuteSecondFrame_t;
+typedef struct MidiFileFrozen *MidiFileFrozen_t;
+typedef struct MidiFileReader *MidiFileReader_t;
+typedef struct MidiFileSnapshot *MidiFileSnapshot_t;
+typedef struct MidiFileJournal *MidiFileJournal_t;
+
+/* public only so that iterators can live on the stack; don't use the members directly */
+struct MidiFileIterator
+{
+	MidiFile_t midi_file;
+	MidiFileTrack_t track; /* walk this track rather than the whole file */
+	int channel; /* only events on this channel, unless negative */
+	long end_tick; /* stop at this tick, unless negative */
+	MidiFileEvent_t next_event;
+};
 
 typedef enum
 {
@@ -94,6 +320,25 @@ typedef enum
 }
 MidiFileDivisionType_t;
 
+typedef enum
+{
+	MIDI_FILE_PROBE_HEADER_ONLY = 0,
+	MIDI_FILE_PROBE_CONDUCTOR_TRACK = 1,
+	MIDI_FILE_PROBE_META_EVENTS = 2,
+	MIDI_FILE_PROBE_LAST_EVENTS = 4
+}
+MidiFileProbeFlag_t;
+
+typedef enum
+{
+	MIDI_FILE_SAVE_DEFAULT = 0,
+	MIDI_FILE_SAVE_RUNNING_STATUS = 1,
+	MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS = 2,
+	MIDI_FILE_SAVE_TRIM_META_EVENTS = 4,
+	MIDI_FILE_SAVE_COMPACT = 7
+}
+MidiFileSaveFlag_t;
+
 typedef enum
 {
 	MIDI_FILE_EVENT_TYPE_INVALID = -1,
@@ -113,10 +358,27 @@ typedef enum
 }
 MidiFileEventType_t;
 
+/* see note 32 */
+struct MidiFileEventRecord
+{
+	long tick;
+	MidiFileEventType_t type;
+	int track_number; /* only for MidiFile_importEvents() */
+	int channel;
+	int number; /* note, controller number, program, or meta type */
+	int value; /* velocity, amount, controller or pitch wheel value, or payload length for sysex and meta */
+	long payload_offset; /* where the sysex or meta payload starts in the payloads given alongside */
+};
+
 MidiFile_t MidiFile_load(char *filename);
+MidiFile_t MidiFile_probe(char *filename, int flags);
 int MidiFile_save(MidiFile_t midi_file, const char* filename);
 MidiFile_t MidiFile_loadFromBuffer(unsigned char *buffer);
+MidiFile_t MidiFile_loadFromBufferWithLength(unsigned char *buffer, long buffer_length);
+MidiFile_t MidiFile_loadInParallel(char *filename, int number_of_threads);
+MidiFile_t MidiFile_loadFromBufferWithLengthInParallel(unsigned char *buffer, long buffer_length, int number_of_threads);
 int MidiFile_saveToBuffer(MidiFile_t midi_file, unsigned char *buffer);
+unsigned char *MidiFile_saveToGrowableBuffer(MidiFile_t midi_file, int *file_size_out);
 int MidiFile_getFileSize(MidiFile_t midi_file);
 
 MidiFile_t MidiFile_new(int file_format, MidiFileDivisionType_t division_type, int resolution);
@@ -130,9 +392,17 @@ int MidiFile_getResolution(MidiFile_t midi_file);
 int MidiFile_setResolution(MidiFile_t midi_file, int resolution);
 float MidiFile_getNumberOfFramesPerSecond(MidiFile_t midi_file);
 int MidiFile_setNumberOfFramesPerSecond(MidiFile_t midi_file, float number_of_frames_per_second);
+int MidiFile_getSaveFlags(MidiFile_t midi_file);
+int MidiFile_setSaveFlags(MidiFile_t midi_file, int flags);
+int MidiFile_isIndexed(MidiFile_t midi_file);
+int MidiFile_setIndexed(MidiFile_t midi_file, int indexed);
+int MidiFile_beginBatch(MidiFile_t midi_file);
+int MidiFile_endBatch(MidiFile_t midi_file);
+int MidiFile_isInBatch(MidiFile_t midi_file);
 MidiFileTrack_t MidiFile_createTrack(MidiFile_t midi_file);
 int MidiFile_getNumberOfTracks(MidiFile_t midi_file);
 MidiFileTrack_t MidiFile_getTrackByNumber(MidiFile_t midi_file, int number, int create);
+int MidiFile_importEvents(MidiFile_t midi_file, const struct MidiFileEventRecord *records, long number_of_records, const unsigned char *payloads);
 MidiFileTrack_t MidiFile_getFirstTrack(MidiFile_t midi_file);
 MidiFileTrack_t MidiFile_getLastTrack(MidiFile_t midi_file);
 MidiFileEvent_t MidiFile_getFirstEvent(MidiFile_t midi_file);
@@ -152,6 +422,14 @@ float MidiFile_getBeatFromTick(MidiFile_t midi_file, long tick);
 long MidiFile_getTickFromBeat(MidiFile_t midi_file, float beat);
 float MidiFile_getTimeFromTick(MidiFile_t midi_file, long tick); /* time is in seconds */
 long MidiFile_getTickFromTime(MidiFile_t midi_file, float time);
+int MidiFile_getBeatsFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, float *beats); /* see note 24 */
+int MidiFile_getTicksFromBeats(MidiFile_t midi_file, long number_of_beats, const float *beats, long *ticks);
+int MidiFile_getTimesFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, float *times);
+int MidiFile_getTicksFromTimes(MidiFile_t midi_file, long number_of_times, const float *times, long *ticks);
+long long MidiFile_getTimeUsFromTick(MidiFile_t midi_file, long tick); /* see note 34 */
+long MidiFile_getTickFromTimeUs(MidiFile_t midi_file, long long time_us);
+int MidiFile_getTimesUsFromTicks(MidiFile_t midi_file, long number_of_ticks, const long *ticks, long long *times_us);
+int MidiFile_getTicksFromTimesUs(MidiFile_t midi_file, long number_of_times, const long long *times_us, long *ticks);
 float MidiFile_getMeasureFromTick(MidiFile_t midi_file, long tick);
 long MidiFile_getTickFromMeasure(MidiFile_t midi_file, float measure);
 int MidiFile_setMeasureBeatFromTick(MidiFile_t midi_file, long tick, MidiFileMeasureBeat_t measure_beat);
@@ -170,6 +448,10 @@ char *MidiFile_getHourMinuteSecondStringFromTick(MidiFile_t midi_file, long tick
 int MidiFile_getTickFromHourMinuteSecondString(MidiFile_t midi_file, char *hour_minute_second_string);
 char *MidiFile_getHourMinuteSecondFrameStringFromTick(MidiFile_t midi_file, long tick);
 int MidiFile_getTickFromHourMinuteSecondFrameString(MidiFile_t midi_file, char *hour_minute_second_frame_string);
+int MidiFile_formatMeasureBeatFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size); /* see note 23 */
+int MidiFile_formatMeasureBeatTickFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size);
+int MidiFile_formatHourMinuteSecondFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size);
+int MidiFile_formatHourMinuteSecondFrameFromTick(MidiFile_t midi_file, long tick, char *buffer, int buffer_size);
 long MidiFile_getTickFromMarker(MidiFile_t midi_file, char *marker);
 long MidiFile_getTickFromTimeString(MidiFile_t midi_file, char *time_string);
 
@@ -212,6 +494,7 @@ MidiFileEvent_t MidiFileTrack_createTimeSignatureEvent(MidiFileTrack_t track, lo
 MidiFileEvent_t MidiFileTrack_createKeySignatureEvent(MidiFileTrack_t track, long tick, int number, int minor);
 MidiFileEvent_t MidiFileTrack_createVoiceEvent(MidiFileTrack_t track, long tick, unsigned long data);
 MidiFileEvent_t MidiFileTrack_copyEvent(MidiFileTrack_t track, MidiFileEvent_t event);
+int MidiFileTrack_appendEvents(MidiFileTrack_t track, const struct MidiFileEventRecord *records, long number_of_records, const unsigned char *payloads);
 MidiFileEvent_t MidiFileTrack_getFirstEvent(MidiFileTrack_t track);
 MidiFileEvent_t MidiFileTrack_getLastEvent(MidiFileTrack_t track);
 MidiFileEvent_t MidiFileTrack_iterateEvents(MidiFileTrack_t track);
@@ -411,6 +694,7 @@ int MidiFileMeasureBeat_setMeasure(MidiFileMeasureBeat_t measure_beat, long meas
 float MidiFileMeasureBeat_getBeat(MidiFileMeasureBeat_t measure_beat);
 int MidiFileMeasureBeat_setBeat(MidiFileMeasureBeat_t measure_beat, float beat);
 char *MidiFileMeasureBeat_toString(MidiFileMeasureBeat_t measure_beat);
+int MidiFileMeasureBeat_format(MidiFileMeasureBeat_t measure_beat, char *buffer, int buffer_size);
 int MidiFileMeasureBeat_parse(MidiFileMeasureBeat_t measure_beat, char *string);
 
 MidiFileMeasureBeatTick_t MidiFileMeasureBeatTick_new(void);
@@ -422,6 +706,7 @@ int MidiFileMeasureBeatTick_setBeat(MidiFileMeasureBeatTick_t measure_beat_tick,
 float MidiFileMeasureBeatTick_getTick(MidiFileMeasureBeatTick_t measure_beat_tick);
 int MidiFileMeasureBeatTick_setTick(MidiFileMeasureBeatTick_t measure_beat_tick, float tick);
 char *MidiFileMeasureBeatTick_toString(MidiFileMeasureBeatTick_t measure_beat_tick);
+int MidiFileMeasureBeatTick_format(MidiFileMeasureBeatTick_t measure_beat_tick, char *buffer, int buffer_size);
 int MidiFileMeasureBeatTick_parse(MidiFileMeasureBeatTick_t measure_beat_tick, char *string);
 
 MidiFileHourMinuteSecond_t MidiFileHourMinuteSecond_new(void);
@@ -433,6 +718,7 @@ int MidiFileHourMinuteSecond_setMinute(MidiFileHourMinuteSecond_t hour_minute_se
 float MidiFileHourMinuteSecond_getSecond(MidiFileHourMinuteSecond_t hour_minute_second);
 int MidiFileHourMinuteSecond_setSecond(MidiFileHourMinuteSecond_t hour_minute_second, float second);
 char *MidiFileHourMinuteSecond_toString(MidiFileHourMinuteSecond_t hour_minute_second);
+int MidiFileHourMinuteSecond_format(MidiFileHourMinuteSecond_t hour_minute_second, char *buffer, int buffer_size);
 int MidiFileHourMinuteSecond_parse(MidiFileHourMinuteSecond_t hour_minute_second, char *string);
 
 MidiFileHourMinuteSecondFrame_t MidiFileHourMinuteSecondFrame_new(void);
@@ -446,8 +732,55 @@ int MidiFileHourMinuteSecondFrame_setSecond(MidiFileHourMinuteSecondFrame_t hour
 float MidiFileHourMinuteSecondFrame_getFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame);
 int MidiFileHourMinuteSecondFrame_setFrame(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, float frame);
 char *MidiFileHourMinuteSecondFrame_toString(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame);
+int MidiFileHourMinuteSecondFrame_format(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, char *buffer, int buffer_size);
 int MidiFileHourMinuteSecondFrame_parse(MidiFileHourMinuteSecondFrame_t hour_minute_second_frame, char *string);
 
+MidiFileFrozen_t MidiFile_freeze(MidiFile_t midi_file);
+int MidiFileFrozen_free(MidiFileFrozen_t frozen);
+long MidiFileFrozen_getNumberOfEvents(MidiFileFrozen_t frozen);
+long MidiFileFrozen_getIndexForTick(MidiFileFrozen_t frozen, long tick);
+const long *MidiFileFrozen_getTicks(MidiFileFrozen_t frozen);
+const long long *MidiFileFrozen_getTimesUs(MidiFileFrozen_t frozen);
+const unsigned short *MidiFileFrozen_getTrackNumbers(MidiFileFrozen_t frozen);
+const signed char *MidiFileFrozen_getTypes(MidiFileFrozen_t frozen);
+const unsigned char *MidiFileFrozen_getChannels(MidiFileFrozen_t frozen);
+const short *MidiFileFrozen_getNumbers(MidiFileFrozen_t frozen);
+const int *MidiFileFrozen_getValues(MidiFileFrozen_t frozen);
+const long *MidiFileFrozen_getPayloadOffsets(MidiFileFrozen_t frozen);
+const unsigned char *MidiFileFrozen_getPayloads(MidiFileFrozen_t frozen);
+MidiFileFrozen_t MidiFile_loadFrozen(const char *filename, const char *cache_filename);
+
+MidiFileReader_t MidiFileReader_open(const char *filename);
+MidiFileReader_t MidiFileReader_newFromBuffer(unsigned char *buffer, long buffer_length);
+int MidiFileReader_free(MidiFileReader_t reader);
+int MidiFileReader_getFileFormat(MidiFileReader_t reader);
+MidiFileDivisionType_t MidiFileReader_getDivisionType(MidiFileReader_t reader);
+int MidiFileReader_getResolution(MidiFileReader_t reader);
+int MidiFileReader_getNumberOfTracks(MidiFileReader_t reader);
+MidiFileEvent_t MidiFileReader_getNextEvent(MidiFileReader_t reader);
+MidiFileEvent_t MidiFileReader_getNextEventInTrack(MidiFileReader_t reader, int track_number);
+int MidiFileReader_getTrackNumber(MidiFileReader_t reader);
+long MidiFileReader_getTrackEndTick(MidiFileReader_t reader, int track_number);
+int MidiFileReader_visitEvents(MidiFileReader_t reader, MidiFileEventVisitorCallback_t visitor_callback, void *user_data);
+
+int MidiFileIterator_initForFile(struct MidiFileIterator *iterator, MidiFile_t midi_file);
+int MidiFileIterator_initForTrack(struct MidiFileIterator *iterator, MidiFileTrack_t track);
+int MidiFileIterator_initForChannel(struct MidiFileIterator *iterator, MidiFile_t midi_file, int channel);
+int MidiFileIterator_initForTickRange(struct MidiFileIterator *iterator, MidiFile_t midi_file, long start_tick, long end_tick);
+MidiFileEvent_t MidiFileIterator_getNextEvent(struct MidiFileIterator *iterator);
+int MidiFileIterator_visitEvents(struct MidiFileIterator *iterator, MidiFileEventVisitorCallback_t visitor_callback, void *user_data);
+
+MidiFileSnapshot_t MidiFile_snapshot(MidiFile_t midi_file);
+int MidiFileSnapshot_free(MidiFileSnapshot_t snapshot);
+MidiFile_t MidiFileSnapshot_toMidiFile(MidiFileSnapshot_t snapshot);
+long MidiFileSnapshot_getSize(MidiFileSnapshot_t snapshot);
+
+MidiFileJournal_t MidiFileJournal_open(MidiFile_t midi_file, const char *filename);
+int MidiFileJournal_setSyncInterval(MidiFileJournal_t journal, int number_of_saves);
+int MidiFileJournal_save(MidiFileJournal_t journal);
+int MidiFileJournal_close(MidiFileJournal_t journal, const char *filename);
+MidiFile_t MidiFile_loadFromJournal(const char *filename);
+
 #ifdef __cplusplus
 }
 #endif
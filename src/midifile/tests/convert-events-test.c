@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <midifile.h>
+
+/*
+ * Converts a file's note ons and offs to note events and back, listing
+ * the events in file order after each step, for comparing against the
+ * expected listing.
+ */
+
+static void usage(char *program_name)
+{
+	fprintf(stderr, "Usage:  %s <filename.mid>\n", program_name);
+	exit(1);
+}
+
+static void print_event(MidiFileEvent_t event)
+{
+	printf("%d %ld ", MidiFileTrack_getNumber(MidiFileEvent_getTrack(event)), MidiFileEvent_getTick(event));
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_NOTE_OFF:
+		{
+			printf("note-off %d %d %d\n", MidiFileNoteOffEvent_getChannel(event), MidiFileNoteOffEvent_getNote(event), MidiFileNoteOffEvent_getVelocity(event));
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE_ON:
+		{
+			printf("note-on %d %d %d\n", MidiFileNoteOnEvent_getChannel(event), MidiFileNoteOnEvent_getNote(event), MidiFileNoteOnEvent_getVelocity(event));
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_NOTE:
+		{
+			printf("note %d %d %d %d %ld\n", MidiFileNoteEvent_getChannel(event), MidiFileNoteEvent_getNote(event), MidiFileNoteEvent_getVelocity(event), MidiFileNoteEvent_getEndVelocity(event), MidiFileNoteEvent_getDurationTicks(event));
+			break;
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			printf("meta %d %d\n", MidiFileMetaEvent_getNumber(event), MidiFileMetaEvent_getDataLength(event));
+			break;
+		}
+		default:
+		{
+			printf("type %d\n", MidiFileEvent_getType(event));
+			break;
+		}
+	}
+}
+
+static void print_events(MidiFile_t midi_file, char *heading)
+{
+	MidiFileEvent_t event;
+
+	printf("# %s\n", heading);
+	for (event = MidiFile_getFirstEvent(midi_file); event != NULL; event = MidiFileEvent_getNextEventInFile(event)) print_event(event);
+}
+
+int main(int argc, char **argv)
+{
+	char *input_filename = NULL;
+	int i;
+	MidiFile_t midi_file;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--help") == 0)
+		{
+			usage(argv[0]);
+		}
+		else
+		{
+			input_filename = argv[i];
+		}
+	}
+
+	if (input_filename == NULL) usage(argv[0]);
+
+	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
+		exit(1);
+	}
+
+	MidiFile_convertStandardEventsToNoteEvents(midi_file);
+	print_events(midi_file, "note events");
+	MidiFile_convertNoteEventsToStandardEvents(midi_file);
+	print_events(midi_file, "standard events");
+	MidiFile_free(midi_file);
+	return 0;
+}
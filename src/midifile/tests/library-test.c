@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <midifile.h>
+
+/*
+ * Pass/fail checks for the loading and saving paths which promise to give
+ * the same results as one another:  parallel and serial loading, snapshots
+ * and the file they were taken from, journals and the file they recorded,
+ * saving with each of the save flags and loading back, and probing and
+ * loading in full.  Each check prints "ok" or "FAILED" with its name, and
+ * the exit status is nonzero if any failed.
+ */
+
+#define TEST_FILENAME "library-test.mid"
+#define TEST_JOURNAL_FILENAME "library-test.journal"
+#define TEST_NUMBER_OF_TRACKS 12
+
+static unsigned long random_state = 1;
+static int number_of_failures = 0;
+
+static void usage(char *program_name)
+{
+	fprintf(stderr, "Usage:  %s\n", program_name);
+	exit(1);
+}
+
+static unsigned long get_random(void)
+{
+	random_state = random_state * 1103515245UL + 12345UL;
+	return (random_state >> 16) & 0x7FFF;
+}
+
+static void report(char *name, char *failure)
+{
+	if (failure == NULL)
+	{
+		printf("ok %s\n", name);
+	}
+	else
+	{
+		printf("FAILED %s:  %s\n", name, failure);
+		number_of_failures++;
+	}
+}
+
+static MidiFile_t create_test_file(void)
+{
+	/* every kind of event, with simultaneous events across tracks, note offs with release velocities, and meta events which repeat the one before */
+	MidiFile_t midi_file = MidiFile_new(1, MIDI_FILE_DIVISION_TYPE_PPQ, 480);
+	MidiFileTrack_t conductor_track = MidiFile_createTrack(midi_file);
+	unsigned char sysex_data[6] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+	int track_number;
+	long tick;
+
+	MidiFileTrack_createTimeSignatureEvent(conductor_track, 0, 4, 4);
+	MidiFileTrack_createKeySignatureEvent(conductor_track, 0, 0, 0);
+	MidiFileTrack_createTempoEvent(conductor_track, 0, 120.0);
+	MidiFileTrack_createMarkerEvent(conductor_track, 0, "start");
+	MidiFileTrack_createTempoEvent(conductor_track, 960, 120.0);
+	MidiFileTrack_createKeySignatureEvent(conductor_track, 960, 0, 0);
+	MidiFileTrack_createTempoEvent(conductor_track, 1920, 90.0);
+	MidiFileTrack_createTimeSignatureEvent(conductor_track, 1920, 4, 4);
+	MidiFileTrack_createTimeSignatureEvent(conductor_track, 3840, 3, 4);
+	MidiFileTrack_createMarkerEvent(conductor_track, 3840, "middle");
+	MidiFileTrack_setEndTick(conductor_track, 7680);
+
+	for (track_number = 1; track_number < TEST_NUMBER_OF_TRACKS; track_number++)
+	{
+		MidiFileTrack_t track = MidiFile_createTrack(midi_file);
+		int channel = track_number % 16;
+
+		MidiFileTrack_createPortEvent(track, 0, "port");
+		MidiFileTrack_createProgramChangeEvent(track, 0, channel, track_number);
+
+		if (track_number == 1)
+		{
+			/* not trimmed, since tempos outside the first track only apply in format 2 */
+			MidiFileTrack_createTempoEvent(track, 0, 100.0);
+			MidiFileTrack_createTempoEvent(track, 480, 100.0);
+		}
+
+		if (track_number == 2)
+		{
+			MidiFileTrack_createKeySignatureEvent(track, 0, 2, 1);
+			MidiFileTrack_createKeySignatureEvent(track, 1440, 2, 1);
+		}
+
+		for (tick = 0; tick < 7680; tick += 120 * (1 + (long)(get_random() % 3)))
+		{
+			int note = 36 + (int)(get_random() % 48);
+
+			switch (get_random() % 8)
+			{
+				case 0:
+				{
+					MidiFileTrack_createControlChangeEvent(track, tick, channel, 7, (int)(get_random() % 128));
+					break;
+				}
+				case 1:
+				{
+					MidiFileTrack_createPitchWheelEvent(track, tick, channel, (int)(get_random() % 16384));
+					break;
+				}
+				case 2:
+				{
+					MidiFileTrack_createKeyPressureEvent(track, tick, channel, note, (int)(get_random() % 128));
+					MidiFileTrack_createChannelPressureEvent(track, tick, channel, (int)(get_random() % 128));
+					break;
+				}
+				case 3:
+				{
+					MidiFileTrack_createSysexEvent(track, tick, 6, sysex_data);
+					break;
+				}
+				case 4:
+				{
+					MidiFileTrack_createNoteOnEvent(track, tick, channel, note, 1 + (int)(get_random() % 127));
+					MidiFileTrack_createNoteOnEvent(track, tick + 60, channel, note, 0);
+					break;
+				}
+				default:
+				{
+					MidiFileTrack_createNoteOnEvent(track, tick, channel, note, 1 + (int)(get_random() % 127));
+					MidiFileTrack_createNoteOffEvent(track, tick + 90, channel, note, (int)(get_random() % 128));
+					break;
+				}
+			}
+		}
+
+		if (track_number % 4 == 0) MidiFileTrack_createTextEvent(track, 7000, "end");
+	}
+
+	return midi_file;
+}
+
+static unsigned char *save_to_buffer(MidiFile_t midi_file, int *file_size_out)
+{
+	unsigned char *buffer = MidiFile_saveToGrowableBuffer(midi_file, file_size_out);
+
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "Error:  Cannot save the test file.\n");
+		exit(1);
+	}
+
+	return buffer;
+}
+
+static int files_save_alike(MidiFile_t midi_file, MidiFile_t other_midi_file)
+{
+	unsigned char *buffer, *other_buffer;
+	int file_size, other_file_size, result;
+
+	buffer = save_to_buffer(midi_file, &file_size);
+	other_buffer = save_to_buffer(other_midi_file, &other_file_size);
+	result = ((file_size == other_file_size) && (memcmp(buffer, other_buffer, file_size) == 0));
+	free(buffer);
+	free(other_buffer);
+	return result;
+}
+
+static int file_saves_as(MidiFile_t midi_file, unsigned char *buffer, int file_size)
+{
+	unsigned char *saved_buffer;
+	int saved_file_size, result;
+
+	saved_buffer = save_to_buffer(midi_file, &saved_file_size);
+	result = ((saved_file_size == file_size) && (memcmp(saved_buffer, buffer, file_size) == 0));
+	free(saved_buffer);
+	return result;
+}
+
+static int events_match(MidiFileEvent_t event, MidiFileEvent_t other_event, int note_ends_match_by_note)
+{
+	if (MidiFileEvent_getTick(event) != MidiFileEvent_getTick(other_event)) return 0;
+
+	if (note_ends_match_by_note && MidiFileEvent_isNoteEndEvent(event))
+	{
+		/* a note off saved as a note on with a velocity of zero loses its release velocity */
+		return (MidiFileEvent_isNoteEndEvent(other_event) && ((MidiFileVoiceEvent_getData(event) & 0x7F0F) == (MidiFileVoiceEvent_getData(other_event) & 0x7F0F)));
+	}
+
+	if (MidiFileEvent_getType(event) != MidiFileEvent_getType(other_event)) return 0;
+
+	switch (MidiFileEvent_getType(event))
+	{
+		case MIDI_FILE_EVENT_TYPE_SYSEX:
+		{
+			return ((MidiFileSysexEvent_getDataLength(event) == MidiFileSysexEvent_getDataLength(other_event)) && (memcmp(MidiFileSysexEvent_getData(event), MidiFileSysexEvent_getData(other_event), MidiFileSysexEvent_getDataLength(event)) == 0));
+		}
+		case MIDI_FILE_EVENT_TYPE_META:
+		{
+			return ((MidiFileMetaEvent_getNumber(event) == MidiFileMetaEvent_getNumber(other_event)) && (MidiFileMetaEvent_getDataLength(event) == MidiFileMetaEvent_getDataLength(other_event)) && (memcmp(MidiFileMetaEvent_getData(event), MidiFileMetaEvent_getData(other_event), MidiFileMetaEvent_getDataLength(event)) == 0));
+		}
+		default:
+		{
+			return (MidiFileVoiceEvent_getData(event) == MidiFileVoiceEvent_getData(other_event));
+		}
+	}
+}
+
+static int event_repeats_the_one_before(MidiFileEvent_t event)
+{
+	/* whether MIDI_FILE_SAVE_TRIM_META_EVENTS should leave this event out */
+	MidiFileTrack_t track = MidiFileEvent_getTrack(event);
+	MidiFileEvent_t previous_event;
+	int number;
+
+	if (MidiFileEvent_getType(event) != MIDI_FILE_EVENT_TYPE_META) return 0;
+	number = MidiFileMetaEvent_getNumber(event);
+	if ((number != 0x51) && (number != 0x58) && (number != 0x59)) return 0;
+	if ((number != 0x59) && (MidiFileTrack_getNumber(track) != 0) && (MidiFile_getFileFormat(MidiFileTrack_getMidiFile(track)) != 2)) return 0;
+
+	for (previous_event = MidiFileEvent_getPreviousEventInTrack(event); previous_event != NULL; previous_event = MidiFileEvent_getPreviousEventInTrack(previous_event))
+	{
+		if ((MidiFileEvent_getType(previous_event) == MIDI_FILE_EVENT_TYPE_META) && (MidiFileMetaEvent_getNumber(previous_event) == number))
+		{
+			return ((MidiFileMetaEvent_getDataLength(previous_event) == MidiFileMetaEvent_getDataLength(event)) && (memcmp(MidiFileMetaEvent_getData(previous_event), MidiFileMetaEvent_getData(event), MidiFileMetaEvent_getDataLength(event)) == 0));
+		}
+	}
+
+	return 0;
+}
+
+static int event_survives_probe(MidiFileEvent_t event, int probe_flags)
+{
+	/* whether MidiFile_probe() with these flags should keep this event of a fully loaded file */
+	if ((probe_flags & MIDI_FILE_PROBE_CONDUCTOR_TRACK) && (MidiFileTrack_getNumber(MidiFileEvent_getTrack(event)) == 0)) return 1;
+	if ((probe_flags & MIDI_FILE_PROBE_META_EVENTS) && (MidiFileEvent_getType(event) == MIDI_FILE_EVENT_TYPE_META)) return 1;
+	if ((probe_flags & MIDI_FILE_PROBE_LAST_EVENTS) && (MidiFileEvent_getNextEventInTrack(event) == NULL)) return 1;
+	return 0;
+}
+
+static char *compare_tracks(MidiFile_t expected_midi_file, MidiFile_t midi_file, int save_flags, int probe_flags)
+{
+	/*
+	 * Matches the events of each track against those expected, leaving out
+	 * the expected events which saving with the given flags trims, or
+	 * (for probe flags other than -1) which probing with them skips.
+	 */
+
+	MidiFileTrack_t expected_track, track;
+
+	if (MidiFile_getFileFormat(midi_file) != MidiFile_getFileFormat(expected_midi_file)) return "file format differs";
+	if (MidiFile_getDivisionType(midi_file) != MidiFile_getDivisionType(expected_midi_file)) return "division type differs";
+	if (MidiFile_getResolution(midi_file) != MidiFile_getResolution(expected_midi_file)) return "resolution differs";
+	if (MidiFile_getNumberOfTracks(midi_file) != MidiFile_getNumberOfTracks(expected_midi_file)) return "number of tracks differs";
+
+	for (expected_track = MidiFile_getFirstTrack(expected_midi_file), track = MidiFile_getFirstTrack(midi_file); expected_track != NULL; expected_track = MidiFileTrack_getNextTrack(expected_track), track = MidiFileTrack_getNextTrack(track))
+	{
+		MidiFileEvent_t expected_event, event = MidiFileTrack_getFirstEvent(track);
+		int track_is_read = 1;
+
+		for (expected_event = MidiFileTrack_getFirstEvent(expected_track); expected_event != NULL; expected_event = MidiFileEvent_getNextEventInTrack(expected_event))
+		{
+			if ((save_flags & MIDI_FILE_SAVE_TRIM_META_EVENTS) && event_repeats_the_one_before(expected_event)) continue;
+			if ((probe_flags >= 0) && ! event_survives_probe(expected_event, probe_flags)) continue;
+			if (event == NULL) return "events are missing";
+			if (! events_match(expected_event, event, (save_flags & MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS))) return "events differ";
+			event = MidiFileEvent_getNextEventInTrack(event);
+		}
+
+		if (event != NULL) return "there are extra events";
+		if ((probe_flags >= 0) && ! ((probe_flags & (MIDI_FILE_PROBE_META_EVENTS | MIDI_FILE_PROBE_LAST_EVENTS)) || ((probe_flags & MIDI_FILE_PROBE_CONDUCTOR_TRACK) && (MidiFileTrack_getNumber(track) == 0)))) track_is_read = 0;
+		if (track_is_read && (MidiFileTrack_getEndTick(track) != MidiFileTrack_getEndTick(expected_track))) return "end ticks differ";
+	}
+
+	return NULL;
+}
+
+static char *compare_file_order(MidiFile_t expected_midi_file, MidiFile_t midi_file)
+{
+	MidiFileEvent_t expected_event, event;
+
+	for (expected_event = MidiFile_getFirstEvent(expected_midi_file), event = MidiFile_getFirstEvent(midi_file); expected_event != NULL; expected_event = MidiFileEvent_getNextEventInFile(expected_event), event = MidiFileEvent_getNextEventInFile(event))
+	{
+		if (event == NULL) return "file-wide list is short";
+		if (MidiFileTrack_getNumber(MidiFileEvent_getTrack(event)) != MidiFileTrack_getNumber(MidiFileEvent_getTrack(expected_event))) return "file-wide list is in a different order";
+		if (! events_match(expected_event, event, 0)) return "file-wide list differs";
+	}
+
+	if (event != NULL) return "file-wide list is long";
+	return NULL;
+}
+
+static void check_parallel_load_matches_serial(void)
+{
+	static const int numbers_of_threads[] = { 0, 1, 2, 5, TEST_NUMBER_OF_TRACKS + 3 };
+	MidiFile_t midi_file = create_test_file();
+	MidiFile_t serial_midi_file, parallel_midi_file;
+	unsigned char *buffer;
+	int file_size, i;
+	char *failure = NULL;
+
+	buffer = save_to_buffer(midi_file, &file_size);
+	serial_midi_file = MidiFile_loadFromBufferWithLength(buffer, file_size);
+
+	for (i = 0; (failure == NULL) && (i < (int)(sizeof numbers_of_threads / sizeof numbers_of_threads[0])); i++)
+	{
+		if ((parallel_midi_file = MidiFile_loadFromBufferWithLengthInParallel(buffer, file_size, numbers_of_threads[i])) == NULL)
+		{
+			failure = "cannot load in parallel";
+			break;
+		}
+
+		if ((failure = compare_tracks(serial_midi_file, parallel_midi_file, MIDI_FILE_SAVE_DEFAULT, -1)) == NULL)
+		{
+			failure = compare_file_order(serial_midi_file, parallel_midi_file);
+		}
+
+		if ((failure == NULL) && ! files_save_alike(serial_midi_file, parallel_midi_file)) failure = "saves differently";
+		MidiFile_free(parallel_midi_file);
+	}
+
+	if ((failure == NULL) && (MidiFile_save(midi_file, TEST_FILENAME) == 0))
+	{
+		MidiFile_t file_midi_file = MidiFile_load(TEST_FILENAME);
+
+		if ((parallel_midi_file = MidiFile_loadInParallel(TEST_FILENAME, 0)) == NULL)
+		{
+			failure = "cannot load from a file in parallel";
+		}
+		else
+		{
+			if (((failure = compare_file_order(file_midi_file, parallel_midi_file)) == NULL) && ! files_save_alike(file_midi_file, parallel_midi_file)) failure = "saves differently when loaded from a file";
+			MidiFile_free(parallel_midi_file);
+		}
+
+		MidiFile_free(file_midi_file);
+		remove(TEST_FILENAME);
+	}
+
+	report("parallel load matches serial load", failure);
+	MidiFile_free(serial_midi_file);
+	MidiFile_free(midi_file);
+	free(buffer);
+}
+
+static void edit_test_file(MidiFile_t midi_file, int round)
+{
+	/* one track added to at the end, one with an event moved, one with an event deleted, and a new track */
+	MidiFileTrack_t track;
+	MidiFileEvent_t event;
+
+	track = MidiFile_getTrackByNumber(midi_file, 1 + (round % (TEST_NUMBER_OF_TRACKS - 1)), 0);
+	MidiFileTrack_createNoteStartAndEndEvents(track, MidiFileTrack_getEndTick(track) + 10, MidiFileTrack_getEndTick(track) + 100, 0, 60 + round, 100, 0);
+
+	track = MidiFile_getTrackByNumber(midi_file, 1 + ((round + 3) % (TEST_NUMBER_OF_TRACKS - 1)), 0);
+	event = MidiFileEvent_getNextEventInTrack(MidiFileEvent_getNextEventInTrack(MidiFileTrack_getFirstEvent(track)));
+	MidiFileEvent_setTick(event, MidiFileEvent_getTick(event) + 50);
+
+	track = MidiFile_getTrackByNumber(midi_file, 1 + ((round + 6) % (TEST_NUMBER_OF_TRACKS - 1)), 0);
+	MidiFileEvent_delete(MidiFileTrack_getLastEvent(track));
+
+	MidiFileTrack_createTextEvent(MidiFile_createTrack(midi_file), 10 * round, "added");
+}
+
+static void check_snapshot_isolation(void)
+{
+	MidiFile_t midi_file = create_test_file();
+	MidiFileSnapshot_t first_snapshot, second_snapshot;
+	MidiFile_t first_snapshot_midi_file, second_snapshot_midi_file;
+	unsigned char *original_buffer, *edited_buffer;
+	int original_file_size, edited_file_size;
+	char *failure = NULL;
+
+	original_buffer = save_to_buffer(midi_file, &original_file_size);
+	first_snapshot = MidiFile_snapshot(midi_file);
+	edit_test_file(midi_file, 0);
+	edited_buffer = save_to_buffer(midi_file, &edited_file_size);
+	second_snapshot = MidiFile_snapshot(midi_file);
+	edit_test_file(midi_file, 1);
+
+	if ((first_snapshot == NULL) || (second_snapshot == NULL))
+	{
+		failure = "cannot take a snapshot";
+	}
+	else
+	{
+		first_snapshot_midi_file = MidiFileSnapshot_toMidiFile(first_snapshot);
+		second_snapshot_midi_file = MidiFileSnapshot_toMidiFile(second_snapshot);
+
+		if (file_saves_as(midi_file, edited_buffer, edited_file_size)) failure = "edits are missing from the live file";
+		else if (! file_saves_as(first_snapshot_midi_file, original_buffer, original_file_size)) failure = "first snapshot picked up later edits";
+		else if (! file_saves_as(second_snapshot_midi_file, edited_buffer, edited_file_size)) failure = "second snapshot picked up later edits";
+
+		MidiFile_free(first_snapshot_midi_file);
+		MidiFile_free(second_snapshot_midi_file);
+	}
+
+	MidiFileSnapshot_free(second_snapshot);
+
+	if (failure == NULL)
+	{
+		first_snapshot_midi_file = MidiFileSnapshot_toMidiFile(first_snapshot);
+		if (! file_saves_as(first_snapshot_midi_file, original_buffer, original_file_size)) failure = "first snapshot changed when the second was freed";
+		MidiFile_free(first_snapshot_midi_file);
+	}
+
+	MidiFileSnapshot_free(first_snapshot);
+	report("snapshots are isolated from later edits", failure);
+	MidiFile_free(midi_file);
+	free(original_buffer);
+	free(edited_buffer);
+}
+
+static void check_journal_replay(void)
+{
+	MidiFile_t midi_file = create_test_file();
+	MidiFile_t replayed_midi_file;
+	MidiFileJournal_t journal;
+	int round;
+	char *failure = NULL;
+
+	if ((journal = MidiFileJournal_open(midi_file, TEST_JOURNAL_FILENAME)) == NULL)
+	{
+		failure = "cannot open a journal";
+	}
+	else
+	{
+		MidiFileJournal_setSyncInterval(journal, 0);
+
+		/* enough saves for the journal to be compacted along the way */
+		for (round = 0; (failure == NULL) && (round < 40); round++)
+		{
+			if (round % 4 == 0)
+			{
+				edit_test_file(midi_file, round);
+			}
+			else
+			{
+				MidiFileTrack_t track = MidiFile_getTrackByNumber(midi_file, 1 + (round % (TEST_NUMBER_OF_TRACKS - 1)), 0);
+				MidiFileTrack_createControlChangeEvent(track, MidiFileTrack_getEndTick(track) + 1, 0, 10, round);
+			}
+
+			if (MidiFileJournal_save(journal) < 0)
+			{
+				failure = "cannot save to the journal";
+			}
+			else if ((replayed_midi_file = MidiFile_loadFromJournal(TEST_JOURNAL_FILENAME)) == NULL)
+			{
+				failure = "cannot load from the journal";
+			}
+			else
+			{
+				if (((failure = compare_tracks(midi_file, replayed_midi_file, MIDI_FILE_SAVE_DEFAULT, -1)) == NULL) && ! files_save_alike(midi_file, replayed_midi_file)) failure = "journal replays differently";
+				MidiFile_free(replayed_midi_file);
+			}
+		}
+
+		if (MidiFileJournal_close(journal, TEST_FILENAME) < 0)
+		{
+			if (failure == NULL) failure = "cannot close the journal";
+		}
+		else if (failure == NULL)
+		{
+			if ((replayed_midi_file = MidiFile_load(TEST_FILENAME)) == NULL)
+			{
+				failure = "cannot load the file written on closing the journal";
+			}
+			else
+			{
+				if (! files_save_alike(midi_file, replayed_midi_file)) failure = "file written on closing the journal differs";
+				MidiFile_free(replayed_midi_file);
+			}
+		}
+	}
+
+	remove(TEST_JOURNAL_FILENAME);
+	remove(TEST_FILENAME);
+	report("journal replays to the file as last saved", failure);
+	MidiFile_free(midi_file);
+}
+
+static void check_save_flags_round_trip(void)
+{
+	static const int save_flags[] = { MIDI_FILE_SAVE_DEFAULT, MIDI_FILE_SAVE_RUNNING_STATUS, MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS, MIDI_FILE_SAVE_TRIM_META_EVENTS, MIDI_FILE_SAVE_RUNNING_STATUS | MIDI_FILE_SAVE_NOTE_OFFS_AS_NOTE_ONS, MIDI_FILE_SAVE_COMPACT };
+	static char *names[] = { "load/save round trip with default flags", "load/save round trip with running status", "load/save round trip with note offs as note ons", "load/save round trip with trimmed meta events", "load/save round trip with running status and note offs as note ons", "load/save round trip with compact saving" };
+	MidiFile_t midi_file = create_test_file();
+	int default_file_size = 0, i;
+
+	for (i = 0; i < (int)(sizeof save_flags / sizeof save_flags[0]); i++)
+	{
+		MidiFile_t loaded_midi_file;
+		unsigned char *buffer;
+		int file_size;
+		char *failure = NULL;
+
+		MidiFile_setSaveFlags(midi_file, save_flags[i]);
+		buffer = save_to_buffer(midi_file, &file_size);
+		if (save_flags[i] == MIDI_FILE_SAVE_DEFAULT) default_file_size = file_size;
+
+		if (MidiFile_getFileSize(midi_file) != file_size)
+		{
+			failure = "MidiFile_getFileSize() disagrees with the saved size";
+		}
+		else if ((file_size > default_file_size) || ((save_flags[i] & (MIDI_FILE_SAVE_RUNNING_STATUS | MIDI_FILE_SAVE_TRIM_META_EVENTS)) && (file_size == default_file_size)))
+		{
+			/* note offs as note ons only pay off along with running status */
+			failure = "saved file is no smaller";
+		}
+		else if ((loaded_midi_file = MidiFile_loadFromBufferWithLength(buffer, file_size)) == NULL)
+		{
+			failure = "cannot load the saved file";
+		}
+		else
+		{
+			failure = compare_tracks(midi_file, loaded_midi_file, save_flags[i], -1);
+
+			if ((failure == NULL) && (MidiFile_save(midi_file, TEST_FILENAME) == 0))
+			{
+				/* saving to a file goes by the same flags */
+				MidiFile_t file_midi_file = MidiFile_load(TEST_FILENAME);
+				if ((file_midi_file == NULL) || ! files_save_alike(loaded_midi_file, file_midi_file)) failure = "saving to a file and to a buffer differ";
+				MidiFile_free(file_midi_file);
+				remove(TEST_FILENAME);
+			}
+
+			MidiFile_free(loaded_midi_file);
+		}
+
+		report(names[i], failure);
+		free(buffer);
+	}
+
+	MidiFile_free(midi_file);
+}
+
+static void check_probe_matches_load(void)
+{
+	MidiFile_t midi_file = create_test_file();
+	MidiFile_t loaded_midi_file, probed_midi_file;
+	int probe_flags;
+	char *failure = NULL;
+
+	if ((MidiFile_save(midi_file, TEST_FILENAME) < 0) || ((loaded_midi_file = MidiFile_load(TEST_FILENAME)) == NULL))
+	{
+		report("probe agrees with full load", "cannot save and load the test file");
+		MidiFile_free(midi_file);
+		return;
+	}
+
+	for (probe_flags = 0; (failure == NULL) && (probe_flags <= (MIDI_FILE_PROBE_CONDUCTOR_TRACK | MIDI_FILE_PROBE_META_EVENTS | MIDI_FILE_PROBE_LAST_EVENTS)); probe_flags++)
+	{
+		if ((probed_midi_file = MidiFile_probe(TEST_FILENAME, probe_flags)) == NULL)
+		{
+			failure = "cannot probe";
+			break;
+		}
+
+		failure = compare_tracks(loaded_midi_file, probed_midi_file, MIDI_FILE_SAVE_DEFAULT, probe_flags);
+
+		if ((failure == NULL) && (probe_flags & MIDI_FILE_PROBE_CONDUCTOR_TRACK) && (MidiFile_getTimeFromTick(probed_midi_file, 5000) != MidiFile_getTimeFromTick(loaded_midi_file, 5000)))
+		{
+			failure = "times differ with the conductor track";
+		}
+
+		if ((failure == NULL) && (probe_flags & MIDI_FILE_PROBE_LAST_EVENTS) && (MidiFileEvent_getTick(MidiFile_getLastEvent(probed_midi_file)) != MidiFileEvent_getTick(MidiFile_getLastEvent(loaded_midi_file))))
+		{
+			failure = "last events differ";
+		}
+
+		MidiFile_free(probed_midi_file);
+	}
+
+	remove(TEST_FILENAME);
+	report("probe agrees with full load", failure);
+	MidiFile_free(loaded_midi_file);
+	MidiFile_free(midi_file);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1) usage(argv[0]);
+
+	check_parallel_load_matches_serial();
+	check_snapshot_isolation();
+	check_journal_replay();
+	check_save_flags_round_trip();
+	check_probe_matches_load();
+
+	return (number_of_failures == 0) ? 0 : 1;
+}
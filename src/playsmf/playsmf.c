@@ -152,7 +152,7 @@ int main(int argc, char **argv)
 
 			if ((!should_shutdown) && in_range)
 			{
-				unsigned long event_time = (unsigned long)(MidiFile_getTimeFromTick(midi_file, tick) * 1000);
+				unsigned long event_time = (unsigned long)(MidiFile_getTimeUsFromTick(midi_file, tick) / 1000);
 
 				while (!should_shutdown)
 				{
@@ -78,6 +78,8 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* each move is followed by a note pairing lookup, which a batch would have to sort for, so index instead */
+	MidiFile_setIndexed(midi_file, 1);
 	MidiFile_visitEvents(midi_file, quantize_event, &beat_division);
 
 	if (MidiFile_save(midi_file, output_filename) < 0)
@@ -14,6 +14,7 @@ static int save_every_msecs = 0;
 static MidiUtilAlarm_t alarm;
 static RtMidiInPtr midi_in;
 static MidiFile_t midi_file;
+static MidiFileJournal_t journal = NULL;
 static MidiFileTrack_t track;
 static long start_time_msecs;
 static int changed = 1;
@@ -26,7 +27,7 @@ static void usage(char *program_name)
 
 static void handle_midi_message(double timestamp, const unsigned char *message, size_t message_size, void *user_data)
 {
-	long tick = MidiFile_getTickFromTime(midi_file, (float)(MidiUtil_getCurrentTimeMsecs() - start_time_msecs) / 1000.0);
+	long tick = MidiFile_getTickFromTimeUs(midi_file, (long long)(MidiUtil_getCurrentTimeMsecs() - start_time_msecs) * 1000);
 
 	switch (MidiUtilMessage_getType(message))
 	{
@@ -82,9 +83,15 @@ static void handle_midi_message(double timestamp, const unsigned char *message,
 
 static void handle_alarm(int cancelled, void *user_data)
 {
-	if (cancelled || !changed) return;
-	MidiFile_save(midi_file, filename);
-	changed = 0;
+	if (cancelled) return;
+
+	if (changed)
+	{
+		/* only what was recorded since the last save gets written */
+		MidiFileJournal_save(journal);
+		changed = 0;
+	}
+
 	MidiUtilAlarm_set(alarm, save_every_msecs, handle_alarm, NULL);
 }
 
@@ -93,7 +100,7 @@ static void handle_exit(void *user_data)
 	MidiUtilAlarm_free(alarm);
 	rtmidi_close_port(midi_in);
 
-	if (MidiFile_save(midi_file, filename) != 0)
+	if ((journal == NULL) ? (MidiFile_save(midi_file, filename) != 0) : (MidiFileJournal_close(journal, filename) != 0))
 	{
 		fprintf(stderr, "Error:  Cannot save \"%s\".\n", filename);
 		exit(1);
@@ -146,7 +153,29 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	if (save_every_msecs > 0) MidiUtilAlarm_set(alarm, save_every_msecs, handle_alarm, NULL);
+	if (save_every_msecs > 0)
+	{
+		/* a journal next to the file, which is replaced by the file itself on exit */
+		char *journal_filename = (char *)(malloc(strlen(filename) + 9));
+		MidiFile_t interrupted_midi_file;
+		sprintf(journal_filename, "%s.journal", filename);
+
+		if ((interrupted_midi_file = MidiFile_loadFromJournal(journal_filename)) != NULL)
+		{
+			if (MidiFile_save(interrupted_midi_file, filename) == 0) remove(journal_filename);
+			fprintf(stderr, "Error:  Recovered an interrupted recording into \"%s\"; move it out of the way before recording again.\n", filename);
+			exit(1);
+		}
+
+		if ((journal = MidiFileJournal_open(midi_file, journal_filename)) == NULL)
+		{
+			fprintf(stderr, "Error:  Cannot create \"%s\".\n", journal_filename);
+			exit(1);
+		}
+
+		free(journal_filename);
+		MidiUtilAlarm_set(alarm, save_every_msecs, handle_alarm, NULL);
+	}
 	MidiUtil_waitForExit(handle_exit, NULL);
 	return 0;
 }
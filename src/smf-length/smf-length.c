@@ -31,7 +31,8 @@ int main(int argc, char **argv)
 
 	if (input_filename == NULL) usage(argv[0]);
 
-	if ((midi_file = MidiFile_load(input_filename)) == NULL)
+	/* the tempo map comes from the conductor track, and the length from the last event of any track */
+	if ((midi_file = MidiFile_probe(input_filename, MIDI_FILE_PROBE_CONDUCTOR_TRACK | MIDI_FILE_PROBE_LAST_EVENTS)) == NULL)
 	{
 		fprintf(stderr, "Error:  Cannot read MIDI file \"%s\".\n", input_filename);
 		exit(1);